@@ -9,14 +9,28 @@
  *
  * 
  * Let G := 
- *  1. <statement> := <statement><statement> 
- *  2. <statement> := <assignment> | <expression>
+ *  1. <statement> := <statement>; <statement> 
+ *  2. <statement> := <assignment> | <expression> | <loop> | <definition>
+ *                  | <map>
  *  3. <assignment> := <identifier> = <expression> 
  *  4. <expression> := <term> | <term> { + | - } <expression> 
  *  5. <term> := <factor> | <factor> { * | / | .| X } <term>
- *  6. <factor> := <identifier> | <vector> | <constant> |(<expression>)
- *  7. <identifier> := [a-zA-Z]+
+ *  6. <factor> := <identifier> | <vector> | <constant> |(<expression>) | <call>
+ *  7. <identifier> := [a-zA-Z_][a-zA-Z0-9_]*
  *  8. <value> := { <constant> | <constant>, <constant>, <constant> }
+ *  9. <loop> := for <identifier> in <range> { <statement> }
+ * 10. <range> := <expression> : <expression>     (start:stop)
+ *              | <expression> : <expression> : <expression> (start:step:stop)
+ * 11. <definition> := def <identifier>(<identifier>, ...) = <expression>
+ * 12. <call> := <identifier>(<expression>, ...)
+ * 13. <map> := map <expression>
+ * 
+ * Loop variables are resolved to slots at parse time, so a loop body
+ * is built once and evaluated without touching the vectable for them.
+ * Function parameters are slots too. Small functions are inlined into
+ * the caller's tree when the call is parsed; other calls look the
+ * function up and give it a frame of slots when evaluated. Built-in
+ * functions are resolved to an id when parsed.
  * 
  * Course: CPE2600-121
  * Assignment: Lab Wk 5
@@ -33,7 +47,33 @@
 #include "vec.h"
 // #include "vecvec.h"
 #include "vectable.h"
+#include "functable.h"
+#include "builtins.h"
+#include "operators.h"
 #include "tritone.h"
+#include "wal.h"
+#include "pack.h"
+#include "jobs.h"
+#include "import.h"
+#include "gen.h"
+#include "space.h"
+#include "transform.h"
+#include "fuse.h"
+#include "jit.h"
+#include "prof.h"
+
+// functions with at most this many nodes are inlined into their callers
+#define INLINE_MAX_NODES 64
+
+static int inline_enabled = 1;
+// whether map fuses element-wise expressions into one pass
+static int fuse_enabled = 1;
+// whether hot expressions are compiled to native code
+static int jit_enabled = 1;
+
+// while parsing call arguments, commas separate arguments rather than
+// the components of a vector literal
+static int commas_separate = 0;
 
 /**
  * @brief Returns the next valid token in the input buffer 
@@ -125,14 +165,26 @@ token find_next_token(char* input, int* position) {
             tok.type = TOKEN_QUOTE;
             (*position)++;
             break;
+        case ':':
+            tok.name = ":";
+            tok.type = TOKEN_COLON;
+            (*position)++;
+            break;
+        case ';':
+            tok.name = ";";
+            tok.type = TOKEN_SEMICOLON;
+            (*position)++;
+            break;
         default: 
-            // Identifiers must start with a letter and then can be alphanumeric
-            if(isalpha(cur)) {
+            // Identifiers must start with a letter or _ and then can be 
+            // alphanumeric
+            if(isalpha(cur) || cur == '_') {
                 tok.type = TOKEN_IDENTIFIER;
                 
                 int size = 1;
 
-                while(isalnum(input[*position + size])) {
+                while(isalnum(input[*position + size]) 
+                    || input[*position + size] == '_') {
                     size++;
                 }
 
@@ -177,18 +229,42 @@ token find_next_token(char* input, int* position) {
  * @return token* 
  */
 token* lex(char* input) {
-    static int capacity = 100;
+    int capacity = 100;
     int position = 0;
     int size = 0;
-    // maximum number of tokens is hardcoded to 100;
     token* tokens = malloc(capacity * sizeof(token));
+    // set between a string's opening and closing quotes
+    int closing = 0;
 
     while(1) {
         token tok = find_next_token(input, &position);
 
+        // loop bodies can run long, so grow instead of overflowing.
+        // one spare slot is kept so that lookahead past the end is safe,
+        // and a quote can add a second token
+        if(size + 3 > capacity) {
+            capacity *= 2;
+            tokens = realloc(tokens, capacity * sizeof(token));
+        }
         tokens[size++] = tok;
 
+        // a string is kept as written, spaces and all, up to the closing 
+        // quote, which is lexed as the next token
+        if(tok.type == TOKEN_QUOTE && (closing = !closing)) {
+            char* close = strchr(input + position, '"');
+            int length = close != NULL ? close - (input + position) 
+                : (int)strlen(input + position);
+            token text;
+            text.type = TOKEN_TEXT;
+            text.name = malloc(length + 1);
+            memcpy(text.name, input + position, length);
+            text.name[length] = '\0';
+            tokens[size++] = text;
+            position += length;
+        }
+
         if(tok.type == TOKEN_END) {
+            tokens[size] = tok;
             break;
         }
     }
@@ -226,11 +302,21 @@ node* create_node(node_type type, char* value, node* left, node* right) {
     n->left = left;
     n->right = right;
     n->is_root = 0;
+    n->slot = -1;
+    n->number = 0;
+    n->op = -1;
+    n->hits = 0;
+    n->jit = NULL;
     return n;
 }
 
 
+static node* parse_program(token *tokens, int *position, token_type end);
 static node* parse_statement(token *tokens, int *position);
+static node* parse_loop(token *tokens, int *position);
+static node* parse_define(token *tokens, int *position);
+static node* parse_call(token *tokens, int *position);
+static node* parse_map(token *tokens, int *position);
 static node* parse_expression(token *tokens, int *position);
 static node* parse_term(token *tokens, int *position);
 static node* parse_factor(token *tokens, int *position);
@@ -239,6 +325,7 @@ static node* parse_constant(token *tokens, int *position);
 static node* parse_value(token *tokens, int *position);
 static node* parse_assignment(token* tokens, int* position);
 static node* parse_command(token* tokens, int* position);
+static node* parse_pattern(token* tokens, int* position);
 
 
 /**
@@ -250,7 +337,8 @@ void free_tokens(token* tokens) {
     int cur = 0;
     while(tokens[cur].type != TOKEN_END) {
         if(tokens[cur].type == TOKEN_IDENTIFIER 
-            || tokens[cur].type == TOKEN_CONST) {
+            || tokens[cur].type == TOKEN_CONST
+            || tokens[cur].type == TOKEN_TEXT) {
             free(tokens[cur].name);
         }
         cur++;
@@ -265,13 +353,103 @@ void free_tokens(token* tokens) {
  * @return node* 
  */
 node* parse_input(char* input) {
+    PROF_START(start);
     token* tokens = lex(input);
+    PROF_STOP(STAGE_LEX, start);
+
+    PROF_START(parsing);
     int position = 0;
-    node* result = parse_statement(tokens, &position);
+    node* result = parse_program(tokens, &position, TOKEN_END);
     free_tokens(tokens);
+    PROF_STOP(STAGE_PARSE, parsing);
     return result;
 }
 
+// names of the loop variables currently in scope, indexed by slot
+static char* scope[MAX_SLOTS];
+static int scope_depth = 0;
+
+// values of the loop variables and parameters being evaluated.
+// slot indices in the tree are relative to the current frame
+static value slots[MAX_SLOTS];
+static value* frame = slots;
+
+/**
+ * @brief Returns the slot bound to name, or -1 if it is not a loop variable.
+ * Inner loops shadow outer ones.
+ * 
+ * @param name 
+ * @return int 
+ */
+static int find_slot(char* name) {
+    for(int i = scope_depth - 1; i >= 0; i--) {
+        if(!strcmp(scope[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Parses a list of ';' separated statements up to the end token
+ * and returns its root node. Empty statements are skipped.
+ *  <statement> := <statement>; <statement>
+ * 
+ * Sequences are represented as a right-leaning chain:
+ *      NODE_SEQUENCE -> (statement, NODE_SEQUENCE -> (statement, NULL))
+ * 
+ * @param tokens 
+ * @param position 
+ * @param end token type that ends the list (not consumed)
+ * @return node* 
+ */
+static node* parse_program(token* tokens, int* position, token_type end) {
+    node* head = NULL;
+    node* tail = NULL;
+    int count = 0;
+
+    while(tokens[*position].type != end 
+       && tokens[*position].type != TOKEN_END) {
+        if(tokens[*position].type == TOKEN_SEMICOLON) {
+            (*position)++;
+            continue;
+        }
+
+        int start = *position;
+        node* statement = parse_statement(tokens, position);
+        if(statement == NULL || *position == start) {
+            free_ast(head);
+            return NULL;
+        }
+
+        node* link = create_node(NODE_SEQUENCE, NULL, statement, NULL);
+        if(tail == NULL) {
+            head = link;
+        } else {
+            tail->right = link;
+        }
+        tail = link;
+        count++;
+
+        if(tokens[*position].type != TOKEN_SEMICOLON 
+            && tokens[*position].type != end) {
+            printf("Error: expected ';' near token '%s'\n", 
+                tokens[*position].name);
+            free_ast(head);
+            return NULL;
+        }
+    }
+
+    // a single statement doesn't need the sequence wrapper
+    if(count == 1) {
+        node* statement = head->left;
+        head->left = NULL;
+        free_ast(head);
+        return statement;
+    }
+    return head;
+}
+
 /**
  * @brief Returns true if cmd is a command
  * 
@@ -286,7 +464,30 @@ static int is_command(char* cmd) {
         || !strcmp(cmd, "list")
         || !strcmp(cmd, "write")
         || !strcmp(cmd, "read")
-        || !strcmp(cmd, "fill");
+        || !strcmp(cmd, "fill")
+        || !strcmp(cmd, "gen")
+        || !strcmp(cmd, "set")
+        || !strcmp(cmd, "funcs")
+        || !strcmp(cmd, "stats")
+        || !strcmp(cmd, "tablestats")
+        || !strcmp(cmd, "begin")
+        || !strcmp(cmd, "commit")
+        || !strcmp(cmd, "rollback")
+        || !strcmp(cmd, "compact")
+        || !strcmp(cmd, "jobs");
+}
+
+/**
+ * @brief Returns true if name can't be used as a variable or function
+ * name: a command, a builtin or a keyword
+ * 
+ * @param name 
+ * @return int 
+ */
+int is_reserved(char* name) {
+    return is_command(name) || find_builtin(name) >= 0 
+        || !strcmp(name, "for") || !strcmp(name, "def") 
+        || !strcmp(name, "map") || !strcmp(name, "in");
 }
 
 /**
@@ -298,7 +499,16 @@ static int is_command(char* cmd) {
  * @return node* 
  */
 static node* parse_statement(token *tokens, int* position) {
-    if(is_command(tokens[*position].name)) {
+    if(tokens[*position].type == TOKEN_IDENTIFIER 
+        && !strcmp(tokens[*position].name, "for")) {
+        return parse_loop(tokens, position);
+    } else if(tokens[*position].type == TOKEN_IDENTIFIER 
+        && !strcmp(tokens[*position].name, "def")) {
+        return parse_define(tokens, position);
+    } else if(tokens[*position].type == TOKEN_IDENTIFIER 
+        && !strcmp(tokens[*position].name, "map")) {
+        return parse_map(tokens, position);
+    } else if(is_command(tokens[*position].name)) {
         return parse_command(tokens, position);
     } else if(tokens[*position + 1].type == TOKEN_EQUALS) {
         return parse_assignment(tokens, position); 
@@ -322,31 +532,53 @@ static node* parse_string(token* tokens, int* position) {
     if(tokens[*position].type == TOKEN_QUOTE) {
         // consume the quote
         (*position)++;
-        char *string = calloc(200, sizeof(char));
-        string[0] = '\0';
-        while(tokens[*position].type != TOKEN_QUOTE) {
-            strcat(string, tokens[*position].name);
+        // the lexer hands the whole string over as one token
+        char* string = tokens[*position].name;
+        (*position)++;
+        // consume the quote, if the string was closed
+        if(tokens[*position].type == TOKEN_QUOTE) {
             (*position)++;
         }
-        // consume the quote
-        (*position)++;
 
-        node* n = create_node(
+        // create_node performs a strcpy
+        return create_node(
             NODE_STRING,
             string,
             NULL,
             NULL
         );
-        // create_node performs a strcpy
-        free(string);
-        return n;
     } else {
         return NULL;
     }
 }
 
 /**
- * @brief Attempts to parse a command identifier
+ * @brief Tries to parse a prefix pattern, a name followed by * or a bare
+ * * for every name. The node holds the prefix without the *.
+ * <pattern> := <identifier>* | *
+ * 
+ * @param tokens 
+ * @param position 
+ * @return node* 
+ */
+static node* parse_pattern(token* tokens, int* position) {
+    char* prefix = "";
+    if(tokens[*position].type == TOKEN_IDENTIFIER) {
+        prefix = tokens[*position].name;
+        (*position)++;
+    }
+    if(tokens[*position].type != TOKEN_STAR) {
+        printf("Error: expected a pattern like name*\n");
+        return NULL;
+    }
+    (*position)++;
+    return create_node(NODE_PATTERN, prefix, NULL, NULL);
+}
+
+/**
+ * @brief Attempts to parse a command identifier and its arguments.
+ * Arguments are constants, strings, bare words or patterns, chained together
+ * through their right children.
  * 
  * @param tokens 
  * @param position 
@@ -355,11 +587,30 @@ static node* parse_string(token* tokens, int* position) {
 static node* parse_command(token* tokens, int* position) {
     node* command = parse_identifier(tokens, position);
 
-    node* argument; 
-    if(tokens[*position].type == TOKEN_CONST) {
-        argument = parse_constant(tokens, position);
-    } else {
-        argument = parse_string(tokens, position);
+    node* argument = NULL; 
+    node* last = NULL;
+    while(1) {
+        node* next;
+        if(tokens[*position].type == TOKEN_CONST) {
+            next = parse_constant(tokens, position);
+        } else if(tokens[*position].type == TOKEN_QUOTE) {
+            next = parse_string(tokens, position);
+        } else if(tokens[*position].type == TOKEN_STAR
+            || (tokens[*position].type == TOKEN_IDENTIFIER 
+                && tokens[*position + 1].type == TOKEN_STAR)) {
+            next = parse_pattern(tokens, position);
+        } else if(tokens[*position].type == TOKEN_IDENTIFIER) {
+            next = parse_identifier(tokens, position);
+        } else {
+            break;
+        }
+
+        if(last == NULL) {
+            argument = next;
+        } else {
+            last->right = next;
+        }
+        last = next;
     }
     return create_node(
         NODE_EXECUTE,
@@ -378,6 +629,11 @@ static node* parse_command(token* tokens, int* position) {
  * @return node* 
  */
 static node* parse_assignment(token* tokens, int* position) {
+    if(find_slot(tokens[*position].name) >= 0) {
+        printf("Error: cannot assign to loop variable %s\n", 
+            tokens[*position].name);
+        return NULL;
+    }
     node* identifier = parse_identifier(tokens, position);
     (*position)++;  
     return create_node(
@@ -393,13 +649,450 @@ static node* parse_expression(token* tokens, int* position) {
     while(tokens[*position].type == TOKEN_PLUS 
        || tokens[*position].type == TOKEN_MINUS) {
         char* operator = tokens[(*position)].name;
+        int op = find_operator(tokens[(*position)].type);
         (*position)++;
         node* right = parse_term(tokens, position);
         term = create_node(NODE_OPERATION, operator, term, right);
+        term->op = op;
     }
     return term;
 }
 
+/**
+ * @brief Parses a range and returns its root node. 
+ * Ranges are inclusive on both ends, like matlab.
+ * <range> := <expression> : <expression> 
+ *          | <expression> : <expression> : <expression>
+ * 
+ * Ranges in memory mirror vectors, with a step of 1 if none is given:
+ * 
+ *              NODE_RANGE: null
+ *                 /         \
+ *          start expr     NODE_RANGE: null
+ *                          /          \
+ *                    step expr      stop expr
+ * 
+ * @param tokens 
+ * @param position 
+ * @return node* 
+ */
+static node* parse_range(token* tokens, int* position) {
+    node* start = parse_expression(tokens, position);
+    if(start == NULL || tokens[*position].type != TOKEN_COLON) {
+        printf("Error: expected a range like start:stop\n");
+        free_ast(start);
+        return NULL;
+    }
+    (*position)++;  // consume :
+
+    node* step = NULL;
+    node* stop = parse_expression(tokens, position);
+    if(stop != NULL && tokens[*position].type == TOKEN_COLON) {
+        (*position)++;  // consume :
+        step = stop;
+        stop = parse_expression(tokens, position);
+    } else {
+        step = create_node(NODE_CONSTANT, "1", NULL, NULL);
+        step->number = 1;
+    }
+
+    if(stop == NULL) {
+        free_ast(start);
+        free_ast(step);
+        return NULL;
+    }
+    return create_node(NODE_RANGE, NULL, start, 
+        create_node(NODE_RANGE, NULL, step, stop));
+}
+
+/**
+ * @brief Parses a loop and returns its root node. The loop variable
+ * is bound to a slot while the body is parsed, so references to it
+ * become NODE_SLOT nodes instead of vectable lookups.
+ * <loop> := for <identifier> in <range> { <statement> }
+ * 
+ *              NODE_LOOP: name (slot)
+ *                 /         \
+ *          NODE_RANGE      body
+ * 
+ * @param tokens 
+ * @param position 
+ * @return node* 
+ */
+static node* parse_loop(token* tokens, int* position) {
+    (*position)++;  // consume for
+
+    if(tokens[*position].type != TOKEN_IDENTIFIER 
+        || tokens[*position + 1].type != TOKEN_IDENTIFIER
+        || strcmp(tokens[*position + 1].name, "in")) {
+        printf("Error: expected a loop like for i in 1:10 { ... }\n");
+        return NULL;
+    }
+    if(scope_depth == MAX_SLOTS) {
+        printf("Error: loops nested more than %d deep\n", MAX_SLOTS);
+        return NULL;
+    }
+
+    char* name = tokens[*position].name;
+    (*position) += 2;   // consume name and in
+
+    node* range = parse_range(tokens, position);
+    if(range == NULL) {
+        return NULL;
+    }
+
+    if(tokens[*position].type != TOKEN_LBRACKET) {
+        printf("Error: expected '{' after range\n");
+        free_ast(range);
+        return NULL;
+    }
+    (*position)++;  // consume {
+
+    int slot = scope_depth;
+    scope[scope_depth++] = name;
+    node* body = parse_program(tokens, position, TOKEN_RBRACKET);
+    scope_depth--;
+
+    if(tokens[*position].type != TOKEN_RBRACKET) {
+        printf("Error: expected '}' to close loop over %s\n", name);
+        free_ast(range);
+        free_ast(body);
+        return NULL;
+    }
+    (*position)++;  // consume }
+
+    node* loop = create_node(NODE_LOOP, name, range, body);
+    loop->slot = slot;
+    return loop;
+}
+
+/**
+ * @brief Returns the number of slots a function body needs: its parameters
+ * plus whatever inlined calls inside it bind
+ * 
+ * @param n 
+ * @return int 
+ */
+static int frame_size(node* n) {
+    if(n == NULL) {
+        return 0;
+    }
+    int size = n->slot + (n->type == NODE_CALL ? 0 : 1);
+    int left = frame_size(n->left);
+    int right = frame_size(n->right);
+    if(left > size) {
+        size = left;
+    }
+    return right > size ? right : size;
+}
+
+/**
+ * @brief Parses a function definition and stores it in the function table.
+ * Definitions take effect while parsing, so later statements on the 
+ * same line can call them.
+ * <definition> := def <identifier>(<identifier>, ...) = <expression>
+ * 
+ * @param tokens 
+ * @param position 
+ * @return node* 
+ */
+static node* parse_define(token* tokens, int* position) {
+    (*position)++;  // consume def
+
+    if(scope_depth > 0) {
+        printf("Error: functions can't be defined inside a loop\n");
+        return NULL;
+    }
+    if(tokens[*position].type != TOKEN_IDENTIFIER 
+        || tokens[*position + 1].type != TOKEN_LPAREN) {
+        printf("Error: expected a definition like def f(a, b) = a X b\n");
+        return NULL;
+    }
+
+    char* name = tokens[*position].name;
+    if(is_reserved(name)) {
+        printf("Error: %s is reserved\n", name);
+        return NULL;
+    }
+    (*position) += 2;   // consume name and (
+
+    char* params[MAX_PARAMS];
+    int arity = 0;
+    while(tokens[*position].type == TOKEN_IDENTIFIER) {
+        if(arity == MAX_PARAMS) {
+            printf("Error: functions take at most %d parameters\n", 
+                MAX_PARAMS);
+            return NULL;
+        }
+        params[arity++] = tokens[*position].name;
+        (*position)++;
+        if(tokens[*position].type != TOKEN_COMMA) {
+            break;
+        }
+        (*position)++;  // consume ,
+    }
+
+    if(tokens[*position].type != TOKEN_RPAREN 
+        || tokens[*position + 1].type != TOKEN_EQUALS) {
+        printf("Error: expected ') =' in definition of %s\n", name);
+        return NULL;
+    }
+    (*position) += 2;   // consume ) and =
+
+    // parameters are the first slots of the function's frame
+    for(int i = 0; i < arity; i++) {
+        scope[i] = params[i];
+    }
+    scope_depth = arity;
+    node* body = parse_expression(tokens, position);
+    scope_depth = 0;
+
+    if(body == NULL) {
+        return NULL;
+    }
+
+    int frame = frame_size(body);
+    define_function(name, arity, params, body, frame > arity ? frame : arity);
+    return create_node(NODE_DEFINE, name, NULL, NULL);
+}
+
+/**
+ * @brief Returns true if an argument is cheap enough to be copied into
+ * every use of its parameter instead of being bound to a slot
+ * 
+ * @param n 
+ * @return int 
+ */
+static int is_trivial(node* n) {
+    return n->type == NODE_CONSTANT 
+        || n->type == NODE_VECTOR 
+        || n->type == NODE_SLOT;
+}
+
+/**
+ * @brief Deep copies a tree, moving its slots up by base. Parameter slots
+ * below arity whose argument is trivial are replaced by a copy of it.
+ * 
+ * @param n 
+ * @param args arguments of the call being inlined, or NULL
+ * @param arity 
+ * @param base 
+ * @return node* 
+ */
+static node* copy_ast(node* n, node** args, int arity, int base) {
+    if(n == NULL) {
+        return NULL;
+    }
+    if(n->type == NODE_SLOT && n->slot < arity && is_trivial(args[n->slot])) {
+        return copy_ast(args[n->slot], NULL, 0, 0);
+    }
+
+    node* c = create_node(
+        n->type,
+        n->value, 
+        copy_ast(n->left, args, arity, base), 
+        copy_ast(n->right, args, arity, base)
+    );
+    c->number = n->number;
+    c->op = n->op;
+    c->slot = n->slot >= 0 ? n->slot + base : -1;
+    return c;
+}
+
+/**
+ * @brief Inlines a call to f into the caller's tree. Arguments that 
+ * aren't trivial are evaluated once into the slots above base:
+ * 
+ *              NODE_LET: a (base)
+ *                 /         \
+ *          argument 0     NODE_LET: b (base + 1)
+ *                          /         \
+ *                   argument 1      copy of the body
+ * 
+ * @param f 
+ * @param args parsed arguments, consumed
+ * @param base first free slot in the caller
+ * @return node* 
+ */
+static node* inline_call(function* f, node** args, int base) {
+    node* body = copy_ast(f->body, args, f->arity, base);
+
+    for(int i = f->arity - 1; i >= 0; i--) {
+        if(is_trivial(args[i])) {
+            free_ast(args[i]);
+        } else {
+            node* let = create_node(NODE_LET, f->params[i], args[i], body);
+            let->slot = base + i;
+            body = let;
+        }
+    }
+    return body;
+}
+
+/**
+ * @brief Chains parsed arguments into a list of NODE_ARGUMENT nodes
+ * 
+ * @param args 
+ * @param count 
+ * @return node* 
+ */
+static node* argument_list(node** args, int count) {
+    node* list = NULL;
+    for(int i = count - 1; i >= 0; i--) {
+        list = create_node(NODE_ARGUMENT, NULL, args[i], list);
+    }
+    return list;
+}
+
+/**
+ * @brief Parses a call to a built-in or user defined function. A user 
+ * function must already be defined. Builtins become a NODE_BUILTIN with
+ * their id in op. User functions are inlined if they're small enough, 
+ * otherwise they become a call node:
+ * 
+ *              NODE_CALL: name (frame base)
+ *                 /
+ *          NODE_ARGUMENT -> (argument 0, NODE_ARGUMENT -> (argument 1, NULL))
+ * 
+ * <call> := <identifier>(<expression>, ...)
+ * @param tokens 
+ * @param position 
+ * @return node* 
+ */
+static node* parse_call(token* tokens, int* position) {
+    char* name = tokens[*position].name;
+    (*position) += 2;   // consume name and (
+
+    node* args[MAX_PARAMS];
+    int count = 0;
+    int failed = 0;
+    int base = scope_depth;
+    int separate = commas_separate;
+    commas_separate = 1;
+
+    while(tokens[*position].type != TOKEN_RPAREN) {
+        if(count == MAX_PARAMS || scope_depth == MAX_SLOTS) {
+            printf("Error: too many arguments to %s\n", name);
+            failed = 1;
+            break;
+        }
+
+        node* arg = parse_expression(tokens, position);
+        if(arg == NULL) {
+            failed = 1;
+            break;
+        }
+        args[count++] = arg;
+
+        if(tokens[*position].type != TOKEN_COMMA 
+            && tokens[*position].type != TOKEN_RPAREN) {
+            printf("Error: expected ',' or ')' in call to %s\n", name);
+            failed = 1;
+            break;
+        }
+        if(tokens[*position].type == TOKEN_COMMA) {
+            (*position)++;
+        }
+
+        // reserve the slot this argument may be bound to, so inlined
+        // calls in later arguments can't overwrite it
+        scope[scope_depth++] = "";
+    }
+    scope_depth = base;
+    commas_separate = separate;
+
+    int id = find_builtin(name);
+    if(!failed && id >= 0) {
+        (*position)++;  // consume )
+        if(count != builtin_arity(id)) {
+            printf("Error: %s takes %d arguments but was given %d\n",
+                name, builtin_arity(id), count);
+            for(int i = 0; i < count; i++) {
+                free_ast(args[i]);
+            }
+            return NULL;
+        }
+        node* call = create_node(NODE_BUILTIN, name, argument_list(args, count), NULL);
+        call->op = id;
+        return call;
+    }
+
+    function* f = NULL;
+    if(!failed) {
+        (*position)++;  // consume )
+        f = get_function(name);
+        if(f == NULL) {
+            printf("Error: no function named %s\n", name);
+        } else if(f->arity != count) {
+            printf("Error: %s takes %d arguments but was given %d\n",
+                name, f->arity, count);
+            f = NULL;
+        } else if(base + f->frame > MAX_SLOTS) {
+            printf("Error: calls to %s nested too deeply\n", name);
+            f = NULL;
+        }
+    }
+
+    if(f == NULL) {
+        for(int i = 0; i < count; i++) {
+            free_ast(args[i]);
+        }
+        return NULL;
+    }
+
+    if(inline_enabled && f->size <= INLINE_MAX_NODES) {
+        return inline_call(f, args, base);
+    }
+
+    node* call = create_node(NODE_CALL, name, argument_list(args, count), NULL);
+    call->slot = base;
+    return call;
+}
+
+/**
+ * @brief Parses a map over every stored vector, or only those whose names
+ * match a pattern. Inside the expression, _ is bound to a slot holding 
+ * the vector being mapped.
+ * <map> := map <expression> [in <pattern>]
+ * 
+ *              NODE_MAP: _ (slot)
+ *                 /     \
+ *            expression  pattern
+ * 
+ * @param tokens 
+ * @param position 
+ * @return node* 
+ */
+static node* parse_map(token* tokens, int* position) {
+    (*position)++;  // consume map
+
+    if(scope_depth == MAX_SLOTS) {
+        printf("Error: map nested too deeply\n");
+        return NULL;
+    }
+    int slot = scope_depth;
+    scope[scope_depth++] = "_";
+    node* expression = parse_expression(tokens, position);
+    scope_depth--;
+
+    if(expression == NULL) {
+        return NULL;
+    }
+    node* pattern = NULL;
+    if(tokens[*position].type == TOKEN_IDENTIFIER 
+        && !strcmp(tokens[*position].name, "in")) {
+        (*position)++;
+        pattern = parse_pattern(tokens, position);
+        if(pattern == NULL) {
+            free_ast(expression);
+            return NULL;
+        }
+    }
+    node* map = create_node(NODE_MAP, "_", expression, pattern);
+    map->slot = slot;
+    return map;
+}
+
 /**
  * @brief Parses a term and returns it's root node
  * <term> := <factor> | <factor> { * | / | .| X } <term>
@@ -417,9 +1110,11 @@ static node* parse_term(token* tokens, int* position) {
             tokens[*position].type == TOKEN_DOT
         ) {
         char* operator = tokens[(*position)].name;
+        int op = find_operator(tokens[(*position)].type);
         (*position)++;
         node* right = parse_factor(tokens, position);
         factor = create_node(NODE_OPERATION, operator, factor, right);
+        factor->op = op;
     }
     return factor;
 }
@@ -435,11 +1130,24 @@ static node* parse_term(token* tokens, int* position) {
 static node* parse_factor(token* tokens, int* position) {
     if(tokens[*position].type == TOKEN_LPAREN) {
         (*position)++;  // consume ()
+        // commas inside parentheses build vectors again
+        int separate = commas_separate;
+        commas_separate = 0;
         node* expression = parse_expression(tokens, position);
+        commas_separate = separate;
         (*position)++;  // consume ()
         return expression;
+    } else if(tokens[*position].type == TOKEN_IDENTIFIER 
+        && tokens[*position + 1].type == TOKEN_LPAREN) {
+        return parse_call(tokens, position);
     } else if(tokens[*position].type == TOKEN_IDENTIFIER) { 
-        return parse_identifier(tokens, position);
+        int slot = find_slot(tokens[*position].name);
+        node* identifier = parse_identifier(tokens, position);
+        if(slot >= 0) {
+            identifier->type = NODE_SLOT;
+            identifier->slot = slot;
+        }
+        return identifier;
     } else if(tokens[*position].type == TOKEN_CONST) { 
         return parse_value(tokens, position);
     } else {
@@ -459,7 +1167,9 @@ static node* parse_factor(token* tokens, int* position) {
 static node* parse_constant(token* tokens, int* position) {
     char* value = tokens[(*position)].name;
     (*position )++;
-    return create_node(NODE_CONSTANT, value, NULL, NULL);
+    node* n = create_node(NODE_CONSTANT, value, NULL, NULL);
+    n->number = atof(value);
+    return n;
 }
 
 
@@ -474,7 +1184,7 @@ static node* parse_constant(token* tokens, int* position) {
 static node* parse_value(token* tokens, int* position) {
     if(tokens[*position].type == TOKEN_CONST) {
         node* i = parse_constant(tokens, position);
-        if(tokens[*position].type == TOKEN_COMMA) {
+        if(tokens[*position].type == TOKEN_COMMA && !commas_separate) {
             (*position)++;
         }
 
@@ -486,14 +1196,14 @@ static node* parse_value(token* tokens, int* position) {
         if(next.type != TOKEN_END && next.type == TOKEN_CONST) {
             j = parse_constant(tokens, position);
 
-            if(tokens[*position].type == TOKEN_COMMA) {
+            if(tokens[*position].type == TOKEN_COMMA && !commas_separate) {
                 (*position)++;
             }
 
             // If there's three constants
-            if(tokens[*position].type != TOKEN_END) {
+            if(tokens[*position].type == TOKEN_CONST) {
                 k = parse_constant(tokens, position);
-                if(tokens[*position].type == TOKEN_COMMA) {
+                if(tokens[*position].type == TOKEN_COMMA && !commas_separate) {
                     (*position)++;
                 }
 
@@ -505,6 +1215,7 @@ static node* parse_value(token* tokens, int* position) {
 
             } else {
                 k = create_node(NODE_CONSTANT, "0", NULL, NULL);
+                k->number = 0;
             }
             return create_node(NODE_VECTOR, NULL, i, create_node(NODE_VECTOR, NULL, j, k));
         } else {
@@ -546,6 +1257,7 @@ void free_ast(node* n) {
         free(n->value);
     }
 
+    jit_free(n->jit);
     free_ast(n->left);
     free_ast(n->right);
     free(n);
@@ -604,7 +1316,7 @@ static value make_value_from_vector(vector v) {
  * @param f 
  * @return value 
  */
-static value make_value_from_scalar(float f) {
+static value make_value_from_scalar(real f) {
     value r;
     r.type = VAL_SCALAR;
     r.scalar = f;
@@ -643,6 +1355,12 @@ char* value_to_string(value v) {
     if(!is_sentinel(v)) {
         if(v.type == VAL_VECTOR) {
             snprintf(buffer, 200, "%s\n", vector_to_string(v.vec));
+        } else if(v.type == VAL_QUATERNION) {
+            snprintf(buffer, 200, "%s\n", 
+                quaternion_to_string(held_quaternion(v.held)));
+        } else if(v.type == VAL_MATRIX) {
+            snprintf(buffer, 200, "%s\n", 
+                matrix_to_string(held_matrix(v.held)));
         } else {
             snprintf(buffer, 200, "%.2f\n", v.scalar);
         }
@@ -669,12 +1387,25 @@ static value handle_assignment(node* n) {
         if(result.type == VAL_VECTOR) {
             // CHANGE
             insert_vector(n->left->value, result.vec);
+            unname_transform(n->left->value);
+            return result;
+        } else if(result.type == VAL_QUATERNION 
+            || result.type == VAL_MATRIX) {
+            // transforms aren't stored in the vectable, and a vector 
+            // can't be removed from it
+            if(is_some(get_vector(n->left->value))) {
+                printf("Error: %s is already a vector\n", n->left->value);
+                return sentinel();
+            }
+            name_transform(n->left->value, result.held, 
+                result.type == VAL_MATRIX);
             return result;
         } else {
             printf("Warning: Cannot assign scalar to variable\n");
             printf("Assigning scalar as field i\n");
             vector v = {result.scalar, 0, 0};
             insert_vector(n->left->value, v);
+            unname_transform(n->left->value);
             return(make_value_from_vector(v));
         }
     } else {
@@ -693,10 +1424,165 @@ static value handle_identifier(node* n) {
         vt_option v = get_vector(n->value);
         if(is_some(v)) {
             return make_value_from_vector(v.value.value);
+        }
+        int is_matrix;
+        int held = named_transform_held(n->value, &is_matrix);
+        if(held >= 0) {
+            value r;
+            r.type = is_matrix ? VAL_MATRIX : VAL_QUATERNION;
+            r.held = held;
+            return r;
+        }
+        printf("Error: no vector found named %s\n", n->value);
+        return sentinel();
+}
+
+/**
+ * @brief Handles the set command, which changes an interpreter setting.
+ * With no arguments, prints the current settings.
+ *  set inline { on | off }
+ *  set fuse { on | off }
+ *  set jit { on | off }
+ *  set hash { djb2 | fnv | wy }
+ *  set probe { linear | quadratic | robin | swiss }
+ *  set maxload <number>
+ *  set sync { always | batch | off }
+ *  set conflict { last | first | error }
+ *  set spatial { grid | scan }
+ * 
+ * @param name setting name, or NULL
+ * @param setting new value
+ */
+static void handle_set(node* name, node* setting) {
+    if(name == NULL) {
+        printf("inline: %s\n", inline_enabled ? "on" : "off");
+        printf("fuse: %s\n", fuse_enabled ? "on" : "off");
+        printf("jit: %s\n", jit_enabled ? "on" : "off");
+        print_vectable_settings();
+        printf("sync: %s\n", wal_sync_name());
+        printf("conflict: %s\n", conflict_name());
+        printf("spatial: %s\n", space_mode_name());
+    } else if(setting == NULL) {
+        printf("Error: set %s needs a value\n", name->value);
+    } else if(!strcmp(name->value, "inline")) {
+        if(!strcmp(setting->value, "on")) {
+            inline_enabled = 1;
+        } else if(!strcmp(setting->value, "off")) {
+            inline_enabled = 0;
         } else {
-            printf("Error: no vector found named %s\n", n->value);
-            return sentinel();
+            printf("Error: set inline takes on or off\n");
+        }
+    } else if(!strcmp(name->value, "fuse")) {
+        if(!strcmp(setting->value, "on")) {
+            fuse_enabled = 1;
+        } else if(!strcmp(setting->value, "off")) {
+            fuse_enabled = 0;
+        } else {
+            printf("Error: set fuse takes on or off\n");
+        }
+    } else if(!strcmp(name->value, "jit")) {
+        if(!strcmp(setting->value, "on")) {
+            jit_enabled = 1;
+        } else if(!strcmp(setting->value, "off")) {
+            jit_enabled = 0;
+        } else {
+            printf("Error: set jit takes on or off\n");
+        }
+    } else if(!strcmp(name->value, "hash")) {
+        if(set_vectable_hash(setting->value) < 0) {
+            printf("Error: set hash takes djb2, fnv or wy\n");
+        }
+    } else if(!strcmp(name->value, "probe")) {
+        if(set_vectable_probe(setting->value) < 0) {
+            printf("Error: set probe takes linear, quadratic, robin "
+                "or swiss\n");
+        }
+    } else if(!strcmp(name->value, "maxload")) {
+        if(set_vectable_max_load(atof(setting->value)) < 0) {
+            printf("Error: set maxload takes a number from 0.1 to 0.95\n");
+        }
+    } else if(!strcmp(name->value, "sync")) {
+        if(set_wal_sync(setting->value) < 0) {
+            printf("Error: set sync takes always, batch or off\n");
+        }
+    } else if(!strcmp(name->value, "conflict")) {
+        if(set_conflict(setting->value) < 0) {
+            printf("Error: set conflict takes last, first or error\n");
+        }
+    } else if(!strcmp(name->value, "spatial")) {
+        if(set_space_mode(setting->value) < 0) {
+            printf("Error: set spatial takes grid or scan\n");
+        }
+    } else {
+        printf("Error: no setting named %s\n", name->value);
+    }
+}
+
+/**
+ * @brief Returns true if n is a number argument
+ * 
+ * @param n 
+ * @return int 
+ */
+static int is_number(node* n) {
+    return n != NULL && n->type == NODE_CONSTANT;
+}
+
+/**
+ * @brief Handles gen's arguments and makes the vectors
+ *  gen <count> [seed <n>] [uniform|normal|sphere] [scale <x>]
+ *      [names <length> [<longest>]] [repeat <fraction>]
+ * 
+ * @param arguments 
+ */
+static void handle_gen(node* arguments) {
+    gen_options o;
+    gen_defaults(&o);
+    int valid = is_number(arguments);
+    if(valid) {
+        o.count = atol(arguments->value);
+    }
+    for(node* a = valid ? arguments->right : NULL; a != NULL && valid; 
+        a = a->right) {
+        if(set_gen_dist(&o, a->value) == 0) {
+            continue;
+        }
+        valid = is_number(a->right);
+        if(!valid) {
+            break;
+        } else if(!strcmp(a->value, "seed")) {
+            o.seed = strtoull(a->right->value, NULL, 10);
+        } else if(!strcmp(a->value, "scale")) {
+            o.scale = atof(a->right->value);
+        } else if(!strcmp(a->value, "repeat")) {
+            o.repeat = atof(a->right->value);
+        } else if(!strcmp(a->value, "names")) {
+            o.min_length = atoi(a->right->value);
+            o.max_length = o.min_length;
+            if(is_number(a->right->right)) {
+                a = a->right;
+                o.max_length = atoi(a->right->value);
+            }
+        } else {
+            valid = 0;
         }
+        a = a->right;
+    }
+
+    if(!valid) {
+        printf("Error: gen takes a count and optionally seed <n>, uniform, "
+            "normal or sphere, scale <x>, names <length> [<longest>] and "
+            "repeat <fraction>\n");
+    } else if(o.count < 1 || o.count > 1 << 30) {
+        printf("Error: gen makes from 1 to %d vectors\n", 1 << 30);
+    } else if(o.min_length < 1 || o.max_length > GEN_NAME 
+        || o.min_length > o.max_length) {
+        printf("Error: names are from 1 to %d characters long\n", GEN_NAME);
+    } else if(o.repeat < 0 || o.repeat >= 1) {
+        printf("Error: repeat takes a fraction from 0 up to 1\n");
+    } else {
+        printf("Generated %ld vectors\n", gen_vectors(&o));
+    }
 }
 
 /**
@@ -713,9 +1599,19 @@ static value handle_execute(node* n) {
     } else if(!strcmp(left->value, "free")) {
         int cleared = clear_vectable();
         printf("Freed %d vectors\n", cleared);
+        cleared = clear_named_transforms();
+        if(cleared > 0) {
+            printf("Freed %d quaternions and matrices\n", cleared);
+        }
         return sentinel();
     } else if(!strcmp(left->value, "list")) {
-        print_vectable();
+        if(right == NULL) {
+            print_vectable(NULL);
+        } else if(right->type == NODE_PATTERN) {
+            print_vectable(right->value);
+        } else {
+            printf("Error: list takes a pattern like name*\n");
+        }
         return sentinel();
     } else if(!strcmp(left->value, "help")) {
         print_help();
@@ -725,113 +1621,182 @@ static value handle_execute(node* n) {
         printf("\033[H"); // go home
         return sentinel();
     } else if(!strcmp(left->value, "write")) {
-        // TODO: this is incorrect, the ast does not get built correctly for paths
-        write_vectable(right->value);
+        int flags = 0;
+        int packed = -1;
+        int background = 0;
+        int valid = right != NULL && right->type == NODE_STRING;
+        for(node* option = valid ? right->right : NULL; option != NULL; 
+            option = option->right) {
+            if(!strcmp(option->value, "full")) {
+                flags |= WRITE_FULL;
+            } else if(!strcmp(option->value, "sorted")) {
+                flags |= WRITE_SORTED;
+            } else if(!strcmp(option->value, "packed")) {
+                packed = packed == PACK_LOSSY ? PACK_LOSSY : PACK_LOSSLESS;
+            } else if(!strcmp(option->value, "lossy")) {
+                packed = PACK_LOSSY;
+            } else if(!strcmp(option->value, "bg")) {
+                background = 1;
+            } else {
+                valid = 0;
+            }
+        }
+
+        double error = 0;
+        int written = 0;
+        if(!valid) {
+            printf("Error: write takes \"path\" and optionally full, sorted, "
+                "packed, lossy or bg\n");
+        } else if(in_transaction()) {
+            printf("Error: commit or rollback before write\n");
+        } else if(background && packed >= 0) {
+            printf("Error: bg only writes csv files\n");
+        } else if(background) {
+            int id = start_write_job(right->value, flags);
+            if(id < 0) {
+                printf("Error: %d jobs are already running\n", MAX_JOBS);
+            } else {
+                printf("[%d] Writing %s\n", id, right->value);
+            }
+        } else if(packed < 0) {
+            written = write_vectable(right->value, flags);
+        } else if((written = write_packed(right->value, packed, &error)) == -2) {
+            printf("Error: lossy can't store nan or infinity\n");
+        } else if(written >= 0 && packed == PACK_LOSSY) {
+            printf("Every component is within %g of its value\n", error);
+        }
+        if(written == -1) {
+            printf("Error: Could not write %s\n", right->value);
+        }
     } else if(!strcmp(left->value, "read")) {
-        // TODO: this is incorrect, the ast does not get built correctly for paths
         int read = 0;
-        if((read = read_vectable(right->value)) < 0) {
-            printf("Error: Bad argument to funtion 'read' (does the file exist?)\n");
+        node* option = right != NULL ? right->right : NULL;
+        if(option != NULL && (strcmp(option->value, "bg") || option->right)) {
+            printf("Error: read takes \"path\" and optionally bg\n");
+            read = -2;
+        } else if(option != NULL) {
+            int id = start_read_job(right->value);
+            if(id < 0) {
+                printf("Error: %d jobs are already running\n", MAX_JOBS);
+            } else {
+                printf("[%d] Reading %s\n", id, right->value);
+            }
+            read = -2;
+        } else if(right != NULL && is_glob(right->value)) {
+            int files;
+            read = read_glob(right->value, &files);
+            if(read >= 0) {
+                printf("Read %d vectors from %d files\n", read, files);
+                read = -2;
+            }
+        } else if(right != NULL && is_packed(right->value)) {
+            read = read_packed(right->value);
+        } else if(right != NULL) {
+            read = read_vectable(right->value);
         } else {
+            read = -1;
+        }
+        if(read == -1) {
+            printf("Error: Bad argument to funtion 'read' (does the file exist?)\n");
+        } else if(read >= 0) {
             printf("Read %d vectors from %s\n", read, right->value);
         };
     } else if(!strcmp(left->value, "fill")) {
         fill_vectable(atoi(right->value));
+    } else if(!strcmp(left->value, "gen")) {
+        handle_gen(right);
+    } else if(!strcmp(left->value, "set")) {
+        handle_set(right, right ? right->right : NULL);
+    } else if(!strcmp(left->value, "funcs")) {
+        print_functable();
+    } else if(!strcmp(left->value, "begin")) {
+        if(begin_vectable() < 0) {
+            printf("Error: a transaction is already open\n");
+        }
+    } else if(!strcmp(left->value, "commit")) {
+        int written = commit_vectable();
+        if(written < 0) {
+            printf("Error: no transaction is open\n");
+        } else {
+            printf("Committed %d writes\n", written);
+        }
+    } else if(!strcmp(left->value, "rollback")) {
+        int dropped = rollback_vectable();
+        if(dropped < 0) {
+            printf("Error: no transaction is open\n");
+        } else {
+            printf("Rolled back %d writes\n", dropped);
+        }
+    } else if(!strcmp(left->value, "compact")) {
+        if(!wal_active()) {
+            printf("Error: no log is open, start with tritone -l path\n");
+        } else if(in_transaction()) {
+            printf("Error: commit or rollback before compact\n");
+        } else if(wal_compact() < 0) {
+            printf("Error: could not compact the log\n");
+        }
+    } else if(!strcmp(left->value, "jobs")) {
+        print_jobs();
+    } else if(!strcmp(left->value, "tablestats")) {
+        print_tablestats();
+    } else if(!strcmp(left->value, "stats")) {
+        if(right != NULL && !strcmp(right->value, "reset")) {
+            reset_stats();
+        } else {
+            print_stats();
+        }
     }
     return sentinel();
 }
 
 /**
- * @brief Handles vector and scalar operation nodes and returns their value
+ * @brief Counts an evaluation of an operation or builtin, compiles it 
+ * once it's hot, and runs the compiled code when it can. Code that can't
+ * run any more because something it reads has changed type is thrown 
+ * away, to be compiled again for the new types if the node stays hot.
  * 
  * @param n 
- * @return value 
+ * @param result the node's value, if it ran
+ * @return int 1 if it ran, 0 if the tree has to be evaluated
  */
-static value handle_operation(node*n) {
-    value left = evaluate_ast(n->left);
-    value right = evaluate_ast(n->right);
-
-    // Addition operations
-    if(!strcmp(n->value, "+")) {
-
-        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
-            vector sum = vec_add(left.vec, right.vec);
-            return make_value_from_vector(sum);
-        } else if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) { 
-            float sum = left.scalar + right.scalar;
-            value v = make_value_from_scalar(sum);
-            return v;
-        } else {
-            printf("Error: addition not implemented for scalar + vector\n");
-            return sentinel();
-        }
-    // Subtraction Operations
-    } else if(!strcmp(n->value, "-")) { 
-
-        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
-            vector sum = vec_sub(left.vec, right.vec);
-            return make_value_from_vector(sum);
-        } else if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) { 
-            float sum = left.scalar - right.scalar;
-            return make_value_from_scalar(sum);
-        } else {
-            printf("Error: subtraction not implemented for scalar + vector\n");
-            return sentinel();
-        }
-    // Multiplicaton functions
-    } else if(!strcmp(n->value, "*")) { 
-
-        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
-            vector sum = vec_mul(left.vec, right.vec);
-            return make_value_from_vector(sum);
-        } else if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) { 
-            float sum = left.scalar * right.scalar;
-            return make_value_from_scalar(sum);
-        } else if(left.type == VAL_VECTOR && right.type == VAL_SCALAR) {
-            float i = left.vec.i * right.scalar;
-            float j = left.vec.j * right.scalar;
-            float k = left.vec.k * right.scalar;
-            vector product = {i, j, k};
-            return make_value_from_vector(product);
-        } else {
-            float i = right.vec.i * left.scalar;
-            float j = right.vec.j * left.scalar;
-            float k = right.vec.k * left.scalar;
-            vector product = {i, j, k};
-            return make_value_from_vector(product);
-        }
-    // Division operations
-    } else if(!strcmp(n->value, "/")) { 
-
-        if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) { 
-            return make_value_from_scalar(left.scalar/right.scalar);
-        } else {
-            printf("Error: invalid arguments to scalar division\n");
-            return sentinel();
+static int run_hot(node* n, value* result) {
+    if(!jit_enabled) {
+        return 0;
+    }
+    if(n->jit == NULL) {
+        if(n->hits == JIT_HOT || ++n->hits < JIT_HOT) {
+            return 0;
         }
-    // Dot produt
-    } else if(!strcmp(n->value, ".")) { 
-
-        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
-            float sum = vec_dot(left.vec, right.vec);
-            return make_value_from_scalar(sum);
-        } else { 
-            printf("Error: invalid arguments to dot product\n");
-            return sentinel();
+        n->jit = jit_compile(n, frame);
+        if(n->jit == NULL) {
+            return 0;
         }
-    // Cross product
-    } else if(!strcmp(n->value, "X")) { 
+    }
+    if(jit_run(n->jit, frame, result)) {
+        return 1;
+    }
+    jit_free(n->jit);
+    n->jit = NULL;
+    n->hits = 0;
+    return 0;
+}
 
-        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
-            vector cross = vec_cross(left.vec, right.vec);
-            return make_value_from_vector(cross);
-        } else { 
-            printf("Error: invalid arguments to cross product\n");
-            return sentinel();
-        }
-    } else {
-        return sentinel();
+/**
+ * @brief Handles vector and scalar operation nodes and returns their value.
+ * The operator was resolved when parsing, so this is one lookup in the
+ * operator table on the operand types.
+ * 
+ * @param n 
+ * @return value 
+ */
+static value handle_operation(node*n) {
+    value result;
+    if(run_hot(n, &result)) {
+        return result;
     }
+    value left = evaluate_ast(n->left);
+    value right = evaluate_ast(n->right);
+    return operators[n->op][left.type][right.type](&left, &right);
 }
 
 /**
@@ -849,13 +1814,283 @@ static value handle_operation(node*n) {
  * @return value 
  */
 static value handle_vector(node* n) {
-    float i = atof(n->left->value);
-    float j = atof(n->right->left->value);
-    float k = atof(n->right->right->value);
+    real i = n->left->number;
+    real j = n->right->left->number;
+    real k = n->right->right->number;
     vector v = {i, j, k};
     return make_value_from_vector(v);
 }
 
+/**
+ * @brief Evaluates each statement in a sequence in order and returns
+ * the value of the last one
+ * 
+ * @param n 
+ * @return value 
+ */
+static value handle_sequence(node* n) {
+    value result = sentinel();
+    for(; n != NULL; n = n->right) {
+        result = evaluate_ast(n->left);
+    }
+    return result;
+}
+
+/**
+ * @brief Evaluates a loop node. The range is evaluated once, then the body
+ * is evaluated for each value with the loop variable held in its slot.
+ * 
+ * @param n 
+ * @return value 
+ */
+static value handle_loop(node* n) {
+    value start = evaluate_ast(n->left->left);
+    value step = evaluate_ast(n->left->right->left);
+    value stop = evaluate_ast(n->left->right->right);
+
+    if(start.type != VAL_SCALAR || step.type != VAL_SCALAR 
+        || stop.type != VAL_SCALAR) {
+        printf("Error: range bounds of %s must be scalars\n", n->value);
+        return sentinel();
+    }
+    if(step.scalar == 0) {
+        printf("Error: range of %s has a step of 0\n", n->value);
+        return sentinel();
+    }
+
+    // count iterations up front so float steps don't accumulate error
+    real span = (stop.scalar - start.scalar) / step.scalar;
+    long count = span < 0 ? 0 : (long)(span + 1e-4f) + 1;
+
+    value* slot = &frame[n->slot];
+    int mark = transforms_held();
+    for(long i = 0; i < count; i++) {
+        *slot = make_value_from_scalar(start.scalar + i * step.scalar);
+        evaluate_ast(n->right);
+        release_transforms(mark);
+    }
+    return sentinel();
+}
+
+/**
+ * @brief Evaluates the argument of an inlined call into its slot, then
+ * evaluates the rest of the call
+ * 
+ * @param n 
+ * @return value 
+ */
+static value handle_let(node* n) {
+    frame[n->slot] = evaluate_ast(n->left);
+    return evaluate_ast(n->right);
+}
+
+/**
+ * @brief Evaluates a call that wasn't inlined. The arguments are evaluated
+ * in the caller's frame, then the body is evaluated in a new frame that
+ * starts at the caller's first free slot.
+ * 
+ * @param n 
+ * @return value 
+ */
+static value handle_call(node* n) {
+    function* f = get_function(n->value);
+    if(f == NULL) {
+        printf("Error: no function named %s\n", n->value);
+        return sentinel();
+    }
+
+    value args[MAX_PARAMS];
+    int count = 0;
+    for(node* a = n->left; a != NULL; a = a->right) {
+        if(count == f->arity) {
+            count++;
+            break;
+        }
+        args[count++] = evaluate_ast(a->left);
+    }
+    if(count != f->arity) {
+        printf("Error: %s takes %d arguments\n", n->value, f->arity);
+        return sentinel();
+    }
+
+    value* callee = frame + n->slot;
+    if(callee + f->frame > slots + MAX_SLOTS) {
+        printf("Error: calls to %s nested too deeply\n", n->value);
+        return sentinel();
+    }
+    memcpy(callee, args, count * sizeof(value));
+
+    value* caller = frame;
+    frame = callee;
+    value result = evaluate_ast(f->body);
+    frame = caller;
+    return result;
+}
+
+/**
+ * @brief Evaluates a call to a builtin, dispatching on its id
+ * 
+ * @param n 
+ * @return value 
+ */
+static value handle_builtin(node* n) {
+    value result;
+    if(run_hot(n, &result)) {
+        return result;
+    }
+    value args[MAX_BUILTIN_ARGS];
+    int count = 0;
+    for(node* a = n->left; a != NULL; a = a->right) {
+        args[count++] = evaluate_ast(a->left);
+    }
+    return call_builtin(n->op, args);
+}
+
+/**
+ * @brief Returns true if slot is read anywhere in a tree
+ * 
+ * @param n 
+ * @param slot 
+ * @return int 
+ */
+static int uses_slot(node* n, int slot) {
+    if(n == NULL) {
+        return 0;
+    }
+    if(n->type == NODE_SLOT && n->slot == slot) {
+        return 1;
+    }
+    return uses_slot(n->left, slot) || uses_slot(n->right, slot);
+}
+
+/**
+ * @brief Tries to map a builtin call like f(_, b, ...) with a batch kernel.
+ * Only works when _ is the argument the batch version takes each vector 
+ * as (the first, for most) and appears nowhere else, so the other 
+ * arguments can be evaluated once up front.
+ * 
+ * @param map 
+ * @param data 
+ * @param count 
+ * @return int 1 if it ran, 0 if the expression doesn't fit, -1 on error
+ */
+static int map_batch(node* map, vector_array data, int count) {
+    node* call = map->left;
+    if(call->type != NODE_BUILTIN || !builtin_batches(call->op)) {
+        return 0;
+    }
+
+    int each = builtin_each(call->op);
+    int arg = 0;
+    for(node* a = call->left; a != NULL; a = a->right, arg++) {
+        if(arg != each && uses_slot(a->left, map->slot)) {
+            return 0;
+        } else if(arg == each && (a->left->type != NODE_SLOT 
+            || a->left->slot != map->slot)) {
+            return 0;
+        }
+    }
+
+    value args[MAX_BUILTIN_ARGS];
+    arg = 0;
+    for(node* a = call->left; a != NULL; a = a->right, arg++) {
+        if(arg != each) {
+            args[arg] = evaluate_ast(a->left);
+        }
+    }
+    return map_builtin(call->op, data, args, count) < 0 ? -1 : 1;
+}
+
+/**
+ * @brief Tries to map an element-wise expression as one fused pass, 
+ * compiled once rather than walked for every vector
+ * 
+ * @param map 
+ * @param data 
+ * @param count 
+ * @return int 1 if it ran, 0 if the expression doesn't fit
+ */
+static int map_fused(node* map, vector_array data, int count) {
+    if(!fuse_enabled) {
+        return 0;
+    }
+    fused* f = fuse_expression(map->left, map->slot, frame);
+    if(f == NULL) {
+        return 0;
+    }
+    run_fused(f, data, count, FUSE_BLOCK);
+    free_fused(f);
+    return 1;
+}
+
+/**
+ * @brief Evaluates a map node: replaces every stored vector, or those 
+ * matching its pattern, with the value of the expression, with _ bound to 
+ * the old vector. Scalar results are stored in the i field, like 
+ * assignments.
+ * 
+ * @param n 
+ * @return value 
+ */
+static value handle_map(node* n) {
+    char* prefix = n->right != NULL ? n->right->value : NULL;
+    int count = prefix != NULL ? count_prefix(prefix) : count_vectors();
+    vector_array data = {
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real))
+    };
+    if(prefix != NULL) {
+        gather_prefix(prefix, data);
+    } else {
+        gather_vectors(data);
+    }
+
+    int batched = map_batch(n, data, count);
+    if(batched == 0) {
+        batched = map_fused(n, data, count);
+    }
+    int failed = 0;
+    int mark = transforms_held();
+    for(int x = 0; x < count && !batched; x++) {
+        vector v = { data.i[x], data.j[x], data.k[x] };
+        frame[n->slot] = make_value_from_vector(v);
+        value result = evaluate_ast(n->left);
+        release_transforms(mark);
+
+        if(result.type == VAL_SCALAR) {
+            v.i = result.scalar;
+            v.j = 0;
+            v.k = 0;
+        } else if(result.type == VAL_VECTOR) {
+            v = result.vec;
+        } else {
+            if(result.type != VAL_SENTINEL) {
+                printf("Error: only vectors and scalars can be stored\n");
+            }
+            // leave it unchanged; the error has been printed
+            failed++;
+            continue;
+        }
+        data.i[x] = v.i;
+        data.j[x] = v.j;
+        data.k[x] = v.k;
+    }
+
+    if(batched >= 0) {
+        if(prefix != NULL) {
+            scatter_prefix(prefix, data);
+        } else {
+            scatter_vectors(data);
+        }
+        printf("Mapped %d vectors\n", count - failed);
+    }
+    free(data.i);
+    free(data.j);
+    free(data.k);
+    return sentinel();
+}
+
 /**
  * @brief Evaluates an AST branch given the root node using
  * recursive descent parsing (essentially pre-order traversal).
@@ -886,7 +2121,21 @@ value evaluate_ast(node* n) {
             return handle_vector(n);
             break;
         case(NODE_CONSTANT):
-            return make_value_from_scalar(atof(n->value));
+            return make_value_from_scalar(n->number);
+        case(NODE_SLOT):
+            return frame[n->slot];
+        case(NODE_SEQUENCE):
+            return handle_sequence(n);
+        case(NODE_LOOP):
+            return handle_loop(n);
+        case(NODE_LET):
+            return handle_let(n);
+        case(NODE_CALL):
+            return handle_call(n);
+        case(NODE_BUILTIN):
+            return handle_builtin(n);
+        case(NODE_MAP):
+            return handle_map(n);
         default:
             return sentinel();
     }
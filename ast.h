@@ -32,7 +32,10 @@
         TOKEN_RBRACKET,
         TOKEN_DOT,
         TOKEN_CROSS,
-        TOKEN_CONST
+        TOKEN_CONST,
+        TOKEN_COLON,
+        TOKEN_SEMICOLON,
+        TOKEN_TEXT          // everything between a pair of quotes
     } token_type;
 
     typedef struct {
@@ -48,15 +51,35 @@
         NODE_CONSTANT,
         NODE_EXECUTE,
         NODE_STRING,
+        NODE_SEQUENCE,
+        NODE_LOOP,
+        NODE_RANGE,
+        NODE_SLOT,
+        NODE_DEFINE,
+        NODE_CALL,
+        NODE_ARGUMENT,
+        NODE_LET,
+        NODE_BUILTIN,
+        NODE_MAP,
+        NODE_PATTERN,       // name* or *, value holds the prefix before the *
     } node_type;
 
+    // slots hold loop variables and function parameters. Calls that
+    // aren't inlined get a frame of slots above the caller's
+    #define MAX_SLOTS 256
+
     typedef struct node node;
     struct node {
         char* value;
         node_type type;
         int is_root;
+        int slot;           // slot index, relative to the current frame
+        real number;        // pre-parsed value of a NODE_CONSTANT
+        int op;             // operator of a NODE_OPERATION, id of a NODE_BUILTIN
         node* left;
         node* right;
+        int hits;           // evaluations so far, until it's compiled
+        struct jitted* jit; // native code for it, once it is hot
     };
 
 
@@ -64,21 +87,29 @@
         VAL_VECTOR,
         VAL_SCALAR,
         VAL_SENTINEL,
+        VAL_QUATERNION,
+        VAL_MATRIX,
+        VAL_COUNT,
     } value_type;
 
     typedef struct {
         value_type type;
         union {
-            float scalar;
+            real scalar;
             vector vec;
+            int held;       // a quaternion or matrix, by its place in the
+                            // transform arena
         };
     } value;
 
+    token* lex(char* input);
+    void free_tokens(token* tokens);
     node* parse_input(char* input);
     void print_ast(node* root);
     void free_ast(node* root);
     value evaluate_ast(node* n);
     char* value_to_string(value v);
     void print_help();
+    int is_reserved(char* name);
 
-#endif 
\ No newline at end of file
+#endif 
\ No newline at end of file
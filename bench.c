@@ -0,0 +1,2454 @@
+/**
+ * @file bench.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Benchmark driver for tritone. Each benchmark builds whatever
+ * state it needs through the same entry points the REPL uses and reports
+ * its throughput, both as text and, with -o, as a JSON results file so
+ * runs can be compared for regressions.
+ *
+ * Usage: tritone-bench [-n iterations] [-k max keys] [-o results.json]
+ *                      [-b name,name,...]
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "ast.h"
+#include "vec.h"
+#include "vectable.h"
+#include "index.h"
+#include "wal.h"
+#include "pack.h"
+#include "jobs.h"
+#include "import.h"
+#include "gen.h"
+#include "space.h"
+#include "region.h"
+#include "transform.h"
+#include "functable.h"
+#include "operators.h"
+#include "fuse.h"
+#include "jit.h"
+
+/**
+ * @brief Returns a monotonic timestamp in seconds
+ *
+ * @return double
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// JSON results file, NULL when only text is wanted
+static FILE* json = NULL;
+static int results = 0;
+// name of the benchmark currently reporting
+static char* group = "";
+// comma separated benchmarks to run, NULL for all of them
+static char* only = NULL;
+
+/**
+ * @brief Returns true if the benchmark called name should run
+ *
+ * @param name
+ * @return int
+ */
+static int wanted(char* name) {
+    if(only == NULL) {
+        return 1;
+    }
+    int length = strlen(name);
+    for(char* item = only; item != NULL; item = strchr(item, ',')) {
+        if(*item == ',') {
+            item++;
+        }
+        if(!strncmp(item, name, length) 
+            && (item[length] == ',' || item[length] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts a benchmark: prints its heading and names the results
+ * reported after it
+ *
+ * @param name short name used in the JSON output
+ * @param description
+ */
+static void section(char* name, char* description) {
+    group = name;
+    printf("%s: %s\n", name, description);
+}
+
+/**
+ * @brief Prints one result of the current benchmark and appends it to
+ * the JSON results
+ *
+ * @param name what was measured, unique within the benchmark
+ * @param value
+ * @param unit
+ */
+static void report(char* name, double value, char* unit) {
+    // small values such as errors would round to zero at two places
+    if(value != 0 && value < 0.01) {
+        printf("  %-36s %14.3e %s\n", name, value, unit);
+    } else {
+        printf("  %-36s %14.2f %s\n", name, value, unit);
+    }
+    if(json != NULL) {
+        fprintf(json, 
+            "%s\n    {\"bench\": \"%s\", \"case\": \"%s\", "
+            "\"value\": %.6g, \"unit\": \"%s\"}",
+            results++ ? "," : "", group, name, value, unit);
+    }
+}
+
+/**
+ * @brief Sends stdout to /dev/null, so messages from commands like fill
+ * and map don't drown out the results
+ *
+ * @return int descriptor to pass to unmute
+ */
+static int mute(void) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    return saved;
+}
+
+/**
+ * @brief Restores stdout after mute
+ *
+ * @param saved
+ */
+static void unmute(int saved) {
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+/**
+ * @brief Parses and evaluates a line, discarding the result
+ *
+ * @param line
+ */
+static void run(char* line) {
+    node* root = parse_input(line);
+    evaluate_ast(root);
+    free_ast(root);
+    clear_transforms();
+}
+
+/**
+ * @brief Runs acc = acc + v X w for iterations iterations, once as a
+ * generated script (one parse per line) and once as a single loop.
+ *
+ * @param iterations
+ */
+static void bench_loop(long iterations) {
+    section("loop", "acc = acc + v X w, one line per iteration vs a loop");
+    run("v = 1, 2, 3; w = 4, 5, 6; acc = 0, 0, 0");
+
+    double start = now();
+    for(long i = 0; i < iterations; i++) {
+        run("acc = acc + v X w");
+    }
+    double script = now() - start;
+
+    char line[100];
+    snprintf(line, 100, "for i in 1:%ld { acc = acc + v X w }", iterations);
+    start = now();
+    run(line);
+    double loop = now() - start;
+
+    report("script", iterations / script, "iterations/sec");
+    report("loop", iterations / loop, "iterations/sec");
+}
+
+/**
+ * @brief Runs a loop that calls proj and a function built on it, with
+ * inlining on and off
+ *
+ * @param iterations
+ */
+static void bench_calls(long iterations) {
+    char line[200];
+    snprintf(line, 200, "for i in 1:%ld { p = proj(v, w) + refl(v, i * w) }",
+        iterations);
+
+    section("calls", "p = proj(v, w) + refl(v, i * w)");
+    char* modes[] = { "on", "off" };
+    for(int m = 0; m < 2; m++) {
+        char set[40];
+        snprintf(set, 40, "set inline %s", modes[m]);
+        run(set);
+        // definitions are inlined into their callers when parsed
+        run("v = 1, 2, 3; w = 4, 5, 6");
+        run("def proj(a, b) = (a . b) / (b . b) * b");
+        run("def refl(a, b) = 2 * proj(a, b) - a");
+
+        double start = now();
+        run(line);
+        double elapsed = now() - start;
+        char name[20];
+        snprintf(name, 20, "inline %s", modes[m]);
+        report(name, 2 * iterations / elapsed, "calls/sec");
+    }
+    run("set inline on");
+}
+
+/**
+ * @brief Times the scalar and batch versions of the builtin kernels over
+ * count random vectors, then maps normalize over a table of that size
+ * with the batch kernel and with per-element evaluation
+ *
+ * @param count
+ */
+static void bench_builtins(int count) {
+    vector_array data = {
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real))
+    };
+    real* out = malloc(count * sizeof(real));
+    vector b = { 1, 2, 3 };
+    srand(1);
+    for(int x = 0; x < count; x++) {
+        data.i[x] = rand() / (real)RAND_MAX - 0.5f;
+        data.j[x] = rand() / (real)RAND_MAX - 0.5f;
+        data.k[x] = rand() / (real)RAND_MAX - 0.5f;
+    }
+
+    section("builtins", "scalar vs batch kernels and map");
+
+    // norm and angle don't modify data, so they can run first
+    double start = now();
+    for(int x = 0; x < count; x++) {
+        vector v = { data.i[x], data.j[x], data.k[x] };
+        out[x] = vec_norm(v);
+    }
+    double scalar = now() - start;
+    start = now();
+    vec_norm_batch(data, out, count);
+    double batch = now() - start;
+    report("norm scalar", count / scalar / 1e6, "Mvectors/sec");
+    report("norm batch", count / batch / 1e6, "Mvectors/sec");
+
+    start = now();
+    for(int x = 0; x < count; x++) {
+        vector v = { data.i[x], data.j[x], data.k[x] };
+        out[x] = vec_angle(v, b);
+    }
+    scalar = now() - start;
+    start = now();
+    vec_angle_batch(data, b, out, count);
+    batch = now() - start;
+    report("angle scalar", count / scalar / 1e6, "Mvectors/sec");
+    report("angle batch", count / batch / 1e6, "Mvectors/sec");
+
+    start = now();
+    for(int x = 0; x < count; x++) {
+        vector v = { data.i[x], data.j[x], data.k[x] };
+        v = vec_lerp(v, b, 0.5f);
+        data.i[x] = v.i;
+        data.j[x] = v.j;
+        data.k[x] = v.k;
+    }
+    scalar = now() - start;
+    start = now();
+    vec_lerp_batch(data, b, 0.5f, count);
+    batch = now() - start;
+    report("lerp scalar", count / scalar / 1e6, "Mvectors/sec");
+    report("lerp batch", count / batch / 1e6, "Mvectors/sec");
+
+    start = now();
+    for(int x = 0; x < count; x++) {
+        vector v = { data.i[x], data.j[x], data.k[x] };
+        v = vec_normalize(v);
+        data.i[x] = v.i;
+        data.j[x] = v.j;
+        data.k[x] = v.k;
+    }
+    scalar = now() - start;
+    start = now();
+    vec_normalize_batch(data, count);
+    batch = now() - start;
+    report("normalize scalar", count / scalar / 1e6, "Mvectors/sec");
+    report("normalize batch", count / batch / 1e6, "Mvectors/sec");
+
+    free(data.i);
+    free(data.j);
+    free(data.k);
+    free(out);
+
+    int saved = mute();
+    clear_vectable();
+    fill_vectable(count);
+    start = now();
+    run("map normalize(_)");
+    batch = now() - start;
+    // fused, this would be compiled rather than walked per element
+    run("set fuse off");
+    start = now();
+    run("map normalize(_ + (0, 0, 0))");
+    scalar = now() - start;
+    run("set fuse on");
+    clear_vectable();
+    unmute(saved);
+    report("map normalize batch", count / batch / 1e6, "Mvectors/sec");
+    report("map normalize per-element", count / scalar / 1e6, 
+        "Mvectors/sec");
+}
+
+/**
+ * @brief Rotates and transforms count random points, one at a time and
+ * with the batch kernels, then through map: batched, per element, and
+ * as the chain of cross and dot products a rotation took before there
+ * were quaternions
+ *
+ * @param count
+ */
+static void bench_transform(int count) {
+    vector_array data = {
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real))
+    };
+    srand(1);
+    for(int x = 0; x < count; x++) {
+        data.i[x] = rand() / (real)RAND_MAX - 0.5f;
+        data.j[x] = rand() / (real)RAND_MAX - 0.5f;
+        data.k[x] = rand() / (real)RAND_MAX - 0.5f;
+    }
+    quaternion q = quaternion_axis_angle((vector){ 1, 2, 3 }, 0.7f);
+    matrix m = matrix_affine(quaternion_matrix(q), (vector){ 1, 2, 3 });
+
+    section("transform", "rotate and apply, scalar vs batch and map");
+
+    double start = now();
+    for(int x = 0; x < count; x++) {
+        vector v = { data.i[x], data.j[x], data.k[x] };
+        v = quaternion_rotate(q, v);
+        data.i[x] = v.i;
+        data.j[x] = v.j;
+        data.k[x] = v.k;
+    }
+    double scalar = now() - start;
+    start = now();
+    quaternion_rotate_batch(data, q, count);
+    double batch = now() - start;
+    report("rotate scalar", count / scalar / 1e6, "Mpoints/sec");
+    report("rotate batch", count / batch / 1e6, "Mpoints/sec");
+
+    start = now();
+    for(int x = 0; x < count; x++) {
+        vector v = { data.i[x], data.j[x], data.k[x] };
+        v = matrix_apply(&m, v);
+        data.i[x] = v.i;
+        data.j[x] = v.j;
+        data.k[x] = v.k;
+    }
+    scalar = now() - start;
+    start = now();
+    matrix_apply_batch(data, &m, count);
+    batch = now() - start;
+    report("apply mat4 scalar", count / scalar / 1e6, "Mpoints/sec");
+    report("apply mat4 batch", count / batch / 1e6, "Mpoints/sec");
+    free(data.i);
+    free(data.j);
+    free(data.k);
+
+    // the same rotation by Rodrigues' formula, with the unit axis and the
+    // angle's cosine, sine and 1 - cosine written out
+    char* chain = "map _ * 0.7648 + ((0.2673, 0.5345, 0.8018) X _) * 0.6442"
+        " + (0.2673, 0.5345, 0.8018) * (((0.2673, 0.5345, 0.8018) . _)"
+        " * 0.2352)";
+    char* lines[4] = { "map rotate(_, q)", "map q * _", chain,
+        "map apply(M, _)" };
+    char* names[4] = { "map rotate batch", "map q * _ per-element",
+        "map cross and dot chain", "map apply mat4 batch" };
+    int saved = mute();
+    clear_vectable();
+    fill_vectable(count);
+    run("q = quat((1, 2, 3), 0.7)");
+    run("M = mat4(q, (1, 2, 3))");
+    double took[4];
+    for(int x = 0; x < 4; x++) {
+        start = now();
+        run(lines[x]);
+        took[x] = now() - start;
+    }
+    clear_vectable();
+    clear_named_transforms();
+    unmute(saved);
+    for(int x = 0; x < 4; x++) {
+        report(names[x], count / took[x] / 1e6, "Mpoints/sec");
+    }
+}
+
+/**
+ * @brief Maps chains of 4, 16 and 64 element-wise operations over count
+ * vectors: walking the tree per element, fused a block at a time, and
+ * one operation at a time over whole arrays. Also estimates the memory 
+ * each moves, counting every component array a step reads or writes once
+ * temporaries no longer fit in cache.
+ *
+ * @param count
+ */
+static void bench_fuse(int count) {
+    section("fuse", "map chains tree-walked, fused, and unfused arrays");
+    int saved = mute();
+    clear_vectable();
+    fill_vectable(count);
+    vector_array data = {
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real)),
+        malloc(count * sizeof(real))
+    };
+    gather_vectors(data);
+    value frame[MAX_SLOTS];
+
+    double walked[3];
+    double fused_time[3];
+    double unfused_time[3];
+    int passes[3];
+    int steps[3];
+    char line[2048];
+    for(int c = 0; c < 3; c++) {
+        // each term is 4 operations
+        int terms = 1 << (2 * c);
+        strcpy(line, "map _");
+        for(int t = 0; t < terms; t++) {
+            strcat(line, " + (_ * 1.01 - (0.5, 0.25, 0.125)) / 3");
+        }
+
+        run("set fuse off");
+        double start = now();
+        run(line);
+        walked[c] = now() - start;
+        run("set fuse on");
+
+        node* root = parse_input(line);
+        fused* f = fuse_expression(root->left, root->slot, frame);
+        steps[c] = fused_steps(f);
+        passes[c] = fused_passes(f);
+        start = now();
+        run_fused(f, data, count, FUSE_BLOCK);
+        fused_time[c] = now() - start;
+        start = now();
+        run_fused(f, data, count, count);
+        unfused_time[c] = now() - start;
+        free_fused(f);
+        free_ast(root);
+    }
+    clear_vectable();
+    unmute(saved);
+    free(data.i);
+    free(data.j);
+    free(data.k);
+
+    char name[40];
+    for(int c = 0; c < 3; c++) {
+        snprintf(name, 40, "%d ops tree walk", steps[c]);
+        report(name, count / walked[c] / 1e6, "Mvectors/sec");
+        snprintf(name, 40, "%d ops fused", steps[c]);
+        report(name, count / fused_time[c] / 1e6, "Mvectors/sec");
+        snprintf(name, 40, "%d ops unfused arrays", steps[c]);
+        report(name, count / unfused_time[c] / 1e6, "Mvectors/sec");
+        snprintf(name, 40, "%d ops fused traffic", steps[c]);
+        report(name, 6.0 * count * sizeof(real) / 1e6, "MB");
+        snprintf(name, 40, "%d ops unfused traffic", steps[c]);
+        report(name, (double)passes[c] * count * sizeof(real) / 1e6, "MB");
+    }
+}
+
+/**
+ * @brief Evaluates the same expression iterations times by walking the
+ * tree and with the jit, which compiles it after its first JIT_HOT
+ * evaluations, directly and as the body of a loop. Also times compiling
+ * it and reports the size of its code.
+ *
+ * @param iterations
+ */
+static void bench_jit(long iterations) {
+    section("jit", "an expression tree-walked vs compiled to native code");
+    char* expression = "a * 1.5 + (b X c) - norm(a - b) * c / 3"
+        " + (a . c) * b";
+    char loop[256];
+    snprintf(loop, 256, "for i in 1:%ld { d = %s * i }", iterations,
+        expression);
+    run("a = 1, 2, 3; b = 4, 5, 6; c = 0.5, 0.25, 0.125");
+
+    double took[2];
+    double looped[2];
+    real sink[2] = { 0, 0 };
+    for(int jit = 0; jit < 2; jit++) {
+        run(jit ? "set jit on" : "set jit off");
+        node* root = parse_input(expression);
+        double start = now();
+        for(long i = 0; i < iterations; i++) {
+            value v = evaluate_ast(root);
+            sink[jit] += v.vec.i;
+        }
+        took[jit] = now() - start;
+        free_ast(root);
+
+        int saved = mute();
+        start = now();
+        run(loop);
+        looped[jit] = now() - start;
+        unmute(saved);
+    }
+
+    node* root = parse_input(expression);
+    value frame[MAX_SLOTS];
+    int compiles = 1000;
+    int bytes = 0;
+    double start = now();
+    for(int x = 0; x < compiles; x++) {
+        jitted* j = jit_compile(root, frame);
+        bytes = j != NULL ? jit_code_bytes(j) : 0;
+        jit_free(j);
+    }
+    double compiling = now() - start;
+    free_ast(root);
+    clear_vectable();
+
+    report("tree walk", iterations / took[0] / 1e6, "Mevaluations/sec");
+    report("jit", iterations / took[1] / 1e6, "Mevaluations/sec");
+    report("tree walk per evaluation", took[0] / iterations * 1e9, "ns");
+    report("jit per evaluation", took[1] / iterations * 1e9, "ns");
+    report("loop tree walk", iterations / looped[0] / 1e6,
+        "Miterations/sec");
+    report("loop jit", iterations / looped[1] / 1e6, "Miterations/sec");
+    report("compile", compiling / compiles * 1e6, "us");
+    report("code size", bytes, "bytes");
+    report("results differ", sink[0] != sink[1], "");
+}
+
+/**
+ * @brief The if/else chain handle_operation used before operators were
+ * dispatched through a table, kept for comparison. Only the combinations
+ * it supported are benchmarked.
+ *
+ * @param op
+ * @param left
+ * @param right
+ * @return value
+ */
+__attribute__((noinline))
+static value branch_operation(char* op, value left, value right) {
+    value r;
+    if(!strcmp(op, "+")) {
+        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
+            r.type = VAL_VECTOR;
+            r.vec = vec_add(left.vec, right.vec);
+        } else if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) {
+            r.type = VAL_SCALAR;
+            r.scalar = left.scalar + right.scalar;
+        } else {
+            r.type = VAL_SENTINEL;
+        }
+    } else if(!strcmp(op, "-")) {
+        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
+            r.type = VAL_VECTOR;
+            r.vec = vec_sub(left.vec, right.vec);
+        } else if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) {
+            r.type = VAL_SCALAR;
+            r.scalar = left.scalar - right.scalar;
+        } else {
+            r.type = VAL_SENTINEL;
+        }
+    } else if(!strcmp(op, "*")) {
+        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
+            r.type = VAL_VECTOR;
+            r.vec = vec_mul(left.vec, right.vec);
+        } else if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) {
+            r.type = VAL_SCALAR;
+            r.scalar = left.scalar * right.scalar;
+        } else if(left.type == VAL_VECTOR && right.type == VAL_SCALAR) {
+            r.type = VAL_VECTOR;
+            r.vec = vec_mul(left.vec, vec_splat(right.scalar));
+        } else {
+            r.type = VAL_VECTOR;
+            r.vec = vec_mul(vec_splat(left.scalar), right.vec);
+        }
+    } else if(!strcmp(op, "/")) {
+        if(left.type == VAL_SCALAR && right.type == VAL_SCALAR) {
+            r.type = VAL_SCALAR;
+            r.scalar = left.scalar / right.scalar;
+        } else {
+            r.type = VAL_SENTINEL;
+        }
+    } else if(!strcmp(op, ".")) {
+        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
+            r.type = VAL_SCALAR;
+            r.scalar = vec_dot(left.vec, right.vec);
+        } else {
+            r.type = VAL_SENTINEL;
+        }
+    } else if(!strcmp(op, "X")) {
+        if(left.type == VAL_VECTOR && right.type == VAL_VECTOR) {
+            r.type = VAL_VECTOR;
+            r.vec = vec_cross(left.vec, right.vec);
+        } else {
+            r.type = VAL_SENTINEL;
+        }
+    } else {
+        r.type = VAL_SENTINEL;
+    }
+    return r;
+}
+
+/**
+ * @brief Compares the old operator branch chain against the dispatch
+ * table on a mix of operators and operand types
+ *
+ * @param iterations
+ */
+static void bench_dispatch(long iterations) {
+    value v = { .type = VAL_VECTOR, .vec = { 1, 2, 3 } };
+    value s = { .type = VAL_SCALAR, .scalar = 2 };
+    struct {
+        char* name;
+        int op;
+        value left;
+        value right;
+    } cases[] = {
+        { "+", OP_ADD, v, v }, { "+", OP_ADD, s, s },
+        { "-", OP_SUB, v, v }, { "*", OP_MUL, v, s },
+        { "*", OP_MUL, s, v }, { "/", OP_DIV, s, s },
+        { ".", OP_DOT, v, v }, { "X", OP_CROSS, v, v },
+    };
+    int count = sizeof(cases) / sizeof(cases[0]);
+    real sink = 0;
+
+    section("dispatch", "mixed operations, old branch chain vs table");
+
+    double start = now();
+    for(long i = 0; i < iterations; i++) {
+        int c = i % count;
+        value r = branch_operation(cases[c].name, cases[c].left, cases[c].right);
+        sink += r.type == VAL_SCALAR ? r.scalar : r.vec.i;
+    }
+    double chain = now() - start;
+
+    start = now();
+    for(long i = 0; i < iterations; i++) {
+        int c = i % count;
+        value l = cases[c].left;
+        value r = cases[c].right;
+        value result = operators[cases[c].op][l.type][r.type](&l, &r);
+        sink += result.type == VAL_SCALAR ? result.scalar : result.vec.i;
+    }
+    double table = now() - start;
+
+    report("branch chain", iterations / chain, "ops/sec");
+    report("table", iterations / table, "ops/sec");
+    report("checksum", sink, "");
+}
+
+/**
+ * @brief Measures how far a long accumulation drifts from the exact sum, 
+ * for comparing numeric types
+ *
+ * @param iterations
+ */
+static void bench_precision(long iterations) {
+    section("precision", "repeated additions of (0.1, 0.01, 0.001)");
+    char line[100];
+    snprintf(line, 100, 
+        "acc = 0, 0, 0; for i in 1:%ld { acc = acc + (0.1, 0.01, 0.001) }",
+        iterations);
+    double start = now();
+    run(line);
+    double elapsed = now() - start;
+
+    vector acc = get_vector("acc").value.value;
+    long double exact[] = { 0.1L * iterations, 0.01L * iterations, 
+                            0.001L * iterations };
+    long double got[] = { acc.i, acc.j, acc.k };
+    long double worst = 0;
+    for(int c = 0; c < 3; c++) {
+        long double error = (got[c] - exact[c]) / exact[c];
+        if(error < 0) {
+            error = -error;
+        }
+        if(error > worst) {
+            worst = error;
+        }
+    }
+
+    report("additions", iterations / elapsed, "iterations/sec");
+    report("worst relative error", worst, "");
+}
+
+/**
+ * @brief Lexes generated inputs of increasing length, each enough times
+ * to cover about bytes bytes of input
+ *
+ * @param bytes
+ */
+static void bench_lex(long bytes) {
+    section("lex", "generated inputs of increasing length");
+    char* fragment = "alpha + 2.5 * (beta . gamma) X delta - 13, 0.25; ";
+    int fragment_length = strlen(fragment);
+    int lengths[] = { 64, 1024, 16384 };
+
+    for(int l = 0; l < 3; l++) {
+        char* input = malloc(lengths[l] + 1);
+        for(int c = 0; c < lengths[l]; c++) {
+            input[c] = fragment[c % fragment_length];
+        }
+        input[lengths[l]] = '\0';
+
+        long rounds = bytes / lengths[l] + 1;
+        long tokens = 0;
+        double start = now();
+        for(long r = 0; r < rounds; r++) {
+            token* t = lex(input);
+            for(int x = 0; t[x].type != TOKEN_END; x++) {
+                tokens++;
+            }
+            free_tokens(t);
+        }
+        double elapsed = now() - start;
+
+        char name[40];
+        snprintf(name, 40, "%d bytes", lengths[l]);
+        report(name, rounds * lengths[l] / elapsed / 1e6, "MB/sec");
+        snprintf(name, 40, "%d bytes tokens", lengths[l]);
+        report(name, tokens / elapsed / 1e6, "Mtokens/sec");
+        free(input);
+    }
+}
+
+/**
+ * @brief Parses (lexing included) expressions of several shapes
+ *
+ * @param iterations
+ */
+static void bench_parse(long iterations) {
+    section("parse", "parse_input on varied expression shapes");
+    struct {
+        char* name;
+        char* input;
+    } shapes[] = {
+        { "constant", "42" },
+        { "vector", "1, 2, 3" },
+        { "assignment", "a = 1.5, -2, 3" },
+        { "nested", "((((a + b) * 2) - c) . (d X (e - f))) * g" },
+        { "builtin call", "norm(a X b) + angle(a, lerp(b, c, 0.5))" },
+        { "sequence", "a = 1, 2, 3; b = a X a; c = b . a" },
+        { "loop", "for i in 1:10 { a = a + b * i; c = a X b }" },
+        { "chain of 64", NULL },
+    };
+    int count = sizeof(shapes) / sizeof(shapes[0]);
+
+    // a + b + a + ... with 64 operands
+    char chain[64 * 4];
+    chain[0] = '\0';
+    for(int x = 0; x < 64; x++) {
+        strcat(chain, x ? " + " : "");
+        strcat(chain, x % 2 ? "b" : "a");
+    }
+    shapes[count - 1].input = chain;
+
+    for(int c = 0; c < count; c++) {
+        double start = now();
+        for(long i = 0; i < iterations; i++) {
+            free_ast(parse_input(shapes[c].input));
+        }
+        double elapsed = now() - start;
+        report(shapes[c].name, iterations / elapsed, "parses/sec");
+    }
+}
+
+/**
+ * @brief Evaluates a pre-parsed expression for each operator and
+ * operand type pair, plus one that looks its operands up in the table
+ *
+ * @param iterations
+ */
+static void bench_evaluate(long iterations) {
+    section("evaluate", "evaluate_ast per operator");
+    struct {
+        char* name;
+        char* input;
+    } cases[] = {
+        { "vector + vector", "(1, 2, 3) + (4, 5, 6)" },
+        { "scalar + scalar", "2 + 3" },
+        { "vector - vector", "(1, 2, 3) - (4, 5, 6)" },
+        { "scalar - scalar", "2 - 3" },
+        { "vector * vector", "(1, 2, 3) * (4, 5, 6)" },
+        { "vector * scalar", "(1, 2, 3) * 2" },
+        { "scalar * vector", "2 * (1, 2, 3)" },
+        { "scalar * scalar", "2 * 3" },
+        { "vector / vector", "(1, 2, 3) / (4, 5, 6)" },
+        { "vector / scalar", "(1, 2, 3) / 2" },
+        { "scalar / scalar", "2 / 3" },
+        { "vector . vector", "(1, 2, 3) . (4, 5, 6)" },
+        { "vector X vector", "(1, 2, 3) X (4, 5, 6)" },
+        { "variables a + b", "a + b" },
+    };
+    int count = sizeof(cases) / sizeof(cases[0]);
+    // the tree walk itself; the jit section times compiled expressions
+    run("set jit off");
+    run("a = 1, 2, 3; b = 4, 5, 6");
+
+    real sink = 0;
+    for(int c = 0; c < count; c++) {
+        node* root = parse_input(cases[c].input);
+        double start = now();
+        for(long i = 0; i < iterations; i++) {
+            value v = evaluate_ast(root);
+            sink += v.type == VAL_SCALAR ? v.scalar : v.vec.i;
+        }
+        double elapsed = now() - start;
+        free_ast(root);
+        report(cases[c].name, iterations / elapsed, "evaluations/sec");
+    }
+    report("checksum", sink, "");
+    run("set jit on");
+    clear_vectable();
+}
+
+/**
+ * @brief Writes key number x into key, stride bytes long. Multiplying by
+ * an odd constant is a bijection, so keys are unique but not sequential.
+ *
+ * @param key
+ * @param stride
+ * @param prefix
+ * @param x
+ */
+static void make_key(char* key, int stride, char prefix, long x) {
+    snprintf(key, stride, "%c%x", prefix, (unsigned)(x * 2654435761u));
+}
+
+#define KEY_STRIDE 16
+
+/**
+ * @brief Times insert_vector and get_vector hits and misses on tables of
+ * 1K keys up to max_keys keys, growing by 10x. Small tables are repeated
+ * so each size does about as much work as the largest.
+ *
+ * @param max_keys
+ */
+static void bench_table(long max_keys) {
+    section("table", "insert_vector and get_vector by table size");
+    char* keys = malloc(max_keys * KEY_STRIDE);
+    char* misses = malloc(max_keys * KEY_STRIDE);
+    for(long x = 0; x < max_keys; x++) {
+        make_key(keys + x * KEY_STRIDE, KEY_STRIDE, 'k', x);
+        make_key(misses + x * KEY_STRIDE, KEY_STRIDE, 'm', x);
+    }
+
+    for(long n = 1000; n <= max_keys; n *= 10) {
+        long rounds = max_keys / n;
+        double insert = 0;
+        double hit = 0;
+        double miss = 0;
+        long found = 0;
+
+        for(long r = 0; r < rounds; r++) {
+            int saved = mute();
+            clear_vectable();
+            double start = now();
+            for(long x = 0; x < n; x++) {
+                vector v = { x, x, x };
+                insert_vector(keys + x * KEY_STRIDE, v);
+            }
+            insert += now() - start;
+            unmute(saved);
+
+            start = now();
+            for(long x = 0; x < n; x++) {
+                found += is_some(get_vector(keys + x * KEY_STRIDE));
+            }
+            hit += now() - start;
+
+            start = now();
+            for(long x = 0; x < n; x++) {
+                found += is_some(get_vector(misses + x * KEY_STRIDE));
+            }
+            miss += now() - start;
+        }
+
+        if(found != rounds * n) {
+            printf("Error: found %ld of %ld keys\n", found, rounds * n);
+        }
+        long operations = rounds * n;
+        char name[40];
+        snprintf(name, 40, "%ld keys insert", n);
+        report(name, operations / insert / 1e6, "Mops/sec");
+        snprintf(name, 40, "%ld keys get hit", n);
+        report(name, operations / hit / 1e6, "Mops/sec");
+        snprintf(name, 40, "%ld keys get miss", n);
+        report(name, operations / miss / 1e6, "Mops/sec");
+    }
+
+    clear_vectable();
+    free(keys);
+    free(misses);
+}
+
+/**
+ * @brief Times inserts and lookups of count keys under each hash function
+ * and probing, once with scattered keys and once with short similar
+ * names like sensor_123
+ *
+ * @param count
+ */
+static void bench_table_settings(long count) {
+    section("table settings", "hash function and probing, Mops/sec");
+    char* keys = malloc(count * KEY_STRIDE);
+    char* hashes[] = { "djb2", "fnv", "wy" };
+    char* probes[] = { "linear", "quadratic", "robin" };
+
+    for(int similar = 0; similar < 2; similar++) {
+        for(long x = 0; x < count; x++) {
+            if(similar) {
+                snprintf(keys + x * KEY_STRIDE, KEY_STRIDE, "sensor_%ld", x);
+            } else {
+                make_key(keys + x * KEY_STRIDE, KEY_STRIDE, 'k', x);
+            }
+        }
+
+        for(int h = 0; h < 3; h++) {
+            for(int p = 0; p < 3; p++) {
+                char set[60];
+                snprintf(set, 60, "set hash %s; set probe %s", 
+                    hashes[h], probes[p]);
+                run(set);
+
+                int saved = mute();
+                clear_vectable();
+                double start = now();
+                for(long x = 0; x < count; x++) {
+                    vector v = { x, x, x };
+                    insert_vector(keys + x * KEY_STRIDE, v);
+                }
+                double insert = now() - start;
+                unmute(saved);
+
+                long found = 0;
+                start = now();
+                for(long x = 0; x < count; x++) {
+                    found += is_some(get_vector(keys + x * KEY_STRIDE));
+                }
+                double hit = now() - start;
+                if(found != count) {
+                    printf("Error: found %ld of %ld keys\n", found, count);
+                }
+
+                char name[60];
+                snprintf(name, 60, "%s %s %s insert", 
+                    similar ? "similar" : "scattered", hashes[h], probes[p]);
+                report(name, count / insert / 1e6, "Mops/sec");
+                snprintf(name, 60, "%s %s %s get", 
+                    similar ? "similar" : "scattered", hashes[h], probes[p]);
+                report(name, count / hit / 1e6, "Mops/sec");
+            }
+        }
+    }
+
+    run("set hash djb2; set probe linear");
+    clear_vectable();
+    free(keys);
+}
+
+/**
+ * @brief Times get_vector hits and misses with linear, Robin Hood and
+ * swiss probing at several load factors. The table is filled to each
+ * load factor of the largest power of two capacity at most max_keys.
+ *
+ * @param max_keys
+ */
+static void bench_load_factors(long max_keys) {
+    section("load factors", "get_vector hits and misses by probing");
+    long capacity = 1;
+    while(capacity * 2 <= max_keys) {
+        capacity *= 2;
+    }
+    char* keys = malloc(capacity * KEY_STRIDE);
+    char* misses = malloc(capacity * KEY_STRIDE);
+    for(long x = 0; x < capacity; x++) {
+        make_key(keys + x * KEY_STRIDE, KEY_STRIDE, 'k', x);
+        make_key(misses + x * KEY_STRIDE, KEY_STRIDE, 'm', x);
+    }
+
+    char* probes[] = { "linear", "robin", "swiss" };
+    double loads[] = { 0.5, 0.7, 0.875, 0.94 };
+    // doubling waits until 0.95, so each fill stays at capacity
+    run("set maxload 0.95");
+    for(int l = 0; l < 4; l++) {
+        long n = capacity * loads[l];
+        for(int p = 0; p < 3; p++) {
+            char set[40];
+            snprintf(set, 40, "set probe %s", probes[p]);
+            run(set);
+
+            int saved = mute();
+            clear_vectable();
+            for(long x = 0; x < n; x++) {
+                vector v = { x, x, x };
+                insert_vector(keys + x * KEY_STRIDE, v);
+            }
+            unmute(saved);
+
+            long found = 0;
+            double start = now();
+            for(long x = 0; x < n; x++) {
+                found += is_some(get_vector(keys + x * KEY_STRIDE));
+            }
+            double hit = now() - start;
+            start = now();
+            for(long x = 0; x < n; x++) {
+                found += is_some(get_vector(misses + x * KEY_STRIDE));
+            }
+            double miss = now() - start;
+            if(found != n) {
+                printf("Error: found %ld of %ld keys\n", found, n);
+            }
+
+            char name[60];
+            snprintf(name, 60, "load %.3f %s hit", loads[l], probes[p]);
+            report(name, n / hit / 1e6, "Mops/sec");
+            snprintf(name, 60, "load %.3f %s miss", loads[l], probes[p]);
+            report(name, n / miss / 1e6, "Mops/sec");
+        }
+    }
+
+    run("set probe linear; set maxload 0.7");
+    clear_vectable();
+    free(keys);
+    free(misses);
+}
+
+/**
+ * @brief Measures the heap used per key and the insert and clear times of
+ * count short keys and count long keys
+ *
+ * @param count
+ */
+static void bench_key_storage(long count) {
+    section("key storage", "heap bytes per key, insert and clear");
+    char* kinds[] = { "short", "long" };
+    char key[64];
+
+    for(int kind = 0; kind < 2; kind++) {
+        int saved = mute();
+        clear_vectable();
+        // large arrays are mapped separately from the heap proper
+        struct mallinfo2 info = mallinfo2();
+        size_t before = info.uordblks + info.hblkhd;
+        double start = now();
+        for(long x = 0; x < count; x++) {
+            if(kind) {
+                snprintf(key, 64, "long_variable_name_%x", 
+                    (unsigned)(x * 2654435761u));
+            } else {
+                make_key(key, KEY_STRIDE, 'k', x);
+            }
+            vector v = { x, x, x };
+            insert_vector(key, v);
+        }
+        double insert = now() - start;
+        info = mallinfo2();
+        size_t after = info.uordblks + info.hblkhd;
+        start = now();
+        clear_vectable();
+        double clear = now() - start;
+        unmute(saved);
+
+        char name[40];
+        snprintf(name, 40, "%s keys heap", kinds[kind]);
+        report(name, (double)(after - before) / count, "bytes/key");
+        snprintf(name, 40, "%s keys insert", kinds[kind]);
+        report(name, count / insert / 1e6, "Mops/sec");
+        snprintf(name, 40, "%s keys clear", kinds[kind]);
+        report(name, count / clear / 1e6, "Mops/sec");
+    }
+}
+
+/**
+ * @brief Compares two doubles for qsort
+ *
+ * @param a
+ * @param b
+ * @return int
+ */
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Times every one of count inserts into an empty table and
+ * reports the latency percentiles, which show the cost of resizing
+ *
+ * @param count
+ */
+static void bench_insert_latency(long count) {
+    section("insert latency", "percentiles of single insert_vector calls");
+    double* latency = malloc(count * sizeof(double));
+    char key[KEY_STRIDE];
+
+    int saved = mute();
+    clear_vectable();
+    for(long x = 0; x < count; x++) {
+        make_key(key, KEY_STRIDE, 'k', x);
+        vector v = { x, x, x };
+        double start = now();
+        insert_vector(key, v);
+        latency[x] = now() - start;
+    }
+    clear_vectable();
+    unmute(saved);
+
+    qsort(latency, count, sizeof(double), compare_doubles);
+    double percentiles[] = { 50, 99, 99.9, 99.99 };
+    for(int p = 0; p < 4; p++) {
+        char name[40];
+        snprintf(name, 40, "p%g", percentiles[p]);
+        report(name, latency[(long)(count * percentiles[p] / 100)] * 1e9, 
+            "ns");
+    }
+    report("max", latency[count - 1] * 1e9, "ns");
+    free(latency);
+}
+
+/**
+ * @brief Times prefix queries on a table of count keys split into 1000
+ * groups named like g042_..., walking the ordered index against testing
+ * every key, and a map scoped to one group against one over every key
+ *
+ * @param count
+ */
+static void bench_prefix(long count) {
+    section("prefix scan", "index walks of one group of names vs every name");
+    char key[KEY_STRIDE];
+    int saved = mute();
+    clear_vectable();
+    double start = now();
+    for(long x = 0; x < count; x++) {
+        snprintf(key, KEY_STRIDE, "g%03ld_%x", x % 1000, 
+            (unsigned)(x * 2654435761u));
+        vector v = { x, x, x };
+        insert_vector(key, v);
+    }
+    double insert = now() - start;
+    unmute(saved);
+    report("insert with index", count / insert / 1e6, "Mops/sec");
+
+    // the first query merges every pending name into the tree
+    start = now();
+    long matched = count_prefix("g007_");
+    double merge = now() - start;
+    report("first query", merge * 1e3, "ms");
+    report("index heap", (double)index_memory() / count, "bytes/key");
+
+    // 100 groups through the index
+    int queries = 100;
+    long found = 0;
+    long expected = 0;
+    for(int q = 0; q < queries; q++) {
+        expected += count / 1000 + (q * 7 < count % 1000);
+    }
+    start = now();
+    for(int q = 0; q < queries; q++) {
+        snprintf(key, KEY_STRIDE, "g%03d_", q * 7);
+        found += count_prefix(key);
+    }
+    double indexed = (now() - start) / queries;
+
+    // one group by testing every name
+    matched = 0;
+    start = now();
+    index_cursor c = index_seek("");
+    for(char* name = index_next(&c); name != NULL; name = index_next(&c)) {
+        matched += strncmp(name, "g007_", 5) == 0;
+    }
+    double scanned = now() - start;
+
+    if(found != expected || matched != count / 1000 + (7 < count % 1000)) {
+        printf("Error: prefix queries found %ld and %ld keys\n", 
+            found, matched);
+    }
+    report("group via index", indexed * 1e6, "us");
+    report("group via every key", scanned * 1e6, "us");
+    report("ordered walk", count / scanned / 1e6, "Mkeys/sec");
+
+    saved = mute();
+    start = now();
+    run("map _ * 2 in g007_*");
+    double scoped = now() - start;
+    start = now();
+    run("map _ * 2");
+    double whole = now() - start;
+    clear_vectable();
+    unmute(saved);
+    report("map in one group", scoped * 1e6, "us");
+    report("map over every key", whole * 1e6, "us");
+}
+
+// reader threads for the transactions benchmark
+#define READERS 3
+// writes per batch in the transactions benchmark
+#define BATCH 10000
+
+typedef struct {
+    char* keys;
+    long count;
+    unsigned int seed;
+    long reads;
+    atomic_int* stop;
+} reader_args;
+
+/**
+ * @brief Looks up random keys with read_vector until told to stop
+ *
+ * @param arg a reader_args
+ * @return void*
+ */
+static void* reader(void* arg) {
+    reader_args* r = arg;
+    unsigned int state = r->seed;
+    long found = 0;
+    while(!atomic_load(r->stop)) {
+        for(int x = 0; x < 1000; x++) {
+            state = state * 1664525u + 1013904223u;
+            long key = state % r->count;
+            found += is_some(read_vector(r->keys + key * KEY_STRIDE));
+        }
+        r->reads += 1000;
+    }
+    if(found != r->reads) {
+        printf("Error: a reader found %ld of %ld keys\n", found, r->reads);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs READERS reader threads for about half a second while the
+ * main thread writes batches of BATCH updates, inside transactions or
+ * not, or doesn't write at all
+ *
+ * @param keys
+ * @param count
+ * @param mode 0 no writes, 1 plain inserts, 2 transactions
+ * @param write_rate set to the writes per second
+ * @return double reads per second across the readers
+ */
+static double read_during_writes(char* keys, long count, int mode, 
+    double* write_rate) {
+    atomic_int stop = 0;
+    reader_args args[READERS];
+    pthread_t threads[READERS];
+    for(int t = 0; t < READERS; t++) {
+        args[t] = (reader_args){ keys, count, t * 2654435761u + 1, 0, &stop };
+        pthread_create(&threads[t], NULL, reader, &args[t]);
+    }
+
+    long writes = 0;
+    double start = now();
+    while(now() - start < 0.5) {
+        if(mode == 0) {
+            usleep(1000);
+            continue;
+        }
+        if(mode == 2) {
+            begin_vectable();
+        }
+        for(long x = 0; x < BATCH; x++) {
+            long key = (writes + x) % count;
+            vector v = { key, key, key };
+            insert_vector(keys + key * KEY_STRIDE, v);
+        }
+        if(mode == 2) {
+            commit_vectable();
+        }
+        writes += BATCH;
+    }
+    atomic_store(&stop, 1);
+    long reads = 0;
+    for(int t = 0; t < READERS; t++) {
+        pthread_join(threads[t], NULL);
+        reads += args[t].reads;
+    }
+    double elapsed = now() - start;
+    *write_rate = writes / elapsed;
+    return reads / elapsed;
+}
+
+/**
+ * @brief Times begin on tables of 1K up to max_keys keys, commits and 
+ * rollbacks of BATCH writes, and lookups from other threads while the 
+ * main thread writes
+ *
+ * @param max_keys
+ */
+static void bench_transactions(long max_keys) {
+    section("transactions", "begin, commit and rollback, reads during writes");
+    char* keys = malloc(max_keys * KEY_STRIDE);
+    for(long x = 0; x < max_keys; x++) {
+        make_key(keys + x * KEY_STRIDE, KEY_STRIDE, 'k', x);
+    }
+
+    int saved = mute();
+    clear_vectable();
+    long stored = 0;
+    unmute(saved);
+    for(long n = 1000; n <= max_keys; n *= 10) {
+        saved = mute();
+        for(; stored < n; stored++) {
+            vector v = { stored, stored, stored };
+            insert_vector(keys + stored * KEY_STRIDE, v);
+        }
+        unmute(saved);
+
+        int rounds = 10000;
+        double start = now();
+        for(int r = 0; r < rounds; r++) {
+            begin_vectable();
+            rollback_vectable();
+        }
+        char name[40];
+        snprintf(name, 40, "%ld keys begin", n);
+        report(name, (now() - start) / rounds * 1e9, "ns");
+    }
+
+    long batch = BATCH < stored ? BATCH : stored;
+    double start = now();
+    begin_vectable();
+    for(long x = 0; x < batch; x++) {
+        vector v = { -x, -x, -x };
+        insert_vector(keys + x * KEY_STRIDE, v);
+    }
+    double staging = now() - start;
+    start = now();
+    rollback_vectable();
+    double rollback = now() - start;
+    begin_vectable();
+    for(long x = 0; x < batch; x++) {
+        vector v = { -x, -x, -x };
+        insert_vector(keys + x * KEY_STRIDE, v);
+    }
+    start = now();
+    commit_vectable();
+    double commit = now() - start;
+    report("staged writes", batch / staging / 1e6, "Mops/sec");
+    report("commit", batch / commit / 1e6, "Mops/sec");
+    report("rollback", batch / rollback / 1e6, "Mops/sec");
+
+    share_vectable();
+    char* modes[] = { "no writes", "plain writes", "transactions" };
+    for(int mode = 0; mode < 3; mode++) {
+        double writes;
+        double reads = read_during_writes(keys, stored, mode, &writes);
+        char name[40];
+        snprintf(name, 40, "reads, %s", modes[mode]);
+        report(name, reads / 1e6, "Mops/sec");
+        if(mode > 0) {
+            snprintf(name, 40, "writes, %s", modes[mode]);
+            report(name, writes / 1e6, "Mops/sec");
+        }
+    }
+
+    saved = mute();
+    clear_vectable();
+    unmute(saved);
+    free(keys);
+}
+
+/**
+ * @brief Empties the file at path
+ *
+ * @param path
+ */
+static void truncate_file(char* path) {
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+/**
+ * @brief Times assignments without the log and with it in each sync mode,
+ * one assignment per line and 1000 per line; then replay and compaction 
+ * of a log of count assignments
+ *
+ * @param count
+ */
+static void bench_wal(long count) {
+    section("wal", "assignments with the log off and on, replay, compaction");
+    char path[] = "/tmp/tritone-wal-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        printf("Error: Could not create a temporary file\n");
+        return;
+    }
+    close(fd);
+    char key[KEY_STRIDE];
+
+    // always fsyncs every line, so it gets fewer of them
+    long always_lines = count < 2000 ? count : 2000;
+    char* modes[] = { "no log", "off", "batch", "always", 
+        "off, 1000/line", "always, 1000/line" };
+    char* sync_modes[] = { NULL, "off", "batch", "always", "off", "always" };
+    long counts[] = { count, count, count, always_lines, count, count };
+    long per_line[] = { 1, 1, 1, 1, 1000, 1000 };
+    for(int m = 0; m < 6; m++) {
+        int saved = mute();
+        clear_vectable();
+        unmute(saved);
+        if(sync_modes[m] != NULL) {
+            truncate_file(path);
+            wal_open(path);
+            set_wal_sync(sync_modes[m]);
+        }
+        double start = now();
+        for(long x = 0; x < counts[m]; x++) {
+            make_key(key, KEY_STRIDE, 'k', x);
+            vector v = { x, x, x };
+            insert_vector(key, v);
+            if((x + 1) % per_line[m] == 0) {
+                wal_sync();
+            }
+        }
+        wal_sync();
+        double elapsed = now() - start;
+        wal_close();
+        char name[40];
+        snprintf(name, 40, "assign, %s", modes[m]);
+        report(name, counts[m] / elapsed / 1e6, "Mops/sec");
+    }
+
+    // the batch run's log is replaced by one of count assignments
+    truncate_file(path);
+    int saved = mute();
+    clear_vectable();
+    wal_open(path);
+    set_wal_sync("off");
+    for(long x = 0; x < count; x++) {
+        make_key(key, KEY_STRIDE, 'k', x);
+        vector v = { x, -x, x };
+        insert_vector(key, v);
+    }
+    wal_close();
+    clear_vectable();
+    unmute(saved);
+
+    struct stat st;
+    stat(path, &st);
+    double megabytes = st.st_size / 1e6;
+    double start = now();
+    int replayed = wal_open(path);
+    double replay = now() - start;
+    if(replayed != count) {
+        printf("Error: replayed %d of %ld records\n", replayed, count);
+    }
+    report("replay", replayed / replay / 1e6, "Mrecords/sec");
+    report("replay", megabytes / replay, "MB/sec");
+
+    // overwrite every key twice more, staying under the automatic 
+    // compaction, then compact back to one record each
+    for(int round = 1; round <= 2; round++) {
+        for(long x = 0; x < count; x++) {
+            make_key(key, KEY_STRIDE, 'k', x);
+            vector v = { x, round, x };
+            insert_vector(key, v);
+        }
+        wal_sync();
+    }
+    stat(path, &st);
+    double before = st.st_size / 1e6;
+    start = now();
+    wal_compact();
+    double compact = now() - start;
+    stat(path, &st);
+    report("log before compaction", before, "MB");
+    report("log after compaction", st.st_size / 1e6, "MB");
+    report("compaction", compact * 1e3, "ms");
+    wal_close();
+
+    saved = mute();
+    clear_vectable();
+    unmute(saved);
+    unlink(path);
+}
+
+/**
+ * @brief for_each_vector visitor that writes one row with fprintf, the 
+ * way write_vectable used to
+ *
+ * @param key
+ * @param value
+ * @param arg the FILE
+ */
+static void fprintf_row(char* key, vector value, void* arg) {
+    fprintf(arg, "%s,%.2lf,%.2lf,%.2lf\n", key, 
+        (double)value.i, (double)value.j, (double)value.k);
+}
+
+/**
+ * @brief Returns the size of the file at path in MB
+ *
+ * @param path
+ * @return double
+ */
+static double file_megabytes(char* path) {
+    struct stat st;
+    stat(path, &st);
+    return st.st_size / 1e6;
+}
+
+/**
+ * @brief Checks whether the files at a and b hold the same bytes
+ *
+ * @param a
+ * @param b
+ * @return int 1 if they do, 0 if not or if either can't be read
+ */
+static int same_file(char* a, char* b) {
+    FILE* fa = fopen(a, "r");
+    FILE* fb = fopen(b, "r");
+    int same = fa != NULL && fb != NULL;
+    char left[4096];
+    char right[4096];
+    while(same) {
+        size_t got = fread(left, 1, sizeof(left), fa);
+        same = fread(right, 1, sizeof(right), fb) == got
+            && memcmp(left, right, got) == 0;
+        if(got < sizeof(left)) {
+            break;
+        }
+    }
+    if(fa != NULL) {
+        fclose(fa);
+    }
+    if(fb != NULL) {
+        fclose(fb);
+    }
+    return same;
+}
+
+/**
+ * @brief Times write_vectable with each set of options against one 
+ * fprintf per row, and read_vectable, on a table of count keys through a 
+ * temporary file
+ *
+ * @param count
+ */
+static void bench_io(long count) {
+    section("io", "write_vectable and read_vectable");
+    char path[] = "/tmp/tritone-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        printf("Error: Could not create a temporary file\n");
+        return;
+    }
+    close(fd);
+
+    int saved = mute();
+    clear_vectable();
+    char key[KEY_STRIDE];
+    for(long x = 0; x < count; x++) {
+        make_key(key, KEY_STRIDE, 'k', x);
+        vector v = { x * 0.5f, -x * 0.25f, x / 3.0f };
+        insert_vector(key, v);
+    }
+    unmute(saved);
+
+    char name[40];
+    double start = now();
+    FILE* fp = fopen(path, "w");
+    for_each_vector(fprintf_row, fp);
+    fclose(fp);
+    double elapsed = now() - start;
+    snprintf(name, 40, "%ld keys fprintf per row", count);
+    report(name, file_megabytes(path) / elapsed, "MB/sec");
+
+    char* modes[] = { "write", "write full", "write sorted", 
+                      "write full sorted" };
+    for(int flags = 0; flags < 4; flags++) {
+        start = now();
+        int written = write_vectable(path, flags);
+        elapsed = now() - start;
+        if(written != count) {
+            printf("Error: wrote %d of %ld vectors\n", written, count);
+        }
+        snprintf(name, 40, "%ld keys %s", count, modes[flags]);
+        report(name, file_megabytes(path) / elapsed, "MB/sec");
+        snprintf(name, 40, "%s rows", modes[flags]);
+        report(name, count / elapsed / 1e6, "Mrows/sec");
+    }
+
+    write_vectable(path, 0);
+    double megabytes = file_megabytes(path);
+    saved = mute();
+    clear_vectable();
+    start = now();
+    int read = read_vectable(path);
+    elapsed = now() - start;
+    unmute(saved);
+
+    if(read != count) {
+        printf("Error: read %d of %ld vectors\n", read, count);
+    }
+    snprintf(name, 40, "%ld keys read", count);
+    report(name, megabytes / elapsed, "MB/sec");
+    report("file size", megabytes, "MB");
+
+    clear_vectable();
+    unlink(path);
+}
+
+/**
+ * @brief Times loading count rows into an empty table one insert_vector
+ * at a time, which grows the table through every doubling, after
+ * reserve_vectable, and with one insert_vectors, which reserves and
+ * prefetches
+ *
+ * @param count
+ */
+static void bench_bulk(long count) {
+    section("bulk", "one insert at a time vs reserved vs insert_vectors");
+    char* keys = malloc(count * KEY_STRIDE);
+    char** names = malloc(count * sizeof(char*));
+    vector* values = malloc(count * sizeof(vector));
+    for(long x = 0; x < count; x++) {
+        names[x] = keys + x * KEY_STRIDE;
+        make_key(names[x], KEY_STRIDE, 'k', x);
+        values[x] = (vector){ x, -x, x * 0.5f };
+    }
+
+    char* modes[] = { "insert_vector", "reserve + insert_vector",
+                      "insert_vectors" };
+    char name[40];
+    int saved = mute();
+    double elapsed[3];
+    for(int mode = 0; mode < 3; mode++) {
+        clear_vectable();
+        double start = now();
+        if(mode == 2) {
+            insert_vectors(names, values, count);
+        } else {
+            if(mode == 1) {
+                reserve_vectable(count);
+            }
+            for(long x = 0; x < count; x++) {
+                insert_vector(names[x], values[x]);
+            }
+        }
+        elapsed[mode] = now() - start;
+        if(count_vectors() != count) {
+            unmute(saved);
+            printf("Error: stored %d of %ld vectors\n", count_vectors(),
+                count);
+            saved = mute();
+        }
+    }
+    clear_vectable();
+    unmute(saved);
+
+    for(int mode = 0; mode < 3; mode++) {
+        snprintf(name, 40, "%ld keys %s", count, modes[mode]);
+        report(name, count / elapsed[mode] / 1e6, "Mrows/sec");
+    }
+    free(keys);
+    free(names);
+    free(values);
+}
+
+/**
+ * @brief The old fill, kept for comparison: rand() names malloc'd one at
+ * a time and stored with insert_vector
+ *
+ * @param count
+ */
+static void rand_fill(long count) {
+    const char charset[] = "abcdefghijklmnopqrstuvwxyz"
+                           "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    for(long x = 0; x < count; x++) {
+        char* name = malloc(12);
+        for(int c = 0; c < 11; c++) {
+            name[c] = charset[rand() % (int)(sizeof(charset) - 1)];
+        }
+        name[11] = '\0';
+        vector v = { x, x, x };
+        insert_vector(name, v);
+        free(name);
+    }
+}
+
+/**
+ * @brief Times gen: making count rows on one thread without storing them,
+ * making and storing them on every thread with each distribution, and
+ * the old rand() fill, and checks that names up to GEN_NAME long read back
+ * from a csv
+ *
+ * @param count
+ */
+static void bench_gen(long count) {
+    section("gen", "seeded synthetic rows vs the old rand() fill");
+    gen_options o;
+    gen_defaults(&o);
+    o.count = count;
+    char* text = malloc((long)GEN_BLOCK * (GEN_NAME + 1));
+    char** names = malloc(GEN_BLOCK * sizeof(char*));
+    vector* values = malloc(GEN_BLOCK * sizeof(vector));
+    double start = now();
+    for(long block = 0; block * GEN_BLOCK < count; block++) {
+        gen_block(&o, block, text, names, values);
+    }
+    double made = now() - start;
+    free(text);
+    free(names);
+    free(values);
+
+    char* dists[] = { "uniform", "normal", "sphere" };
+    double stored[3];
+    int saved = mute();
+    for(int d = 0; d < 3; d++) {
+        set_gen_dist(&o, dists[d]);
+        clear_vectable();
+        start = now();
+        gen_vectors(&o);
+        stored[d] = now() - start;
+    }
+    int distinct = count_vectors();
+    clear_vectable();
+    start = now();
+    rand_fill(count);
+    double old = now() - start;
+    int old_distinct = count_vectors();
+    clear_vectable();
+    unmute(saved);
+
+    char name[40];
+    report("rows made on one thread", count / made / 1e6, "Mrows/sec");
+    for(int d = 0; d < 3; d++) {
+        snprintf(name, 40, "gen %s", dists[d]);
+        report(name, count / stored[d] / 1e6, "Mrows/sec");
+    }
+    report("gen distinct names", distinct, "rows");
+    report("rand() fill", count / old / 1e6, "Mrows/sec");
+    report("rand() fill distinct names", old_distinct, "rows");
+
+    // names up to GEN_NAME long must come back from a csv unchanged
+    char first[] = "/tmp/tritone-bench-XXXXXX";
+    char second[] = "/tmp/tritone-bench-XXXXXX";
+    int fd = mkstemp(first);
+    int other = mkstemp(second);
+    if(fd < 0 || other < 0) {
+        printf("Error: Could not create a temporary file\n");
+        return;
+    }
+    close(fd);
+    close(other);
+    gen_defaults(&o);
+    o.count = count < 100000 ? count : 100000;
+    o.min_length = 40;
+    o.max_length = GEN_NAME;
+    saved = mute();
+    gen_vectors(&o);
+    write_vectable(first, WRITE_FULL | WRITE_SORTED);
+    clear_vectable();
+    int read = read_vectable(first);
+    write_vectable(second, WRITE_FULL | WRITE_SORTED);
+    clear_vectable();
+    unmute(saved);
+    if(read != o.count || !same_file(first, second)) {
+        printf("Error: %ld rows with long names did not survive a csv\n",
+            o.count);
+    }
+    report("long names read back", read, "rows");
+    unlink(first);
+    unlink(second);
+}
+
+/**
+ * @brief Times read and write of packed tables against CSV on count 
+ * sensor-like vectors (sequential names, values that drift), and the LZ 
+ * codec on its own on the CSV text
+ *
+ * @param count
+ */
+static void bench_packed(long count) {
+    section("packed", "compressed binary tables against csv");
+    char path[] = "/tmp/tritone-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        printf("Error: Could not create a temporary file\n");
+        return;
+    }
+    close(fd);
+
+    int saved = mute();
+    clear_vectable();
+    char key[32];
+    srand(7);
+    vector v = { 0, 0, 0 };
+    for(long x = 0; x < count; x++) {
+        snprintf(key, 32, "sensor_%07ld", x);
+        v.i += (rand() % 201 - 100) / 100.0f;
+        v.j += (rand() % 21 - 10) / 4.0f;
+        v.k = 20 + (x % 1000) / 8.0f + (rand() % 100) / 1000.0f;
+        insert_vector(key, v);
+    }
+    unmute(saved);
+
+    char name[40];
+    char* formats[] = { "csv", "packed", "lossy" };
+    double megabytes = 0;
+    for(int format = 0; format < 3; format++) {
+        double error;
+        double start = now();
+        int written = format == 0 ? write_vectable(path, WRITE_FULL)
+            : write_packed(path, format - 1, &error);
+        double write = now() - start;
+        if(written != count) {
+            printf("Error: wrote %d of %ld vectors\n", written, count);
+        }
+        double size = file_megabytes(path);
+        megabytes = format == 0 ? size : megabytes;
+
+        saved = mute();
+        clear_vectable();
+        start = now();
+        int read = format == 0 ? read_vectable(path) : read_packed(path);
+        double elapsed = now() - start;
+        unmute(saved);
+        if(read != count) {
+            printf("Error: read %d of %ld vectors\n", read, count);
+        }
+
+        snprintf(name, 40, "%s bytes per vector", formats[format]);
+        report(name, size * 1e6 / count, "bytes");
+        snprintf(name, 40, "%s ratio to csv", formats[format]);
+        report(name, megabytes / size, "x");
+        snprintf(name, 40, "%s write", formats[format]);
+        report(name, count / write / 1e6, "Mrows/sec");
+        snprintf(name, 40, "%s read", formats[format]);
+        report(name, count / elapsed / 1e6, "Mrows/sec");
+        if(format == 2) {
+            report("lossy error bound", error, "");
+        }
+    }
+
+    // the codec alone, on the csv text in blocks the size packed files use
+    write_vectable(path, WRITE_FULL | WRITE_SORTED);
+    FILE* fp = fopen(path, "r");
+    size_t length = file_megabytes(path) * 1e6;
+    unsigned char* text = malloc(length);
+    length = fread(text, 1, length, fp);
+    fclose(fp);
+    size_t block = 1 << 18;
+    unsigned char* packed = malloc(lz_bound(length) + length / block * 16);
+    size_t* sizes = malloc((length / block + 1) * sizeof(size_t));
+    unsigned char* out = malloc(length);
+
+    double start = now();
+    size_t total = 0;
+    for(size_t at = 0, b = 0; at < length; at += block, b++) {
+        size_t raw = length - at < block ? length - at : block;
+        sizes[b] = lz_compress(text + at, raw, packed + total);
+        total += sizes[b];
+    }
+    double compress = now() - start;
+    start = now();
+    size_t offset = 0;
+    for(size_t at = 0, b = 0; at < length; at += block, b++) {
+        size_t raw = length - at < block ? length - at : block;
+        if(lz_decompress(packed + offset, sizes[b], out + at, raw) < 0) {
+            printf("Error: the codec could not read back block %zu\n", b);
+        }
+        offset += sizes[b];
+    }
+    double decompress = now() - start;
+    if(memcmp(text, out, length)) {
+        printf("Error: the codec changed the text\n");
+    }
+    report("lz ratio on csv text", (double)length / total, "x");
+    report("lz compress", length / compress / 1e9, "GB/sec");
+    report("lz decompress", length / decompress / 1e9, "GB/sec");
+
+    free(text);
+    free(packed);
+    free(sizes);
+    free(out);
+    clear_vectable();
+    unlink(path);
+}
+
+/**
+ * @brief Reports the p50, p99 and max of count latencies in seconds
+ *
+ * @param label
+ * @param latency sorted in place
+ * @param count
+ */
+static void report_latency(char* label, double* latency, long count) {
+    char name[40];
+    qsort(latency, count, sizeof(double), compare_doubles);
+    snprintf(name, 40, "%s p50", label);
+    report(name, latency[count / 2] * 1e6, "us");
+    snprintf(name, 40, "%s p99", label);
+    report(name, latency[count * 99 / 100] * 1e6, "us");
+    snprintf(name, 40, "%s max", label);
+    report(name, latency[count - 1] * 1e6, "us");
+}
+
+// queries timed at each size through the grid; scans take far longer 
+// each, so fewer of them are timed
+#define SPACE_QUERIES 2000
+#define SPACE_SCANS 40
+
+/**
+ * @brief Returns a random point in the cube from -1 to 1
+ *
+ * @return vector
+ */
+static vector random_point(void) {
+    vector v = { 
+        rand() / (real)RAND_MAX * 2 - 1, 
+        rand() / (real)RAND_MAX * 2 - 1, 
+        rand() / (real)RAND_MAX * 2 - 1 
+    };
+    return v;
+}
+
+/**
+ * @brief Times count knn or within queries at random points in the cube
+ * and reports their latency
+ *
+ * @param label
+ * @param k knn's k, or 0 for within
+ * @param r within's radius
+ * @param count
+ * @return double average matches found
+ */
+static double time_queries(char* label, int k, real r, long count) {
+    double* latency = malloc(count * sizeof(double));
+    space_match* out = malloc((k + 1) * sizeof(space_match));
+    long matches = 0;
+    srand(5);
+    for(long x = 0; x < count; x++) {
+        vector q = random_point();
+        double start = now();
+        if(k > 0) {
+            matches += knn_vectors(q, k, out);
+        } else {
+            space_match* found;
+            matches += within_vectors(q, r, &found);
+            free(found);
+        }
+        latency[x] = now() - start;
+    }
+    report_latency(label, latency, count);
+    free(latency);
+    free(out);
+    return (double)matches / count;
+}
+
+/**
+ * @brief Times knn and within on 1M points up to max_keys, growing by 
+ * 10x, through the grid and by scanning every point, along with building
+ * the grid and keeping it up to date on insert
+ *
+ * @param max_keys
+ */
+static void bench_space(long max_keys) {
+    section("space", "knn and within latency, grid vs scan");
+    gen_options o;
+    gen_defaults(&o);
+    o.seed = 11;
+    char name[40];
+    long n = max_keys < 1000000 ? max_keys : 1000000;
+    for(; n <= max_keys; n *= 10) {
+        int saved = mute();
+        clear_vectable();
+        o.count = n;
+        gen_vectors(&o);
+        unmute(saved);
+
+        set_space_mode("grid");
+        space_match nearest;
+        double start = now();
+        knn_vectors((vector){ 0, 0, 0 }, 1, &nearest);
+        snprintf(name, 40, "%ldM build", n / 1000000);
+        report(name, (now() - start) * 1e3, "ms");
+
+        // a radius that holds about 100 points on average
+        real r = cbrt(100 * 8 * 3 / (4 * 3.14159265 * n));
+        for(int scan = 0; scan < 2; scan++) {
+            char* how = scan ? "scan" : "grid";
+            long count = scan ? SPACE_SCANS : SPACE_QUERIES;
+            set_space_mode(how);
+            snprintf(name, 40, "%ldM knn 1 %s", n / 1000000, how);
+            time_queries(name, 1, 0, count);
+            snprintf(name, 40, "%ldM knn 10 %s", n / 1000000, how);
+            time_queries(name, 10, 0, count);
+            snprintf(name, 40, "%ldM within %s", n / 1000000, how);
+            double found = time_queries(name, 0, r, count);
+            snprintf(name, 40, "%ldM within %s found", n / 1000000, how);
+            report(name, found, "points");
+        }
+        set_space_mode("grid");
+
+        // new names one at a time, with the grid following and without
+        char key[32];
+        double inserts[2];
+        for(int indexed = 0; indexed < 2; indexed++) {
+            if(indexed) {
+                knn_vectors((vector){ 0, 0, 0 }, 1, &nearest);
+            } else {
+                space_drop();
+            }
+            srand(9);
+            start = now();
+            for(long x = 0; x < 100000; x++) {
+                snprintf(key, 32, "new%d_%ld", indexed, x);
+                insert_vector(key, random_point());
+            }
+            inserts[indexed] = (now() - start) / 100000;
+        }
+        snprintf(name, 40, "%ldM insert_vector", n / 1000000);
+        report(name, inserts[0] * 1e9, "ns");
+        snprintf(name, 40, "%ldM insert_vector with grid", n / 1000000);
+        report(name, inserts[1] * 1e9, "ns");
+    }
+
+    // every point on the unit sphere, where the cells inside are empty
+    int saved = mute();
+    clear_vectable();
+    o.count = max_keys < 1000000 ? max_keys : 1000000;
+    set_gen_dist(&o, "sphere");
+    gen_vectors(&o);
+    unmute(saved);
+    space_match nearest;
+    knn_vectors((vector){ 0, 0, 0 }, 1, &nearest);
+    time_queries("1M sphere knn 10 grid", 10, 0, SPACE_QUERIES);
+    clear_vectable();
+}
+
+// region queries timed at each size through the tree; scans take far
+// longer each, so fewer of them are timed
+#define REGION_QUERIES 2000
+#define REGION_SCANS 20
+
+/**
+ * @brief Times count inbox or insphere queries of one size at random
+ * points in the cube and reports their latency
+ *
+ * @param label
+ * @param sphere 1 for insphere, 0 for inbox
+ * @param size the sphere's radius or the box's side
+ * @param count
+ * @return double average vectors in a region
+ */
+static double time_regions(char* label, int sphere, real size, long count) {
+    double* latency = malloc(count * sizeof(double));
+    long found = 0;
+    srand(6);
+    for(long x = 0; x < count; x++) {
+        vector c = random_point();
+        vector hi = { c.i + size, c.j + size, c.k + size };
+        double start = now();
+        region_summary s = sphere ? insphere_vectors(c, size) 
+            : inbox_vectors(c, hi);
+        latency[x] = now() - start;
+        found += s.count;
+    }
+    report_latency(label, latency, count);
+    free(latency);
+    return (double)found / count;
+}
+
+/**
+ * @brief Times inbox and insphere on 1M points up to max_keys, growing by
+ * 10x, through the region tree and by scanning every point, for regions
+ * holding about a hundred points and about a tenth of them, along with 
+ * building the tree
+ *
+ * @param max_keys
+ */
+static void bench_region(long max_keys) {
+    section("region", "inbox and insphere latency, tree vs scan");
+    gen_options o;
+    gen_defaults(&o);
+    o.seed = 12;
+    char name[48];
+    // box sides and sphere radii holding about 100 points per million
+    // and about a tenth of the cube
+    real sides[2] = { 0.093, 0.86 };
+    real radii[2] = { 0.058, 0.53 };
+    char* sizes[2] = { "small", "large" };
+    long n = max_keys < 1000000 ? max_keys : 1000000;
+    for(; n <= max_keys; n *= 10) {
+        int saved = mute();
+        clear_vectable();
+        o.count = n;
+        gen_vectors(&o);
+        unmute(saved);
+
+        set_space_mode("grid");
+        vector_array points;
+        space_points(&points);
+        double start = now();
+        inbox_vectors((vector){ 0, 0, 0 }, (vector){ 0, 0, 0 });
+        snprintf(name, 48, "%ldM tree build", n / 1000000);
+        report(name, (now() - start) * 1e3, "ms");
+
+        for(int scan = 0; scan < 2; scan++) {
+            char* how = scan ? "scan" : "tree";
+            long count = scan ? REGION_SCANS : REGION_QUERIES;
+            set_space_mode(scan ? "scan" : "grid");
+            for(int z = 0; z < 2; z++) {
+                // the small regions shrink as the points get denser
+                real shrink = z == 0 ? cbrt(1000000.0 / n) : 1;
+                snprintf(name, 48, "%ldM inbox %s %s", n / 1000000, 
+                    sizes[z], how);
+                double found = time_regions(name, 0, sides[z] * shrink, 
+                    count);
+                snprintf(name, 48, "%ldM inbox %s %s found", n / 1000000,
+                    sizes[z], how);
+                report(name, found, "points");
+                snprintf(name, 48, "%ldM insphere %s %s", n / 1000000, 
+                    sizes[z], how);
+                time_regions(name, 1, radii[z] * shrink, count);
+            }
+        }
+        set_space_mode("grid");
+    }
+    clear_vectable();
+}
+
+/**
+ * @brief Times importing count rows split over shards csv files with one
+ * glob read, against reading the files one at a time
+ *
+ * @param count
+ * @param shards
+ */
+static void bench_import(long count, int shards) {
+    section("import", "glob read of many csv shards vs one read per file");
+    char dir[] = "/tmp/tritone-bench-XXXXXX";
+    if(mkdtemp(dir) == NULL) {
+        printf("Error: Could not create a temporary directory\n");
+        return;
+    }
+
+    char path[64];
+    char key[KEY_STRIDE];
+    long per_shard = count / shards;
+    double megabytes = 0;
+    for(int s = 0; s < shards; s++) {
+        snprintf(path, 64, "%s/part_%04d.csv", dir, s);
+        FILE* fp = fopen(path, "w");
+        for(long x = s * per_shard; x < (s + 1) * per_shard; x++) {
+            make_key(key, KEY_STRIDE, 'k', x);
+            fprintf(fp, "%s,%.2f,%.2f,%.2f\n", key, x * 0.5, -x * 0.25,
+                x / 3.0);
+        }
+        fclose(fp);
+        megabytes += file_megabytes(path);
+    }
+    long rows = per_shard * shards;
+
+    int saved = mute();
+    clear_vectable();
+    double start = now();
+    for(int s = 0; s < shards; s++) {
+        snprintf(path, 64, "%s/part_%04d.csv", dir, s);
+        read_vectable(path);
+    }
+    double one_by_one = now() - start;
+    int stored = count_vectors();
+
+    char* policies[] = { "last", "first", "error" };
+    double glob_times[3];
+    snprintf(path, 64, "%s/part_*.csv", dir);
+    for(int p = 0; p < 3; p++) {
+        set_conflict(policies[p]);
+        clear_vectable();
+        int files;
+        start = now();
+        read_glob(path, &files);
+        glob_times[p] = now() - start;
+    }
+    set_conflict("last");
+    int glob_stored = count_vectors();
+    clear_vectable();
+    unmute(saved);
+    if(stored != rows || glob_stored != rows) {
+        printf("Error: stored %d and %d of %ld vectors\n", stored,
+            glob_stored, rows);
+    }
+
+    char name[40];
+    snprintf(name, 40, "%d shards one read each", shards);
+    report(name, rows / one_by_one / 1e6, "Mrows/sec");
+    for(int p = 0; p < 3; p++) {
+        snprintf(name, 40, "%d shards glob, conflict %s", shards, 
+            policies[p]);
+        report(name, rows / glob_times[p] / 1e6, "Mrows/sec");
+    }
+    report("glob read", megabytes / glob_times[0], "MB/sec");
+
+    for(int s = 0; s < shards; s++) {
+        snprintf(path, 64, "%s/part_%04d.csv", dir, s);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+/**
+ * @brief Times a line at the prompt, with nothing else going on and while
+ * a csv of count rows loads in the background, against how long a
+ * foreground read blocks it. Publishing the finished read is timed too.
+ *
+ * @param count
+ */
+static void bench_jobs(long count) {
+    section("jobs", "line latency during a background read");
+    char path[] = "/tmp/tritone-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        printf("Error: Could not create a temporary file\n");
+        return;
+    }
+    close(fd);
+
+    int saved = mute();
+    clear_vectable();
+    char key[KEY_STRIDE];
+    for(long x = 0; x < count; x++) {
+        make_key(key, KEY_STRIDE, 'k', x);
+        vector v = { x * 0.5f, -x * 0.25f, x / 3.0f };
+        insert_vector(key, v);
+    }
+    write_vectable(path, 0);
+    clear_vectable();
+    run("a = 1, 2, 3; b = 4, 5, 6");
+    unmute(saved);
+
+    long samples = 100000;
+    double* latency = malloc(samples * sizeof(double));
+    for(long x = 0; x < samples; x++) {
+        double start = now();
+        run("c = a X b + a");
+        latency[x] = now() - start;
+    }
+    report_latency("idle line", latency, samples);
+
+    // a line every 100us, as a busy script would send them, until the
+    // read has been published
+    saved = mute();
+    double started = now();
+    start_read_job(path);
+    long lines = 0;
+    double publish = 0;
+    while(count_vectors() < count + 3 && now() - started < 600) {
+        double start = now();
+        poll_jobs();
+        double polled = now();
+        run("c = a X b + a");
+        if(lines < samples) {
+            latency[lines++] = now() - start;
+        }
+        publish = polled - start > publish ? polled - start : publish;
+        while(now() - start < 100e-6) {
+            sched_yield();
+        }
+    }
+    double background = now() - started;
+    unmute(saved);
+    if(count_vectors() != count + 3) {
+        printf("Error: read %d of %ld vectors\n", count_vectors() - 3, count);
+    }
+    report_latency("line during read", latency, lines);
+    report("publish pause", publish * 1e3, "ms");
+    report("background read", background, "sec");
+
+    saved = mute();
+    clear_vectable();
+    double start = now();
+    read_vectable(path);
+    double blocking = now() - start;
+    unmute(saved);
+    report("line blocked by foreground read", blocking, "sec");
+
+    free(latency);
+    clear_vectable();
+    unlink(path);
+}
+
+/**
+ * @brief Entry point
+ *
+ * @param argc
+ * @param argv
+ * @return int
+ */
+int main(int argc, char** argv) {
+    long iterations = 1000000;
+    long max_keys = 1000000;
+    char* path = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:k:o:b:")) != -1) {
+        switch(opt) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            case 'k':
+                max_keys = atol(optarg);
+                break;
+            case 'o':
+                path = optarg;
+                break;
+            case 'b':
+                only = optarg;
+                break;
+            default:
+                printf("Usage: %s [-n iterations] [-k max keys] "
+                    "[-o results.json] [-b name,name,...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(iterations < 1 || max_keys < 1000) {
+        printf("Error: Need at least 1 iteration and 1000 keys\n");
+        return 1;
+    }
+
+    if(path != NULL) {
+        json = fopen(path, "w");
+        if(json == NULL) {
+            printf("Error: Could not open %s\n", path);
+            return 1;
+        }
+        fprintf(json, 
+            "{\n  \"numeric\": \"%s\",\n  \"iterations\": %ld,\n"
+            "  \"max_keys\": %ld,\n  \"results\": [",
+            REAL_NAME, iterations, max_keys);
+    }
+
+    printf("numeric type: %s\n", REAL_NAME);
+    vectable_init();
+    if(wanted("lex")) {
+        bench_lex(iterations * 64);
+    }
+    if(wanted("parse")) {
+        bench_parse(iterations / 10);
+    }
+    if(wanted("evaluate")) {
+        bench_evaluate(iterations);
+    }
+    if(wanted("table")) {
+        bench_table(max_keys);
+    }
+    if(wanted("table settings")) {
+        bench_table_settings(max_keys < 1000000 ? max_keys : 1000000);
+    }
+    if(wanted("load factors")) {
+        bench_load_factors(max_keys);
+    }
+    if(wanted("key storage")) {
+        bench_key_storage(max_keys);
+    }
+    if(wanted("insert latency")) {
+        bench_insert_latency(max_keys);
+    }
+    if(wanted("prefix scan")) {
+        bench_prefix(max_keys);
+    }
+    if(wanted("wal")) {
+        bench_wal(max_keys < 1000000 ? max_keys : 1000000);
+    }
+    if(wanted("bulk")) {
+        bench_bulk(max_keys);
+    }
+    if(wanted("gen")) {
+        bench_gen(max_keys);
+    }
+    if(wanted("io")) {
+        bench_io(max_keys);
+    }
+    if(wanted("packed")) {
+        bench_packed(max_keys);
+    }
+    if(wanted("import")) {
+        bench_import(max_keys, 200);
+    }
+    if(wanted("jobs")) {
+        bench_jobs(max_keys);
+    }
+    if(wanted("space")) {
+        bench_space(max_keys);
+    }
+    if(wanted("region")) {
+        bench_region(max_keys);
+    }
+    if(wanted("loop")) {
+        bench_loop(iterations);
+    }
+    if(wanted("calls")) {
+        bench_calls(iterations);
+    }
+    if(wanted("builtins")) {
+        bench_builtins(iterations);
+    }
+    if(wanted("transform")) {
+        bench_transform(iterations);
+    }
+    if(wanted("fuse")) {
+        bench_fuse(iterations);
+    }
+    if(wanted("jit")) {
+        bench_jit(iterations);
+    }
+    if(wanted("dispatch")) {
+        bench_dispatch(iterations * 10);
+    }
+    if(wanted("precision")) {
+        bench_precision(iterations);
+    }
+    // last, since every write takes the lock once other threads read
+    if(wanted("transactions")) {
+        bench_transactions(max_keys);
+    }
+    stop_jobs();
+    free_vectable();
+    clear_functable();
+
+    if(json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+        printf("results written to %s\n", path);
+    }
+    return 0;
+}
@@ -0,0 +1,639 @@
+/**
+ * @file builtins.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Registry of built-in functions. Names are resolved to an id when
+ * a call is parsed, and evaluation indexes straight into the registry.
+ * Each function has a single evaluation and most have a batch version; the
+ * batch version runs when map applies the function to the whole vectable.
+ * knn, within, inbox and insphere search the table instead of working on
+ * their arguments alone, and have no batch version. quat, mat3 and mat4 
+ * make quaternions and matrices, which only rotate, apply, * and the 
+ * constructors themselves take.
+ * 
+ * Scalars are broadcast to (s, s, s) where a function mixes them 
+ * with vectors.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <tgmath.h>
+#include "builtins.h"
+#include "vectable.h"
+#include "space.h"
+#include "region.h"
+#include "transform.h"
+
+typedef value (*builtin_eval)(value* args);
+typedef int (*builtin_batch)(vector_array data, value* args, int n);
+
+typedef struct {
+    char* name;
+    int arity;
+    builtin_eval eval;      // evaluates one call
+    builtin_batch batch;    // applies to n vectors with args[each] as 
+                            // each one, or NULL
+    int each;               // the argument map's _ is for the batch version
+    int transforms;         // takes quaternions and matrices
+} builtin;
+
+/**
+ * @brief Converts a vector to a value struct
+ * 
+ * @param v 
+ * @return value 
+ */
+static value vector_value(vector v) {
+    value r;
+    r.type = VAL_VECTOR;
+    r.vec = v;
+    return r;
+}
+
+/**
+ * @brief Converts a scalar to a value struct
+ * 
+ * @param f 
+ * @return value 
+ */
+static value scalar_value(real f) {
+    value r;
+    r.type = VAL_SCALAR;
+    r.scalar = f;
+    return r;
+}
+
+/**
+ * @brief Holds a quaternion for the rest of the line and returns a value
+ * referring to it
+ * 
+ * @param q 
+ * @return value 
+ */
+static value quaternion_value(quaternion q) {
+    value r;
+    r.type = VAL_QUATERNION;
+    r.held = hold_quaternion(q);
+    return r;
+}
+
+/**
+ * @brief Holds a matrix for the rest of the line and returns a value 
+ * referring to it
+ * 
+ * @param m 
+ * @return value 
+ */
+static value matrix_value(matrix m) {
+    value r;
+    r.type = VAL_MATRIX;
+    r.held = hold_matrix(m);
+    return r;
+}
+
+/**
+ * @brief Prints an argument error for a builtin and returns the sentinel
+ * 
+ * @param name 
+ * @return value 
+ */
+static value invalid(char* name) {
+    printf("Error: invalid arguments to %s\n", name);
+    value r;
+    r.type = VAL_SENTINEL;
+    return r;
+}
+
+/**
+ * @brief Returns a value as a vector, broadcasting scalars
+ * 
+ * @param v 
+ * @return vector 
+ */
+static vector as_vector(value v) {
+    if(v.type == VAL_SCALAR) {
+        vector broadcast = { v.scalar, v.scalar, v.scalar };
+        return broadcast;
+    }
+    return v.vec;
+}
+
+/**
+ * @brief Returns true if any of the first n arguments is a quaternion or
+ * matrix
+ * 
+ * @param args 
+ * @param n 
+ * @return int 
+ */
+static int has_transform(value* args, int n) {
+    for(int i = 0; i < n; i++) {
+        if(args[i].type == VAL_QUATERNION || args[i].type == VAL_MATRIX) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns true if any of the first n arguments is the sentinel, 
+ * meaning an error has already been reported
+ * 
+ * @param args 
+ * @param n 
+ * @return int 
+ */
+static int has_sentinel(value* args, int n) {
+    for(int i = 0; i < n; i++) {
+        if(args[i].type == VAL_SENTINEL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Zeroes the j and k fields after a batch kernel wrote scalars 
+ * into i, which is how a scalar is stored in the vectable
+ * 
+ * @param data 
+ * @param n 
+ */
+static void scalars_to_vectors(vector_array data, int n) {
+    memset(data.j, 0, n * sizeof(real));
+    memset(data.k, 0, n * sizeof(real));
+}
+
+/**
+ * @brief norm(x): length of a vector, or the absolute value of a scalar
+ */
+static value eval_norm(value* args) {
+    if(args[0].type == VAL_VECTOR) {
+        return scalar_value(vec_norm(args[0].vec));
+    }
+    return scalar_value(fabs(args[0].scalar));
+}
+
+static int batch_norm(vector_array data, value* args, int n) {
+    vec_norm_batch(data, data.i, n);
+    scalars_to_vectors(data, n);
+    return 0;
+}
+
+/**
+ * @brief normalize(v): v scaled to unit length
+ */
+static value eval_normalize(value* args) {
+    if(args[0].type != VAL_VECTOR) {
+        return invalid("normalize");
+    }
+    return vector_value(vec_normalize(args[0].vec));
+}
+
+static int batch_normalize(vector_array data, value* args, int n) {
+    vec_normalize_batch(data, n);
+    return 0;
+}
+
+/**
+ * @brief angle(a, b): angle between two vectors in radians
+ */
+static value eval_angle(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_VECTOR) {
+        return invalid("angle");
+    }
+    return scalar_value(vec_angle(args[0].vec, args[1].vec));
+}
+
+static int batch_angle(vector_array data, value* args, int n) {
+    if(args[1].type != VAL_VECTOR) {
+        invalid("angle");
+        return -1;
+    }
+    vec_angle_batch(data, args[1].vec, data.i, n);
+    scalars_to_vectors(data, n);
+    return 0;
+}
+
+/**
+ * @brief lerp(a, b, t): linear interpolation from a (t = 0) to b (t = 1)
+ */
+static value eval_lerp(value* args) {
+    if(args[2].type != VAL_SCALAR) {
+        return invalid("lerp");
+    }
+    real t = args[2].scalar;
+    if(args[0].type == VAL_SCALAR && args[1].type == VAL_SCALAR) {
+        return scalar_value(args[0].scalar + (args[1].scalar - args[0].scalar) * t);
+    }
+    return vector_value(vec_lerp(as_vector(args[0]), as_vector(args[1]), t));
+}
+
+static int batch_lerp(vector_array data, value* args, int n) {
+    if(args[2].type != VAL_SCALAR) {
+        invalid("lerp");
+        return -1;
+    }
+    vec_lerp_batch(data, as_vector(args[1]), args[2].scalar, n);
+    return 0;
+}
+
+/**
+ * @brief project(a, b): projection of a onto b
+ */
+static value eval_project(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_VECTOR) {
+        return invalid("project");
+    }
+    return vector_value(vec_project(args[0].vec, args[1].vec));
+}
+
+static int batch_project(vector_array data, value* args, int n) {
+    if(args[1].type != VAL_VECTOR) {
+        invalid("project");
+        return -1;
+    }
+    vec_project_batch(data, args[1].vec, n);
+    return 0;
+}
+
+/**
+ * @brief min(a, b): element-wise minimum
+ */
+static value eval_min(value* args) {
+    if(args[0].type == VAL_SCALAR && args[1].type == VAL_SCALAR) {
+        return scalar_value(fmin(args[0].scalar, args[1].scalar));
+    }
+    return vector_value(vec_min(as_vector(args[0]), as_vector(args[1])));
+}
+
+static int batch_min(vector_array data, value* args, int n) {
+    vec_min_batch(data, as_vector(args[1]), n);
+    return 0;
+}
+
+/**
+ * @brief max(a, b): element-wise maximum
+ */
+static value eval_max(value* args) {
+    if(args[0].type == VAL_SCALAR && args[1].type == VAL_SCALAR) {
+        return scalar_value(fmax(args[0].scalar, args[1].scalar));
+    }
+    return vector_value(vec_max(as_vector(args[0]), as_vector(args[1])));
+}
+
+static int batch_max(vector_array data, value* args, int n) {
+    vec_max_batch(data, as_vector(args[1]), n);
+    return 0;
+}
+
+/**
+ * @brief abs(x): element-wise absolute value
+ */
+static value eval_abs(value* args) {
+    if(args[0].type == VAL_SCALAR) {
+        return scalar_value(fabs(args[0].scalar));
+    }
+    return vector_value(vec_abs(args[0].vec));
+}
+
+static int batch_abs(vector_array data, value* args, int n) {
+    vec_abs_batch(data, n);
+    return 0;
+}
+
+/**
+ * @brief sqrt(x): element-wise square root
+ */
+static value eval_sqrt(value* args) {
+    if(args[0].type == VAL_SCALAR) {
+        return scalar_value(sqrt(args[0].scalar));
+    }
+    return vector_value(vec_sqrt(args[0].vec));
+}
+
+static int batch_sqrt(vector_array data, value* args, int n) {
+    vec_sqrt_batch(data, n);
+    return 0;
+}
+
+/**
+ * @brief Prints the vectors a query found, nearest first
+ * 
+ * @param found 
+ * @param count 
+ */
+static void print_matches(space_match* found, int count) {
+    for(int x = 0; x < count; x++) {
+        printf("%s: %s, distance %.2f\n", found[x].name, 
+            vector_to_string(found[x].value), found[x].distance);
+    }
+}
+
+/**
+ * @brief knn(q, k): prints the k stored vectors nearest to q and returns 
+ * the nearest
+ */
+static value eval_knn(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_SCALAR 
+        || !(args[1].scalar >= 1)) {
+        return invalid("knn");
+    }
+    int stored = count_vectors();
+    int k = args[1].scalar < stored ? (int)args[1].scalar : stored;
+    space_match* found = malloc((k + 1) * sizeof(space_match));
+    int count = knn_vectors(args[0].vec, k, found);
+    print_matches(found, count);
+    value r;
+    if(count > 0) {
+        r = vector_value(found[0].value);
+    } else {
+        printf("No vectors are currently stored\n");
+        r.type = VAL_SENTINEL;
+    }
+    free(found);
+    return r;
+}
+
+/**
+ * @brief within(q, r): prints the stored vectors no farther than r from q, 
+ * nearest first, and returns how many there are
+ */
+static value eval_within(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_SCALAR 
+        || !(args[1].scalar >= 0)) {
+        return invalid("within");
+    }
+    space_match* found;
+    int count = within_vectors(args[0].vec, args[1].scalar, &found);
+    print_matches(found, count);
+    free(found);
+    return scalar_value(count);
+}
+
+/**
+ * @brief Prints how many vectors a region holds and returns their mean
+ * 
+ * @param s 
+ * @return value 
+ */
+static value region_value(region_summary s) {
+    value r;
+    if(s.count == 0) {
+        printf("No vectors are in the region\n");
+        r.type = VAL_SENTINEL;
+        return r;
+    }
+    printf("%ld %s, centroid %s\n", s.count, 
+        s.count == 1 ? "vector" : "vectors", vector_to_string(s.centroid));
+    return vector_value(s.centroid);
+}
+
+/**
+ * @brief inbox(lo, hi): prints how many stored vectors are in the box from
+ * lo to hi and returns their centroid
+ */
+static value eval_inbox(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_VECTOR) {
+        return invalid("inbox");
+    }
+    return region_value(inbox_vectors(args[0].vec, args[1].vec));
+}
+
+/**
+ * @brief insphere(c, r): prints how many stored vectors are no farther 
+ * than r from c and returns their centroid
+ */
+static value eval_insphere(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_SCALAR 
+        || !(args[1].scalar >= 0)) {
+        return invalid("insphere");
+    }
+    return region_value(insphere_vectors(args[0].vec, args[1].scalar));
+}
+
+/**
+ * @brief quat(axis, angle): the rotation by angle radians about axis
+ */
+static value eval_quat(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_SCALAR 
+        || vec_norm(args[0].vec) == 0) {
+        return invalid("quat");
+    }
+    return quaternion_value(quaternion_axis_angle(args[0].vec, 
+        args[1].scalar));
+}
+
+/**
+ * @brief mat3(r0, r1, r2): the 3x3 matrix with rows r0, r1 and r2
+ */
+static value eval_mat3(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_VECTOR 
+        || args[2].type != VAL_VECTOR) {
+        return invalid("mat3");
+    }
+    return matrix_value(matrix_rows(args[0].vec, args[1].vec, args[2].vec));
+}
+
+/**
+ * @brief mat4(R, t): the 4x4 matrix that applies R, a 3x3 matrix or a 
+ * quaternion, then moves by t
+ */
+static value eval_mat4(value* args) {
+    if(args[1].type != VAL_VECTOR) {
+        return invalid("mat4");
+    }
+    matrix r;
+    if(args[0].type == VAL_QUATERNION) {
+        r = quaternion_matrix(held_quaternion(args[0].held));
+    } else if(args[0].type == VAL_MATRIX 
+        && held_matrix(args[0].held)->size == 3) {
+        r = *held_matrix(args[0].held);
+    } else {
+        return invalid("mat4");
+    }
+    return matrix_value(matrix_affine(r, args[1].vec));
+}
+
+/**
+ * @brief rotate(v, q): v rotated by the quaternion q
+ */
+static value eval_rotate(value* args) {
+    if(args[0].type != VAL_VECTOR || args[1].type != VAL_QUATERNION) {
+        return invalid("rotate");
+    }
+    return vector_value(quaternion_rotate(held_quaternion(args[1].held), 
+        args[0].vec));
+}
+
+static int batch_rotate(vector_array data, value* args, int n) {
+    if(args[1].type != VAL_QUATERNION) {
+        invalid("rotate");
+        return -1;
+    }
+    quaternion_rotate_batch(data, held_quaternion(args[1].held), n);
+    return 0;
+}
+
+/**
+ * @brief apply(M, v): the matrix or quaternion M applied to v
+ */
+static value eval_apply(value* args) {
+    if(args[1].type != VAL_VECTOR) {
+        return invalid("apply");
+    }
+    if(args[0].type == VAL_QUATERNION) {
+        return vector_value(quaternion_rotate(held_quaternion(args[0].held),
+            args[1].vec));
+    } else if(args[0].type == VAL_MATRIX) {
+        return vector_value(matrix_apply(held_matrix(args[0].held), 
+            args[1].vec));
+    }
+    return invalid("apply");
+}
+
+static int batch_apply(vector_array data, value* args, int n) {
+    if(args[0].type == VAL_QUATERNION) {
+        quaternion_rotate_batch(data, held_quaternion(args[0].held), n);
+    } else if(args[0].type == VAL_MATRIX) {
+        matrix_apply_batch(data, held_matrix(args[0].held), n);
+    } else {
+        invalid("apply");
+        return -1;
+    }
+    return 0;
+}
+
+static const builtin builtins[BUILTIN_COUNT] = {
+    [BUILTIN_NORM]      = { "norm",      1, eval_norm,      batch_norm },
+    [BUILTIN_NORMALIZE] = { "normalize", 1, eval_normalize, batch_normalize },
+    [BUILTIN_ANGLE]     = { "angle",     2, eval_angle,     batch_angle },
+    [BUILTIN_LERP]      = { "lerp",      3, eval_lerp,      batch_lerp },
+    [BUILTIN_PROJECT]   = { "project",   2, eval_project,   batch_project },
+    [BUILTIN_MIN]       = { "min",       2, eval_min,       batch_min },
+    [BUILTIN_MAX]       = { "max",       2, eval_max,       batch_max },
+    [BUILTIN_ABS]       = { "abs",       1, eval_abs,       batch_abs },
+    [BUILTIN_SQRT]      = { "sqrt",      1, eval_sqrt,      batch_sqrt },
+    [BUILTIN_KNN]       = { "knn",       2, eval_knn,       NULL },
+    [BUILTIN_WITHIN]    = { "within",    2, eval_within,    NULL },
+    [BUILTIN_INBOX]     = { "inbox",     2, eval_inbox,     NULL },
+    [BUILTIN_INSPHERE]  = { "insphere",  2, eval_insphere,  NULL },
+    [BUILTIN_QUAT]      = { "quat",      2, eval_quat,      NULL },
+    [BUILTIN_MAT3]      = { "mat3",      3, eval_mat3,      NULL },
+    [BUILTIN_MAT4]      = { "mat4",      2, eval_mat4,      NULL,
+                            .transforms = 1 },
+    [BUILTIN_ROTATE]    = { "rotate",    2, eval_rotate,    batch_rotate,
+                            .transforms = 1 },
+    [BUILTIN_APPLY]     = { "apply",     2, eval_apply,     batch_apply,
+                            .each = 1, .transforms = 1 },
+};
+
+/**
+ * @brief Returns the id of the builtin named name, or -1. 
+ * Only used while parsing.
+ * 
+ * @param name 
+ * @return int 
+ */
+int find_builtin(char* name) {
+    for(int id = 0; id < BUILTIN_COUNT; id++) {
+        if(!strcmp(builtins[id].name, name)) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Returns the name of a builtin
+ * 
+ * @param id 
+ * @return char* 
+ */
+char* builtin_name(int id) {
+    return builtins[id].name;
+}
+
+/**
+ * @brief Returns the number of arguments a builtin takes
+ * 
+ * @param id 
+ * @return int 
+ */
+int builtin_arity(int id) {
+    return builtins[id].arity;
+}
+
+/**
+ * @brief Returns true if a builtin has a batch version for map
+ * 
+ * @param id 
+ * @return int 
+ */
+int builtin_batches(int id) {
+    return builtins[id].batch != NULL;
+}
+
+/**
+ * @brief Returns which argument of a builtin's batch version is each 
+ * vector, the one map's _ has to be
+ * 
+ * @param id 
+ * @return int 
+ */
+int builtin_each(int id) {
+    return builtins[id].each;
+}
+
+/**
+ * @brief Evaluates a builtin on already evaluated arguments
+ * 
+ * @param id 
+ * @param args 
+ * @return value 
+ */
+value call_builtin(int id, value* args) {
+    if(has_sentinel(args, builtins[id].arity)) {
+        value r;
+        r.type = VAL_SENTINEL;
+        return r;
+    }
+    if(!builtins[id].transforms && has_transform(args, builtins[id].arity)) {
+        return invalid(builtins[id].name);
+    }
+    return builtins[id].eval(args);
+}
+
+/**
+ * @brief Applies a builtin to n vectors in place. Each vector is argument
+ * builtin_each(id), which args leaves unset; the rest of args are the 
+ * same for every vector. Functions that produce scalars store them in the
+ * i field.
+ * 
+ * @param id 
+ * @param data 
+ * @param args 
+ * @param n 
+ * @return int 0 on success, -1 if the arguments were invalid
+ */
+int map_builtin(int id, vector_array data, value* args, int n) {
+    for(int x = 0; x < builtins[id].arity; x++) {
+        if(x == builtins[id].each) {
+            continue;
+        }
+        if(has_sentinel(args + x, 1)) {
+            return -1;
+        }
+        if(!builtins[id].transforms && has_transform(args + x, 1)) {
+            invalid(builtins[id].name);
+            return -1;
+        }
+    }
+    return builtins[id].batch(data, args, n);
+}
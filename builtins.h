@@ -0,0 +1,37 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+    #include "ast.h"
+    #define MAX_BUILTIN_ARGS 3
+
+    typedef enum {
+        BUILTIN_NORM,
+        BUILTIN_NORMALIZE,
+        BUILTIN_ANGLE,
+        BUILTIN_LERP,
+        BUILTIN_PROJECT,
+        BUILTIN_MIN,
+        BUILTIN_MAX,
+        BUILTIN_ABS,
+        BUILTIN_SQRT,
+        BUILTIN_KNN,
+        BUILTIN_WITHIN,
+        BUILTIN_INBOX,
+        BUILTIN_INSPHERE,
+        BUILTIN_QUAT,
+        BUILTIN_MAT3,
+        BUILTIN_MAT4,
+        BUILTIN_ROTATE,
+        BUILTIN_APPLY,
+        BUILTIN_COUNT,
+    } builtin_id;
+
+    int find_builtin(char* name);
+    char* builtin_name(int id);
+    int builtin_arity(int id);
+    int builtin_batches(int id);
+    int builtin_each(int id);
+    value call_builtin(int id, value* args);
+    int map_builtin(int id, vector_array data, value* args, int n);
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ * @file csv.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Streaming parser for the name,i,j,k files read and write use.
+ * A file is fed in chunks of up to CSV_CHUNK bytes; each chunk is read
+ * into a buffer from csv_buffer, CSV_LINE bytes past its start, so the
+ * unfinished line at the end of the chunk before can be copied in front
+ * of it and parsed whole. Rows are only collected here; storing them is
+ * up to the caller.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "csv.h"
+
+/**
+ * @brief Starts an empty reader
+ *
+ * @param r
+ */
+void csv_init(csv_reader* r) {
+    r->capacity = 1024;
+    r->count = 0;
+    r->names_capacity = r->capacity * 16;
+    r->names_length = 0;
+    r->names = malloc(r->names_capacity);
+    r->starts = malloc(r->capacity * sizeof(size_t));
+    r->values = malloc(r->capacity * sizeof(vector));
+    r->line = 1;
+    r->carried = 0;
+}
+
+/**
+ * @brief Frees the rows a reader collected
+ *
+ * @param r
+ */
+void csv_free(csv_reader* r) {
+    free(r->names);
+    free(r->starts);
+    free(r->values);
+    r->names = NULL;
+    r->starts = NULL;
+    r->values = NULL;
+}
+
+/**
+ * @brief Returns a buffer for one chunk: read into it CSV_LINE bytes past
+ * the start, and free it when done
+ *
+ * @return char*
+ */
+char* csv_buffer(void) {
+    return malloc(CSV_LINE + CSV_CHUNK + 1);
+}
+
+/**
+ * @brief Parses one number and the whitespace before it, the way scanf's
+ * REAL_SCAN does
+ *
+ * @param at moved past the number
+ * @param value
+ * @return int 0, or -1 if there is no number
+ */
+static int parse_number(char** at, real* value) {
+    char* end;
+    #ifdef TRITONE_DOUBLE
+        *value = strtod(*at, &end);
+    #else
+        *value = strtof(*at, &end);
+    #endif
+    if(end == *at) {
+        return -1;
+    }
+    *at = end;
+    return 0;
+}
+
+/**
+ * @brief Parses the rows in text, which must end with a '\0'. Stops
+ * before an unfinished last line unless last is set.
+ *
+ * @param r
+ * @param text
+ * @param end where the text's '\0' is
+ * @param last
+ * @return char* where parsing stopped, or NULL at a bad line
+ */
+static char* parse_rows(csv_reader* r, char* text, char* end, int last) {
+    char* at = text;
+    while(1) {
+        while(at < end && isspace((unsigned char)*at)) {
+            at++;
+        }
+        if(at == end) {
+            return at;
+        }
+        char* newline = memchr(at, '\n', end - at);
+        if(newline == NULL && !last) {
+            return at;
+        }
+        char* line_end = newline != NULL ? newline : end;
+
+        if(r->count == r->capacity) {
+            r->capacity *= 2;
+            r->starts = realloc(r->starts, r->capacity * sizeof(size_t));
+            r->values = realloc(r->values, r->capacity * sizeof(vector));
+        }
+        char* comma = memchr(at, ',', line_end - at);
+        if(comma == NULL || comma == at) {
+            return NULL;
+        }
+        size_t length = comma - at;
+        while(r->names_length + length + 1 > r->names_capacity) {
+            r->names_capacity *= 2;
+            r->names = realloc(r->names, r->names_capacity);
+        }
+        r->starts[r->count] = r->names_length;
+        memcpy(r->names + r->names_length, at, length);
+        r->names[r->names_length + length] = '\0';
+
+        // the numbers may not run into the next line
+        char saved = *line_end;
+        *line_end = '\0';
+        vector* v = &r->values[r->count];
+        at = comma + 1;
+        int bad = parse_number(&at, &v->i) < 0 || *at++ != ','
+            || parse_number(&at, &v->j) < 0 || *at++ != ','
+            || parse_number(&at, &v->k) < 0;
+        while(!bad && at < line_end && isspace((unsigned char)*at)) {
+            at++;
+        }
+        bad = bad || at != line_end;
+        *line_end = saved;
+        if(bad) {
+            return NULL;
+        }
+        r->names_length += length + 1;
+        r->count++;
+        r->line++;
+    }
+}
+
+/**
+ * @brief Parses the next length bytes of a file, read into buffer
+ * CSV_LINE bytes past its start. The unfinished line at the end is kept
+ * for the next chunk.
+ *
+ * @param r
+ * @param buffer from csv_buffer
+ * @param length
+ * @param last set for the file's final chunk
+ * @return int 0, or -1 if a line is bad (r->line is its number)
+ */
+int csv_chunk(csv_reader* r, char* buffer, size_t length, int last) {
+    char* text = buffer + CSV_LINE - r->carried;
+    memcpy(text, r->carry, r->carried);
+    char* end = buffer + CSV_LINE + length;
+    *end = '\0';
+    char* stopped = parse_rows(r, text, end, last);
+    if(stopped == NULL) {
+        return -1;
+    }
+    r->carried = end - stopped;
+    if(r->carried >= CSV_LINE) {
+        return -1;
+    }
+    memcpy(r->carry, stopped, r->carried);
+    return 0;
+}
+
+/**
+ * @brief Returns an array pointing at each row's name, for insert_vectors,
+ * once every row is parsed
+ *
+ * @param r
+ * @return char**
+ */
+char** csv_names(csv_reader* r) {
+    char** names = malloc(((size_t)r->count + 1) * sizeof(char*));
+    for(int x = 0; x < r->count; x++) {
+        names[x] = r->names + r->starts[x];
+    }
+    return names;
+}
+
+/**
+ * @brief Parses the whole csv at path into a new reader
+ *
+ * @param path
+ * @param r started here; free it with csv_free whatever the result
+ * @return int 0, -1 if path can't be read, or -2 if a line is bad 
+ * (r->line is its number)
+ */
+int csv_read(char* path, csv_reader* r) {
+    csv_init(r);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+
+    char* buffer = csv_buffer();
+    int bad = 0;
+    ssize_t length;
+    while(!bad && (length = read(fd, buffer + CSV_LINE, CSV_CHUNK)) > 0) {
+        bad = csv_chunk(r, buffer, length, 0) < 0;
+    }
+    bad = bad || csv_chunk(r, buffer, 0, 1) < 0;
+    free(buffer);
+    close(fd);
+    return length < 0 ? -1 : bad ? -2 : 0;
+}
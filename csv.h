@@ -0,0 +1,34 @@
+#ifndef CSV_H
+#define CSV_H
+
+    #include <stddef.h>
+    #include "vec.h"
+
+    // bytes read from a file at a time
+    #define CSV_CHUNK (4 << 20)
+    // longest line that can be split across two chunks, and so the
+    // longest name a row can be sure of being read with
+    #define CSV_LINE 4096
+
+    // rows parsed from a csv file, in file order
+    typedef struct {
+        char* names;        // every row's name and its '\0', back to back
+        size_t names_length;
+        size_t names_capacity;
+        size_t* starts;     // where each row's name starts in names
+        vector* values;
+        int count;
+        int capacity;
+        int line;           // line being parsed, for errors
+        char carry[CSV_LINE];   // end of the last chunk, not a whole line yet
+        size_t carried;
+    } csv_reader;
+
+    void csv_init(csv_reader* r);
+    void csv_free(csv_reader* r);
+    char* csv_buffer(void);
+    int csv_chunk(csv_reader* r, char* buffer, size_t length, int last);
+    char** csv_names(csv_reader* r);
+    int csv_read(char* path, csv_reader* r);
+
+#endif
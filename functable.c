@@ -0,0 +1,134 @@
+/**
+ * @file functable.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Table of user defined functions, kept next to the vectable.
+ * Functions are looked up by name when a call is parsed so small ones can
+ * be inlined; only calls that aren't inlined look them up when evaluated.
+ * There are rarely more than a handful, so they're kept in a growable
+ * array and searched linearly.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "functable.h"
+
+static function* functions = NULL;
+static int size = 0;
+static int capacity = 0;
+
+/**
+ * @brief Counts the nodes in a tree
+ *
+ * @param n
+ * @return int
+ */
+static int count_nodes(node* n) {
+    if(n == NULL) {
+        return 0;
+    }
+    return 1 + count_nodes(n->left) + count_nodes(n->right);
+}
+
+/**
+ * @brief Frees the strings and body owned by a function
+ *
+ * @param f
+ */
+static void free_function(function* f) {
+    free(f->name);
+    for(int i = 0; i < f->arity; i++) {
+        free(f->params[i]);
+    }
+    free_ast(f->body);
+}
+
+/**
+ * @brief Returns the function named name, or NULL if there isn't one
+ *
+ * @param name
+ * @return function*
+ */
+function* get_function(char* name) {
+    for(int i = 0; i < size; i++) {
+        if(!strcmp(functions[i].name, name)) {
+            return &functions[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Stores a function, replacing any function with the same name.
+ * The table takes ownership of body; name and params are copied.
+ *
+ * @param name
+ * @param arity
+ * @param params
+ * @param body
+ * @param frame
+ */
+void define_function(char* name, int arity, char** params,
+                     node* body, int frame) {
+    function* f = get_function(name);
+    if(f != NULL) {
+        free_function(f);
+    } else {
+        if(size == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            functions = realloc(functions, capacity * sizeof(function));
+        }
+        f = &functions[size++];
+    }
+
+    f->name = malloc(strlen(name) + 1);
+    strcpy(f->name, name);
+    f->arity = arity;
+    for(int i = 0; i < arity; i++) {
+        f->params[i] = malloc(strlen(params[i]) + 1);
+        strcpy(f->params[i], params[i]);
+    }
+    f->body = body;
+    f->frame = frame;
+    f->size = count_nodes(body);
+}
+
+/**
+ * @brief Frees every function and empties the table
+ *
+ * @return int number of functions freed
+ */
+int clear_functable(void) {
+    int freed = size;
+    for(int i = 0; i < size; i++) {
+        free_function(&functions[i]);
+    }
+    free(functions);
+    functions = NULL;
+    size = 0;
+    capacity = 0;
+    return freed;
+}
+
+/**
+ * @brief Lists the defined functions and their parameters
+ *
+ */
+void print_functable(void) {
+    if(size == 0) {
+        printf("No functions are currently defined\n");
+        return;
+    }
+    for(int i = 0; i < size; i++) {
+        printf("%s(", functions[i].name);
+        for(int p = 0; p < functions[i].arity; p++) {
+            printf(p ? ", %s" : "%s", functions[i].params[p]);
+        }
+        printf("): %d nodes\n", functions[i].size);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef FUNCTABLE_H
+#define FUNCTABLE_H
+
+    #include "ast.h"
+    #define MAX_PARAMS 8
+
+    typedef struct {
+        char* name;
+        int arity;                  // number of parameters
+        char* params[MAX_PARAMS];   // parameter names, for listing
+        node* body;                 // parameters are slots 0..arity-1
+        int frame;                  // slots the body needs when called
+        int size;                   // nodes in the body
+    } function;
+
+    void define_function(char* name, int arity, char** params,
+                         node* body, int frame);
+    function* get_function(char* name);
+    int clear_functable(void);
+    void print_functable(void);
+
+#endif
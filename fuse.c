@@ -0,0 +1,680 @@
+/**
+ * @file fuse.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Fused map expressions. Evaluating map _ * 2 + b - _ / 3 one
+ * vector at a time walks the tree and makes a value at every node for
+ * every vector; doing it one operator at a time over whole arrays would
+ * make a full temporary array per operator and stream each of them
+ * through memory. Instead, an expression made only of arithmetic, dot and
+ * cross products, the element-wise builtins, stored vectors, constants
+ * and inlined calls is compiled once into steps over registers of
+ * FUSE_BLOCK vectors each. Every step runs over a block before the next
+ * one starts, so the registers stay in cache, and each vector is read
+ * from and written back to the table's arrays exactly once.
+ *
+ * The type of every register, scalar or vector, is known when the
+ * expression is compiled, so steps don't check types as they run. An
+ * expression that would fail, or that uses anything else, isn't fused
+ * and map evaluates it one vector at a time as before, errors included.
+ * Each step does the same operations in the same order as the operator or
+ * builtin it replaces, so fused and unfused maps give the same bits.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include "fuse.h"
+#include "operators.h"
+#include "builtins.h"
+#include "vectable.h"
+#include "simd.h"
+
+typedef enum {
+    FUSE_ADD,
+    FUSE_SUB,
+    FUSE_MUL,
+    FUSE_DIV,
+    FUSE_DOT,
+    FUSE_CROSS,
+    FUSE_NORM,
+    FUSE_NORMALIZE,
+    FUSE_ABS,
+    FUSE_SQRT,
+    FUSE_MIN,
+    FUSE_MAX,
+} fuse_op;
+
+typedef enum {
+    REG_INPUT,          // the block of vectors being mapped
+    REG_CONSTANT,       // the same for every vector
+    REG_TEMP,           // a step's result
+} register_kind;
+
+typedef struct {
+    register_kind kind;
+    int scalar;         // holds scalars, in c[0] only
+    vector constant;    // a constant's value, a scalar in i
+    int in_use;         // a temp holding a value not yet used up
+    int pinned;         // a temp bound to a slot by an inlined call
+    real* c[3];         // the current block of each component
+} fuse_register;
+
+typedef struct {
+    fuse_op op;
+    int dst;
+    int a;
+    int b;              // -1 for builtins of one argument
+} fuse_step;
+
+struct fused {
+    fuse_register regs[FUSE_REGISTERS];
+    int count;
+    fuse_step* steps;
+    int step_count;
+    int step_capacity;
+    int result;
+    value* frame;               // slots outside the expression
+    int bound[MAX_SLOTS];       // register each slot is bound to, or -1
+};
+
+/**
+ * @brief Adds a register, if there's room
+ *
+ * @param f
+ * @param kind
+ * @param scalar
+ * @return int the register, or -1
+ */
+static int new_register(fused* f, register_kind kind, int scalar) {
+    if(f->count == FUSE_REGISTERS) {
+        return -1;
+    }
+    fuse_register* r = &f->regs[f->count];
+    memset(r, 0, sizeof(fuse_register));
+    r->kind = kind;
+    r->scalar = scalar;
+    return f->count++;
+}
+
+/**
+ * @brief Returns a constant register holding v, shared with any other
+ * use of the same constant
+ *
+ * @param f
+ * @param v
+ * @param scalar v is a scalar, in i
+ * @return int the register, or -1
+ */
+static int constant(fused* f, vector v, int scalar) {
+    for(int r = 0; r < f->count; r++) {
+        fuse_register* c = &f->regs[r];
+        // compared bit for bit, so 0 and -0 stay apart
+        if(c->kind == REG_CONSTANT && c->scalar == scalar 
+            && !memcmp(&c->constant, &v, sizeof(vector))) {
+            return r;
+        }
+    }
+    int r = new_register(f, REG_CONSTANT, scalar);
+    if(r >= 0) {
+        f->regs[r].constant = v;
+    }
+    return r;
+}
+
+/**
+ * @brief Returns a temp for a step's result, reusing a free one that 
+ * holds the same kind of value. Steps look up their registers' kinds as
+ * they run, so a register never changes kind.
+ *
+ * @param f
+ * @param scalar
+ * @return int the register, or -1
+ */
+static int new_temp(fused* f, int scalar) {
+    for(int r = 0; r < f->count; r++) {
+        fuse_register* t = &f->regs[r];
+        if(t->kind == REG_TEMP && !t->in_use && t->scalar == scalar) {
+            t->in_use = 1;
+            return r;
+        }
+    }
+    int r = new_register(f, REG_TEMP, scalar);
+    if(r >= 0) {
+        f->regs[r].in_use = 1;
+    }
+    return r;
+}
+
+/**
+ * @brief Frees a temp once a step has used it, unless an inlined call
+ * still has it bound
+ *
+ * @param f
+ * @param r
+ */
+static void release(fused* f, int r) {
+    if(f->regs[r].kind == REG_TEMP && !f->regs[r].pinned) {
+        f->regs[r].in_use = 0;
+    }
+}
+
+/**
+ * @brief Appends a step
+ *
+ * @param f
+ * @param op
+ * @param dst
+ * @param a
+ * @param b
+ */
+static void add_step(fused* f, fuse_op op, int dst, int a, int b) {
+    if(f->step_count == f->step_capacity) {
+        f->step_capacity = f->step_capacity ? f->step_capacity * 2 : 16;
+        f->steps = realloc(f->steps, f->step_capacity * sizeof(fuse_step));
+    }
+    f->steps[f->step_count++] = (fuse_step){ op, dst, a, b };
+}
+
+static int compile(fused* f, node* n);
+
+/**
+ * @brief Compiles an operation node
+ *
+ * @param f
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be fused
+ */
+static int compile_operation(fused* f, node* n) {
+    int a = compile(f, n->left);
+    int b = a < 0 ? -1 : compile(f, n->right);
+    if(b < 0) {
+        return -1;
+    }
+    int scalars = f->regs[a].scalar && f->regs[b].scalar;
+    int vectors = !f->regs[a].scalar && !f->regs[b].scalar;
+    fuse_op op;
+    int scalar = scalars;
+    switch(n->op) {
+        case OP_ADD:
+            op = FUSE_ADD;
+            break;
+        case OP_SUB:
+            op = FUSE_SUB;
+            break;
+        case OP_MUL:
+            op = FUSE_MUL;
+            break;
+        case OP_DIV:
+            op = FUSE_DIV;
+            break;
+        case OP_DOT:
+            op = FUSE_DOT;
+            scalar = 1;
+            break;
+        case OP_CROSS:
+            op = FUSE_CROSS;
+            scalar = 0;
+            break;
+        default:
+            return -1;
+    }
+    if((op == FUSE_DOT || op == FUSE_CROSS) && !vectors) {
+        return -1;
+    }
+    int d = new_temp(f, scalar);
+    if(d < 0) {
+        return -1;
+    }
+    add_step(f, op, d, a, b);
+    release(f, a);
+    release(f, b);
+    return d;
+}
+
+/**
+ * @brief Compiles a call to one of the element-wise builtins
+ *
+ * @param f
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be fused
+ */
+static int compile_builtin(fused* f, node* n) {
+    int args[MAX_BUILTIN_ARGS];
+    int count = 0;
+    for(node* a = n->left; a != NULL; a = a->right) {
+        args[count] = compile(f, a->left);
+        if(args[count++] < 0) {
+            return -1;
+        }
+    }
+    if(count == 0) {
+        return -1;
+    }
+    int a = args[0];
+    int b = count > 1 ? args[1] : -1;
+    int scalar = f->regs[a].scalar;
+    fuse_op op;
+    switch(n->op) {
+        case BUILTIN_NORM:
+            // the norm of a scalar is its absolute value
+            op = scalar ? FUSE_ABS : FUSE_NORM;
+            scalar = 1;
+            break;
+        case BUILTIN_NORMALIZE:
+            if(scalar) {
+                return -1;
+            }
+            op = FUSE_NORMALIZE;
+            break;
+        case BUILTIN_ABS:
+            op = FUSE_ABS;
+            break;
+        case BUILTIN_SQRT:
+            op = FUSE_SQRT;
+            break;
+        case BUILTIN_MIN:
+        case BUILTIN_MAX:
+            op = n->op == BUILTIN_MIN ? FUSE_MIN : FUSE_MAX;
+            scalar = scalar && f->regs[b].scalar;
+            break;
+        default:
+            return -1;
+    }
+    int d = new_temp(f, scalar);
+    if(d < 0) {
+        return -1;
+    }
+    add_step(f, op, d, a, b);
+    for(int x = 0; x < count; x++) {
+        release(f, args[x]);
+    }
+    return d;
+}
+
+/**
+ * @brief Compiles an inlined call's argument, bound to its slot while the
+ * rest of the call is compiled
+ *
+ * @param f
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be fused
+ */
+static int compile_let(fused* f, node* n) {
+    int r = compile(f, n->left);
+    if(r < 0) {
+        return -1;
+    }
+    int outer = f->bound[n->slot];
+    f->bound[n->slot] = r;
+    f->regs[r].pinned++;
+    int result = compile(f, n->right);
+    f->regs[r].pinned--;
+    f->bound[n->slot] = outer;
+    if(result != r) {
+        release(f, r);
+    }
+    return result;
+}
+
+/**
+ * @brief Compiles a node into steps
+ *
+ * @param f
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be fused
+ */
+static int compile(fused* f, node* n) {
+    if(n == NULL) {
+        return -1;
+    }
+    switch(n->type) {
+        case NODE_OPERATION:
+            return compile_operation(f, n);
+        case NODE_BUILTIN:
+            return compile_builtin(f, n);
+        case NODE_LET:
+            return compile_let(f, n);
+        case NODE_CONSTANT:
+            return constant(f, (vector){ n->number, 0, 0 }, 1);
+        case NODE_VECTOR: {
+            vector v = { n->left->number, n->right->left->number,
+                n->right->right->number };
+            return constant(f, v, 0);
+        }
+        case NODE_IDENTIFIER: {
+            // map only changes the table once every vector is done
+            vt_option v = get_vector(n->value);
+            return is_some(v) ? constant(f, v.value.value, 0) : -1;
+        }
+        case NODE_SLOT: {
+            if(f->bound[n->slot] >= 0) {
+                return f->bound[n->slot];
+            }
+            // a loop variable or parameter from outside the map
+            value v = f->frame[n->slot];
+            if(v.type == VAL_SCALAR) {
+                return constant(f, (vector){ v.scalar, 0, 0 }, 1);
+            } else if(v.type == VAL_VECTOR) {
+                return constant(f, v.vec, 0);
+            }
+            return -1;
+        }
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Compiles a map expression
+ *
+ * @param expr
+ * @param slot the slot _ is in
+ * @param frame the slots outside the expression
+ * @return fused* NULL if the expression can't be fused
+ */
+fused* fuse_expression(node* expr, int slot, value* frame) {
+    fused* f = calloc(1, sizeof(fused));
+    f->frame = frame;
+    for(int s = 0; s < MAX_SLOTS; s++) {
+        f->bound[s] = -1;
+    }
+    f->bound[slot] = new_register(f, REG_INPUT, 0);
+    f->result = compile(f, expr);
+    if(f->result < 0) {
+        free_fused(f);
+        return NULL;
+    }
+    return f;
+}
+
+/**
+ * @brief Returns a register's component x, or its only component if it
+ * holds scalars
+ *
+ * @param r
+ * @param x
+ * @return real*
+ */
+static real* component(fuse_register* r, int x) {
+    return r->c[r->scalar ? 0 : x];
+}
+
+/*
+ * out = x op y over a block, REAL_LANES at a time with SSE when it is
+ * available.
+ */
+#define COMBINE(name, vop, symbol)                                          \
+    static void name(real* out, real* x, real* y, int m) {                  \
+        int l = 0;                                                          \
+        COMBINE_LANES(vop)                                                  \
+        for(; l < m; l++) {                                                 \
+            out[l] = x[l] symbol y[l];                                      \
+        }                                                                   \
+    }
+
+#ifdef SIMD
+    #define COMBINE_LANES(vop)                                              \
+        for(; l + REAL_LANES <= m; l += REAL_LANES) {                       \
+            vr_store(out + l, vop(vr_load(x + l), vr_load(y + l)));         \
+        }
+#else
+    #define COMBINE_LANES(vop)
+#endif
+
+COMBINE(combine_add, vr_add, +)
+COMBINE(combine_sub, vr_sub, -)
+COMBINE(combine_mul, vr_mul, *)
+COMBINE(combine_div, vr_div, /)
+
+/**
+ * @brief Dot products of two vector registers over a block, added in the
+ * same order as vec_dot
+ *
+ * @param out
+ * @param a
+ * @param b
+ * @param m
+ */
+static void block_dot(real* out, fuse_register* a, fuse_register* b, int m) {
+    int l = 0;
+#ifdef SIMD
+    for(; l + REAL_LANES <= m; l += REAL_LANES) {
+        vreal d = vr_add(vr_add(
+            vr_mul(vr_load(a->c[0] + l), vr_load(b->c[0] + l)),
+            vr_mul(vr_load(a->c[1] + l), vr_load(b->c[1] + l))),
+            vr_mul(vr_load(a->c[2] + l), vr_load(b->c[2] + l)));
+        vr_store(out + l, d);
+    }
+#endif
+    for(; l < m; l++) {
+        out[l] = (a->c[0][l] * b->c[0][l]) + (a->c[1][l] * b->c[1][l])
+            + (a->c[2][l] * b->c[2][l]);
+    }
+}
+
+/**
+ * @brief Cross products of two vector registers over a block, worked out
+ * as vec_cross does
+ *
+ * @param d
+ * @param a
+ * @param b
+ * @param m
+ */
+static void block_cross(fuse_register* d, fuse_register* a,
+    fuse_register* b, int m) {
+    int l = 0;
+#ifdef SIMD
+    // flipping the sign bit is exactly what - does, zeros and NaNs too
+    vreal sign = vr_set1(-0.0);
+    for(; l + REAL_LANES <= m; l += REAL_LANES) {
+        vreal ai = vr_load(a->c[0] + l);
+        vreal aj = vr_load(a->c[1] + l);
+        vreal ak = vr_load(a->c[2] + l);
+        vreal bi = vr_load(b->c[0] + l);
+        vreal bj = vr_load(b->c[1] + l);
+        vreal bk = vr_load(b->c[2] + l);
+        vr_store(d->c[0] + l, vr_sub(vr_mul(aj, bk), vr_mul(ak, bj)));
+        vr_store(d->c[1] + l,
+            vr_xor(vr_sub(vr_mul(ai, bk), vr_mul(ak, bi)), sign));
+        vr_store(d->c[2] + l, vr_sub(vr_mul(ai, bj), vr_mul(aj, bi)));
+    }
+#endif
+    for(; l < m; l++) {
+        vector u = { a->c[0][l], a->c[1][l], a->c[2][l] };
+        vector v = { b->c[0][l], b->c[1][l], b->c[2][l] };
+        vector c = vec_cross(u, v);
+        d->c[0][l] = c.i;
+        d->c[1][l] = c.j;
+        d->c[2][l] = c.k;
+    }
+}
+
+/**
+ * @brief Runs a builtin's step over a block, one vector at a time with the
+ * same function the builtin uses
+ *
+ * @param s
+ * @param d
+ * @param a
+ * @param b
+ * @param m
+ */
+static void block_builtin(fuse_step* s, fuse_register* d, fuse_register* a,
+    fuse_register* b, int m) {
+    int comps = d->scalar ? 1 : 3;
+    for(int l = 0; l < m; l++) {
+        vector v = { a->c[0][l], 0, 0 };
+        if(!a->scalar) {
+            v.j = a->c[1][l];
+            v.k = a->c[2][l];
+        }
+        if(s->op == FUSE_NORM) {
+            d->c[0][l] = vec_norm(v);
+        } else if(s->op == FUSE_NORMALIZE) {
+            vector u = vec_normalize(v);
+            d->c[0][l] = u.i;
+            d->c[1][l] = u.j;
+            d->c[2][l] = u.k;
+        } else {
+            for(int x = 0; x < comps; x++) {
+                real e = component(a, x)[l];
+                if(s->op == FUSE_ABS) {
+                    d->c[x][l] = fabs(e);
+                } else if(s->op == FUSE_SQRT) {
+                    d->c[x][l] = sqrt(e);
+                } else if(s->op == FUSE_MIN) {
+                    d->c[x][l] = fmin(e, component(b, x)[l]);
+                } else {
+                    d->c[x][l] = fmax(e, component(b, x)[l]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Runs one step over a block
+ *
+ * @param f
+ * @param s
+ * @param m
+ */
+static void run_step(fused* f, fuse_step* s, int m) {
+    fuse_register* d = &f->regs[s->dst];
+    fuse_register* a = &f->regs[s->a];
+    fuse_register* b = s->b >= 0 ? &f->regs[s->b] : NULL;
+    int comps = d->scalar ? 1 : 3;
+    switch(s->op) {
+        case FUSE_ADD:
+            for(int x = 0; x < comps; x++) {
+                combine_add(d->c[x], component(a, x), component(b, x), m);
+            }
+            break;
+        case FUSE_SUB:
+            for(int x = 0; x < comps; x++) {
+                combine_sub(d->c[x], component(a, x), component(b, x), m);
+            }
+            break;
+        case FUSE_MUL:
+            for(int x = 0; x < comps; x++) {
+                combine_mul(d->c[x], component(a, x), component(b, x), m);
+            }
+            break;
+        case FUSE_DIV:
+            for(int x = 0; x < comps; x++) {
+                combine_div(d->c[x], component(a, x), component(b, x), m);
+            }
+            break;
+        case FUSE_DOT:
+            block_dot(d->c[0], a, b, m);
+            break;
+        case FUSE_CROSS:
+            block_cross(d, a, b, m);
+            break;
+        default:
+            block_builtin(s, d, a, b, m);
+            break;
+    }
+}
+
+/**
+ * @brief Maps a fused expression over n vectors in place, block vectors
+ * at a time. Scalar results are stored in the i field, like map.
+ *
+ * @param f
+ * @param data
+ * @param n
+ * @param block FUSE_BLOCK, or n to run each step over every vector
+ * before the next, with a whole temporary array per step
+ */
+void run_fused(fused* f, vector_array data, int n, int block) {
+    block = block < 1 ? 1 : block;
+    real* space = malloc((long)f->count * 3 * block * sizeof(real));
+    for(int r = 0; r < f->count; r++) {
+        fuse_register* reg = &f->regs[r];
+        for(int x = 0; x < 3; x++) {
+            reg->c[x] = space + ((long)r * 3 + x) * block;
+        }
+        if(reg->kind == REG_CONSTANT) {
+            real c[3] = { reg->constant.i, reg->constant.j,
+                reg->constant.k };
+            for(int x = 0; x < 3; x++) {
+                for(int l = 0; l < block; l++) {
+                    reg->c[x][l] = c[x];
+                }
+            }
+        }
+    }
+
+    fuse_register* input = &f->regs[0];
+    fuse_register* result = &f->regs[f->result];
+    real* out[3] = { data.i, data.j, data.k };
+    for(int at = 0; at < n; at += block) {
+        int m = n - at < block ? n - at : block;
+        for(int x = 0; x < 3; x++) {
+            input->c[x] = out[x] + at;
+        }
+        for(int s = 0; s < f->step_count; s++) {
+            run_step(f, &f->steps[s], m);
+        }
+        if(result == input) {
+            continue;
+        }
+        for(int x = 0; x < 3; x++) {
+            if(x == 0 || !result->scalar) {
+                memcpy(out[x] + at, result->c[x], m * sizeof(real));
+            } else {
+                memset(out[x] + at, 0, m * sizeof(real));
+            }
+        }
+    }
+    free(space);
+}
+
+/**
+ * @brief Returns how many steps a fused expression has
+ *
+ * @param f
+ * @return int
+ */
+int fused_steps(fused* f) {
+    return f->step_count;
+}
+
+/**
+ * @brief Returns how many component arrays are read or written per vector
+ * if each step goes through memory: the steps' operands and results, and
+ * reading the input and writing the result once
+ *
+ * @param f
+ * @return int
+ */
+int fused_passes(fused* f) {
+    int passes = 6;
+    for(int s = 0; s < f->step_count; s++) {
+        fuse_step* step = &f->steps[s];
+        passes += f->regs[step->dst].scalar ? 1 : 3;
+        passes += f->regs[step->a].scalar ? 1 : 3;
+        if(step->b >= 0) {
+            passes += f->regs[step->b].scalar ? 1 : 3;
+        }
+    }
+    return passes;
+}
+
+/**
+ * @brief Frees a fused expression
+ *
+ * @param f
+ */
+void free_fused(fused* f) {
+    free(f->steps);
+    free(f);
+}
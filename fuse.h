@@ -0,0 +1,25 @@
+#ifndef FUSE_H
+#define FUSE_H
+
+    #include "ast.h"
+
+    /*
+     * Fused map expressions. An element-wise expression over _ is
+     * compiled once into a list of steps over blocks of vectors, so map
+     * reads and writes each vector once however long the expression is.
+     */
+
+    // vectors worked on at a time, so a block's registers stay in cache
+    #define FUSE_BLOCK 256
+    // most registers an expression can use, constants included
+    #define FUSE_REGISTERS 32
+
+    typedef struct fused fused;
+
+    fused* fuse_expression(node* expr, int slot, value* frame);
+    void run_fused(fused* f, vector_array data, int n, int block);
+    int fused_steps(fused* f);
+    int fused_passes(fused* f);
+    void free_fused(fused* f);
+
+#endif
@@ -0,0 +1,383 @@
+/**
+ * @file gen.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Synthetic tables, gen 1000000 seed 7 normal. Rows are made in
+ * blocks of GEN_BLOCK, each from a xoshiro256** generator seeded from
+ * the seed and the block's number, so a block comes out the same no
+ * matter which thread makes it. Up to GEN_THREADS threads make the blocks
+ * of a round and the round is stored with one insert_vectors.
+ *
+ * A name is a function of the seed and a name number alone. Its first
+ * characters are the number scrambled and written in base 62 (a letter
+ * first, so the REPL can use it, and never X, which it reads as the
+ * cross product), wide enough to tell every row apart, so names never
+ * collide by accident. A row only shares a name when it is picked to
+ * repeat an earlier row's. The rest of a name, up to its length, is
+ * random characters from a generator seeded by the number. A name that
+ * comes out as a command or keyword gets a 0 added.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "gen.h"
+#include "ast.h"
+#include "pool.h"
+#include "vectable.h"
+#include "wal.h"
+
+static const char* dist_names[GEN_DIST_COUNT] = { "uniform", "normal", "sphere" };
+// first characters: the lexer reads a leading X as the cross product
+static const char letters[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWYZ";
+static const char alnum[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+typedef struct {
+    unsigned long long s[4];
+} xoshiro;
+
+// the blocks of one round and the next one not yet started
+typedef struct {
+    gen_options* o;
+    long first_block;
+    int blocks;
+    atomic_int next;
+    char* text;
+    char** names;
+    vector* values;
+} gen_round;
+
+/**
+ * @brief Sets o to the defaults: uniform components in -1 to 1, unique
+ * 8 character names, seed 1
+ *
+ * @param o
+ */
+void gen_defaults(gen_options* o) {
+    o->count = 0;
+    o->seed = 1;
+    o->dist = GEN_UNIFORM;
+    o->scale = 1;
+    o->min_length = 8;
+    o->max_length = 8;
+    o->repeat = 0;
+}
+
+/**
+ * @brief Sets the distribution of o's components by name
+ *
+ * @param o
+ * @param name uniform, normal or sphere
+ * @return int 0, or -1 if there's no such distribution
+ */
+int set_gen_dist(gen_options* o, char* name) {
+    for(int x = 0; x < GEN_DIST_COUNT; x++) {
+        if(!strcmp(name, dist_names[x])) {
+            o->dist = x;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Advances a splitmix64 state and returns its next output, used
+ * to seed the other generators
+ *
+ * @param state
+ * @return unsigned long long
+ */
+static unsigned long long splitmix(unsigned long long* state) {
+    unsigned long long z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Seeds a xoshiro256** generator from a seed and a stream number
+ *
+ * @param r
+ * @param seed
+ * @param stream
+ */
+static void seed_xoshiro(xoshiro* r, unsigned long long seed,
+    unsigned long long stream) {
+    unsigned long long state = seed ^ (stream * 0xd1b54a32d192ed03ull);
+    for(int x = 0; x < 4; x++) {
+        r->s[x] = splitmix(&state);
+    }
+}
+
+/**
+ * @brief Returns the next 64 bits of a xoshiro256** generator
+ *
+ * @param r
+ * @return unsigned long long
+ */
+static unsigned long long next_bits(xoshiro* r) {
+    unsigned long long* s = r->s;
+    unsigned long long x = s[1] * 5;
+    unsigned long long result = ((x << 7) | (x >> 57)) * 9;
+    unsigned long long t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/**
+ * @brief Returns a uniform double in [0, 1)
+ *
+ * @param r
+ * @return double
+ */
+static double next_double(xoshiro* r) {
+    return (next_bits(r) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * @brief Returns two independent standard normal numbers, by Marsaglia's
+ * polar method
+ *
+ * @param r
+ * @param a
+ * @param b
+ */
+static void next_normals(xoshiro* r, double* a, double* b) {
+    double u, v, s;
+    do {
+        u = next_double(r) * 2 - 1;
+        v = next_double(r) * 2 - 1;
+        s = u * u + v * v;
+    } while(s >= 1 || s == 0);
+    double m = sqrt(-2 * log(s) / s);
+    *a = u * m;
+    *b = v * m;
+}
+
+/**
+ * @brief Returns a vector drawn from o's distribution
+ *
+ * @param o
+ * @param r
+ * @return vector
+ */
+static vector next_vector(gen_options* o, xoshiro* r) {
+    double c[4];
+    if(o->dist == GEN_UNIFORM) {
+        for(int x = 0; x < 3; x++) {
+            c[x] = (next_double(r) * 2 - 1) * o->scale;
+        }
+        return (vector){ c[0], c[1], c[2] };
+    }
+
+    double length;
+    do {
+        next_normals(r, &c[0], &c[1]);
+        next_normals(r, &c[2], &c[3]);
+        length = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+    } while(o->dist == GEN_SPHERE && length == 0);
+    double scale = o->dist == GEN_SPHERE ? o->scale / length : o->scale;
+    return (vector){ c[0] * scale, c[1] * scale, c[2] * scale };
+}
+
+/**
+ * @brief Returns how many bits it takes to number count rows
+ *
+ * @param count
+ * @return int
+ */
+static int name_bits(long count) {
+    int bits = 1;
+    while((1l << bits) < count) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * @brief Returns how many characters it takes to write any number of
+ * bits bits: one of the 51 first letters, then base 62 digits
+ *
+ * @param bits
+ * @return int
+ */
+static int core_width(int bits) {
+    int width = 1;
+    double values = 51;
+    while(values < (double)(1l << bits)) {
+        values *= 62;
+        width++;
+    }
+    return width;
+}
+
+/**
+ * @brief Returns true if name is lowercase letters only, as every
+ * command, builtin and keyword is, so few names need is_reserved
+ *
+ * @param name
+ * @return int
+ */
+static int all_lowercase(char* name) {
+    for(; *name; name++) {
+        if(*name < 'a' || *name > 'z') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Writes name number n into name, with its terminator
+ *
+ * @param o
+ * @param n
+ * @param bits from name_bits, for o->count
+ * @param width from core_width, for bits
+ * @param name room for GEN_NAME characters and the terminator
+ */
+static void make_name(gen_options* o, long n, int bits, int width,
+    char* name) {
+    // an odd multiply, an xorshift and another multiply, each of which
+    // can be undone, so different numbers stay different
+    unsigned long long mask = (1ull << bits) - 1;
+    unsigned long long v = ((unsigned long long)n * 0x9e3779b97f4a7c15ull)
+        & mask;
+    v ^= v >> (bits / 2 + 1);
+    v = (v * 0xbf58476d1ce4e5b9ull) & mask;
+
+    name[0] = letters[v % 51];
+    v /= 51;
+    for(int x = 1; x < width; x++) {
+        name[x] = alnum[v % 62];
+        v /= 62;
+    }
+
+    xoshiro r;
+    seed_xoshiro(&r, o->seed, ~(unsigned long long)n);
+    unsigned long long bits_left = next_bits(&r);
+    int length = o->min_length
+        + bits_left % (o->max_length - o->min_length + 1);
+    for(int x = width; x < length; x++) {
+        name[x] = alnum[next_bits(&r) % 62];
+    }
+    int end = length > width ? length : width;
+    name[end] = '\0';
+    // the first width characters still tell it apart from every other
+    while(all_lowercase(name) && is_reserved(name)) {
+        name[end++] = '0';
+        name[end] = '\0';
+    }
+}
+
+/**
+ * @brief Makes the rows of block block: names into text, GEN_NAME + 1
+ * bytes apart, and pointers to them into names
+ *
+ * @param o
+ * @param block
+ * @param text room for GEN_BLOCK names
+ * @param names room for GEN_BLOCK rows
+ * @param values room for GEN_BLOCK rows
+ */
+void gen_block(gen_options* o, long block, char* text, char** names,
+    vector* values) {
+    xoshiro r;
+    seed_xoshiro(&r, o->seed, block);
+    int bits = name_bits(o->count);
+    int width = core_width(bits);
+    long first = block * GEN_BLOCK;
+    long end = first + GEN_BLOCK < o->count ? first + GEN_BLOCK : o->count;
+    for(long row = first; row < end; row++) {
+        int x = row - first;
+        long n = row;
+        if(o->repeat > 0 && row > 0 && next_double(&r) < o->repeat) {
+            n = next_bits(&r) % row;
+        }
+        names[x] = text + (long)x * (GEN_NAME + 1);
+        make_name(o, n, bits, width, names[x]);
+        values[x] = next_vector(o, &r);
+    }
+}
+
+/**
+ * @brief Makes blocks of a round until none are left
+ *
+ * @param arg the gen_round
+ * @return void*
+ */
+static void* make_blocks(void* arg) {
+    gen_round* g = arg;
+    int b;
+    while((b = atomic_fetch_add(&g->next, 1)) < g->blocks) {
+        long at = (long)b * GEN_BLOCK;
+        gen_block(g->o, g->first_block + b, g->text + at * (GEN_NAME + 1),
+            g->names + at, g->values + at);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Makes o->count rows and stores them, a round of GEN_ROUND blocks
+ * at a time, as one group in the log
+ *
+ * @param o
+ * @return long number of rows stored
+ */
+long gen_vectors(gen_options* o) {
+    long rows = GEN_ROUND * GEN_BLOCK;
+    rows = rows < o->count ? rows : o->count;
+    gen_round g;
+    g.o = o;
+    g.text = malloc((rows + 1) * (GEN_NAME + 1));
+    g.names = malloc((rows + 1) * sizeof(char*));
+    g.values = malloc((rows + 1) * sizeof(vector));
+
+    int threads = pool_threads(GEN_THREADS);
+
+    reserve_vectable(o->count);
+    wal_begin();
+    long blocks = (o->count + GEN_BLOCK - 1) / GEN_BLOCK;
+    for(long first = 0; first < blocks; first += GEN_ROUND) {
+        g.first_block = first;
+        g.blocks = blocks - first < GEN_ROUND ? blocks - first : GEN_ROUND;
+        g.next = 0;
+        run_threads(make_blocks, &g, threads < g.blocks ? threads : g.blocks);
+
+        long end = (first + g.blocks) * GEN_BLOCK;
+        end = end < o->count ? end : o->count;
+        insert_vectors(g.names, g.values, end - first * GEN_BLOCK);
+    }
+    wal_end();
+
+    free(g.text);
+    free(g.names);
+    free(g.values);
+    return o->count;
+}
+
+/**
+ * @brief Inserts size random vectors into the table, as gen with the
+ * default options does
+ *
+ * @param size
+ */
+void fill_vectable(int size) {
+    gen_options o;
+    gen_defaults(&o);
+    o.count = size;
+    gen_vectors(&o);
+}
@@ -0,0 +1,44 @@
+#ifndef GEN_H
+#define GEN_H
+
+    #include "vec.h"
+
+    /*
+     * Synthetic tables for testing, made with gen. The same seed and
+     * options give the same rows on any machine and any number of threads.
+     */
+
+    // rows made from one seeding of the generator
+    #define GEN_BLOCK 65536
+    // blocks made and stored at a time
+    #define GEN_ROUND 16
+    // most threads making rows at once
+    #define GEN_THREADS 8
+    // longest name gen makes
+    #define GEN_NAME 63
+
+    typedef enum {
+        GEN_UNIFORM,    // each component between -scale and scale
+        GEN_NORMAL,     // each component normal, standard deviation scale
+        GEN_SPHERE,     // a random direction, length scale
+        GEN_DIST_COUNT,
+    } gen_dist;
+
+    typedef struct {
+        long count;
+        unsigned long long seed;
+        gen_dist dist;
+        double scale;
+        int min_length;     // name lengths are uniform between these
+        int max_length;
+        double repeat;      // fraction of rows reusing an earlier row's name
+    } gen_options;
+
+    void gen_defaults(gen_options* o);
+    int set_gen_dist(gen_options* o, char* name);
+    void gen_block(gen_options* o, long block, char* text, char** names,
+        vector* values);
+    long gen_vectors(gen_options* o);
+    void fill_vectable(int size);
+
+#endif
@@ -0,0 +1,360 @@
+/**
+ * @file import.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Imports of many files at once, read "shards_*.csv". The pattern is
+ * expanded with glob, sorted by name, and the files are parsed by up to
+ * IMPORT_THREADS threads, each taking the next file not yet started, into
+ * readers of their own. Nothing is stored until every file has parsed;
+ * the rows are then merged into one list in the order set conflict asks
+ * for and stored with a single insert_vectors, which sizes the table once
+ * for all of them.
+ *
+ * Packed tables can be mixed in with the csv files; they are recognised
+ * the same way read recognises them.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include "import.h"
+#include "pool.h"
+#include "vectable.h"
+#include "csv.h"
+#include "pack.h"
+
+static const char* conflict_names[CONFLICT_COUNT] = { "last", "first", "error" };
+static conflict_policy conflict = CONFLICT_LAST;
+
+// one file of an import
+typedef struct {
+    char* path;
+    int packed;
+    int result;         // 0, -1 if it can't be read, -2 if it's bad
+    csv_reader csv;
+    pack_rows pack;
+    char** names;
+    vector* values;
+    int count;
+} shard;
+
+// the files of an import and the next one to parse
+typedef struct {
+    shard* shards;
+    int count;
+    atomic_int next;
+} shard_queue;
+
+/**
+ * @brief Returns true if path is a pattern for glob rather than one file:
+ * it has a *, ? or [ and no file has exactly that name, so a file like
+ * data[1].csv is still read as itself
+ *
+ * @param path
+ * @return int
+ */
+int is_glob(char* path) {
+    struct stat st;
+    return strpbrk(path, "*?[") != NULL
+        && (stat(path, &st) < 0 || S_ISDIR(st.st_mode));
+}
+
+/**
+ * @brief Sets what an import does with a name it finds more than once
+ *
+ * @param name last, first or error
+ * @return int 0, or -1 if there's no such policy
+ */
+int set_conflict(char* name) {
+    for(int x = 0; x < CONFLICT_COUNT; x++) {
+        if(!strcmp(name, conflict_names[x])) {
+            conflict = x;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Returns the name of the current conflict policy
+ *
+ * @return char*
+ */
+char* conflict_name(void) {
+    return (char*)conflict_names[conflict];
+}
+
+/**
+ * @brief Parses one file, csv or packed
+ *
+ * @param s
+ */
+static void parse_shard(shard* s) {
+    s->packed = is_packed(s->path);
+    if(s->packed) {
+        s->result = unpack_file(s->path, &s->pack);
+        if(s->result == 0) {
+            s->names = s->pack.keys;
+            s->values = s->pack.values;
+            s->count = s->pack.count;
+        }
+    } else {
+        s->result = csv_read(s->path, &s->csv);
+        if(s->result == 0) {
+            s->names = csv_names(&s->csv);
+            s->values = s->csv.values;
+            s->count = s->csv.count;
+        }
+    }
+}
+
+/**
+ * @brief Parses files from the queue until none are left
+ *
+ * @param arg the shard_queue
+ * @return void*
+ */
+static void* parse_shards(void* arg) {
+    shard_queue* q = arg;
+    int x;
+    while((x = atomic_fetch_add(&q->next, 1)) < q->count) {
+        parse_shard(&q->shards[x]);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Frees what a file's parse left behind
+ *
+ * @param s
+ */
+static void free_shard(shard* s) {
+    if(s->packed && s->result == 0) {
+        free_pack_rows(&s->pack);
+    } else if(!s->packed) {
+        if(s->result == 0) {
+            free(s->names);
+        }
+        csv_free(&s->csv);
+    }
+    free(s->path);
+}
+
+/**
+ * @brief Returns a hash of name for finding repeats, FNV-1a
+ *
+ * @param name
+ * @return unsigned int
+ */
+static unsigned int hash_name(char* name) {
+    unsigned int hash = 2166136261u;
+    for(; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Finds the first row whose name is on an earlier row too
+ *
+ * @param names
+ * @param count
+ * @param earlier set to the earlier row
+ * @return int the row, or -1 if every name is on one row
+ */
+static int find_repeat(char** names, int count, int* earlier) {
+    int capacity = 16;
+    while(capacity < count * 2) {
+        capacity *= 2;
+    }
+    int* seen = malloc(capacity * sizeof(int));
+    memset(seen, -1, capacity * sizeof(int));
+    int repeat = -1;
+    for(int x = 0; x < count && repeat < 0; x++) {
+        unsigned int slot = hash_name(names[x]) & (capacity - 1);
+        while(seen[slot] >= 0 && strcmp(names[seen[slot]], names[x])) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if(seen[slot] >= 0) {
+            *earlier = seen[slot];
+            repeat = x;
+        }
+        seen[slot] = x;
+    }
+    free(seen);
+    return repeat;
+}
+
+/**
+ * @brief Returns the file that merged row x came from
+ *
+ * @param rows
+ * @param x
+ * @return shard*
+ */
+static shard* shard_of(import_rows* rows, int x) {
+    shard* shards = rows->shards;
+    int at = 0;
+    int s = 0;
+    while(at + shards[s].count <= x) {
+        at += shards[s++].count;
+    }
+    return &shards[s];
+}
+
+/**
+ * @brief Merges the parsed files' rows into one list: in file and line
+ * order, backwards when the first row is to win, since a later row
+ * overwrites an earlier one when stored
+ *
+ * @param rows
+ * @return int 0, or -1 if a name repeats and repeats aren't allowed
+ */
+static int merge_shards(import_rows* rows) {
+    shard* shards = rows->shards;
+    long total = 0;
+    for(int s = 0; s < rows->shard_count; s++) {
+        total += shards[s].count;
+    }
+    rows->names = malloc((total + 1) * sizeof(char*));
+    rows->values = malloc((total + 1) * sizeof(vector));
+    rows->count = total;
+
+    int at = 0;
+    for(int s = 0; s < rows->shard_count; s++) {
+        memcpy(rows->names + at, shards[s].names,
+            shards[s].count * sizeof(char*));
+        memcpy(rows->values + at, shards[s].values,
+            shards[s].count * sizeof(vector));
+        at += shards[s].count;
+    }
+
+    if(conflict == CONFLICT_FIRST) {
+        for(int x = 0, y = rows->count - 1; x < y; x++, y--) {
+            char* name = rows->names[x];
+            rows->names[x] = rows->names[y];
+            rows->names[y] = name;
+            vector value = rows->values[x];
+            rows->values[x] = rows->values[y];
+            rows->values[y] = value;
+        }
+    } else if(conflict == CONFLICT_ERROR) {
+        int earlier;
+        int repeat = find_repeat(rows->names, rows->count, &earlier);
+        if(repeat >= 0) {
+            snprintf(rows->error, IMPORT_ERROR,
+                "%s is in both %s and %s, nothing was read",
+                rows->names[repeat], shard_of(rows, earlier)->path,
+                shard_of(rows, repeat)->path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses every file matching pattern, without storing anything
+ *
+ * @param pattern
+ * @param rows filled in; free with free_import whatever the result
+ * @return int number of rows, -1 if no file matches or one can't be read,
+ * or -2 if a file is bad or a name repeats when set conflict is error.
+ * rows->error says which.
+ */
+int import_glob(char* pattern, import_rows* rows) {
+    memset(rows, 0, sizeof(import_rows));
+    glob_t g;
+    // GLOB_MARK ends directories in a / so they can be left out
+    if(glob(pattern, GLOB_MARK, NULL, &g) != 0) {
+        snprintf(rows->error, IMPORT_ERROR, "No files match %s", pattern);
+        return -1;
+    }
+    shard* shards = calloc(g.gl_pathc, sizeof(shard));
+    int count = 0;
+    for(size_t x = 0; x < g.gl_pathc; x++) {
+        size_t length = strlen(g.gl_pathv[x]);
+        if(length > 0 && g.gl_pathv[x][length - 1] != '/') {
+            shards[count++].path = strdup(g.gl_pathv[x]);
+        }
+    }
+    globfree(&g);
+    rows->shards = shards;
+    rows->shard_count = count;
+    rows->files = count;
+    if(count == 0) {
+        snprintf(rows->error, IMPORT_ERROR, "No files match %s", pattern);
+        return -1;
+    }
+
+    shard_queue q = { shards, count, 0 };
+    int threads = pool_threads(IMPORT_THREADS);
+    run_threads(parse_shards, &q, threads < count ? threads : count);
+
+    for(int s = 0; s < count; s++) {
+        if(shards[s].result == -1) {
+            snprintf(rows->error, IMPORT_ERROR, "Could not read %s",
+                shards[s].path);
+            return -1;
+        } else if(shards[s].result == -2 && shards[s].packed) {
+            snprintf(rows->error, IMPORT_ERROR,
+                "%s is damaged, nothing was read", shards[s].path);
+            return -2;
+        } else if(shards[s].result == -2) {
+            snprintf(rows->error, IMPORT_ERROR,
+                "Bad line at line %d of %s, nothing was read",
+                shards[s].csv.line, shards[s].path);
+            return -2;
+        }
+    }
+    if(merge_shards(rows) < 0) {
+        return -2;
+    }
+    return rows->count;
+}
+
+/**
+ * @brief Frees the rows of an import and the files they came from
+ *
+ * @param rows
+ */
+void free_import(import_rows* rows) {
+    shard* shards = rows->shards;
+    for(int s = 0; s < rows->shard_count; s++) {
+        free_shard(&shards[s]);
+    }
+    free(shards);
+    free(rows->names);
+    free(rows->values);
+    rows->shards = NULL;
+    rows->names = NULL;
+    rows->values = NULL;
+}
+
+/**
+ * @brief Reads every file matching pattern into the table, all at once
+ *
+ * @param pattern
+ * @param files set to the number of files read
+ * @return int number of rows stored, or -2 if nothing was, after saying
+ * why
+ */
+int read_glob(char* pattern, int* files) {
+    import_rows rows;
+    int read = import_glob(pattern, &rows);
+    if(read < 0) {
+        printf("Error: %s\n", rows.error);
+        read = -2;
+    } else {
+        insert_vectors(rows.names, rows.values, rows.count);
+    }
+    *files = rows.files;
+    free_import(&rows);
+    return read;
+}
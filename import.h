@@ -0,0 +1,43 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+    #include "vec.h"
+
+    /*
+     * Reads many files at once, as read "shards_*.csv": each file matched is
+     * parsed on a thread of its own and the rows of all of them are
+     * stored together.
+     */
+
+    // most threads parsing files at once
+    #define IMPORT_THREADS 8
+    // longest import error message
+    #define IMPORT_ERROR 512
+
+    // what happens when a name is in more than one row of an import
+    typedef enum {
+        CONFLICT_LAST,      // the last row wins, files taken in name order
+        CONFLICT_FIRST,     // the first row wins
+        CONFLICT_ERROR,     // nothing is read
+        CONFLICT_COUNT,
+    } conflict_policy;
+
+    // the rows of every file, merged in the order they are to be stored
+    typedef struct {
+        char** names;
+        vector* values;
+        int count;
+        int files;
+        char error[IMPORT_ERROR];   // why the import failed
+        void* shards;               // the parsed files the rows point into
+        int shard_count;
+    } import_rows;
+
+    int is_glob(char* path);
+    int import_glob(char* pattern, import_rows* rows);
+    void free_import(import_rows* rows);
+    int read_glob(char* pattern, int* files);
+    int set_conflict(char* name);
+    char* conflict_name(void);
+
+#endif
@@ -0,0 +1,576 @@
+/**
+ * @file index.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Ordered index of variable names, kept next to the hash table so
+ * names can be listed in order and walked by prefix without visiting
+ * every slot. A B+tree whose leaves are linked left to right; the keys
+ * are copied into an arena the index owns, so they stay put when the
+ * table moves its own copies around.
+ *
+ * Each key in a node carries its first 8 bytes packed big-endian, so most
+ * comparisons are one integer compare instead of a strcmp through a
+ * pointer.
+ *
+ * New names are only appended to a pending list, which keeps inserting
+ * into the table fast. The next seek radix sorts the list and merges it:
+ * one at a time if it is small next to the tree, otherwise by rebuilding
+ * the tree from the merged sorted keys, which is linear.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "index.h"
+
+// arena blocks are at least this large
+#define ARENA_BLOCK (1 << 16)
+// nodes built from sorted keys are left this full, leaving room to insert
+#define BULK_FILL (INDEX_ORDER * 3 / 4)
+// pending keys are inserted one at a time below 1 / MERGE_RATIO of the tree
+#define MERGE_RATIO 8
+// pending lists longer than this are freed once merged
+#define PENDING_KEPT 4096
+
+typedef struct {
+    unsigned long long head;    // first 8 bytes, big-endian
+    char* name;
+} index_key;
+
+struct index_node {
+    int leaf;
+    int count;
+    index_key keys[INDEX_ORDER];
+    union {
+        index_node* children[INDEX_ORDER + 1];  // internal nodes
+        index_node* next;                       // leaves
+    };
+};
+
+typedef struct arena_block arena_block;
+struct arena_block {
+    arena_block* previous;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static index_node* root = NULL;
+static long size = 0;
+static long nodes = 0;
+static arena_block* arena = NULL;
+static long arena_bytes = 0;
+static index_key* pending = NULL;
+static long pending_count = 0;
+static long pending_capacity = 0;
+
+/**
+ * @brief Copies name into the arena
+ *
+ * @param name
+ * @return char* the copy
+ */
+static char* arena_copy(char* name) {
+    size_t length = strlen(name) + 1;
+    if(arena == NULL || arena->used + length > arena->size) {
+        size_t block_size = length > ARENA_BLOCK ? length : ARENA_BLOCK;
+        arena_block* block = malloc(sizeof(arena_block) + block_size);
+        block->previous = arena;
+        block->used = 0;
+        block->size = block_size;
+        arena = block;
+        arena_bytes += sizeof(arena_block) + block_size;
+    }
+    char* copy = arena->data + arena->used;
+    memcpy(copy, name, length);
+    arena->used += length;
+    return copy;
+}
+
+/**
+ * @brief Returns a key for name, without copying it
+ *
+ * @param name
+ * @return index_key
+ */
+static index_key make_key(char* name) {
+    index_key k = { 0, name };
+    for(int i = 0; i < 8 && name[i] != '\0'; i++) {
+        k.head |= (unsigned long long)(unsigned char)name[i] << (56 - 8 * i);
+    }
+    return k;
+}
+
+/**
+ * @brief Compares two keys in strcmp order
+ *
+ * @param a
+ * @param b
+ * @return int
+ */
+static int compare_keys(index_key a, index_key b) {
+    if(a.head != b.head) {
+        return a.head < b.head ? -1 : 1;
+    }
+    return strcmp(a.name, b.name);
+}
+
+/**
+ * @brief Compares two keys for qsort
+ *
+ * @param a
+ * @param b
+ * @return int
+ */
+static int compare_pending(const void* a, const void* b) {
+    return compare_keys(*(const index_key*)a, *(const index_key*)b);
+}
+
+/**
+ * @brief Sorts count keys. A radix sort on the heads, one byte per pass,
+ * skipping bytes every key shares; then runs with equal heads, which 
+ * only long names sharing their first 8 bytes have, are sorted by name.
+ *
+ * @param keys
+ * @param count
+ */
+static void sort_keys(index_key* keys, long count) {
+    index_key* buffer = malloc(count * sizeof(index_key));
+    index_key* from = keys;
+    index_key* to = buffer;
+    for(int shift = 0; shift < 64; shift += 8) {
+        long offsets[256] = { 0 };
+        for(long i = 0; i < count; i++) {
+            offsets[(from[i].head >> shift) & 0xff]++;
+        }
+        if(offsets[(from[0].head >> shift) & 0xff] == count) {
+            continue;
+        }
+        long total = 0;
+        for(int b = 0; b < 256; b++) {
+            long bucket = offsets[b];
+            offsets[b] = total;
+            total += bucket;
+        }
+        for(long i = 0; i < count; i++) {
+            to[offsets[(from[i].head >> shift) & 0xff]++] = from[i];
+        }
+        index_key* swap = from;
+        from = to;
+        to = swap;
+    }
+    if(from != keys) {
+        memcpy(keys, from, count * sizeof(index_key));
+    }
+    free(buffer);
+
+    long start = 0;
+    for(long i = 1; i <= count; i++) {
+        if(i == count || keys[i].head != keys[start].head) {
+            if(i - start > 1) {
+                qsort(&keys[start], i - start, sizeof(index_key), 
+                    compare_pending);
+            }
+            start = i;
+        }
+    }
+}
+
+/**
+ * @brief Allocates an empty node
+ *
+ * @param leaf 1 for a leaf, 0 for an internal node
+ * @return index_node*
+ */
+static index_node* new_node(int leaf) {
+    index_node* n = malloc(sizeof(index_node));
+    n->leaf = leaf;
+    n->count = 0;
+    nodes++;
+    return n;
+}
+
+/**
+ * @brief Returns the number of keys in n that sort before k
+ *
+ * @param n
+ * @param k
+ * @return int
+ */
+static int lower_bound(index_node* n, index_key k) {
+    int low = 0;
+    int high = n->count;
+    while(low < high) {
+        int middle = (low + high) / 2;
+        if(compare_keys(n->keys[middle], k) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Returns the child of internal node n whose range holds k.
+ * Separators are the first key of the child to their right, so a key
+ * equal to one belongs to the right.
+ *
+ * @param n
+ * @param k
+ * @return int
+ */
+static int child_for(index_node* n, index_key k) {
+    int low = 0;
+    int high = n->count;
+    while(low < high) {
+        int middle = (low + high) / 2;
+        if(compare_keys(n->keys[middle], k) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Inserts k below n. If n overflows it is split in half and the
+ * new right half is returned, with the key that separates them in
+ * separator.
+ *
+ * @param n
+ * @param k
+ * @param separator set when n splits
+ * @return index_node* the new right sibling, or NULL
+ */
+static index_node* insert_below(index_node* n, index_key k, index_key* separator) {
+    if(n->leaf) {
+        int position = lower_bound(n, k);
+        if(position < n->count && compare_keys(n->keys[position], k) == 0) {
+            return NULL;
+        }
+        memmove(&n->keys[position + 1], &n->keys[position],
+            (n->count - position) * sizeof(index_key));
+        n->keys[position] = k;
+        n->count++;
+        size++;
+    } else {
+        int child = child_for(n, k);
+        index_key middle;
+        index_node* right = insert_below(n->children[child], k, &middle);
+        if(right == NULL) {
+            return NULL;
+        }
+        memmove(&n->keys[child + 1], &n->keys[child],
+            (n->count - child) * sizeof(index_key));
+        memmove(&n->children[child + 2], &n->children[child + 1],
+            (n->count - child) * sizeof(index_node*));
+        n->keys[child] = middle;
+        n->children[child + 1] = right;
+        n->count++;
+    }
+
+    if(n->count < INDEX_ORDER) {
+        return NULL;
+    }
+
+    int half = n->count / 2;
+    index_node* right = new_node(n->leaf);
+    if(n->leaf) {
+        right->count = n->count - half;
+        memcpy(right->keys, &n->keys[half], right->count * sizeof(index_key));
+        right->next = n->next;
+        n->next = right;
+        *separator = right->keys[0];
+    } else {
+        // the middle key moves up rather than into either half
+        right->count = n->count - half - 1;
+        memcpy(right->keys, &n->keys[half + 1],
+            right->count * sizeof(index_key));
+        memcpy(right->children, &n->children[half + 1],
+            (right->count + 1) * sizeof(index_node*));
+        *separator = n->keys[half];
+    }
+    n->count = half;
+    return right;
+}
+
+/**
+ * @brief Inserts k into the tree
+ *
+ * @param k
+ */
+static void insert_key(index_key k) {
+    if(root == NULL) {
+        root = new_node(1);
+        root->next = NULL;
+    }
+    index_key separator;
+    index_node* right = insert_below(root, k, &separator);
+    if(right != NULL) {
+        index_node* top = new_node(0);
+        top->count = 1;
+        top->keys[0] = separator;
+        top->children[0] = root;
+        top->children[1] = right;
+        root = top;
+    }
+}
+
+/**
+ * @brief Frees n and everything below it
+ *
+ * @param n
+ */
+static void free_node(index_node* n) {
+    if(!n->leaf) {
+        for(int i = 0; i <= n->count; i++) {
+            free_node(n->children[i]);
+        }
+    }
+    free(n);
+}
+
+/**
+ * @brief Builds a tree bottom up from count sorted, distinct keys
+ *
+ * @param keys
+ * @param count
+ * @return index_node* the root, or NULL if count is 0
+ */
+static index_node* bulk_load(index_key* keys, long count) {
+    if(count == 0) {
+        return NULL;
+    }
+    long level_count = (count + BULK_FILL - 1) / BULK_FILL;
+    index_node** level = malloc(level_count * sizeof(index_node*));
+    // the smallest key below each node of the level, for separators
+    index_key* first = malloc(level_count * sizeof(index_key));
+
+    index_node* previous = NULL;
+    for(long l = 0; l < level_count; l++) {
+        index_node* leaf = new_node(1);
+        long start = l * BULK_FILL;
+        leaf->count = count - start < BULK_FILL ? count - start : BULK_FILL;
+        memcpy(leaf->keys, &keys[start], leaf->count * sizeof(index_key));
+        leaf->next = NULL;
+        if(previous != NULL) {
+            previous->next = leaf;
+        }
+        previous = leaf;
+        level[l] = leaf;
+        first[l] = keys[start];
+    }
+
+    while(level_count > 1) {
+        long parents = (level_count + BULK_FILL) / (BULK_FILL + 1);
+        for(long p = 0; p < parents; p++) {
+            index_node* parent = new_node(0);
+            long start = p * (BULK_FILL + 1);
+            long children = level_count - start < BULK_FILL + 1
+                ? level_count - start : BULK_FILL + 1;
+            for(long c = 0; c < children; c++) {
+                parent->children[c] = level[start + c];
+                if(c > 0) {
+                    parent->keys[c - 1] = first[start + c];
+                }
+            }
+            parent->count = children - 1;
+            level[p] = parent;
+            first[p] = first[start];
+        }
+        level_count = parents;
+    }
+
+    index_node* top = level[0];
+    free(level);
+    free(first);
+    return top;
+}
+
+/**
+ * @brief Merges the pending keys into the tree
+ *
+ */
+static void flush_pending(void) {
+    if(pending_count == 0) {
+        return;
+    }
+    sort_keys(pending, pending_count);
+
+    if(pending_count * MERGE_RATIO < size) {
+        for(long p = 0; p < pending_count; p++) {
+            insert_key(pending[p]);
+        }
+        pending_count = 0;
+        return;
+    }
+
+    // merge the leaves and the sorted pending keys, then rebuild
+    index_key* merged = malloc((size + pending_count) * sizeof(index_key));
+    index_node* leaf = root;
+    while(leaf != NULL && !leaf->leaf) {
+        leaf = leaf->children[0];
+    }
+    long count = 0;
+    long p = 0;
+    int position = 0;
+    while(leaf != NULL || p < pending_count) {
+        if(leaf != NULL && position >= leaf->count) {
+            leaf = leaf->next;
+            position = 0;
+            continue;
+        }
+        index_key k;
+        if(leaf == NULL
+            || (p < pending_count
+                && compare_keys(pending[p], leaf->keys[position]) < 0)) {
+            k = pending[p++];
+        } else {
+            k = leaf->keys[position++];
+        }
+        // a name inserted twice is kept once
+        if(count == 0 || compare_keys(merged[count - 1], k) != 0) {
+            merged[count++] = k;
+        }
+    }
+
+    if(root != NULL) {
+        free_node(root);
+    }
+    nodes = 0;
+    root = bulk_load(merged, count);
+    size = count;
+    free(merged);
+
+    // a large burst of inserts shouldn't keep its list around
+    pending_count = 0;
+    if(pending_capacity > PENDING_KEPT) {
+        free(pending);
+        pending = NULL;
+        pending_capacity = 0;
+    }
+}
+
+/**
+ * @brief Adds a name to the index. It is only merged into the tree by the
+ * next seek.
+ *
+ * @param name
+ */
+void index_insert(char* name) {
+    if(pending_count == pending_capacity) {
+        pending_capacity = pending_capacity ? pending_capacity * 2 : 1024;
+        pending = realloc(pending, pending_capacity * sizeof(index_key));
+    }
+    pending[pending_count++] = make_key(arena_copy(name));
+}
+
+/**
+ * @brief Removes a name from the index. Leaves are allowed to run low or
+ * empty; their separators still bound the names around them.
+ *
+ * @param name
+ */
+void index_remove(char* name) {
+    flush_pending();
+    index_node* n = root;
+    if(n == NULL) {
+        return;
+    }
+    index_key k = make_key(name);
+    while(!n->leaf) {
+        n = n->children[child_for(n, k)];
+    }
+    int position = lower_bound(n, k);
+    if(position < n->count && compare_keys(n->keys[position], k) == 0) {
+        memmove(&n->keys[position], &n->keys[position + 1],
+            (n->count - position - 1) * sizeof(index_key));
+        n->count--;
+        size--;
+    }
+}
+
+/**
+ * @brief Empties the index and releases its nodes and names
+ *
+ */
+void index_clear(void) {
+    if(root != NULL) {
+        free_node(root);
+        root = NULL;
+    }
+    while(arena != NULL) {
+        arena_block* previous = arena->previous;
+        free(arena);
+        arena = previous;
+    }
+    free(pending);
+    pending = NULL;
+    pending_count = 0;
+    pending_capacity = 0;
+    size = 0;
+    nodes = 0;
+    arena_bytes = 0;
+}
+
+/**
+ * @brief Returns a cursor on the first name that starts with prefix. An
+ * empty prefix walks every name. Inserting invalidates the cursor.
+ *
+ * @param prefix must outlive the cursor
+ * @return index_cursor
+ */
+index_cursor index_seek(char* prefix) {
+    flush_pending();
+    index_cursor c = { NULL, 0, prefix, strlen(prefix) };
+    index_node* n = root;
+    if(n == NULL) {
+        return c;
+    }
+    index_key k = make_key(prefix);
+    while(!n->leaf) {
+        n = n->children[child_for(n, k)];
+    }
+    c.leaf = n;
+    c.position = lower_bound(n, k);
+    return c;
+}
+
+/**
+ * @brief Returns the name under the cursor and moves past it
+ *
+ * @param c
+ * @return char* the name, or NULL once past the last name with the prefix
+ */
+char* index_next(index_cursor* c) {
+    while(c->leaf != NULL && c->position >= c->leaf->count) {
+        c->leaf = c->leaf->next;
+        c->position = 0;
+    }
+    if(c->leaf == NULL) {
+        return NULL;
+    }
+    char* name = c->leaf->keys[c->position].name;
+    if(strncmp(name, c->prefix, c->prefix_length) != 0) {
+        c->leaf = NULL;
+        return NULL;
+    }
+    c->position++;
+    return name;
+}
+
+/**
+ * @brief Returns the bytes held by the nodes, the names and the pending
+ * list
+ *
+ * @return long
+ */
+long index_memory(void) {
+    return nodes * (long)sizeof(index_node) + arena_bytes
+        + pending_capacity * (long)sizeof(index_key);
+}
@@ -0,0 +1,24 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+    // keys per node of the B+tree
+    #define INDEX_ORDER 32
+
+    typedef struct index_node index_node;
+
+    // walks the keys that start with prefix, in order
+    typedef struct {
+        index_node* leaf;
+        int position;
+        char* prefix;
+        int prefix_length;
+    } index_cursor;
+
+    void index_insert(char* name);
+    void index_remove(char* name);
+    void index_clear(void);
+    index_cursor index_seek(char* prefix);
+    char* index_next(index_cursor* c);
+    long index_memory(void);
+
+#endif
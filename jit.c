@@ -0,0 +1,681 @@
+/**
+ * @file jit.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Native code for hot expressions. A loop body or function run a
+ * million times walks the same tree a million times, making a value and
+ * dispatching through the operator table at every node. An expression
+ * made of arithmetic, dot and cross products, norm, abs, sqrt, constants,
+ * variables, slots and inlined calls can instead be compiled, once it is
+ * hot, to x86-64 SSE code written by hand into an mmap'd page, with no
+ * JIT library.
+ *
+ * Every node gets a register of four reals in memory: a vector's i, j
+ * and k and a spare lane, or a scalar copied into all four, so that + -
+ * * and / are one packed instruction whatever they mix, just as the
+ * operators splat a scalar mixed with a vector. Dot and cross products
+ * work a component at a time in the same order as vec_dot and vec_cross,
+ * so the code gives the same bits as the tree it replaces. The one
+ * exception is which NaN an operation on two NaNs gives back, which the
+ * C compiler leaves to operand order.
+ *
+ * The types of the variables and slots an expression reads are taken
+ * when it is compiled. Each run checks them first; if one has changed,
+ * or a variable is gone, the run is refused and the tree evaluated as
+ * before, errors and all.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "jit.h"
+#include "operators.h"
+#include "builtins.h"
+#include "vectable.h"
+
+#if defined(__x86_64__) && defined(__SSE2__)
+    #define JIT
+#endif
+
+// a register's reals; a vector uses the first three
+#define LANES 4
+
+// a variable or slot the expression reads, copied into its register
+// before each run
+typedef struct {
+    node* n;
+    int reg;
+    value_type type;
+} jit_leaf;
+
+struct jitted {
+    void (*code)(real* regs);
+    unsigned char* page;
+    long mapped;                // bytes mapped for the code
+    int code_bytes;
+    real* regs;                 // LANES reals per register
+    int count;
+    int result;
+    int scalar;                 // the result is a scalar
+    jit_leaf leaves[JIT_LEAVES];
+    int leaf_count;
+};
+
+#ifdef JIT
+
+/*
+ * SSE encodings. Packed and scalar forms of an instruction share an
+ * opcode and differ in prefix: none for ps, 66 for pd, F3 for ss and F2
+ * for sd. A double register takes two 16 byte xmm loads.
+ */
+#ifdef TRITONE_DOUBLE
+    #define PACKED 0x66
+    #define SCALAR 0xF2
+    #define CHUNKS 2
+#else
+    #define PACKED 0
+    #define SCALAR 0xF3
+    #define CHUNKS 1
+#endif
+
+#define SSE_LOAD    0x10
+#define SSE_STORE   0x11
+#define SSE_SQRT    0x51
+#define SSE_AND     0x54
+#define SSE_XOR     0x57
+#define SSE_ADD     0x58
+#define SSE_MUL     0x59
+#define SSE_SUB     0x5C
+#define SSE_DIV     0x5E
+
+#define REGISTER_BYTES (LANES * (int)sizeof(real))
+
+typedef struct {
+    unsigned char* code;
+    int size;
+    int capacity;
+} emitter;
+
+typedef struct {
+    jitted* j;
+    emitter e;
+    value* frame;
+    int bound[MAX_SLOTS];       // register an inlined call bound, or -1
+    int scalar[JIT_REGISTERS];
+    int sign;                   // register of -0s
+    int magnitude;              // register of everything but the sign
+} compiler;
+
+/**
+ * @brief Appends a byte of code
+ *
+ * @param e
+ * @param byte
+ */
+static void emit(emitter* e, int byte) {
+    if(e->size == e->capacity) {
+        e->capacity = e->capacity ? e->capacity * 2 : 256;
+        e->code = realloc(e->code, e->capacity);
+    }
+    e->code[e->size++] = byte;
+}
+
+/**
+ * @brief Appends an SSE instruction on xmm and the real at offset bytes
+ * into the register file, addressed through rdi
+ *
+ * @param e
+ * @param prefix PACKED or SCALAR
+ * @param opcode
+ * @param xmm 0 to 7
+ * @param offset
+ */
+static void emit_memory(emitter* e, int prefix, int opcode, int xmm,
+    int offset) {
+    if(prefix) {
+        emit(e, prefix);
+    }
+    emit(e, 0x0F);
+    emit(e, opcode);
+    // [rdi + disp32]
+    emit(e, 0x80 | xmm << 3 | 7);
+    for(int b = 0; b < 4; b++) {
+        emit(e, (offset >> (8 * b)) & 0xFF);
+    }
+}
+
+/**
+ * @brief Appends an SSE instruction from xmm src to xmm dst
+ *
+ * @param e
+ * @param prefix
+ * @param opcode
+ * @param dst
+ * @param src
+ */
+static void emit_xmm(emitter* e, int prefix, int opcode, int dst, int src) {
+    if(prefix) {
+        emit(e, prefix);
+    }
+    emit(e, 0x0F);
+    emit(e, opcode);
+    emit(e, 0xC0 | dst << 3 | src);
+}
+
+/**
+ * @brief Appends a copy of xmm0's first lane into all of its lanes
+ *
+ * @param e
+ */
+static void emit_broadcast(emitter* e) {
+#ifdef TRITONE_DOUBLE
+    // unpcklpd xmm0, xmm0
+    emit_xmm(e, 0x66, 0x14, 0, 0);
+#else
+    // shufps xmm0, xmm0, 0
+    emit_xmm(e, 0, 0xC6, 0, 0);
+    emit(e, 0);
+#endif
+}
+
+/**
+ * @brief Returns the offset of a register's lane
+ *
+ * @param r
+ * @param lane
+ * @return int
+ */
+static int lane(int r, int lane) {
+    return r * REGISTER_BYTES + lane * (int)sizeof(real);
+}
+
+/**
+ * @brief Appends dst = a op b over every lane
+ *
+ * @param e
+ * @param opcode
+ * @param dst
+ * @param a
+ * @param b -1 for an operation of one operand
+ */
+static void emit_packed(emitter* e, int opcode, int dst, int a, int b) {
+    for(int c = 0; c < CHUNKS; c++) {
+        int chunk = c * 16;
+        emit_memory(e, PACKED, SSE_LOAD, 0, lane(a, 0) + chunk);
+        if(b >= 0) {
+            emit_memory(e, PACKED, SSE_LOAD, 1, lane(b, 0) + chunk);
+            emit_xmm(e, PACKED, opcode, 0, 1);
+        } else {
+            emit_xmm(e, PACKED, opcode, 0, 0);
+        }
+        emit_memory(e, PACKED, SSE_STORE, 0, lane(dst, 0) + chunk);
+    }
+}
+
+/**
+ * @brief Appends xmm0 = a[x] * b[y] - a[y] * b[x], one component of a
+ * cross product
+ *
+ * @param e
+ * @param a
+ * @param b
+ * @param x a's and b's lane for the first product
+ * @param y their lane for the second
+ */
+static void emit_difference(emitter* e, int a, int b, int x, int y) {
+    emit_memory(e, SCALAR, SSE_LOAD, 0, lane(a, x));
+    emit_memory(e, SCALAR, SSE_MUL, 0, lane(b, y));
+    emit_memory(e, SCALAR, SSE_LOAD, 1, lane(a, y));
+    emit_memory(e, SCALAR, SSE_MUL, 1, lane(b, x));
+    emit_xmm(e, SCALAR, SSE_SUB, 0, 1);
+}
+
+/**
+ * @brief Appends dst = a X b, as vec_cross works it out
+ *
+ * @param c
+ * @param dst
+ * @param a
+ * @param b
+ */
+static void emit_cross(compiler* c, int dst, int a, int b) {
+    emitter* e = &c->e;
+    emit_difference(e, a, b, 1, 2);
+    emit_memory(e, SCALAR, SSE_STORE, 0, lane(dst, 0));
+    emit_difference(e, a, b, 0, 2);
+    // flipping the sign bit is exactly what - does
+    emit_memory(e, PACKED, SSE_LOAD, 2, lane(c->sign, 0));
+    emit_xmm(e, PACKED, SSE_XOR, 0, 2);
+    emit_memory(e, SCALAR, SSE_STORE, 0, lane(dst, 1));
+    emit_difference(e, a, b, 0, 1);
+    emit_memory(e, SCALAR, SSE_STORE, 0, lane(dst, 2));
+}
+
+/**
+ * @brief Appends dst = a . b, added in the same order as vec_dot, and
+ * its square root for norm
+ *
+ * @param e
+ * @param dst
+ * @param a
+ * @param b
+ * @param root
+ */
+static void emit_dot(emitter* e, int dst, int a, int b, int root) {
+    emit_memory(e, SCALAR, SSE_LOAD, 0, lane(a, 0));
+    emit_memory(e, SCALAR, SSE_MUL, 0, lane(b, 0));
+    for(int x = 1; x < 3; x++) {
+        emit_memory(e, SCALAR, SSE_LOAD, 1, lane(a, x));
+        emit_memory(e, SCALAR, SSE_MUL, 1, lane(b, x));
+        emit_xmm(e, SCALAR, SSE_ADD, 0, 1);
+    }
+    if(root) {
+        emit_xmm(e, SCALAR, SSE_SQRT, 0, 0);
+    }
+    emit_broadcast(e);
+    for(int chunk = 0; chunk < CHUNKS; chunk++) {
+        emit_memory(e, PACKED, SSE_STORE, 0, lane(dst, 0) + chunk * 16);
+    }
+}
+
+/**
+ * @brief Adds a register
+ *
+ * @param c
+ * @param scalar
+ * @return int the register, or -1 if there's no room
+ */
+static int new_register(compiler* c, int scalar) {
+    if(c->j->count == JIT_REGISTERS) {
+        return -1;
+    }
+    c->scalar[c->j->count] = scalar;
+    return c->j->count++;
+}
+
+/**
+ * @brief Adds a register of bit masks made from -0 in every lane: the
+ * sign bit alone, or with flip 0xFF, every bit but the sign
+ *
+ * @param c
+ * @param flip xor'd into each byte of -0
+ * @return int the register, or -1
+ */
+static int mask_register(compiler* c, int flip) {
+    int r = new_register(c, 0);
+    if(r >= 0) {
+        real zero = -0.0;
+        unsigned char* bytes = (unsigned char*)&zero;
+        for(int b = 0; b < (int)sizeof(real); b++) {
+            bytes[b] ^= flip;
+        }
+        for(int x = 0; x < LANES; x++) {
+            c->j->regs[r * LANES + x] = zero;
+        }
+    }
+    return r;
+}
+
+/**
+ * @brief Adds a register holding a constant
+ *
+ * @param c
+ * @param v
+ * @param scalar v is a scalar, in i
+ * @return int the register, or -1
+ */
+static int constant(compiler* c, vector v, int scalar) {
+    int r = new_register(c, scalar);
+    if(r >= 0) {
+        real* lanes = c->j->regs + r * LANES;
+        lanes[0] = v.i;
+        lanes[1] = scalar ? v.i : v.j;
+        lanes[2] = scalar ? v.i : v.k;
+        lanes[3] = scalar ? v.i : 0;
+    }
+    return r;
+}
+
+/**
+ * @brief Returns the register of a variable or slot read from outside
+ * the expression, of the type it has now
+ *
+ * @param c
+ * @param n
+ * @return int the register, or -1
+ */
+static int leaf(compiler* c, node* n) {
+    jitted* j = c->j;
+    for(int x = 0; x < j->leaf_count; x++) {
+        node* seen = j->leaves[x].n;
+        if(seen->type == n->type && (n->type == NODE_SLOT
+            ? seen->slot == n->slot : !strcmp(seen->value, n->value))) {
+            return j->leaves[x].reg;
+        }
+    }
+    value_type type;
+    if(n->type == NODE_SLOT) {
+        type = c->frame[n->slot].type;
+    } else {
+        type = is_some(get_vector(n->value)) ? VAL_VECTOR : VAL_SENTINEL;
+    }
+    if(j->leaf_count == JIT_LEAVES
+        || (type != VAL_VECTOR && type != VAL_SCALAR)) {
+        return -1;
+    }
+    int r = new_register(c, type == VAL_SCALAR);
+    if(r >= 0) {
+        j->leaves[j->leaf_count++] = (jit_leaf){ n, r, type };
+    }
+    return r;
+}
+
+static int compile(compiler* c, node* n);
+
+/**
+ * @brief Compiles an operation node
+ *
+ * @param c
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be
+ * compiled
+ */
+static int compile_operation(compiler* c, node* n) {
+    int a = compile(c, n->left);
+    int b = a < 0 ? -1 : compile(c, n->right);
+    if(b < 0) {
+        return -1;
+    }
+    int scalars = c->scalar[a] && c->scalar[b];
+    int vectors = !c->scalar[a] && !c->scalar[b];
+    int opcode;
+    switch(n->op) {
+        case OP_ADD:
+            opcode = SSE_ADD;
+            break;
+        case OP_SUB:
+            opcode = SSE_SUB;
+            break;
+        case OP_MUL:
+            opcode = SSE_MUL;
+            break;
+        case OP_DIV:
+            opcode = SSE_DIV;
+            break;
+        case OP_DOT:
+        case OP_CROSS: {
+            if(!vectors) {
+                return -1;
+            }
+            int d = new_register(c, n->op == OP_DOT);
+            if(d < 0) {
+                return -1;
+            } else if(n->op == OP_DOT) {
+                emit_dot(&c->e, d, a, b, 0);
+            } else {
+                emit_cross(c, d, a, b);
+            }
+            return d;
+        }
+        default:
+            return -1;
+    }
+    int d = new_register(c, scalars);
+    if(d >= 0) {
+        emit_packed(&c->e, opcode, d, a, b);
+    }
+    return d;
+}
+
+/**
+ * @brief Compiles a call to norm, abs or sqrt
+ *
+ * @param c
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be
+ * compiled
+ */
+static int compile_builtin(compiler* c, node* n) {
+    if(n->op != BUILTIN_NORM && n->op != BUILTIN_ABS
+        && n->op != BUILTIN_SQRT) {
+        return -1;
+    }
+    int a = compile(c, n->left->left);
+    if(a < 0) {
+        return -1;
+    }
+    int scalar = n->op == BUILTIN_NORM || c->scalar[a];
+    int d = new_register(c, scalar);
+    if(d < 0) {
+        return -1;
+    }
+    if(n->op == BUILTIN_NORM && !c->scalar[a]) {
+        emit_dot(&c->e, d, a, a, 1);
+    } else if(n->op == BUILTIN_SQRT) {
+        emit_packed(&c->e, SSE_SQRT, d, a, -1);
+    } else {
+        // the norm of a scalar is its absolute value
+        for(int chunk = 0; chunk < CHUNKS; chunk++) {
+            emit_memory(&c->e, PACKED, SSE_LOAD, 0, lane(a, 0) + chunk * 16);
+            emit_memory(&c->e, PACKED, SSE_LOAD, 1,
+                lane(c->magnitude, 0) + chunk * 16);
+            emit_xmm(&c->e, PACKED, SSE_AND, 0, 1);
+            emit_memory(&c->e, PACKED, SSE_STORE, 0,
+                lane(d, 0) + chunk * 16);
+        }
+    }
+    return d;
+}
+
+/**
+ * @brief Compiles an inlined call's argument, bound to its slot while the
+ * rest of the call is compiled
+ *
+ * @param c
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be
+ * compiled
+ */
+static int compile_let(compiler* c, node* n) {
+    int r = compile(c, n->left);
+    if(r < 0) {
+        return -1;
+    }
+    int outer = c->bound[n->slot];
+    c->bound[n->slot] = r;
+    int result = compile(c, n->right);
+    c->bound[n->slot] = outer;
+    return result;
+}
+
+/**
+ * @brief Compiles a node
+ *
+ * @param c
+ * @param n
+ * @return int the register holding its value, or -1 if it can't be
+ * compiled
+ */
+static int compile(compiler* c, node* n) {
+    if(n == NULL) {
+        return -1;
+    }
+    switch(n->type) {
+        case NODE_OPERATION:
+            return compile_operation(c, n);
+        case NODE_BUILTIN:
+            return compile_builtin(c, n);
+        case NODE_LET:
+            return compile_let(c, n);
+        case NODE_CONSTANT:
+            return constant(c, (vector){ n->number, 0, 0 }, 1);
+        case NODE_VECTOR: {
+            vector v = { n->left->number, n->right->left->number,
+                n->right->right->number };
+            return constant(c, v, 0);
+        }
+        case NODE_SLOT:
+            if(c->bound[n->slot] >= 0) {
+                return c->bound[n->slot];
+            }
+            return leaf(c, n);
+        case NODE_IDENTIFIER:
+            return leaf(c, n);
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Copies code into a page of its own and makes it executable
+ * and no longer writable
+ *
+ * @param j
+ * @param e
+ * @return int 0, or -1 if the page couldn't be made
+ */
+static int install(jitted* j, emitter* e) {
+    long page = sysconf(_SC_PAGESIZE);
+    j->mapped = (e->size + page - 1) / page * page;
+    j->page = mmap(NULL, j->mapped, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(j->page == MAP_FAILED) {
+        j->page = NULL;
+        return -1;
+    }
+    memcpy(j->page, e->code, e->size);
+    if(mprotect(j->page, j->mapped, PROT_READ | PROT_EXEC)) {
+        return -1;
+    }
+    j->code_bytes = e->size;
+    j->code = (void (*)(real*))j->page;
+    return 0;
+}
+
+/**
+ * @brief Compiles an expression to native code, taking the types of the
+ * variables and slots it reads from what they hold now
+ *
+ * @param expr
+ * @param frame the slots outside the expression
+ * @return jitted* NULL if the expression can't be compiled
+ */
+jitted* jit_compile(node* expr, value* frame) {
+    jitted* j = calloc(1, sizeof(jitted));
+    j->regs = calloc(JIT_REGISTERS * LANES, sizeof(real));
+    compiler* c = calloc(1, sizeof(compiler));
+    c->j = j;
+    c->frame = frame;
+    for(int s = 0; s < MAX_SLOTS; s++) {
+        c->bound[s] = -1;
+    }
+    c->sign = mask_register(c, 0);
+    c->magnitude = mask_register(c, 0xFF);
+    j->result = compile(c, expr);
+    if(j->result >= 0) {
+        j->scalar = c->scalar[j->result];
+        emit(&c->e, 0xC3);      // ret
+    }
+    if(j->result < 0 || install(j, &c->e)) {
+        jit_free(j);
+        j = NULL;
+    }
+    free(c->e.code);
+    free(c);
+    return j;
+}
+
+#else
+
+/**
+ * @brief Compiles nothing off x86-64; every expression is walked
+ *
+ * @param expr
+ * @param frame
+ * @return jitted* NULL
+ */
+jitted* jit_compile(node* expr, value* frame) {
+    return NULL;
+}
+
+#endif
+
+/**
+ * @brief Runs compiled code, after copying in the variables and slots
+ * it reads
+ *
+ * @param j
+ * @param frame the slots outside the expression
+ * @param out the expression's value
+ * @return int 1 if it ran, 0 if something it reads has changed type or
+ * is gone, and the tree has to be evaluated instead
+ */
+int jit_run(jitted* j, value* frame, value* out) {
+    for(int x = 0; x < j->leaf_count; x++) {
+        jit_leaf* l = &j->leaves[x];
+        value v;
+        if(l->n->type == NODE_SLOT) {
+            v = frame[l->n->slot];
+        } else {
+            vt_option found = get_vector(l->n->value);
+            if(!is_some(found)) {
+                return 0;
+            }
+            v.type = VAL_VECTOR;
+            v.vec = found.value.value;
+        }
+        if(v.type != l->type) {
+            return 0;
+        }
+        real* lanes = j->regs + l->reg * LANES;
+        if(v.type == VAL_SCALAR) {
+            lanes[0] = lanes[1] = lanes[2] = lanes[3] = v.scalar;
+        } else {
+            lanes[0] = v.vec.i;
+            lanes[1] = v.vec.j;
+            lanes[2] = v.vec.k;
+        }
+    }
+    j->code(j->regs);
+    real* result = j->regs + j->result * LANES;
+    if(j->scalar) {
+        out->type = VAL_SCALAR;
+        out->scalar = result[0];
+    } else {
+        out->type = VAL_VECTOR;
+        out->vec = (vector){ result[0], result[1], result[2] };
+    }
+    return 1;
+}
+
+/**
+ * @brief Returns how many bytes of machine code were written
+ *
+ * @param j
+ * @return int
+ */
+int jit_code_bytes(jitted* j) {
+    return j->code_bytes;
+}
+
+/**
+ * @brief Unmaps compiled code and frees what goes with it
+ *
+ * @param j
+ */
+void jit_free(jitted* j) {
+    if(j == NULL) {
+        return;
+    }
+    if(j->page != NULL) {
+        munmap(j->page, j->mapped);
+    }
+    free(j->regs);
+    free(j);
+}
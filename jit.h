@@ -0,0 +1,27 @@
+#ifndef JIT_H
+#define JIT_H
+
+    #include "ast.h"
+
+    /*
+     * Native code for hot expressions. Once an operation or builtin has
+     * been evaluated JIT_HOT times it is compiled to x86-64 machine code
+     * in a page of its own, and later evaluations run that instead of
+     * walking the tree, until a variable it reads changes type.
+     */
+
+    // evaluations of an expression before it is compiled
+    #define JIT_HOT 1000
+    // most registers an expression can use, one per node
+    #define JIT_REGISTERS 128
+    // most variables and slots an expression can read
+    #define JIT_LEAVES 32
+
+    typedef struct jitted jitted;
+
+    jitted* jit_compile(node* expr, value* frame);
+    int jit_run(jitted* j, value* frame, value* out);
+    int jit_code_bytes(jitted* j);
+    void jit_free(jitted* j);
+
+#endif
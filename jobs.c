@@ -0,0 +1,833 @@
+/**
+ * @file jobs.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Background reads and writes, so the prompt stays usable while a
+ * big file loads or saves. Jobs wait in a small table and JOB_WORKERS
+ * threads run them in the order they were started.
+ *
+ * A read job parses the file into a detached table of its own, off the
+ * main thread. The main thread is the only one that changes the table,
+ * so the finished job waits there until poll_jobs, called between lines,
+ * stores it all at once with publish_detached. A job that finishes inside
+ * a transaction waits for it to end.
+ *
+ * Reads go through io_uring, set up with raw system calls: a job keeps
+ * READ_DEPTH chunks of the file in flight and parses each one as it
+ * arrives while the kernel fills the next. Where io_uring isn't available
+ * the worker reads each chunk itself with pread.
+ *
+ * A pattern matching many files is handed to import_glob instead, which
+ * parses the files side by side.
+ *
+ * A write job works from a snapshot of the table taken when it starts,
+ * so later changes don't end up half in the file.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "jobs.h"
+#include "vectable.h"
+#include "csv.h"
+#include "pack.h"
+#include "import.h"
+
+// chunks of a file a read job keeps in flight
+#define READ_DEPTH 4
+
+typedef enum {
+    JOB_READ,
+    JOB_WRITE,
+} job_kind;
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_FINISHED,
+} job_state;
+
+typedef struct {
+    int id;
+    job_kind kind;
+    char* path;
+    int flags;              // write_vectable flags
+    atomic_int state;
+    atomic_long done;       // bytes read or rows written so far
+    atomic_long total;      // bytes or rows in all
+    double started;
+    double finished;
+    int result;             // rows, -1 if the file can't be used, -2 if it's bad
+    int line;               // the bad line of a csv
+    int packed;
+    int files;              // files a pattern matched
+    char* error;            // why a pattern's import failed
+    vectable* table;        // a read's detached table, or a write's snapshot
+} job;
+
+static job* jobs[MAX_JOBS];
+static int next_id = 1;
+static pthread_t workers[JOB_WORKERS];
+static int workers_started = 0;
+static atomic_int stopping = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Returns a monotonic time in seconds
+ *
+ * @return double
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// an io_uring instance and its mapped rings
+typedef struct {
+    int fd;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+} uring;
+
+/**
+ * @brief Unmaps the rings and closes the instance
+ *
+ * @param r
+ */
+static void uring_free(uring* r) {
+    if(r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if(r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_size);
+    }
+    if(r->sq_ring != MAP_FAILED) {
+        munmap(r->sq_ring, r->sq_size);
+    }
+    close(r->fd);
+}
+
+/**
+ * @brief Sets up an io_uring with room for entries requests and maps its
+ * submission and completion rings
+ *
+ * @param r
+ * @param entries
+ * @return int 0, or -1 if io_uring can't be used here
+ */
+static int uring_init(uring* r, unsigned entries) {
+#ifdef __NR_io_uring_setup
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(r->fd < 0) {
+        return -1;
+    }
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        // both rings live in one mapping
+        r->sq_size = r->sq_size > r->cq_size ? r->sq_size : r->cq_size;
+        r->cq_size = r->sq_size;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ring = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = r->sq_ring;
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        r->cq_ring = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED
+        || r->sqes == MAP_FAILED) {
+        uring_free(r);
+        return -1;
+    }
+
+    char* sq = r->sq_ring;
+    char* cq = r->cq_ring;
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+#else
+    (void)r;
+    (void)entries;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Asks the kernel to read length bytes of fd at offset into buffer
+ *
+ * @param r
+ * @param fd
+ * @param buffer
+ * @param length
+ * @param offset
+ * @param tag handed back by uring_wait
+ * @return int 0, or -1 if the request couldn't be submitted
+ */
+static int uring_read(uring* r, int fd, void* buffer, unsigned length,
+    long offset, int tag) {
+    // this thread is the only one submitting, so the tail is its own
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) == 1
+        ? 0 : -1;
+}
+
+/**
+ * @brief Waits for the next finished request
+ *
+ * @param r
+ * @param tag set to the request's tag
+ * @param result set to its bytes read, or -errno
+ * @return int 0, or -1 if waiting fails
+ */
+static int uring_wait(uring* r, int* tag, int* result) {
+    while(1) {
+        unsigned head = *r->cq_head;
+        if(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+            *tag = cqe->user_data;
+            *result = cqe->res;
+            __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if(syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS,
+            NULL, 0) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Returns true if io_uring works here
+ *
+ * @return int
+ */
+int uring_available(void) {
+    static int available = -1;
+    if(available < 0) {
+        uring r;
+        available = uring_init(&r, 1) == 0;
+        if(available) {
+            uring_free(&r);
+        }
+    }
+    return available;
+}
+
+// hands out a file's chunks in order, keeping the next ones in flight
+typedef struct {
+    int fd;
+    long size;
+    char* buffers[READ_DEPTH];  // from csv_buffer
+    long offsets[READ_DEPTH];   // where each slot's chunk starts, -1 if none
+    int lengths[READ_DEPTH];
+    int results[READ_DEPTH];    // bytes read, or -1 while in flight
+    long next_offset;
+    int next_slot;              // slot of the next chunk to hand out
+    uring ring;
+    int use_ring;
+} chunk_reader;
+
+/**
+ * @brief Reads all of length bytes at offset, the slow way
+ *
+ * @param fd
+ * @param buffer
+ * @param length
+ * @param offset
+ * @return int 0, or -1 on error or an early end of file
+ */
+static int pread_all(int fd, char* buffer, size_t length, long offset) {
+    while(length > 0) {
+        ssize_t got = pread(fd, buffer, length, offset);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {
+            return -1;
+        }
+        buffer += got;
+        offset += got;
+        length -= got;
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for the chunks still in flight and closes the ring, so the
+ * rest of the file is read with pread. A request whose submission failed
+ * may still be sitting in the ring, and the kernel would pick it up on the
+ * next io_uring_enter; closing the ring is what makes sure it never runs.
+ *
+ * @param r
+ */
+static void stop_ring(chunk_reader* r) {
+    for(int slot = 0; slot < READ_DEPTH; slot++) {
+        while(r->offsets[slot] >= 0 && r->results[slot] == -1) {
+            int tag;
+            int result;
+            if(uring_wait(&r->ring, &tag, &result) < 0) {
+                break;
+            }
+            r->results[tag] = result < 0 ? 0 : result;
+        }
+    }
+    uring_free(&r->ring);
+    r->use_ring = 0;
+}
+
+/**
+ * @brief Gives slot the next chunk of the file and, with io_uring, asks
+ * for it right away
+ *
+ * @param r
+ * @param slot
+ */
+static void submit_chunk(chunk_reader* r, int slot) {
+    if(r->next_offset >= r->size) {
+        r->offsets[slot] = -1;
+        return;
+    }
+    long left = r->size - r->next_offset;
+    r->offsets[slot] = r->next_offset;
+    r->lengths[slot] = left < CSV_CHUNK ? left : CSV_CHUNK;
+    r->results[slot] = -1;
+    r->next_offset += r->lengths[slot];
+    if(r->use_ring && uring_read(&r->ring, r->fd,
+        r->buffers[slot] + CSV_LINE, r->lengths[slot], r->offsets[slot],
+        slot) < 0) {
+        // read it, and every chunk after it, with pread instead
+        r->results[slot] = 0;
+        stop_ring(r);
+    }
+}
+
+/**
+ * @brief Starts reading the file fd, of size bytes
+ *
+ * @param r
+ * @param fd
+ * @param size
+ */
+static void open_reader(chunk_reader* r, int fd, long size) {
+    r->fd = fd;
+    r->size = size;
+    r->next_offset = 0;
+    r->next_slot = 0;
+    r->use_ring = uring_init(&r->ring, READ_DEPTH) == 0;
+    for(int slot = 0; slot < READ_DEPTH; slot++) {
+        r->offsets[slot] = -1;
+    }
+    for(int slot = 0; slot < READ_DEPTH; slot++) {
+        r->buffers[slot] = csv_buffer();
+        submit_chunk(r, slot);
+    }
+}
+
+/**
+ * @brief Returns the buffer holding the next chunk, CSV_LINE bytes past
+ * its start, once it has arrived
+ *
+ * @param r
+ * @param length set to the chunk's length
+ * @return char* the buffer, or NULL at the end of the file or on an error
+ * (length is then -1)
+ */
+static char* next_chunk(chunk_reader* r, long* length) {
+    int slot = r->next_slot;
+    *length = 0;
+    if(r->offsets[slot] < 0) {
+        return NULL;
+    }
+    while(r->use_ring && r->results[slot] == -1) {
+        int tag;
+        int result;
+        if(uring_wait(&r->ring, &tag, &result) < 0) {
+            *length = -1;
+            return NULL;
+        }
+        // a failed or short read is finished with pread below
+        r->results[tag] = result < 0 ? 0 : result;
+    }
+
+    // chunks that arrived before the ring was stopped are kept
+    int got = r->results[slot] > 0 ? r->results[slot] : 0;
+    char* data = r->buffers[slot] + CSV_LINE;
+    if(got < r->lengths[slot] && pread_all(r->fd, data + got,
+        r->lengths[slot] - got, r->offsets[slot] + got) < 0) {
+        *length = -1;
+        return NULL;
+    }
+    *length = r->lengths[slot];
+    return r->buffers[slot];
+}
+
+/**
+ * @brief Hands the slot of the chunk just used back for a later chunk
+ *
+ * @param r
+ */
+static void release_chunk(chunk_reader* r) {
+    submit_chunk(r, r->next_slot);
+    r->next_slot = (r->next_slot + 1) % READ_DEPTH;
+}
+
+/**
+ * @brief Waits for any reads still in flight and frees the buffers
+ *
+ * @param r
+ */
+static void close_reader(chunk_reader* r) {
+    if(r->use_ring) {
+        stop_ring(r);
+    }
+    for(int slot = 0; slot < READ_DEPTH; slot++) {
+        free(r->buffers[slot]);
+    }
+}
+
+/**
+ * @brief Reads a packed table whole and decodes it into j's table
+ *
+ * @param j
+ * @param r
+ */
+static void read_packed_job(job* j, chunk_reader* r) {
+    unsigned char* file = malloc(r->size + 1);
+    long length = 0;
+    long at = 0;
+    char* chunk;
+    while(!stopping && (chunk = next_chunk(r, &length)) != NULL) {
+        memcpy(file + at, chunk + CSV_LINE, length);
+        at += length;
+        atomic_store(&j->done, at);
+        release_chunk(r);
+    }
+    if(length < 0 || stopping) {
+        j->result = -1;
+    } else {
+        pack_rows rows;
+        if(unpack(file, at, &rows) < 0) {
+            j->result = -2;
+        } else {
+            fill_detached(j->table, rows.keys, rows.values, rows.count);
+            j->result = rows.count;
+            free_pack_rows(&rows);
+        }
+    }
+    free(file);
+}
+
+/**
+ * @brief Parses a csv chunk by chunk as it arrives, then stores the rows
+ * in j's table
+ *
+ * @param j
+ * @param r
+ */
+static void read_csv_job(job* j, chunk_reader* r) {
+    csv_reader csv;
+    csv_init(&csv);
+    int bad = 0;
+    long length = 0;
+    long at = 0;
+    char* chunk;
+    while(!bad && !stopping && (chunk = next_chunk(r, &length)) != NULL) {
+        bad = csv_chunk(&csv, chunk, length, 0) < 0;
+        at += length;
+        atomic_store(&j->done, at);
+        release_chunk(r);
+    }
+    // the unfinished last line is parsed from a buffer of its own
+    char* last = csv_buffer();
+    bad = bad || csv_chunk(&csv, last, 0, 1) < 0;
+    free(last);
+
+    if(length < 0 || stopping) {
+        j->result = -1;
+    } else if(bad) {
+        j->result = -2;
+        j->line = csv.line;
+    } else {
+        char** names = csv_names(&csv);
+        fill_detached(j->table, names, csv.values, csv.count);
+        j->result = csv.count;
+        free(names);
+    }
+    csv_free(&csv);
+}
+
+/**
+ * @brief Runs a read job on a worker
+ *
+ * @param j
+ */
+static void run_read(job* j) {
+    if(is_glob(j->path)) {
+        // many files are parsed at once rather than streamed
+        import_rows rows;
+        j->result = import_glob(j->path, &rows);
+        j->files = rows.files;
+        if(j->result >= 0) {
+            fill_detached(j->table, rows.names, rows.values, rows.count);
+        } else {
+            j->error = strdup(rows.error);
+        }
+        free_import(&rows);
+        return;
+    }
+
+    int fd = open(j->path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        j->result = -1;
+        if(fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    atomic_store(&j->total, st.st_size);
+    j->packed = is_packed(j->path);
+
+    chunk_reader r;
+    open_reader(&r, fd, st.st_size);
+    if(j->packed) {
+        read_packed_job(j, &r);
+    } else {
+        read_csv_job(j, &r);
+    }
+    close_reader(&r);
+    close(fd);
+}
+
+/**
+ * @brief Runs jobs in the order they were started until stop_jobs, and
+ * then every write still queued
+ *
+ * @param arg unused
+ * @return void*
+ */
+static void* run_jobs(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&mutex);
+    while(1) {
+        job* j = NULL;
+        for(int x = 0; x < MAX_JOBS; x++) {
+            if(jobs[x] != NULL && jobs[x]->state == JOB_QUEUED
+                && (!stopping || jobs[x]->kind == JOB_WRITE)
+                && (j == NULL || jobs[x]->id < j->id)) {
+                j = jobs[x];
+            }
+        }
+        if(j == NULL && stopping) {
+            break;
+        } else if(j == NULL) {
+            pthread_cond_wait(&wake, &mutex);
+            continue;
+        }
+
+        j->state = JOB_RUNNING;
+        j->started = now();
+        pthread_mutex_unlock(&mutex);
+        if(j->kind == JOB_READ) {
+            run_read(j);
+        } else {
+            atomic_store(&j->total, j->table->size);
+            j->result = write_snapshot(j->table, j->path, j->flags,
+                &j->done);
+        }
+        pthread_mutex_lock(&mutex);
+        j->finished = now();
+        j->state = JOB_FINISHED;
+    }
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+/**
+ * @brief Queues a job, starting the workers the first time
+ *
+ * @param kind
+ * @param path
+ * @param flags
+ * @param table
+ * @return int the job's number, or -1 if MAX_JOBS are already queued
+ */
+static int start_job(job_kind kind, char* path, int flags, vectable* table) {
+    pthread_mutex_lock(&mutex);
+    int slot = 0;
+    while(slot < MAX_JOBS && jobs[slot] != NULL) {
+        slot++;
+    }
+    if(slot == MAX_JOBS) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+
+    job* j = calloc(1, sizeof(job));
+    j->id = next_id++;
+    j->kind = kind;
+    j->path = strdup(path);
+    j->flags = flags;
+    j->table = table;
+    j->state = JOB_QUEUED;
+    jobs[slot] = j;
+    if(!workers_started) {
+        for(int x = 0; x < JOB_WORKERS; x++) {
+            pthread_create(&workers[x], NULL, run_jobs, NULL);
+        }
+        workers_started = 1;
+    }
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&mutex);
+    return j->id;
+}
+
+/**
+ * @brief Starts reading path, csv or packed, in the background
+ *
+ * @param path
+ * @return int the job's number, or -1 if too many jobs are queued
+ */
+int start_read_job(char* path) {
+    vectable* table = detached_vectable();
+    int id = start_job(JOB_READ, path, 0, table);
+    if(id < 0) {
+        free_detached(table);
+    }
+    return id;
+}
+
+/**
+ * @brief Starts writing a snapshot of the table to path as a csv in the
+ * background
+ *
+ * @param path
+ * @param flags write_vectable flags
+ * @return int the job's number, or -1 if too many jobs are queued
+ */
+int start_write_job(char* path, int flags) {
+    vectable* snapshot = snapshot_vectable();
+    int id = start_job(JOB_WRITE, path, flags, snapshot);
+    if(id < 0) {
+        free_snapshot(snapshot);
+    }
+    return id;
+}
+
+/**
+ * @brief Frees a job and what it still holds
+ *
+ * @param j
+ */
+static void free_job(job* j) {
+    if(j->table != NULL && j->kind == JOB_READ) {
+        free_detached(j->table);
+    } else if(j->table != NULL) {
+        free_snapshot(j->table);
+    }
+    free(j->error);
+    free(j->path);
+    free(j);
+}
+
+/**
+ * @brief Reports a finished job, storing what a read loaded
+ *
+ * @param j
+ */
+static void finish_job(job* j) {
+    double seconds = j->finished - j->started;
+    if(j->kind == JOB_WRITE && j->result >= 0) {
+        printf("[%d] Wrote %d vectors to %s in %.2fs\n", j->id, j->result,
+            j->path, seconds);
+    } else if(j->kind == JOB_WRITE) {
+        printf("[%d] Error: Could not write %s\n", j->id, j->path);
+    } else if(j->result >= 0) {
+        publish_detached(j->table);
+        j->table = NULL;
+        if(j->files > 0) {
+            printf("[%d] Read %d vectors from %d files in %.2fs\n", j->id,
+                j->result, j->files, seconds);
+        } else {
+            printf("[%d] Read %d vectors from %s in %.2fs\n", j->id,
+                j->result, j->path, seconds);
+        }
+    } else if(j->error != NULL) {
+        printf("[%d] Error: %s\n", j->id, j->error);
+    } else if(j->result == -1) {
+        printf("[%d] Error: Could not read %s\n", j->id, j->path);
+    } else if(j->packed) {
+        printf("[%d] Error: %s is damaged, nothing was read\n", j->id,
+            j->path);
+    } else {
+        printf("[%d] Error: Bad line at line %d of %s, nothing was read\n",
+            j->id, j->line, j->path);
+    }
+    free_job(j);
+}
+
+/**
+ * @brief Reports finished jobs and stores what finished reads loaded.
+ * Called by the main thread between lines; a read that finishes inside
+ * a transaction is kept until it ends.
+ *
+ */
+void poll_jobs(void) {
+    if(!workers_started) {
+        return;
+    }
+    while(1) {
+        job* j = NULL;
+        pthread_mutex_lock(&mutex);
+        for(int x = 0; x < MAX_JOBS && j == NULL; x++) {
+            if(jobs[x] != NULL && jobs[x]->state == JOB_FINISHED
+                && !(jobs[x]->kind == JOB_READ && jobs[x]->result >= 0
+                    && in_transaction())) {
+                j = jobs[x];
+                jobs[x] = NULL;
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        if(j == NULL) {
+            return;
+        }
+        finish_job(j);
+    }
+}
+
+/**
+ * @brief Lists the jobs that haven't been reported yet and how far along
+ * they are
+ *
+ */
+void print_jobs(void) {
+    int listed = 0;
+    pthread_mutex_lock(&mutex);
+    for(int x = 0; x < MAX_JOBS; x++) {
+        job* j = jobs[x];
+        if(j == NULL) {
+            continue;
+        }
+        listed++;
+        char* kind = j->kind == JOB_READ ? "read" : "write";
+        long done = atomic_load(&j->done);
+        long total = atomic_load(&j->total);
+        int percent = total > 0 ? done * 100 / total : 0;
+        if(j->state == JOB_QUEUED) {
+            printf("[%d] %s %s: queued\n", j->id, kind, j->path);
+        } else if(j->state == JOB_FINISHED && j->kind == JOB_READ
+            && j->result >= 0 && in_transaction()) {
+            printf("[%d] %s %s: finished, stored after the transaction\n",
+                j->id, kind, j->path);
+        } else if(j->state == JOB_FINISHED) {
+            printf("[%d] %s %s: finished\n", j->id, kind, j->path);
+        } else if(j->kind == JOB_READ && is_glob(j->path)) {
+            printf("[%d] read %s: parsing, %.1fs\n", j->id, j->path,
+                now() - j->started);
+        } else if(j->kind == JOB_READ) {
+            printf("[%d] read %s: %.1f of %.1f MB (%d%%), %.1fs\n", j->id,
+                j->path, done / 1e6, total / 1e6, percent,
+                now() - j->started);
+        } else {
+            printf("[%d] write %s: %ld of %ld vectors (%d%%), %.1fs\n",
+                j->id, j->path, done, total, percent, now() - j->started);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    if(listed == 0) {
+        printf("No jobs are running\n");
+    } else {
+        printf("Reading with %s\n", uring_available() ? "io_uring" : "pread");
+    }
+}
+
+/**
+ * @brief Stops the workers for exit: reads are dropped, and every write,
+ * running or queued, is finished and reported
+ *
+ */
+void stop_jobs(void) {
+    if(!workers_started) {
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    stopping = 1;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&mutex);
+    for(int x = 0; x < JOB_WORKERS; x++) {
+        pthread_join(workers[x], NULL);
+    }
+    workers_started = 0;
+
+    // in the order they were started
+    while(1) {
+        int first = -1;
+        for(int x = 0; x < MAX_JOBS; x++) {
+            if(jobs[x] != NULL
+                && (first < 0 || jobs[x]->id < jobs[first]->id)) {
+                first = x;
+            }
+        }
+        if(first < 0) {
+            break;
+        }
+        job* j = jobs[first];
+        jobs[first] = NULL;
+        if(j->kind == JOB_WRITE) {
+            finish_job(j);
+        } else {
+            free_job(j);
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+    /*
+     * Background reads and writes, started with read "path" bg and
+     * write "path" bg. A read is parsed off the main thread and stored
+     * all at once between lines; a write works from a snapshot.
+     */
+
+    // most jobs queued or running at once
+    #define MAX_JOBS 16
+    // threads that run jobs
+    #define JOB_WORKERS 2
+
+    int start_read_job(char* path);
+    int start_write_job(char* path, int flags);
+    void poll_jobs(void);
+    void print_jobs(void);
+    void stop_jobs(void);
+    int uring_available(void);
+
+#endif
@@ -16,6 +16,8 @@
 #include <string.h>
 #include "tritone.h"
 #include "vectable.h"
+#include "wal.h"
+#include "prof.h"
 
 
 /**
@@ -36,8 +38,25 @@ int main(int arc, char** argv) {
 
     vectable_init();
 
+    // -l path replays the log at path and keeps logging to it
+    if(argv[1] && !strcmp("-l", argv[1])) {
+        if(argv[2] == NULL) {
+            printf("Error: -l needs a path\n");
+            exit(1);
+        }
+        int replayed = wal_open(argv[2]);
+        if(replayed < 0) {
+            printf("Error: Could not open the log %s\n", argv[2]);
+            exit(1);
+        }
+        printf("Replayed %d changes from %s\n", replayed, argv[2]);
+    }
+
     do {
-        printf("%s", tritone());
+        char* output = tritone();
+        PROF_START(start);
+        printf("%s", output);
+        PROF_STOP(STAGE_PRINT, start);
     } while(1);
 
     return -1;
@@ -0,0 +1,280 @@
+/**
+ * @file operators.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Binary operators, dispatched through a table indexed by 
+ * [operator][left type][right type], so evaluating an operation node is
+ * a single indirect call. The operator is resolved when the node is parsed.
+ * 
+ * Arithmetic (+ - * /) broadcasts: a scalar mixed with a vector acts like
+ * (s, s, s), and vector with vector is element-wise. Dot and cross products
+ * only take two vectors. Quaternions and matrices only multiply: each 
+ * other, to compose, or a vector, to transform it. Any operation on the 
+ * sentinel (an operand that already failed) quietly gives the sentinel.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include "operators.h"
+#include "transform.h"
+
+/**
+ * @brief Converts a vector to a value struct
+ * 
+ * @param v 
+ * @return value 
+ */
+static value vector_value(vector v) {
+    value r;
+    r.type = VAL_VECTOR;
+    r.vec = v;
+    return r;
+}
+
+/**
+ * @brief Converts a scalar to a value struct
+ * 
+ * @param f 
+ * @return value 
+ */
+static value scalar_value(real f) {
+    value r;
+    r.type = VAL_SCALAR;
+    r.scalar = f;
+    return r;
+}
+
+/**
+ * @brief Holds a quaternion for the rest of the line and returns a value
+ * referring to it
+ * 
+ * @param q 
+ * @return value 
+ */
+static value quaternion_value(quaternion q) {
+    value r;
+    r.type = VAL_QUATERNION;
+    r.held = hold_quaternion(q);
+    return r;
+}
+
+/**
+ * @brief Holds a matrix for the rest of the line and returns a value 
+ * referring to it
+ * 
+ * @param m 
+ * @return value 
+ */
+static value matrix_value(matrix m) {
+    value r;
+    r.type = VAL_MATRIX;
+    r.held = hold_matrix(m);
+    return r;
+}
+
+/**
+ * @brief Result of any operation with a sentinel operand
+ */
+static value propagate(const value* left, const value* right) {
+    value r;
+    r.type = VAL_SENTINEL;
+    return r;
+}
+
+/**
+ * @brief Applies an arithmetic operator to each component pair
+ */
+#define COMPONENTS(a, symbol, b)                                            \
+    vector_value((vector){ (a).i symbol (b).i, (a).j symbol (b).j,          \
+                           (a).k symbol (b).k })
+
+/*
+ * Each arithmetic operator gets one function per operand combination:
+ * vector-vector, vector-scalar, scalar-vector and scalar-scalar. They work
+ * on the components directly so that each one is a leaf function. Any
+ * other combination is an error.
+ */
+#define ARITHMETIC(name, symbol, label)                                     \
+    static value name##_vv(const value* left, const value* right) {                       \
+        return COMPONENTS(left->vec, symbol, right->vec);                     \
+    }                                                                       \
+    static value name##_vs(const value* left, const value* right) {                       \
+        vector splat = { right->scalar, right->scalar, right->scalar };        \
+        return COMPONENTS(left->vec, symbol, splat);                         \
+    }                                                                       \
+    static value name##_sv(const value* left, const value* right) {                       \
+        vector splat = { left->scalar, left->scalar, left->scalar };           \
+        return COMPONENTS(splat, symbol, right->vec);                        \
+    }                                                                       \
+    static value name##_ss(const value* left, const value* right) {                       \
+        return scalar_value(left->scalar symbol right->scalar);               \
+    }                                                                       \
+    static value name##_invalid(const value* left, const value* right) {    \
+        printf("Error: invalid arguments to " label "\n");                 \
+        return propagate(left, right);                                      \
+    }
+
+ARITHMETIC(add, +, "addition")
+ARITHMETIC(sub, -, "subtraction")
+ARITHMETIC(mul, *, "multiplication")
+ARITHMETIC(div, /, "division")
+
+/**
+ * @brief Rotates a vector by a quaternion
+ */
+static value mul_qv(const value* left, const value* right) {
+    return vector_value(quaternion_rotate(held_quaternion(left->held), 
+        right->vec));
+}
+
+/**
+ * @brief Composes two quaternions
+ */
+static value mul_qq(const value* left, const value* right) {
+    return quaternion_value(quaternion_mul(held_quaternion(left->held), 
+        held_quaternion(right->held)));
+}
+
+/**
+ * @brief Composes a quaternion with a matrix
+ */
+static value mul_qm(const value* left, const value* right) {
+    matrix m = quaternion_matrix(held_quaternion(left->held));
+    return matrix_value(matrix_mul(m, *held_matrix(right->held)));
+}
+
+/**
+ * @brief Applies a matrix to a vector
+ */
+static value mul_mv(const value* left, const value* right) {
+    return vector_value(matrix_apply(held_matrix(left->held), right->vec));
+}
+
+/**
+ * @brief Composes a matrix with a quaternion
+ */
+static value mul_mq(const value* left, const value* right) {
+    matrix m = quaternion_matrix(held_quaternion(right->held));
+    return matrix_value(matrix_mul(*held_matrix(left->held), m));
+}
+
+/**
+ * @brief Composes two matrices
+ */
+static value mul_mm(const value* left, const value* right) {
+    return matrix_value(matrix_mul(*held_matrix(left->held), 
+        *held_matrix(right->held)));
+}
+
+/**
+ * @brief Dot product of two vectors
+ */
+static value dot_vv(const value* left, const value* right) {
+    return scalar_value(vec_dot(left->vec, right->vec));
+}
+
+/**
+ * @brief Dot product of anything but two vectors
+ */
+static value dot_invalid(const value* left, const value* right) {
+    printf("Error: invalid arguments to dot product\n");
+    return propagate(left, right);
+}
+
+/**
+ * @brief Cross product of two vectors
+ */
+static value cross_vv(const value* left, const value* right) {
+    return vector_value(vec_cross(left->vec, right->vec));
+}
+
+/**
+ * @brief Cross product of anything but two vectors
+ */
+static value cross_invalid(const value* left, const value* right) {
+    printf("Error: invalid arguments to cross product\n");
+    return propagate(left, right);
+}
+
+// every operator treats a sentinel on either side the same way
+#define SENTINEL_RIGHT [VAL_SENTINEL] = propagate
+#define TRANSFORM_RIGHT(fn) [VAL_QUATERNION] = fn, [VAL_MATRIX] = fn
+#define SENTINEL_ROW [VAL_SENTINEL] = { [VAL_VECTOR] = propagate,          \
+    [VAL_SCALAR] = propagate, [VAL_SENTINEL] = propagate,                   \
+    TRANSFORM_RIGHT(propagate) }
+
+// a quaternion or matrix on the left, for operators that don't take them
+#define TRANSFORM_ROWS(fn)                                                  \
+    [VAL_QUATERNION] = { [VAL_VECTOR] = fn, [VAL_SCALAR] = fn,              \
+                         TRANSFORM_RIGHT(fn), SENTINEL_RIGHT },             \
+    [VAL_MATRIX] = { [VAL_VECTOR] = fn, [VAL_SCALAR] = fn,                  \
+                     TRANSFORM_RIGHT(fn), SENTINEL_RIGHT }
+
+#define ARITHMETIC_ROWS(name)                                               \
+    [VAL_VECTOR] = { [VAL_VECTOR] = name##_vv, [VAL_SCALAR] = name##_vs,    \
+                     TRANSFORM_RIGHT(name##_invalid), SENTINEL_RIGHT },     \
+    [VAL_SCALAR] = { [VAL_VECTOR] = name##_sv, [VAL_SCALAR] = name##_ss,    \
+                     TRANSFORM_RIGHT(name##_invalid), SENTINEL_RIGHT },     \
+    SENTINEL_ROW
+
+const operator_fn operators[OP_COUNT][VAL_COUNT][VAL_COUNT] = {
+    [OP_ADD] = { ARITHMETIC_ROWS(add), TRANSFORM_ROWS(add_invalid) },
+    [OP_SUB] = { ARITHMETIC_ROWS(sub), TRANSFORM_ROWS(sub_invalid) },
+    [OP_MUL] = { 
+        ARITHMETIC_ROWS(mul),
+        [VAL_QUATERNION] = { [VAL_VECTOR] = mul_qv, [VAL_SCALAR] = mul_invalid,
+                             [VAL_QUATERNION] = mul_qq, 
+                             [VAL_MATRIX] = mul_qm, SENTINEL_RIGHT },
+        [VAL_MATRIX] = { [VAL_VECTOR] = mul_mv, [VAL_SCALAR] = mul_invalid,
+                         [VAL_QUATERNION] = mul_mq, [VAL_MATRIX] = mul_mm,
+                         SENTINEL_RIGHT },
+    },
+    [OP_DIV] = { ARITHMETIC_ROWS(div), TRANSFORM_ROWS(div_invalid) },
+    [OP_DOT] = {
+        [VAL_VECTOR] = { [VAL_VECTOR] = dot_vv, [VAL_SCALAR] = dot_invalid, 
+                         TRANSFORM_RIGHT(dot_invalid), SENTINEL_RIGHT },
+        [VAL_SCALAR] = { [VAL_VECTOR] = dot_invalid, 
+                         [VAL_SCALAR] = dot_invalid, 
+                         TRANSFORM_RIGHT(dot_invalid), SENTINEL_RIGHT },
+        SENTINEL_ROW,
+        TRANSFORM_ROWS(dot_invalid)
+    },
+    [OP_CROSS] = {
+        [VAL_VECTOR] = { [VAL_VECTOR] = cross_vv, 
+                         [VAL_SCALAR] = cross_invalid, 
+                         TRANSFORM_RIGHT(cross_invalid), SENTINEL_RIGHT },
+        [VAL_SCALAR] = { [VAL_VECTOR] = cross_invalid, 
+                         [VAL_SCALAR] = cross_invalid, 
+                         TRANSFORM_RIGHT(cross_invalid), SENTINEL_RIGHT },
+        SENTINEL_ROW,
+        TRANSFORM_ROWS(cross_invalid)
+    },
+};
+
+/**
+ * @brief Returns the operator for an operator token, or -1
+ * 
+ * @param type 
+ * @return int 
+ */
+int find_operator(token_type type) {
+    switch(type) {
+        case TOKEN_PLUS:
+            return OP_ADD;
+        case TOKEN_MINUS:
+            return OP_SUB;
+        case TOKEN_STAR:
+            return OP_MUL;
+        case TOKEN_SLASH:
+            return OP_DIV;
+        case TOKEN_DOT:
+            return OP_DOT;
+        case TOKEN_CROSS:
+            return OP_CROSS;
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef OPERATORS_H
+#define OPERATORS_H
+
+    #include "ast.h"
+
+    typedef enum {
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_DOT,
+        OP_CROSS,
+        OP_COUNT,
+    } operator_id;
+
+    // operands are passed by pointer: a value passed by copy is split 
+    // across integer and float registers and has to be shuffled back
+    typedef value (*operator_fn)(const value* left, const value* right);
+
+    // indexed by [operator][left type][right type]
+    extern const operator_fn operators[OP_COUNT][VAL_COUNT][VAL_COUNT];
+
+    int find_operator(token_type type);
+
+#endif
@@ -0,0 +1,908 @@
+/**
+ * @file pack.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Compressed binary tables. A CSV row spends 30 or more bytes on a
+ * 12 byte vector; a packed table stores the names once as a sorted,
+ * front-coded dictionary and the components as three columns that
+ * compress well.
+ *
+ * The file is a header followed by four streams: the names, then the i,
+ * j and k columns, in name order. Each name is written as the length it
+ * shares with the one before it, the length of the rest, and the rest.
+ * A lossless column holds each component's bits xor'd with the previous
+ * component's, and a lossy one the difference between neighbouring 16
+ * bit quantised components, so values close to their neighbours leave
+ * mostly zero bits. Each column is then byte-shuffled (every first byte,
+ * then every second byte, ...), which lines the similar bytes up.
+ *
+ * Every stream is cut into blocks of PACK_BLOCK bytes and each block is
+ * compressed on its own with an LZ4-style codec: runs of literal bytes
+ * followed by a copy of earlier output, found through a hash of the next
+ * four bytes. A block that doesn't get smaller is stored as it is.
+ * Everything is in the machine's byte order.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pack.h"
+#include "vec.h"
+#include "vectable.h"
+#include "index.h"
+
+#define PACK_MAGIC "TRIPACK1"
+#define PACK_MAGIC_LENGTH 8
+// raw bytes of a stream compressed at a time
+#define PACK_BLOCK (1 << 18)
+// set in a block's stored length when the block isn't compressed
+#define PACK_RAW_BLOCK 0x80000000u
+// largest value a lossy component is quantised to
+#define PACK_LEVELS 65535
+
+// bits of the codec's hash of four bytes
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+// the last bytes of a block are always literals, so the decoder's fast
+// copies can't run off the end
+#define LZ_LAST_LITERALS 12
+#define LZ_MAX_OFFSET 65535
+
+/**
+ * @brief Reads 4 bytes without caring about alignment
+ *
+ * @param p
+ * @return uint32_t
+ */
+static uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/**
+ * @brief Returns the codec's hash table slot for four bytes
+ *
+ * @param v
+ * @return uint32_t
+ */
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Returns the most bytes lz_compress can turn length bytes into
+ *
+ * @param length
+ * @return size_t
+ */
+size_t lz_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+/**
+ * @brief Writes a length past the 15 that fits in a token, as a run of
+ * 255s and a final byte
+ *
+ * @param out
+ * @param length
+ * @return unsigned char* the end of what was written
+ */
+static unsigned char* write_length(unsigned char* out, size_t length) {
+    while(length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+/**
+ * @brief Writes one sequence: literal bytes, then, unless this is the last
+ * sequence, a match of match bytes offset bytes back
+ *
+ * @param out
+ * @param literals
+ * @param literal_length
+ * @param match match length, 0 for the last sequence
+ * @param offset
+ * @return unsigned char* the end of what was written
+ */
+static unsigned char* write_sequence(unsigned char* out,
+    const unsigned char* literals, size_t literal_length,
+    size_t match, size_t offset) {
+    unsigned char* token = out++;
+    *token = (literal_length < 15 ? literal_length : 15) << 4;
+    if(literal_length >= 15) {
+        out = write_length(out, literal_length - 15);
+    }
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+    if(match == 0) {
+        return out;
+    }
+
+    *out++ = offset & 0xff;
+    *out++ = offset >> 8;
+    match -= LZ_MIN_MATCH;
+    *token |= match < 15 ? match : 15;
+    if(match >= 15) {
+        out = write_length(out, match - 15);
+    }
+    return out;
+}
+
+/**
+ * @brief Compresses length bytes into out, which must hold lz_bound(length)
+ * bytes. Matches are found greedily through a hash table of the last
+ * position each four bytes were seen at, and the search speeds up through
+ * stretches it can't find anything in.
+ *
+ * @param in
+ * @param length
+ * @param out
+ * @return size_t compressed length
+ */
+size_t lz_compress(const unsigned char* in, size_t length,
+    unsigned char* out) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    unsigned char* start = out;
+    size_t anchor = 0;
+    size_t position = 1;
+    if(length > LZ_LAST_LITERALS) {
+        size_t limit = length - LZ_LAST_LITERALS;
+        while(position < limit) {
+            uint32_t seq = read32(in + position);
+            uint32_t h = lz_hash(seq);
+            size_t candidate = table[h];
+            table[h] = position;
+            if(position - candidate > LZ_MAX_OFFSET
+                || read32(in + candidate) != seq) {
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+
+            // grow the match backwards over literals that also match
+            while(position > anchor && candidate > 0
+                && in[position - 1] == in[candidate - 1]) {
+                position--;
+                candidate--;
+            }
+            // 8 bytes at a time, then byte by byte through the 8 that differ
+            size_t match = LZ_MIN_MATCH;
+            while(position + match + 8 <= limit
+                && !memcmp(in + candidate + match, in + position + match, 8)) {
+                match += 8;
+            }
+            while(position + match < limit
+                && in[candidate + match] == in[position + match]) {
+                match++;
+            }
+            out = write_sequence(out, in + anchor, position - anchor,
+                match, position - candidate);
+            position += match;
+            anchor = position;
+            if(position - 2 < limit) {
+                table[lz_hash(read32(in + position - 2))] = position - 2;
+            }
+        }
+    }
+    out = write_sequence(out, in + anchor, length - anchor, 0, 0);
+    return out - start;
+}
+
+/**
+ * @brief Reads a length continued past a token's 15
+ *
+ * @param in
+ * @param end
+ * @param length added to
+ * @return int 0, or -1 if the input ends first
+ */
+static int read_length(const unsigned char** in, const unsigned char* end,
+    size_t* length) {
+    unsigned char byte;
+    do {
+        if(*in >= end) {
+            return -1;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while(byte == 255);
+    return 0;
+}
+
+/**
+ * @brief Decompresses length bytes of lz_compress output into exactly
+ * out_length bytes. Every length and offset is checked, so a damaged
+ * file fails instead of writing out of bounds.
+ *
+ * @param in
+ * @param length
+ * @param out
+ * @param out_length
+ * @return int 0, or -1 if the input is damaged
+ */
+int lz_decompress(const unsigned char* in, size_t length,
+    unsigned char* out, size_t out_length) {
+    const unsigned char* end = in + length;
+    unsigned char* op = out;
+    unsigned char* out_end = out + out_length;
+    while(in < end) {
+        unsigned char token = *in++;
+        size_t literals = token >> 4;
+        if(literals == 15 && read_length(&in, end, &literals) < 0) {
+            return -1;
+        }
+        if(literals > (size_t)(end - in)
+            || literals > (size_t)(out_end - op)) {
+            return -1;
+        }
+        if(literals <= 16 && end - in >= 16 && out_end - op >= 16) {
+            memcpy(op, in, 16);
+        } else {
+            memcpy(op, in, literals);
+        }
+        op += literals;
+        in += literals;
+        if(in == end) {
+            break;
+        }
+
+        if(end - in < 2) {
+            return -1;
+        }
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+        size_t match = token & 15;
+        if(match == 15 && read_length(&in, end, &match) < 0) {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if(offset == 0 || offset > (size_t)(op - out)
+            || match > (size_t)(out_end - op)) {
+            return -1;
+        }
+
+        unsigned char* from = op - offset;
+        if(offset >= 16 && out_end - op >= (ptrdiff_t)match + 16) {
+            // copies 16 bytes at a time, overshooting into space that the
+            // next sequence overwrites
+            for(size_t x = 0; x < match; x += 16) {
+                memcpy(op + x, from + x, 16);
+            }
+        } else if(offset >= 8 && out_end - op >= (ptrdiff_t)match + 8) {
+            for(size_t x = 0; x < match; x += 8) {
+                memcpy(op + x, from + x, 8);
+            }
+        } else {
+            for(size_t x = 0; x < match; x++) {
+                op[x] = from[x];
+            }
+        }
+        op += match;
+    }
+    return op == out_end ? 0 : -1;
+}
+
+/**
+ * @brief Appends an unsigned LEB128 varint
+ *
+ * @param out
+ * @param value
+ * @return unsigned char* the end of what was written
+ */
+static unsigned char* write_varint(unsigned char* out, size_t value) {
+    while(value >= 0x80) {
+        *out++ = value | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+/**
+ * @brief Reads an unsigned LEB128 varint
+ *
+ * @param in
+ * @param end
+ * @param value
+ * @return int 0, or -1 if the input ends first or the value is too long
+ */
+static int read_varint(const unsigned char** in, const unsigned char* end,
+    size_t* value) {
+    *value = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+        if(*in >= end) {
+            return -1;
+        }
+        unsigned char byte = *(*in)++;
+        *value |= (size_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Splits count elements of size bytes into size planes of count
+ * bytes: every first byte, then every second byte, and so on
+ *
+ * @param in
+ * @param count
+ * @param size
+ * @param out
+ */
+static void shuffle(const unsigned char* in, size_t count, int size,
+    unsigned char* out) {
+    for(int b = 0; b < size; b++) {
+        unsigned char* plane = out + b * count;
+        for(size_t x = 0; x < count; x++) {
+            plane[x] = in[x * size + b];
+        }
+    }
+}
+
+/**
+ * @brief Undoes shuffle
+ *
+ * @param in
+ * @param count
+ * @param size
+ * @param out
+ */
+static void unshuffle(const unsigned char* in, size_t count, int size,
+    unsigned char* out) {
+    for(int b = 0; b < size; b++) {
+        const unsigned char* plane = in + b * count;
+        for(size_t x = 0; x < count; x++) {
+            out[x * size + b] = plane[x];
+        }
+    }
+}
+
+/**
+ * @brief Writes all of length bytes to out
+ *
+ * @param out
+ * @param bytes
+ * @param length
+ * @return int 0, or -1 on error
+ */
+static int write_all(int out, const void* bytes, size_t length) {
+    const char* p = bytes;
+    while(length > 0) {
+        ssize_t written = write(out, p, length);
+        if(written < 0) {
+            return -1;
+        }
+        p += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compresses a stream block by block and writes it to out
+ *
+ * @param out
+ * @param stream
+ * @param length
+ * @return long bytes written, or -1 on error
+ */
+static long write_stream(int out, const unsigned char* stream, size_t length) {
+    unsigned char* block = malloc(lz_bound(PACK_BLOCK) + 4);
+    long total = 0;
+    for(size_t at = 0; at < length; at += PACK_BLOCK) {
+        size_t raw = length - at < PACK_BLOCK ? length - at : PACK_BLOCK;
+        uint32_t stored = lz_compress(stream + at, raw, block + 4);
+        if(stored >= raw) {
+            stored = raw;
+            memcpy(block + 4, stream + at, raw);
+            memcpy(block, &(uint32_t){ stored | PACK_RAW_BLOCK }, 4);
+        } else {
+            memcpy(block, &stored, 4);
+        }
+        if(write_all(out, block, stored + 4) < 0) {
+            free(block);
+            return -1;
+        }
+        total += stored + 4;
+    }
+    free(block);
+    return total;
+}
+
+/**
+ * @brief Decompresses a stream of length bytes starting at *in
+ *
+ * @param in moved past the stream
+ * @param end
+ * @param stream
+ * @param length
+ * @return int 0, or -1 if the stream is damaged
+ */
+static int read_stream(const unsigned char** in, const unsigned char* end,
+    unsigned char* stream, size_t length) {
+    for(size_t at = 0; at < length; at += PACK_BLOCK) {
+        size_t raw = length - at < PACK_BLOCK ? length - at : PACK_BLOCK;
+        if(end - *in < 4) {
+            return -1;
+        }
+        uint32_t stored = read32(*in);
+        *in += 4;
+        uint32_t size = stored & ~PACK_RAW_BLOCK;
+        if(size > (size_t)(end - *in)) {
+            return -1;
+        }
+        if(stored & PACK_RAW_BLOCK) {
+            if(size != raw) {
+                return -1;
+            }
+            memcpy(stream + at, *in, raw);
+        } else if(lz_decompress(*in, size, stream + at, raw) < 0) {
+            return -1;
+        }
+        *in += size;
+    }
+    return 0;
+}
+
+// the file's fixed header
+typedef struct {
+    char magic[PACK_MAGIC_LENGTH];
+    uint8_t codec;
+    uint8_t real_size;      // sizeof(real) of the build that wrote it
+    uint16_t reserved;
+    uint32_t rows;
+    uint64_t names_length;  // bytes of the front-coded names
+    double min[3];          // lossy only: component = min + level * scale
+    double scale[3];
+} pack_header;
+
+/**
+ * @brief Builds column c of a lossless file: each component's bits xor'd
+ * with the previous component's
+ *
+ * @param values
+ * @param rows
+ * @param c 0, 1 or 2 for i, j or k
+ * @param out rows * sizeof(real) bytes
+ */
+static void encode_exact(vector* values, int rows, int c,
+    unsigned char* out) {
+    #ifdef TRITONE_DOUBLE
+        typedef uint64_t bits;
+    #else
+        typedef uint32_t bits;
+    #endif
+    bits previous = 0;
+    for(int x = 0; x < rows; x++) {
+        real r = ((real*)&values[x])[c];
+        bits b;
+        memcpy(&b, &r, sizeof(b));
+        b ^= previous;
+        previous ^= b;
+        memcpy(out + x * sizeof(b), &b, sizeof(b));
+    }
+}
+
+/**
+ * @brief Builds column c of a lossy file: each component quantised to
+ * PACK_LEVELS steps between the column's min and max, stored as the
+ * difference from the previous one
+ *
+ * @param values
+ * @param rows
+ * @param c 0, 1 or 2 for i, j or k
+ * @param header gets the column's min and scale
+ * @param out rows * 2 bytes
+ * @return int 0, or -1 if the column holds a nan or infinity
+ */
+static int encode_levels(vector* values, int rows, int c,
+    pack_header* header, unsigned char* out) {
+    double min = INFINITY;
+    double max = -INFINITY;
+    for(int x = 0; x < rows; x++) {
+        double r = ((real*)&values[x])[c];
+        if(!isfinite(r)) {
+            return -1;
+        }
+        min = r < min ? r : min;
+        max = r > max ? r : max;
+    }
+    double scale = rows > 0 ? (max - min) / PACK_LEVELS : 0;
+    header->min[c] = rows > 0 ? min : 0;
+    header->scale[c] = scale;
+
+    uint16_t previous = 0;
+    for(int x = 0; x < rows; x++) {
+        double r = ((real*)&values[x])[c];
+        uint16_t level = scale > 0 ? lround((r - min) / scale) : 0;
+        uint16_t delta = level - previous;
+        previous = level;
+        memcpy(out + x * 2, &delta, 2);
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes every stored vector to path as a packed table
+ *
+ * @param path
+ * @param codec
+ * @param error set to the largest amount a component can be off by when
+ * read back: 0 for PACK_LOSSLESS, half a quantisation step for PACK_LOSSY
+ * @return int number of vectors written, -1 if path can't be written, or
+ * -2 if a lossy table holds a nan or infinity
+ */
+int write_packed(char* path, pack_codec codec, double* error) {
+    // names and vectors in name order
+    int capacity = 1024;
+    int rows = 0;
+    vector* values = malloc(capacity * sizeof(vector));
+    size_t names_capacity = 1 << 16;
+    size_t names_length = 0;
+    unsigned char* names = malloc(names_capacity);
+    char* previous = "";
+    size_t previous_length = 0;
+
+    index_cursor cursor = index_seek("");
+    for(char* key = index_next(&cursor); key != NULL;
+        key = index_next(&cursor)) {
+        vt_option o = get_vector(key);
+        if(!is_some(o)) {
+            continue;
+        }
+        if(rows == capacity) {
+            capacity *= 2;
+            values = realloc(values, capacity * sizeof(vector));
+        }
+        values[rows++] = o.value.value;
+
+        size_t length = strlen(key);
+        size_t shared = 0;
+        while(shared < length && shared < previous_length
+            && key[shared] == previous[shared]) {
+            shared++;
+        }
+        if(names_length + length + 20 > names_capacity) {
+            while(names_length + length + 20 > names_capacity) {
+                names_capacity *= 2;
+            }
+            names = realloc(names, names_capacity);
+        }
+        unsigned char* out = names + names_length;
+        out = write_varint(out, shared);
+        out = write_varint(out, length - shared);
+        memcpy(out, key + shared, length - shared);
+        names_length = out + length - shared - names;
+        previous = key;
+        previous_length = length;
+    }
+
+    pack_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, PACK_MAGIC_LENGTH);
+    header.codec = codec;
+    header.real_size = sizeof(real);
+    header.rows = rows;
+    header.names_length = names_length;
+
+    int size = codec == PACK_LOSSY ? 2 : sizeof(real);
+    unsigned char* column = malloc((size_t)rows * size + 1);
+    unsigned char* columns = malloc((size_t)rows * size * 3 + 1);
+    int result = rows;
+    *error = 0;
+    for(int c = 0; c < 3 && result >= 0; c++) {
+        if(codec == PACK_LOSSY) {
+            if(encode_levels(values, rows, c, &header, column) < 0) {
+                result = -2;
+            }
+            *error = header.scale[c] / 2 > *error ? header.scale[c] / 2
+                : *error;
+        } else {
+            encode_exact(values, rows, c, column);
+        }
+        shuffle(column, rows, size, columns + (size_t)c * rows * size);
+    }
+    free(column);
+    free(values);
+
+    int fd = result >= 0 ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+        : -1;
+    if(result >= 0 && fd < 0) {
+        result = -1;
+    }
+    if(result >= 0 && (write_all(fd, &header, sizeof(header)) < 0
+        || write_stream(fd, names, names_length) < 0
+        || write_stream(fd, columns, (size_t)rows * size * 3) < 0)) {
+        result = -1;
+    }
+    if(fd >= 0 && close(fd) < 0) {
+        result = -1;
+    }
+    free(names);
+    free(columns);
+    return result;
+}
+
+/**
+ * @brief Returns true if path starts like a packed table
+ *
+ * @param path
+ * @return int
+ */
+int is_packed(char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return 0;
+    }
+    char magic[PACK_MAGIC_LENGTH];
+    int found = read(fd, magic, PACK_MAGIC_LENGTH) == PACK_MAGIC_LENGTH
+        && !memcmp(magic, PACK_MAGIC, PACK_MAGIC_LENGTH);
+    close(fd);
+    return found;
+}
+
+/**
+ * @brief Reads the whole file at path into memory
+ *
+ * @param path
+ * @param length set to its size
+ * @return unsigned char* the contents, or NULL if it can't be read
+ */
+static unsigned char* read_file(char* path, size_t* length) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    unsigned char* contents = malloc(st.st_size + 1);
+    size_t got = 0;
+    while(got < (size_t)st.st_size) {
+        ssize_t n = read(fd, contents + got, st.st_size - got);
+        if(n <= 0) {
+            free(contents);
+            close(fd);
+            return NULL;
+        }
+        got += n;
+    }
+    close(fd);
+    *length = got;
+    return contents;
+}
+
+/**
+ * @brief Checks the front-coded dictionary and returns how many bytes its
+ * names take, with their terminators
+ *
+ * @param names the dictionary
+ * @param length its length
+ * @param rows
+ * @return size_t the bytes, or 0 if the dictionary is damaged
+ */
+static size_t names_size(const unsigned char* names, size_t length,
+    int rows) {
+    const unsigned char* in = names;
+    const unsigned char* end = names + length;
+    size_t previous_length = 0;
+    size_t total = 1;
+    for(int x = 0; x < rows; x++) {
+        size_t shared;
+        size_t rest;
+        if(read_varint(&in, end, &shared) < 0
+            || read_varint(&in, end, &rest) < 0
+            || shared > previous_length || rest > (size_t)(end - in)) {
+            return 0;
+        }
+        in += rest;
+        previous_length = shared + rest;
+        total += previous_length + 1;
+    }
+    return total;
+}
+
+/**
+ * @brief Rebuilds the names from the front-coded dictionary, one after
+ * another with their terminators
+ *
+ * @param names the dictionary
+ * @param length its length
+ * @param rows
+ * @param keys gets a pointer to each name
+ * @return char* the names, or NULL if the dictionary is damaged
+ */
+static char* decode_names(const unsigned char* names, size_t length,
+    int rows, char** keys) {
+    size_t size = names_size(names, length, rows);
+    if(size == 0) {
+        return NULL;
+    }
+    char* text = malloc(size);
+    char* name = text;
+    const unsigned char* in = names;
+    const unsigned char* end = names + length;
+    for(int x = 0; x < rows; x++) {
+        size_t shared;
+        size_t rest;
+        read_varint(&in, end, &shared);
+        read_varint(&in, end, &rest);
+        if(x > 0) {
+            memcpy(name, keys[x - 1], shared);
+        }
+        memcpy(name + shared, in, rest);
+        name[shared + rest] = '\0';
+        in += rest;
+        keys[x] = name;
+        name += shared + rest + 1;
+    }
+    return text;
+}
+
+/**
+ * @brief Turns the decompressed columns back into vectors
+ *
+ * @param header
+ * @param columns
+ * @param values
+ */
+static void decode_columns(pack_header* header, unsigned char* columns,
+    vector* values) {
+    int rows = header->rows;
+    int size = header->codec == PACK_LOSSY ? 2 : header->real_size;
+    unsigned char* column = malloc((size_t)rows * size + 1);
+    for(int c = 0; c < 3; c++) {
+        unshuffle(columns + (size_t)c * rows * size, rows, size, column);
+        if(header->codec == PACK_LOSSY) {
+            uint16_t level = 0;
+            for(int x = 0; x < rows; x++) {
+                uint16_t delta;
+                memcpy(&delta, column + x * 2, 2);
+                level += delta;
+                ((real*)&values[x])[c] = header->min[c]
+                    + level * header->scale[c];
+            }
+        } else if(size == 8) {
+            uint64_t bits = 0;
+            for(int x = 0; x < rows; x++) {
+                uint64_t delta;
+                memcpy(&delta, column + x * 8, 8);
+                bits ^= delta;
+                double r;
+                memcpy(&r, &bits, 8);
+                ((real*)&values[x])[c] = r;
+            }
+        } else {
+            uint32_t bits = 0;
+            for(int x = 0; x < rows; x++) {
+                uint32_t delta;
+                memcpy(&delta, column + x * 4, 4);
+                bits ^= delta;
+                float r;
+                memcpy(&r, &bits, 4);
+                ((real*)&values[x])[c] = r;
+            }
+        }
+    }
+    free(column);
+}
+
+/**
+ * @brief Decodes a packed table held in memory
+ *
+ * @param file
+ * @param length
+ * @param rows gets the names and vectors, to free with free_pack_rows
+ * @return int 0, or -1 if the file is damaged
+ */
+int unpack(unsigned char* file, size_t length, pack_rows* rows) {
+    pack_header header;
+    const unsigned char* in = file + sizeof(header);
+    const unsigned char* end = file + length;
+    int size = 0;
+    int valid = length >= sizeof(header);
+    if(valid) {
+        memcpy(&header, file, sizeof(header));
+        size = header.codec == PACK_LOSSY ? 2 : header.real_size;
+        valid = !memcmp(header.magic, PACK_MAGIC, PACK_MAGIC_LENGTH)
+            && header.codec < PACK_CODEC_COUNT
+            && (header.real_size == 4 || header.real_size == 8)
+            && header.rows <= INT32_MAX / 8
+            && header.names_length <= length * 256
+            && (size_t)header.rows * size * 3 <= length * 256;
+    }
+
+    int count = valid ? header.rows : 0;
+    unsigned char* names = valid ? malloc(header.names_length + 1) : NULL;
+    unsigned char* columns = valid ? malloc((size_t)count * size * 3 + 1)
+        : NULL;
+    valid = valid && read_stream(&in, end, names, header.names_length) == 0
+        && read_stream(&in, end, columns, (size_t)count * size * 3) == 0;
+
+    rows->count = count;
+    rows->keys = malloc(((size_t)count + 1) * sizeof(char*));
+    rows->values = malloc(((size_t)count + 1) * sizeof(vector));
+    rows->text = valid
+        ? decode_names(names, header.names_length, count, rows->keys) : NULL;
+    if(rows->text != NULL) {
+        decode_columns(&header, columns, rows->values);
+    }
+    free(names);
+    free(columns);
+    if(rows->text == NULL) {
+        free_pack_rows(rows);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees what unpack decoded
+ *
+ * @param rows
+ */
+void free_pack_rows(pack_rows* rows) {
+    free(rows->keys);
+    free(rows->values);
+    free(rows->text);
+    rows->keys = NULL;
+    rows->values = NULL;
+    rows->text = NULL;
+}
+
+/**
+ * @brief Reads and decodes the packed table at path, without storing it
+ *
+ * @param path
+ * @param rows filled in on success; free with free_pack_rows
+ * @return int 0, -1 if path can't be read, or -2 if it is damaged
+ */
+int unpack_file(char* path, pack_rows* rows) {
+    size_t length;
+    unsigned char* file = read_file(path, &length);
+    if(file == NULL) {
+        return -1;
+    }
+    int valid = unpack(file, length, rows) == 0;
+    free(file);
+    return valid ? 0 : -2;
+}
+
+/**
+ * @brief Reads a packed table from path. The whole file is decoded before
+ * anything is stored, so a damaged file leaves the table as it was.
+ *
+ * @param path
+ * @return int number of vectors read, -1 if path can't be opened, or -2
+ * if the file is damaged
+ */
+int read_packed(char* path) {
+    pack_rows rows;
+    int result = unpack_file(path, &rows);
+    if(result == -2) {
+        printf("Error: %s is damaged, nothing was read\n", path);
+    }
+    if(result < 0) {
+        return result;
+    }
+    insert_vectors(rows.keys, rows.values, rows.count);
+    free_pack_rows(&rows);
+    return rows.count;
+}
@@ -0,0 +1,37 @@
+#ifndef PACK_H
+#define PACK_H
+
+    #include <stddef.h>
+    #include "vec.h"
+
+    /*
+     * Compressed binary tables, written with write "path" packed (or lossy)
+     * and picked up by read from their magic number.
+     */
+
+    typedef enum {
+        PACK_LOSSLESS,  // every bit of every component
+        PACK_LOSSY,     // components quantised to 16 bits between their min and max
+        PACK_CODEC_COUNT,
+    } pack_codec;
+
+    // a packed table decoded into memory
+    typedef struct {
+        char** keys;
+        vector* values;
+        char* text;     // the names keys point into
+        int count;
+    } pack_rows;
+
+    int write_packed(char* path, pack_codec codec, double* error);
+    int read_packed(char* path);
+    int unpack(unsigned char* file, size_t length, pack_rows* rows);
+    int unpack_file(char* path, pack_rows* rows);
+    void free_pack_rows(pack_rows* rows);
+    int is_packed(char* path);
+    size_t lz_bound(size_t length);
+    size_t lz_compress(const unsigned char* in, size_t length, unsigned char* out);
+    int lz_decompress(const unsigned char* in, size_t length,
+        unsigned char* out, size_t out_length);
+
+#endif
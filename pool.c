@@ -0,0 +1,53 @@
+/**
+ * @file pool.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Runs a work function on several threads at once, with the
+ * calling thread as one of them. The work function takes tasks from a
+ * queue of its own until none are left, so a thread that can't be
+ * started only means the others, and the caller, do more of the work.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+/**
+ * @brief Returns how many threads to work on, one per online processor
+ * but at least one and at most most
+ *
+ * @param most
+ * @return int
+ */
+int pool_threads(int most) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = threads < 1 ? 1 : threads;
+    return threads > most ? most : threads;
+}
+
+/**
+ * @brief Runs work(arg) on threads threads, this one included, and
+ * returns once every one of them has returned
+ *
+ * @param work
+ * @param arg
+ * @param threads
+ */
+void run_threads(void* (*work)(void*), void* arg, int threads) {
+    pthread_t* workers = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    while(started < threads - 1
+        && pthread_create(&workers[started], NULL, work, arg) == 0) {
+        started++;
+    }
+    work(arg);
+    for(int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+}
@@ -0,0 +1,13 @@
+#ifndef POOL_H
+#define POOL_H
+
+    /*
+     * Running one piece of work on several threads at once. The work
+     * function takes its next task from a queue it shares with the
+     * other threads, so it doesn't matter how many of them start.
+     */
+
+    int pool_threads(int most);
+    void run_threads(void* (*work)(void*), void* arg, int threads);
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file prof.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Counters behind the stats command. The counting itself is done
+ * by the macros in prof.h where each stage runs; this file only holds
+ * the totals and prints them.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "prof.h"
+
+#ifdef TRITONE_PROFILE
+
+prof_counters prof;
+
+static char* stage_names[STAGE_COUNT] = {
+    [STAGE_INPUT] = "input",
+    [STAGE_LEX] = "lex",
+    [STAGE_PARSE] = "parse",
+    [STAGE_EVALUATE] = "evaluate",
+    [STAGE_TABLE] = "  table",
+    [STAGE_PRINT] = "print",
+};
+
+static char* probe_names[PROBE_COUNT] = {
+    [PROBE_GET] = "get_vector",
+    [PROBE_INSERT] = "insert_vector",
+};
+
+/**
+ * @brief Returns numerator / denominator, or 0 if denominator is 0
+ *
+ * @param numerator
+ * @param denominator
+ * @return double
+ */
+static double ratio(double numerator, double denominator) {
+    return denominator ? numerator / denominator : 0;
+}
+
+/**
+ * @brief Prints the time spent in each stage, the probe lengths of
+ * table operations and the resizes since the last reset
+ *
+ */
+void print_stats(void) {
+    unsigned long long total = 0;
+    for(int s = 0; s < STAGE_COUNT; s++) {
+        // table time is already part of evaluate
+        if(s != STAGE_TABLE) {
+            total += prof.stage[s];
+        }
+    }
+
+    printf("%llu lines, times in %s\n", prof.lines, PROF_UNIT);
+    printf("  %-14s %16s %7s %14s\n", "stage", "total", "share", "per line");
+    for(int s = 0; s < STAGE_COUNT; s++) {
+        printf("  %-14s %16llu %6.1f%% %14.0f\n",
+            stage_names[s],
+            prof.stage[s],
+            100 * ratio(prof.stage[s], total),
+            ratio(prof.stage[s], prof.lines));
+    }
+
+    printf("  %-14s %16s %7s %14s\n", "probes", "calls", "average", "longest");
+    for(int p = 0; p < PROBE_COUNT; p++) {
+        printf("  %-14s %16llu %7.2f %14llu\n",
+            probe_names[p],
+            prof.probes[p],
+            ratio(prof.slots[p], prof.probes[p]),
+            prof.longest[p]);
+    }
+
+    printf("  resizes: %llu, %llu %s total, %llu longest\n",
+        prof.resizes, prof.resize_time, PROF_UNIT, prof.resize_longest);
+}
+
+/**
+ * @brief Zeroes every counter
+ *
+ */
+void reset_stats(void) {
+    memset(&prof, 0, sizeof(prof));
+}
+
+#else
+
+/**
+ * @brief Explains that the counters were compiled out
+ *
+ */
+void print_stats(void) {
+    printf("Error: profiling is not built in, rebuild with make profile\n");
+}
+
+/**
+ * @brief Does nothing; there are no counters to reset
+ *
+ */
+void reset_stats(void) {
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef PROF_H
+#define PROF_H
+
+    /*
+     * Optional instrumentation: cycle counts for each stage of a line,
+     * probe lengths of table lookups and inserts, and resize counts and
+     * times. Only built with -DTRITONE_PROFILE (make profile); otherwise
+     * every PROF_ macro expands to nothing.
+     */
+
+    typedef enum {
+        STAGE_INPUT,        // fgets, including time spent waiting on input
+        STAGE_LEX,
+        STAGE_PARSE,
+        STAGE_EVALUATE,
+        STAGE_TABLE,        // get_vector and insert_vector, within evaluate
+        STAGE_PRINT,
+        STAGE_COUNT,
+    } prof_stage;
+
+    typedef enum {
+        PROBE_GET,
+        PROBE_INSERT,
+        PROBE_COUNT,
+    } prof_probe;
+
+    #ifdef TRITONE_PROFILE
+        #if defined(__x86_64__) || defined(__i386__)
+            #include <x86intrin.h>
+            #define PROF_UNIT "cycles"
+            static inline unsigned long long prof_clock(void) {
+                return __rdtsc();
+            }
+        #else
+            #include <time.h>
+            #define PROF_UNIT "ns"
+            static inline unsigned long long prof_clock(void) {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+            }
+        #endif
+
+        typedef struct {
+            unsigned long long stage[STAGE_COUNT];
+            unsigned long long lines;
+            unsigned long long probes[PROBE_COUNT];   // calls
+            unsigned long long slots[PROBE_COUNT];    // slots visited
+            unsigned long long longest[PROBE_COUNT];
+            unsigned long long resizes;
+            unsigned long long resize_time;
+            unsigned long long resize_longest;
+        } prof_counters;
+
+        extern prof_counters prof;
+
+        #define PROF_START(t) unsigned long long t = prof_clock()
+        #define PROF_STOP(s, t) (prof.stage[s] += prof_clock() - (t))
+        #define PROF_LINE() (prof.lines++)
+        #define PROF_PROBE(p, length) do { \
+                prof.probes[p]++; \
+                prof.slots[p] += (length); \
+                if((unsigned long long)(length) > prof.longest[p]) { \
+                    prof.longest[p] = (length); \
+                } \
+            } while(0)
+        #define PROF_RESIZE(t) do { \
+                unsigned long long _elapsed = prof_clock() - (t); \
+                prof.resizes++; \
+                prof.resize_time += _elapsed; \
+                if(_elapsed > prof.resize_longest) { \
+                    prof.resize_longest = _elapsed; \
+                } \
+            } while(0)
+    #else
+        #define PROF_START(t)
+        #define PROF_STOP(s, t)
+        #define PROF_LINE()
+        #define PROF_PROBE(p, length)
+        #define PROF_RESIZE(t)
+    #endif
+
+    void print_stats(void);
+    void reset_stats(void);
+
+#endif
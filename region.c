@@ -0,0 +1,585 @@
+/**
+ * @file region.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Counts and centroids of the stored vectors in a box or a sphere,
+ * inbox(lo, hi) and insphere(c, r). The first such query copies the
+ * spatial index's points into a bounding volume hierarchy: the points are
+ * split in half at the median along i, then j, then k, down to leaves of
+ * REGION_LEAF points, and each node keeps the tight box around its points
+ * and their sum. A node wholly inside the region adds its count and sum
+ * without looking at a point, one wholly outside is skipped, and only
+ * leaves the region's edge passes through are measured point by point.
+ *
+ * The tree is balanced and complete, so a node's children and the points
+ * it covers follow from its number and nothing else. The first few levels
+ * are split on the calling thread and the subtrees below them are built
+ * by up to REGION_THREADS threads, each taking the next one not yet
+ * started.
+ *
+ * The tree isn't changed when vectors are stored. A vector added since
+ * it was built is past the end of the tree's points and is measured on its
+ * own, and a vector that moved is kept in a list with where the tree has
+ * it, so a query takes it out of the tree's answer and puts it back where
+ * it is now. Once those come to more than one point in REGION_STALE the
+ * tree is built again.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "region.h"
+#include "pool.h"
+#include "space.h"
+
+// the tree is built again once this many points have changed since, for
+// each one it holds
+#define REGION_STALE 32
+// subtrees per thread the top of the tree is split into
+#define REGION_TASKS 4
+
+typedef struct {
+    real lo[3];
+    real hi[3];
+    double sum[3];
+} tree_node;
+
+// a box or a sphere
+typedef struct {
+    int sphere;
+    double lo[3];       // box corners
+    double hi[3];
+    double c[3];        // sphere centre and radius squared
+    double r2;
+} region;
+
+// points in the tree, nodes over them and what changed since
+typedef struct {
+    vector* at;             // each point, in tree order, then those
+                            // with a component that isn't finite
+    tree_node* nodes;
+    int count;              // points when the tree was built
+    int held;               // of those, the finite ones the tree holds
+    unsigned char* moved;   // points that have moved since, by number
+    int* changed;           // the points that have, and where the tree
+    vector* was;            // has them
+    int changes;
+    int changes_capacity;
+} region_tree;
+
+// a subtree for a thread to build
+typedef struct {
+    int node;
+    int from;
+    int to;
+    int depth;
+} subtree;
+
+// the subtrees below the top of the tree and the next one to build
+typedef struct {
+    subtree* tasks;
+    int count;
+    atomic_int next;
+} subtree_queue;
+
+static region_tree tree;
+static int planted = 0;
+
+/**
+ * @brief Frees the tree. The next query builds it again.
+ *
+ */
+void region_drop(void) {
+    if(!planted) {
+        return;
+    }
+    free(tree.at);
+    free(tree.nodes);
+    free(tree.moved);
+    free(tree.changed);
+    free(tree.was);
+    memset(&tree, 0, sizeof(tree));
+    planted = 0;
+}
+
+/**
+ * @brief Notes that point p moved away from old, where the tree has it
+ *
+ * @param p
+ * @param old
+ */
+void region_moved(int p, vector old) {
+    if(!planted || p >= tree.count || tree.moved[p]) {
+        return;
+    }
+    if(tree.changes == tree.changes_capacity) {
+        tree.changes_capacity = tree.changes_capacity > 0
+            ? tree.changes_capacity * 2 : 64;
+        tree.changed = realloc(tree.changed,
+            tree.changes_capacity * sizeof(int));
+        tree.was = realloc(tree.was, tree.changes_capacity * sizeof(vector));
+    }
+    tree.moved[p] = 1;
+    tree.changed[tree.changes] = p;
+    tree.was[tree.changes] = old;
+    tree.changes++;
+}
+
+/**
+ * @brief Returns how many levels the tree needs below its root for n
+ * points
+ *
+ * @param n
+ * @return int
+ */
+static int tree_depth(int n) {
+    int depth = 0;
+    while((n + (1l << depth) - 1) >> depth > REGION_LEAF) {
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * @brief Swaps two of the tree's points
+ *
+ * @param a
+ * @param b
+ */
+static void swap_points(int a, int b) {
+    vector t = tree.at[a];
+    tree.at[a] = tree.at[b];
+    tree.at[b] = t;
+}
+
+/**
+ * @brief Returns one component of one of the tree's points
+ *
+ * @param p
+ * @param axis 0 for i, 1 for j, 2 for k
+ * @return real
+ */
+static real coord(int p, int axis) {
+    return ((real*)&tree.at[p])[axis];
+}
+
+/**
+ * @brief Partially sorts the points from..to along an axis so that the
+ * point at nth is the one a full sort would put there, with none after it
+ * smaller and none before it larger
+ *
+ * @param from
+ * @param to one past the last point
+ * @param nth
+ * @param axis
+ */
+static void select_nth(int from, int to, int nth, int axis) {
+    int lo = from;
+    int hi = to - 1;
+    while(hi > lo) {
+        // median of three, which also guards both ends of the partition
+        int mid = lo + (hi - lo) / 2;
+        if(coord(mid, axis) < coord(lo, axis)) {
+            swap_points(mid, lo);
+        }
+        if(coord(hi, axis) < coord(lo, axis)) {
+            swap_points(hi, lo);
+        }
+        if(coord(hi, axis) < coord(mid, axis)) {
+            swap_points(hi, mid);
+        }
+        real pivot = coord(mid, axis);
+        int i = lo;
+        int j = hi;
+        while(i <= j) {
+            while(coord(i, axis) < pivot) {
+                i++;
+            }
+            while(coord(j, axis) > pivot) {
+                j--;
+            }
+            if(i <= j) {
+                swap_points(i, j);
+                i++;
+                j--;
+            }
+        }
+        if(nth <= j) {
+            hi = j;
+        } else if(nth >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Sets a leaf's box and sum from its points
+ *
+ * @param node
+ * @param from
+ * @param to
+ */
+static void fill_leaf(int node, int from, int to) {
+    tree_node* t = &tree.nodes[node];
+    for(int a = 0; a < 3; a++) {
+        real lo = INFINITY;
+        real hi = -INFINITY;
+        double sum = 0;
+        for(int p = from; p < to; p++) {
+            real x = coord(p, a);
+            lo = x < lo ? x : lo;
+            hi = x > hi ? x : hi;
+            sum += x;
+        }
+        t->lo[a] = lo;
+        t->hi[a] = hi;
+        t->sum[a] = sum;
+    }
+}
+
+/**
+ * @brief Sets a node's box and sum from its children's
+ *
+ * @param node
+ */
+static void fill_parent(int node) {
+    tree_node* t = &tree.nodes[node];
+    tree_node* l = &tree.nodes[2 * node + 1];
+    tree_node* r = &tree.nodes[2 * node + 2];
+    for(int a = 0; a < 3; a++) {
+        t->lo[a] = l->lo[a] < r->lo[a] ? l->lo[a] : r->lo[a];
+        t->hi[a] = l->hi[a] > r->hi[a] ? l->hi[a] : r->hi[a];
+        t->sum[a] = l->sum[a] + r->sum[a];
+    }
+}
+
+/**
+ * @brief Builds the subtree at node over the points from..to
+ *
+ * @param node
+ * @param from
+ * @param to
+ * @param depth levels left below node
+ */
+static void build_subtree(int node, int from, int to, int depth) {
+    if(depth == 0) {
+        fill_leaf(node, from, to);
+        return;
+    }
+    int mid = from + (to - from) / 2;
+    select_nth(from, to, mid, depth % 3);
+    build_subtree(2 * node + 1, from, mid, depth - 1);
+    build_subtree(2 * node + 2, mid, to, depth - 1);
+    fill_parent(node);
+}
+
+/**
+ * @brief Builds subtrees from the queue until none are left
+ *
+ * @param arg the subtree_queue
+ * @return void*
+ */
+static void* build_subtrees(void* arg) {
+    subtree_queue* q = arg;
+    int x;
+    while((x = atomic_fetch_add(&q->next, 1)) < q->count) {
+        subtree* s = &q->tasks[x];
+        build_subtree(s->node, s->from, s->to, s->depth);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Splits the top of the tree, down to where the queue's subtrees
+ * start, and queues those
+ *
+ * @param q
+ * @param node
+ * @param from
+ * @param to
+ * @param depth levels left below node
+ * @param top levels left to split here
+ */
+static void split_top(subtree_queue* q, int node, int from, int to,
+    int depth, int top) {
+    if(top == 0 || depth == 0) {
+        q->tasks[q->count++] = (subtree){ node, from, to, depth };
+        return;
+    }
+    int mid = from + (to - from) / 2;
+    select_nth(from, to, mid, depth % 3);
+    split_top(q, 2 * node + 1, from, mid, depth - 1, top - 1);
+    split_top(q, 2 * node + 2, mid, to, depth - 1, top - 1);
+}
+
+/**
+ * @brief Fills in the nodes split_top split, once their subtrees are built
+ *
+ * @param node
+ * @param depth levels left below node
+ * @param top levels split_top split here
+ */
+static void fill_top(int node, int depth, int top) {
+    if(top == 0 || depth == 0) {
+        return;
+    }
+    fill_top(2 * node + 1, depth - 1, top - 1);
+    fill_top(2 * node + 2, depth - 1, top - 1);
+    fill_parent(node);
+}
+
+/**
+ * @brief Builds the tree over every point the spatial index has
+ *
+ */
+static void plant(void) {
+    vector_array points;
+    int n = space_points(&points);
+    tree.count = n;
+    tree.at = malloc((n + 1) * sizeof(vector));
+    for(int p = 0; p < n; p++) {
+        tree.at[p] = (vector){ points.i[p], points.j[p], points.k[p] };
+    }
+    tree.moved = calloc(n + 1, 1);
+    planted = 1;
+
+    // a NaN would be left out of a node's box but not its sum, so points
+    // that aren't finite go after the tree's and are measured one by one
+    int held = 0;
+    for(int p = 0; p < n; p++) {
+        vector v = tree.at[p];
+        if(isfinite(v.i) && isfinite(v.j) && isfinite(v.k)) {
+            swap_points(p, held++);
+        }
+    }
+    tree.held = held;
+    n = held;
+    if(n == 0) {
+        return;
+    }
+
+    int depth = tree_depth(n);
+    tree.nodes = malloc(((2l << depth) - 1) * sizeof(tree_node));
+    int threads = pool_threads(REGION_THREADS);
+    int top = 0;
+    while((1 << top) < threads * REGION_TASKS && top < depth) {
+        top++;
+    }
+
+    subtree_queue q;
+    q.tasks = malloc((1 << top) * sizeof(subtree));
+    q.count = 0;
+    q.next = 0;
+    split_top(&q, 0, 0, n, depth, top);
+    run_threads(build_subtrees, &q, threads < q.count ? threads : q.count);
+    fill_top(0, depth, top);
+    free(q.tasks);
+}
+
+/**
+ * @brief Returns true if a point is inside a region
+ *
+ * @param g
+ * @param i
+ * @param j
+ * @param k
+ * @return int
+ */
+static int inside(region* g, real i, real j, real k) {
+    if(g->sphere) {
+        double di = i - g->c[0];
+        double dj = j - g->c[1];
+        double dk = k - g->c[2];
+        return di * di + dj * dj + dk * dk <= g->r2;
+    }
+    return i >= g->lo[0] && i <= g->hi[0] && j >= g->lo[1]
+        && j <= g->hi[1] && k >= g->lo[2] && k <= g->hi[2];
+}
+
+/**
+ * @brief Returns how a node's box lies against a region
+ *
+ * @param g
+ * @param t
+ * @return int 0 if they don't meet, 2 if the box is wholly inside, or 1
+ */
+static int overlap(region* g, tree_node* t) {
+    if(!g->sphere) {
+        int within = 1;
+        for(int a = 0; a < 3; a++) {
+            if(t->hi[a] < g->lo[a] || t->lo[a] > g->hi[a]) {
+                return 0;
+            }
+            within &= t->lo[a] >= g->lo[a] && t->hi[a] <= g->hi[a];
+        }
+        return within ? 2 : 1;
+    }
+    // the nearest and farthest the box gets to the centre
+    double near = 0;
+    double far = 0;
+    for(int a = 0; a < 3; a++) {
+        double below = g->c[a] - t->lo[a];
+        double above = t->hi[a] - g->c[a];
+        double gap = below < 0 ? -below : above < 0 ? -above : 0;
+        double reach = below > above ? below : above;
+        near += gap * gap;
+        far += reach * reach;
+    }
+    if(near > g->r2) {
+        return 0;
+    }
+    return far <= g->r2 ? 2 : 1;
+}
+
+/**
+ * @brief Adds up the points of the subtree at node inside a region
+ *
+ * @param g
+ * @param node
+ * @param from
+ * @param to
+ * @param depth levels left below node
+ * @param sum
+ * @param count
+ */
+static void sum_node(region* g, int node, int from, int to, int depth,
+    double* sum, long* count) {
+    tree_node* t = &tree.nodes[node];
+    int o = overlap(g, t);
+    if(o == 0) {
+        return;
+    } else if(o == 2) {
+        *count += to - from;
+        for(int a = 0; a < 3; a++) {
+            sum[a] += t->sum[a];
+        }
+    } else if(depth == 0) {
+        for(int p = from; p < to; p++) {
+            vector v = tree.at[p];
+            if(inside(g, v.i, v.j, v.k)) {
+                (*count)++;
+                sum[0] += v.i;
+                sum[1] += v.j;
+                sum[2] += v.k;
+            }
+        }
+    } else {
+        int mid = from + (to - from) / 2;
+        sum_node(g, 2 * node + 1, from, mid, depth - 1, sum, count);
+        sum_node(g, 2 * node + 2, mid, to, depth - 1, sum, count);
+    }
+}
+
+/**
+ * @brief Adds a point to or takes it from a sum if it is inside a region
+ *
+ * @param g
+ * @param v
+ * @param sign 1 to add, -1 to take away
+ * @param sum
+ * @param count
+ */
+static void adjust(region* g, vector v, int sign, double* sum,
+    long* count) {
+    if(inside(g, v.i, v.j, v.k)) {
+        *count += sign;
+        sum[0] += sign * (double)v.i;
+        sum[1] += sign * (double)v.j;
+        sum[2] += sign * (double)v.k;
+    }
+}
+
+/**
+ * @brief Counts the stored vectors in a region and works out their mean
+ *
+ * @param g
+ * @return region_summary
+ */
+static region_summary summarise(region* g) {
+    vector_array points;
+    int n = space_points(&points);
+    double sum[3] = { 0, 0, 0 };
+    long count = 0;
+    int from = 0;
+    if(get_space_mode() == SPACE_GRID) {
+        if(planted && (long)(tree.changes + n - tree.count)
+            * REGION_STALE > tree.count) {
+            region_drop();
+        }
+        if(!planted) {
+            plant();
+        }
+        if(tree.held > 0) {
+            sum_node(g, 0, 0, tree.held, tree_depth(tree.held), sum,
+                &count);
+        }
+        for(int p = tree.held; p < tree.count; p++) {
+            adjust(g, tree.at[p], 1, sum, &count);
+        }
+        for(int x = 0; x < tree.changes; x++) {
+            int p = tree.changed[x];
+            vector now = { points.i[p], points.j[p], points.k[p] };
+            adjust(g, tree.was[x], -1, sum, &count);
+            adjust(g, now, 1, sum, &count);
+        }
+        // vectors stored since the tree was built
+        from = tree.count;
+    }
+    for(int p = from; p < n; p++) {
+        vector v = { points.i[p], points.j[p], points.k[p] };
+        adjust(g, v, 1, sum, &count);
+    }
+
+    region_summary r;
+    r.count = count;
+    r.centroid.i = count > 0 ? sum[0] / count : 0;
+    r.centroid.j = count > 0 ? sum[1] / count : 0;
+    r.centroid.k = count > 0 ? sum[2] / count : 0;
+    return r;
+}
+
+/**
+ * @brief Counts the committed vectors in the box from lo to hi, edges
+ * included, and works out their mean
+ *
+ * @param lo
+ * @param hi
+ * @return region_summary
+ */
+region_summary inbox_vectors(vector lo, vector hi) {
+    region g;
+    g.sphere = 0;
+    g.lo[0] = lo.i;
+    g.lo[1] = lo.j;
+    g.lo[2] = lo.k;
+    g.hi[0] = hi.i;
+    g.hi[1] = hi.j;
+    g.hi[2] = hi.k;
+    return summarise(&g);
+}
+
+/**
+ * @brief Counts the committed vectors no farther than r from c and works
+ * out their mean
+ *
+ * @param c
+ * @param r
+ * @return region_summary
+ */
+region_summary insphere_vectors(vector c, real r) {
+    region g;
+    g.sphere = 1;
+    g.c[0] = c.i;
+    g.c[1] = c.j;
+    g.c[2] = c.k;
+    g.r2 = (double)r * r;
+    return summarise(&g);
+}
@@ -0,0 +1,28 @@
+#ifndef REGION_H
+#define REGION_H
+
+    #include "vec.h"
+
+    /*
+     * Counts and centroids of the stored vectors inside a box or a
+     * sphere, inbox(lo, hi) and insphere(c, r), answered from a tree of
+     * bounding boxes over the spatial index's points.
+     */
+
+    // most points in a leaf of the tree
+    #define REGION_LEAF 32
+    // most threads building the tree at once
+    #define REGION_THREADS 8
+
+    // how many vectors a region holds and their mean
+    typedef struct {
+        long count;
+        vector centroid;
+    } region_summary;
+
+    void region_moved(int p, vector old);
+    void region_drop(void);
+    region_summary inbox_vectors(vector lo, vector hi);
+    region_summary insphere_vectors(vector c, real r);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+    /*
+     * SSE operations on packed reals, so batch kernels can be written once
+     * for both numeric types. A register holds REAL_LANES floats or doubles.
+     * SIMD is only defined when SSE2 is available.
+     */
+    #include "vec.h"
+
+    #ifdef __SSE2__
+        #define SIMD
+        #include <emmintrin.h>
+
+        #ifdef TRITONE_DOUBLE
+            typedef __m128d vreal;
+            #define REAL_LANES 2
+            #define vr_load     _mm_loadu_pd
+            #define vr_store    _mm_storeu_pd
+            #define vr_set1     _mm_set1_pd
+            #define vr_zero     _mm_setzero_pd
+            #define vr_add      _mm_add_pd
+            #define vr_sub      _mm_sub_pd
+            #define vr_mul      _mm_mul_pd
+            #define vr_div      _mm_div_pd
+            #define vr_sqrt     _mm_sqrt_pd
+            #define vr_min      _mm_min_pd
+            #define vr_max      _mm_max_pd
+            #define vr_cmpeq    _mm_cmpeq_pd
+            #define vr_and      _mm_and_pd
+            #define vr_or       _mm_or_pd
+            #define vr_andnot   _mm_andnot_pd
+            #define vr_xor      _mm_xor_pd
+        #else
+            typedef __m128 vreal;
+            #define REAL_LANES 4
+            #define vr_load     _mm_loadu_ps
+            #define vr_store    _mm_storeu_ps
+            #define vr_set1     _mm_set1_ps
+            #define vr_zero     _mm_setzero_ps
+            #define vr_add      _mm_add_ps
+            #define vr_sub      _mm_sub_ps
+            #define vr_mul      _mm_mul_ps
+            #define vr_div      _mm_div_ps
+            #define vr_sqrt     _mm_sqrt_ps
+            #define vr_min      _mm_min_ps
+            #define vr_max      _mm_max_ps
+            #define vr_cmpeq    _mm_cmpeq_ps
+            #define vr_and      _mm_and_ps
+            #define vr_or       _mm_or_ps
+            #define vr_andnot   _mm_andnot_ps
+            #define vr_xor      _mm_xor_ps
+        #endif
+    #endif
+
+#endif
@@ -0,0 +1,915 @@
+/**
+ * @file space.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Nearest neighbour and radius queries, knn(q, k) and within(q, r).
+ * The first query copies every stored vector and its name into arrays of
+ * its own, one per component, and files them in a uniform grid of cubes
+ * sized to hold SPACE_PER_CELL vectors each on average. A cell is found
+ * through a hash of its coordinates, so the grid has no edges and only
+ * costs memory for cells that hold something, and when the grid is laid
+ * out the vectors of each bucket are put next to each other.
+ *
+ * From then on the table passes on every vector it stores: a new name is
+ * appended and linked into its cell, and a changed vector moves from its
+ * old cell to its new one. Changes to every vector at once (map, free,
+ * a read bigger than the index) drop the index instead, and the next
+ * query builds it again.
+ *
+ * knn visits cells in cubic shells around the query's cell, nearest
+ * first, keeping the k closest in a heap, and stops once the k-th closest
+ * is nearer than anything outside the shells visited could be. within
+ * visits the cells its sphere overlaps. Small tables, and queries that
+ * would visit more cells than it takes to measure every vector, measure
+ * every vector instead with vec_dist2_batch, several at a time with SSE.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "space.h"
+#include "vectable.h"
+#include "region.h"
+
+// each cell coordinate is kept to this many bits, so a cell packs into
+// one key
+#define CELL_BITS 21
+#define CELL_LIMIT (1l << (CELL_BITS - 1))
+// squared distances a scan works out at a time
+#define SCAN_CHUNK 1024
+// bits of a bucket sorted on by each pass of layout's radix sort
+#define RADIX_BITS 11
+// a grid query gives up for a scan once it has visited more cells than
+// one for every this many vectors
+#define CELLS_PER_SCAN 32
+
+// a vector a query has found and its squared distance
+typedef struct {
+    real d2;
+    int point;
+} candidate;
+
+// one query: the k nearest vectors, or every one within a radius
+typedef struct {
+    vector q;
+    int k;              // knn, otherwise 0
+    real r2;            // within, the radius squared
+    candidate* found;   // knn keeps a heap with the farthest on top
+    int count;
+    int capacity;
+    long cells;         // cells visited
+} query;
+
+// a point while the grid is laid out
+typedef struct {
+    long cell;
+    long name_at;
+    real i;
+    real j;
+    real k;
+    int bucket;
+} point_record;
+
+// every stored vector, and the grid over them
+typedef struct {
+    real* i;
+    real* j;
+    real* k;
+    long* name_at;      // each point's name's offset in text
+    long* cell;         // each point's packed cell
+    int* next;          // the next point in the same bucket, or -1
+    int count;
+    int capacity;
+    char* text;
+    long text_size;
+    long text_capacity;
+    int* heads;         // the first point in each bucket, or -1. NULL
+                        // while there is no grid
+    int bucket_bits;
+    int laid_out;       // points when the grid was laid out
+    double origin[3];   // where cell 0 starts
+    double scale;       // cells per unit
+    long low[3];        // the cells the points span
+    long high[3];
+} space_index;
+
+static space_index space;
+static int built = 0;
+static space_mode mode = SPACE_GRID;
+static const char* mode_names[SPACE_MODE_COUNT] = { "grid", "scan" };
+
+/**
+ * @brief Sets how queries find vectors by name
+ *
+ * @param name grid or scan
+ * @return int 0, or -1 if there's no such mode
+ */
+int set_space_mode(char* name) {
+    for(int x = 0; x < SPACE_MODE_COUNT; x++) {
+        if(!strcmp(name, mode_names[x])) {
+            mode = x;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Returns the name of the current query mode
+ *
+ * @return char*
+ */
+char* space_mode_name(void) {
+    return (char*)mode_names[mode];
+}
+
+/**
+ * @brief Returns the current query mode
+ *
+ * @return space_mode
+ */
+space_mode get_space_mode(void) {
+    return mode;
+}
+
+/**
+ * @brief Frees the index. The next query builds it again.
+ *
+ */
+void space_drop(void) {
+    if(!built) {
+        return;
+    }
+    free(space.i);
+    free(space.j);
+    free(space.k);
+    free(space.name_at);
+    free(space.cell);
+    free(space.next);
+    free(space.text);
+    free(space.heads);
+    memset(&space, 0, sizeof(space));
+    built = 0;
+    region_drop();
+}
+
+/**
+ * @brief Drops the index before count vectors are stored at once, if
+ * building it again would take less time than adding them one at a time
+ *
+ * @param count
+ */
+void space_bulk(int count) {
+    if(built && count > space.count) {
+        space_drop();
+    }
+}
+
+/**
+ * @brief Returns a point's name
+ *
+ * @param p
+ * @return char*
+ */
+static char* point_name(int p) {
+    return space.text + space.name_at[p];
+}
+
+/**
+ * @brief Returns a point's vector
+ *
+ * @param p
+ * @return vector
+ */
+static vector point_vector(int p) {
+    vector v = { space.i[p], space.j[p], space.k[p] };
+    return v;
+}
+
+/**
+ * @brief Makes room for capacity points, with names of about length
+ * characters
+ *
+ * @param capacity
+ * @param length
+ */
+static void reserve_points(int capacity, long length) {
+    if(capacity > space.capacity) {
+        space.i = realloc(space.i, capacity * sizeof(real));
+        space.j = realloc(space.j, capacity * sizeof(real));
+        space.k = realloc(space.k, capacity * sizeof(real));
+        space.name_at = realloc(space.name_at, capacity * sizeof(long));
+        space.cell = realloc(space.cell, capacity * sizeof(long));
+        space.next = realloc(space.next, capacity * sizeof(int));
+        space.capacity = capacity;
+    }
+    if(length > space.text_capacity) {
+        space.text = realloc(space.text, length);
+        space.text_capacity = length;
+    }
+}
+
+/**
+ * @brief Appends a point, not yet in the grid
+ *
+ * @param name
+ * @param v
+ * @return int the point
+ */
+static int add_point(char* name, vector v) {
+    long length = strlen(name) + 1;
+    if(space.count == space.capacity 
+        || space.text_size + length > space.text_capacity) {
+        int capacity = space.capacity;
+        if(space.count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 1024;
+        }
+        long text = space.text_capacity > 0 ? space.text_capacity : 16384;
+        while(text < space.text_size + length) {
+            text *= 2;
+        }
+        reserve_points(capacity, text);
+    }
+    memcpy(space.text + space.text_size, name, length);
+
+    int p = space.count++;
+    space.name_at[p] = space.text_size;
+    space.text_size += length;
+    space.i[p] = v.i;
+    space.j[p] = v.j;
+    space.k[p] = v.k;
+    space.cell[p] = 0;
+    space.next[p] = -1;
+    return p;
+}
+
+/**
+ * @brief Returns the cell x falls in along axis a
+ *
+ * @param x
+ * @param a
+ * @param clamped set if the cell is past what CELL_BITS holds, or x
+ * isn't a number
+ * @return long
+ */
+static long cell_coordinate(real x, int a, int* clamped) {
+    double c = floor((x - space.origin[a]) * space.scale);
+    if(!(c >= -CELL_LIMIT)) {
+        *clamped = 1;
+        return -CELL_LIMIT;
+    } else if(c > CELL_LIMIT - 1) {
+        *clamped = 1;
+        return CELL_LIMIT - 1;
+    }
+    return (long)c;
+}
+
+/**
+ * @brief Finds the cell v falls in
+ *
+ * @param v
+ * @param c set to the cell's coordinates
+ * @return int true if a coordinate was clamped
+ */
+static int cell_of(vector v, long* c) {
+    int clamped = 0;
+    c[0] = cell_coordinate(v.i, 0, &clamped);
+    c[1] = cell_coordinate(v.j, 1, &clamped);
+    c[2] = cell_coordinate(v.k, 2, &clamped);
+    return clamped;
+}
+
+/**
+ * @brief Packs a cell's coordinates into one key
+ *
+ * @param c
+ * @return long
+ */
+static long pack_cell(long* c) {
+    return ((c[0] + CELL_LIMIT) << (2 * CELL_BITS))
+        | ((c[1] + CELL_LIMIT) << CELL_BITS) | (c[2] + CELL_LIMIT);
+}
+
+/**
+ * @brief Returns the bucket a cell is filed in
+ *
+ * @param key from pack_cell
+ * @return int
+ */
+static int bucket_of(long key) {
+    return ((unsigned long)key * 0x9e3779b97f4a7c15ul)
+        >> (64 - space.bucket_bits);
+}
+
+/**
+ * @brief Widens the cells the points span to take in c
+ *
+ * @param c
+ */
+static void extend_bounds(long* c) {
+    for(int a = 0; a < 3; a++) {
+        space.low[a] = c[a] < space.low[a] ? c[a] : space.low[a];
+        space.high[a] = c[a] > space.high[a] ? c[a] : space.high[a];
+    }
+}
+
+/**
+ * @brief Picks the cell size for the points and files every point in the
+ * grid, the points of each bucket next to each other
+ *
+ */
+static void layout(void) {
+    // the points are about to be renumbered
+    region_drop();
+    int n = space.count;
+    double lo[3] = { INFINITY, INFINITY, INFINITY };
+    double hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    real* axes[3] = { space.i, space.j, space.k };
+    for(int a = 0; a < 3; a++) {
+        for(int p = 0; p < n; p++) {
+            double x = axes[a][p];
+            if(isfinite(x)) {
+                lo[a] = x < lo[a] ? x : lo[a];
+                hi[a] = x > hi[a] ? x : hi[a];
+            }
+        }
+    }
+    double extent = 0;
+    for(int a = 0; a < 3; a++) {
+        space.origin[a] = isfinite(lo[a]) ? lo[a] : 0;
+        extent = hi[a] - lo[a] > extent ? hi[a] - lo[a] : extent;
+    }
+    double size = 1;
+    if(extent > 0) {
+        // a flat spread (points on a plane or a sphere) is treated as a
+        // little thick, which gives cells about as wide as it needs
+        double volume = 1;
+        for(int a = 0; a < 3; a++) {
+            volume *= fmax(hi[a] - lo[a], extent / 1024);
+        }
+        size = cbrt(volume * SPACE_PER_CELL / n);
+        // every point's cell has to fit in CELL_BITS
+        size = fmax(size, extent / (CELL_LIMIT / 2));
+    }
+    space.scale = 1 / size;
+
+    space.bucket_bits = 4;
+    while((1l << space.bucket_bits) < n / SPACE_PER_CELL) {
+        space.bucket_bits++;
+    }
+    int buckets = 1 << space.bucket_bits;
+    for(int a = 0; a < 3; a++) {
+        space.low[a] = CELL_LIMIT;
+        space.high[a] = -CELL_LIMIT;
+    }
+
+    // the points are sorted by bucket as whole records, a radix digit at
+    // a time, so each pass reads in order and writes to a few thousand
+    // places rather than to anywhere in several arrays
+    point_record* from = malloc((n + 1) * sizeof(point_record));
+    point_record* to = malloc((n + 1) * sizeof(point_record));
+    for(int p = 0; p < n; p++) {
+        long c[3];
+        if(!cell_of(point_vector(p), c)) {
+            extend_bounds(c);
+        }
+        from[p].cell = pack_cell(c);
+        from[p].bucket = bucket_of(from[p].cell);
+        from[p].name_at = space.name_at[p];
+        from[p].i = space.i[p];
+        from[p].j = space.j[p];
+        from[p].k = space.k[p];
+    }
+    int* at = malloc(((1 << RADIX_BITS) + 1) * sizeof(int));
+    for(int shift = 0; shift < space.bucket_bits; shift += RADIX_BITS) {
+        int digits = 1 << RADIX_BITS;
+        memset(at, 0, (digits + 1) * sizeof(int));
+        for(int p = 0; p < n; p++) {
+            at[((from[p].bucket >> shift) & (digits - 1)) + 1]++;
+        }
+        for(int d = 0; d < digits; d++) {
+            at[d + 1] += at[d];
+        }
+        for(int p = 0; p < n; p++) {
+            to[at[(from[p].bucket >> shift) & (digits - 1)]++] = from[p];
+        }
+        point_record* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    free(space.heads);
+    space.heads = malloc(buckets * sizeof(int));
+    memset(space.heads, -1, buckets * sizeof(int));
+    for(int p = 0; p < n; p++) {
+        space.i[p] = from[p].i;
+        space.j[p] = from[p].j;
+        space.k[p] = from[p].k;
+        space.name_at[p] = from[p].name_at;
+        space.cell[p] = from[p].cell;
+        if(p == 0 || from[p].bucket != from[p - 1].bucket) {
+            space.heads[from[p].bucket] = p;
+        }
+        space.next[p] = p + 1 < n && from[p + 1].bucket == from[p].bucket
+            ? p + 1 : -1;
+    }
+    free(from);
+    free(to);
+    free(at);
+    space.laid_out = n;
+}
+
+/**
+ * @brief Files a point in its cell
+ *
+ * @param p
+ * @return int 0, or -1 if the point is past the cells the grid can hold,
+ * and the grid has to be laid out again
+ */
+static int place_point(int p) {
+    long c[3];
+    vector v = point_vector(p);
+    int clamped = cell_of(v, c);
+    if(clamped && isfinite(v.i) && isfinite(v.j) && isfinite(v.k)) {
+        return -1;
+    } else if(!clamped) {
+        extend_bounds(c);
+    }
+    space.cell[p] = pack_cell(c);
+    int b = bucket_of(space.cell[p]);
+    space.next[p] = space.heads[b];
+    space.heads[b] = p;
+    return 0;
+}
+
+/**
+ * @brief Takes a point out of its cell
+ *
+ * @param p
+ */
+static void unlink_point(int p) {
+    int* link = &space.heads[bucket_of(space.cell[p])];
+    while(*link != p) {
+        link = &space.next[*link];
+    }
+    *link = space.next[p];
+}
+
+/**
+ * @brief Finds the point with name whose vector is v
+ *
+ * @param name
+ * @param v
+ * @return int the point, or -1
+ */
+static int find_point(char* name, vector v) {
+    if(space.heads == NULL) {
+        for(int p = 0; p < space.count; p++) {
+            if(!strcmp(point_name(p), name)) {
+                return p;
+            }
+        }
+        return -1;
+    }
+    long c[3];
+    cell_of(v, c);
+    long key = pack_cell(c);
+    for(int p = space.heads[bucket_of(key)]; p >= 0; p = space.next[p]) {
+        if(space.cell[p] == key && !strcmp(point_name(p), name)) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Adds a newly stored vector to the index, if there is one
+ *
+ * @param name
+ * @param v
+ */
+void space_insert(char* name, vector v) {
+    if(!built) {
+        return;
+    }
+    int p = add_point(name, v);
+    if(space.heads == NULL && space.count < SPACE_GRID_MIN) {
+        return;
+    }
+    // a grid that has fallen behind is laid out again, with more buckets
+    if(space.heads == NULL || space.count >= 4 * space.laid_out
+        || place_point(p) < 0) {
+        layout();
+    }
+}
+
+/**
+ * @brief Moves a stored vector that changed from old to v, if there is an
+ * index
+ *
+ * @param name
+ * @param old
+ * @param v
+ */
+void space_move(char* name, vector old, vector v) {
+    if(!built) {
+        return;
+    }
+    int p = find_point(name, old);
+    if(p < 0) {
+        // the index has lost track of the table; start again
+        space_drop();
+        return;
+    }
+    if(space.heads != NULL) {
+        unlink_point(p);
+    }
+    region_moved(p, old);
+    space.i[p] = v.i;
+    space.j[p] = v.j;
+    space.k[p] = v.k;
+    if(space.heads != NULL && place_point(p) < 0) {
+        layout();
+    }
+}
+
+/**
+ * @brief Adds a stored vector to the index being built
+ *
+ * @param key
+ * @param value
+ * @param arg unused
+ */
+static void collect(char* key, vector value, void* arg) {
+    add_point(key, value);
+}
+
+/**
+ * @brief Builds the index from every committed vector
+ *
+ */
+static void build(void) {
+    int stored = count_vectors();
+    reserve_points(stored, stored * 16l);
+    for_each_vector(collect, NULL);
+    built = 1;
+    if(space.count >= SPACE_GRID_MIN) {
+        layout();
+    }
+}
+
+/**
+ * @brief Returns every stored vector, building the index if there isn't
+ * one. A point keeps its number until the index is laid out again or
+ * dropped, which region_drop is told about; until then new vectors are
+ * only added to the end.
+ *
+ * @param points set to the points' components, which change as vectors
+ * are stored
+ * @return int number of points
+ */
+int space_points(vector_array* points) {
+    if(!built) {
+        build();
+    }
+    points->i = space.i;
+    points->j = space.j;
+    points->k = space.k;
+    return space.count;
+}
+
+/**
+ * @brief Returns the squared distance from q to a point, worked out the
+ * same way as vec_dist2_batch
+ *
+ * @param q
+ * @param p
+ * @return real
+ */
+static real distance2(vector q, int p) {
+    real i = space.i[p] - q.i;
+    real j = space.j[p] - q.j;
+    real k = space.k[p] - q.k;
+    return (i * i) + (j * j) + (k * k);
+}
+
+/**
+ * @brief Returns true if a is farther from the query than b, taking the
+ * later name as farther when they are as far as each other, so a query 
+ * finds the same vectors through the grid or a scan
+ *
+ * @param a
+ * @param b
+ * @return int
+ */
+static int farther(candidate a, candidate b) {
+    if(a.d2 != b.d2) {
+        return a.d2 > b.d2;
+    }
+    return strcmp(point_name(a.point), point_name(b.point)) > 0;
+}
+
+/**
+ * @brief Moves the candidate at x up the heap to where it belongs
+ *
+ * @param s
+ * @param x
+ */
+static void sift_up(query* s, int x) {
+    candidate c = s->found[x];
+    while(x > 0 && farther(c, s->found[(x - 1) / 2])) {
+        s->found[x] = s->found[(x - 1) / 2];
+        x = (x - 1) / 2;
+    }
+    s->found[x] = c;
+}
+
+/**
+ * @brief Moves the candidate at the top of the heap down to where it
+ * belongs
+ *
+ * @param s
+ */
+static void sift_down(query* s) {
+    candidate c = s->found[0];
+    int x = 0;
+    while(2 * x + 1 < s->count) {
+        int child = 2 * x + 1;
+        if(child + 1 < s->count
+            && farther(s->found[child + 1], s->found[child])) {
+            child++;
+        }
+        if(!farther(s->found[child], c)) {
+            break;
+        }
+        s->found[x] = s->found[child];
+        x = child;
+    }
+    s->found[x] = c;
+}
+
+/**
+ * @brief Offers a point to a query, which keeps it if it's among the k
+ * nearest so far, or inside the radius
+ *
+ * @param s
+ * @param d2 the point's squared distance
+ * @param p
+ */
+static void offer(query* s, real d2, int p) {
+    if(s->k == 0) {
+        if(d2 <= s->r2) {
+            if(s->count == s->capacity) {
+                s->capacity = s->capacity > 0 ? s->capacity * 2 : 64;
+                s->found = realloc(s->found,
+                    s->capacity * sizeof(candidate));
+            }
+            s->found[s->count++] = (candidate){ d2, p };
+        }
+    } else if(!(d2 < INFINITY)) {
+        // a component that isn't a finite number
+        return;
+    } else if(s->count < s->k) {
+        s->found[s->count++] = (candidate){ d2, p };
+        sift_up(s, s->count - 1);
+    } else if(d2 <= s->found[0].d2 
+        && farther(s->found[0], (candidate){ d2, p })) {
+        s->found[0] = (candidate){ d2, p };
+        sift_down(s);
+    }
+}
+
+/**
+ * @brief Offers every point to a query
+ *
+ * @param s
+ */
+static void scan(query* s) {
+    real d2[SCAN_CHUNK];
+    for(int x = 0; x < space.count; x += SCAN_CHUNK) {
+        int n = space.count - x < SCAN_CHUNK ? space.count - x : SCAN_CHUNK;
+        vector_array a = { space.i + x, space.j + x, space.k + x };
+        vec_dist2_batch(a, s->q, d2, n);
+        for(int y = 0; y < n; y++) {
+            offer(s, d2[y], x + y);
+        }
+    }
+}
+
+/**
+ * @brief Offers the points in one cell to a query
+ *
+ * @param s
+ * @param c
+ */
+static void visit_cell(query* s, long* c) {
+    long key = pack_cell(c);
+    s->cells++;
+    for(int p = space.heads[bucket_of(key)]; p >= 0; p = space.next[p]) {
+        if(space.cell[p] == key) {
+            offer(s, distance2(s->q, p), p);
+        }
+    }
+}
+
+/**
+ * @brief Offers the points in the cells r cells from c in any direction,
+ * leaving out cells with no points around them
+ *
+ * @param s
+ * @param c
+ * @param r
+ */
+static void visit_shell(query* s, long* c, long r) {
+    long from[3];
+    long to[3];
+    for(int a = 0; a < 3; a++) {
+        from[a] = c[a] - r > space.low[a] ? c[a] - r : space.low[a];
+        to[a] = c[a] + r < space.high[a] ? c[a] + r : space.high[a];
+    }
+    long cell[3];
+    for(cell[0] = from[0]; cell[0] <= to[0]; cell[0]++) {
+        int face = cell[0] == c[0] - r || cell[0] == c[0] + r;
+        for(cell[1] = from[1]; cell[1] <= to[1]; cell[1]++) {
+            if(face || cell[1] == c[1] - r || cell[1] == c[1] + r) {
+                for(cell[2] = from[2]; cell[2] <= to[2]; cell[2]++) {
+                    visit_cell(s, cell);
+                }
+                continue;
+            }
+            // inside the shell only its two ends along k are on it
+            cell[2] = c[2] - r;
+            if(cell[2] >= space.low[2]) {
+                visit_cell(s, cell);
+            }
+            cell[2] = c[2] + r;
+            if(r > 0 && cell[2] <= space.high[2]) {
+                visit_cell(s, cell);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Finds the k nearest points through the grid
+ *
+ * @param s
+ * @return int 1, or 0 if it gave up because a scan would be faster
+ */
+static int grid_knn(query* s) {
+    long c[3];
+    cell_of(s->q, c);
+    // shells before the one the points start in are empty
+    long r = 0;
+    for(int a = 0; a < 3; a++) {
+        r = space.low[a] - c[a] > r ? space.low[a] - c[a] : r;
+        r = c[a] - space.high[a] > r ? c[a] - space.high[a] : r;
+    }
+    for(;; r++) {
+        visit_shell(s, c, r);
+        // a point outside the shells visited is at least r cells away
+        double reach = r / space.scale;
+        if(s->count == s->k && s->found[0].d2 <= reach * reach) {
+            return 1;
+        }
+        int covered = 1;
+        for(int a = 0; a < 3; a++) {
+            covered &= c[a] - r <= space.low[a] && c[a] + r >= space.high[a];
+        }
+        if(covered) {
+            return 1;
+        }
+        if(s->cells > space.count / CELLS_PER_SCAN) {
+            s->count = 0;
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief Finds the points within the radius through the grid
+ *
+ * @param s
+ * @param r the radius
+ * @return int 1, or 0 if a scan would be faster
+ */
+static int grid_within(query* s, real r) {
+    vector lo = { s->q.i - r, s->q.j - r, s->q.k - r };
+    vector hi = { s->q.i + r, s->q.j + r, s->q.k + r };
+    long from[3];
+    long to[3];
+    cell_of(lo, from);
+    cell_of(hi, to);
+    double cells = 1;
+    for(int a = 0; a < 3; a++) {
+        from[a] = from[a] > space.low[a] ? from[a] : space.low[a];
+        to[a] = to[a] < space.high[a] ? to[a] : space.high[a];
+        cells *= to[a] >= from[a] ? to[a] - from[a] + 1 : 0;
+    }
+    if(cells > space.count / CELLS_PER_SCAN) {
+        return 0;
+    }
+    long cell[3];
+    for(cell[0] = from[0]; cell[0] <= to[0]; cell[0]++) {
+        for(cell[1] = from[1]; cell[1] <= to[1]; cell[1]++) {
+            for(cell[2] = from[2]; cell[2] <= to[2]; cell[2]++) {
+                visit_cell(s, cell);
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Returns what a query found as a match
+ *
+ * @param c
+ * @return space_match
+ */
+static space_match make_match(candidate c) {
+    space_match m;
+    m.name = point_name(c.point);
+    m.value = point_vector(c.point);
+    m.distance = sqrt(c.d2);
+    return m;
+}
+
+/**
+ * @brief Finds the k committed vectors nearest to q
+ *
+ * @param q
+ * @param k
+ * @param out room for k matches, filled in nearest first
+ * @return int number found, fewer than k if fewer are stored
+ */
+int knn_vectors(vector q, int k, space_match* out) {
+    if(!built) {
+        build();
+    }
+    k = k < space.count ? k : space.count;
+    if(k <= 0) {
+        return 0;
+    }
+    query s = { q, k, 0, malloc(k * sizeof(candidate)), 0, k, 0 };
+    if(mode != SPACE_GRID || space.heads == NULL
+        || (long)k * CELLS_PER_SCAN > space.count || !grid_knn(&s)) {
+        scan(&s);
+    }
+    // the heap gives up the farthest first
+    int found = s.count;
+    while(s.count > 0) {
+        out[s.count - 1] = make_match(s.found[0]);
+        s.found[0] = s.found[--s.count];
+        sift_down(&s);
+    }
+    free(s.found);
+    return found;
+}
+
+/**
+ * @brief qsort comparison of candidates, nearest first
+ *
+ * @param a
+ * @param b
+ * @return int
+ */
+static int compare_candidates(const void* a, const void* b) {
+    const candidate* x = a;
+    const candidate* y = b;
+    if(x->d2 != y->d2) {
+        return x->d2 < y->d2 ? -1 : 1;
+    }
+    return strcmp(point_name(x->point), point_name(y->point));
+}
+
+/**
+ * @brief Finds every committed vector within r of q
+ *
+ * @param q
+ * @param r
+ * @param out set to the matches, nearest first. Free it.
+ * @return int number found
+ */
+int within_vectors(vector q, real r, space_match** out) {
+    if(!built) {
+        build();
+    }
+    query s = { q, 0, r * r, NULL, 0, 0, 0 };
+    if(mode != SPACE_GRID || space.heads == NULL || !grid_within(&s, r)) {
+        scan(&s);
+    }
+    if(s.count > 1) {
+        qsort(s.found, s.count, sizeof(candidate), compare_candidates);
+    }
+    *out = malloc((s.count + 1) * sizeof(space_match));
+    for(int x = 0; x < s.count; x++) {
+        (*out)[x] = make_match(s.found[x]);
+    }
+    free(s.found);
+    return s.count;
+}
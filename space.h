@@ -0,0 +1,41 @@
+#ifndef SPACE_H
+#define SPACE_H
+
+    #include "vec.h"
+
+    /*
+     * Nearest neighbour and radius queries over the stored vectors,
+     * knn(q, k) and within(q, r). The vectors are indexed by a grid the
+     * first time one is asked, and the grid follows every later change.
+     */
+
+    // below this many vectors a query scans them all and there's no grid
+    #define SPACE_GRID_MIN 4096
+    // vectors per grid cell the cell size is picked for
+    #define SPACE_PER_CELL 2
+
+    typedef enum {
+        SPACE_GRID,     // queries go through the grid or region tree
+        SPACE_SCAN,     // queries measure every vector
+        SPACE_MODE_COUNT,
+    } space_mode;
+
+    // a vector found by a query
+    typedef struct {
+        char* name;     // good until the table next changes
+        vector value;
+        real distance;
+    } space_match;
+
+    void space_insert(char* name, vector v);
+    void space_move(char* name, vector old, vector v);
+    void space_bulk(int count);
+    void space_drop(void);
+    int knn_vectors(vector q, int k, space_match* out);
+    int within_vectors(vector q, real r, space_match** out);
+    int space_points(vector_array* points);
+    int set_space_mode(char* name);
+    char* space_mode_name(void);
+    space_mode get_space_mode(void);
+
+#endif
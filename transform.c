@@ -0,0 +1,458 @@
+/**
+ * @file transform.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Quaternions and affine matrices: rotate(v, q), apply(M, v) and
+ * composing them with *. A quaternion is turned into the matrix it stands
+ * for before it touches a vector, so rotating one vector and rotating the
+ * whole table with a batch kernel give the same bits.
+ *
+ * Both are bigger than a value's payload, so a value holds a number into
+ * an arena here instead. A value never outlives the line it was made on,
+ * so the arena is cleared after every line, and loops give back what each
+ * pass held. Assigning one to a name copies it out of the arena into a 
+ * list of named transforms, next to the vectable; there are rarely more 
+ * than a handful, so they're searched linearly like functions.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include "transform.h"
+#include "simd.h"
+
+// arena slots kept between lines; a line that made more gives them back
+#define TRANSFORM_KEEP 1024
+
+typedef union {
+    quaternion q;
+    matrix m;
+} transform;
+
+typedef struct {
+    char* name;
+    int is_matrix;
+    transform t;
+} named_transform;
+
+static transform* held = NULL;
+static int held_count = 0;
+static int held_capacity = 0;
+
+static named_transform* named = NULL;
+static int named_count = 0;
+static int named_capacity = 0;
+
+/**
+ * @brief Returns the unit quaternion that rotates by angle radians about
+ * axis, counterclockwise looking down the axis
+ *
+ * @param axis not zero
+ * @param angle
+ * @return quaternion
+ */
+quaternion quaternion_axis_angle(vector axis, real angle) {
+    vector u = vec_normalize(axis);
+    real s = sin(angle / 2);
+    quaternion q = { cos(angle / 2), u.i * s, u.j * s, u.k * s };
+    return q;
+}
+
+/**
+ * @brief Returns the Hamilton product ab, which rotates by b and then a
+ *
+ * @param a
+ * @param b
+ * @return quaternion
+ */
+quaternion quaternion_mul(quaternion a, quaternion b) {
+    quaternion r = {
+        a.w * b.w - a.i * b.i - a.j * b.j - a.k * b.k,
+        a.w * b.i + a.i * b.w + a.j * b.k - a.k * b.j,
+        a.w * b.j - a.i * b.k + a.j * b.w + a.k * b.i,
+        a.w * b.k + a.i * b.j - a.j * b.i + a.k * b.w
+    };
+    return r;
+}
+
+/**
+ * @brief Returns the rotation matrix of a quaternion. The quaternion
+ * doesn't have to be exactly unit length, so products that have drifted
+ * still rotate without scaling.
+ *
+ * @param q not zero
+ * @return matrix
+ */
+matrix quaternion_matrix(quaternion q) {
+    real s = 2 / (q.w * q.w + q.i * q.i + q.j * q.j + q.k * q.k);
+    real ii = q.i * q.i * s, jj = q.j * q.j * s, kk = q.k * q.k * s;
+    real ij = q.i * q.j * s, ik = q.i * q.k * s, jk = q.j * q.k * s;
+    real wi = q.w * q.i * s, wj = q.w * q.j * s, wk = q.w * q.k * s;
+    matrix m = {
+        {
+            { 1 - jj - kk, ij - wk, ik + wj, 0 },
+            { ij + wk, 1 - ii - kk, jk - wi, 0 },
+            { ik - wj, jk + wi, 1 - ii - jj, 0 }
+        },
+        3
+    };
+    return m;
+}
+
+/**
+ * @brief Returns the 3x3 matrix with the given rows
+ *
+ * @param r0
+ * @param r1
+ * @param r2
+ * @return matrix
+ */
+matrix matrix_rows(vector r0, vector r1, vector r2) {
+    matrix m = {
+        {
+            { r0.i, r0.j, r0.k, 0 },
+            { r1.i, r1.j, r1.k, 0 },
+            { r2.i, r2.j, r2.k, 0 }
+        },
+        3
+    };
+    return m;
+}
+
+/**
+ * @brief Returns the 4x4 matrix that applies r and then moves by t
+ *
+ * @param r
+ * @param t
+ * @return matrix
+ */
+matrix matrix_affine(matrix r, vector t) {
+    r.m[0][3] = t.i;
+    r.m[1][3] = t.j;
+    r.m[2][3] = t.k;
+    r.size = 4;
+    return r;
+}
+
+/**
+ * @brief Returns the product ab, which applies b and then a. It is 4x4 if
+ * either of them is.
+ *
+ * @param a
+ * @param b
+ * @return matrix
+ */
+matrix matrix_mul(matrix a, matrix b) {
+    matrix r;
+    for(int row = 0; row < 3; row++) {
+        for(int col = 0; col < 4; col++) {
+            r.m[row][col] = a.m[row][0] * b.m[0][col]
+                + a.m[row][1] * b.m[1][col] + a.m[row][2] * b.m[2][col];
+        }
+        r.m[row][3] += a.m[row][3];
+    }
+    r.size = a.size > b.size ? a.size : b.size;
+    return r;
+}
+
+/**
+ * @brief Applies a matrix to a vector, with the vector's fourth component
+ * taken as 1
+ *
+ * @param m
+ * @param v
+ * @return vector
+ */
+vector matrix_apply(const matrix* m, vector v) {
+    vector r = {
+        m->m[0][0] * v.i + m->m[0][1] * v.j + m->m[0][2] * v.k + m->m[0][3],
+        m->m[1][0] * v.i + m->m[1][1] * v.j + m->m[1][2] * v.k + m->m[1][3],
+        m->m[2][0] * v.i + m->m[2][1] * v.j + m->m[2][2] * v.k + m->m[2][3]
+    };
+    return r;
+}
+
+/**
+ * @brief Rotates a vector by a quaternion
+ *
+ * @param q not zero
+ * @param v
+ * @return vector
+ */
+vector quaternion_rotate(quaternion q, vector v) {
+    matrix m = quaternion_matrix(q);
+    return matrix_apply(&m, v);
+}
+
+/**
+ * @brief Applies a matrix to each vector, REAL_LANES at a time with SSE
+ * when it is available. Each lane does the same operations in the same
+ * order as matrix_apply.
+ *
+ * @param a
+ * @param m
+ * @param n
+ */
+void matrix_apply_batch(vector_array a, const matrix* m, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal c[3][4];
+    for(int row = 0; row < 3; row++) {
+        for(int col = 0; col < 4; col++) {
+            c[row][col] = vr_set1(m->m[row][col]);
+        }
+    }
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vreal i = vr_load(a.i + x);
+        vreal j = vr_load(a.j + x);
+        vreal k = vr_load(a.k + x);
+        vreal out[3];
+        for(int row = 0; row < 3; row++) {
+            out[row] = vr_add(vr_add(vr_add(vr_mul(c[row][0], i),
+                vr_mul(c[row][1], j)), vr_mul(c[row][2], k)), c[row][3]);
+        }
+        vr_store(a.i + x, out[0]);
+        vr_store(a.j + x, out[1]);
+        vr_store(a.k + x, out[2]);
+    }
+#endif
+    for(; x < n; x++) {
+        vector v = { a.i[x], a.j[x], a.k[x] };
+        v = matrix_apply(m, v);
+        a.i[x] = v.i;
+        a.j[x] = v.j;
+        a.k[x] = v.k;
+    }
+}
+
+/**
+ * @brief Rotates each vector by a quaternion
+ *
+ * @param a
+ * @param q not zero
+ * @param n
+ */
+void quaternion_rotate_batch(vector_array a, quaternion q, int n) {
+    matrix m = quaternion_matrix(q);
+    matrix_apply_batch(a, &m, n);
+}
+
+/**
+ * @brief Converts a quaternion to a formatted string
+ *
+ * @param q
+ * @return char*
+ */
+char* quaternion_to_string(quaternion q) {
+    static char buffer[80];
+    snprintf(buffer, 80, "{ w: %.2f, i: %.2f, j: %.2f, k: %.2f }",
+        q.w, q.i, q.j, q.k);
+    return buffer;
+}
+
+/**
+ * @brief Converts a matrix to a formatted string, a row per line
+ *
+ * @param m
+ * @return char*
+ */
+char* matrix_to_string(const matrix* m) {
+    static char buffer[200];
+    int used = 0;
+    for(int row = 0; row < m->size; row++) {
+        used += snprintf(buffer + used, 200 - used, row == 0 ? "[ " : "  ");
+        for(int col = 0; col < m->size; col++) {
+            real e = row < 3 ? m->m[row][col] : col == 3;
+            used += snprintf(buffer + used, 200 - used, "%8.2f", e);
+        }
+        used += snprintf(buffer + used, 200 - used,
+            row == m->size - 1 ? " ]" : "\n");
+    }
+    return buffer;
+}
+
+/**
+ * @brief Returns a free arena slot, growing the arena if it's full
+ *
+ * @return int
+ */
+static int hold(void) {
+    if(held_count == held_capacity) {
+        held_capacity = held_capacity > 0 ? held_capacity * 2 : 64;
+        held = realloc(held, held_capacity * sizeof(transform));
+    }
+    return held_count++;
+}
+
+/**
+ * @brief Keeps a quaternion until the end of the line
+ *
+ * @param q
+ * @return int its place in the arena
+ */
+int hold_quaternion(quaternion q) {
+    int h = hold();
+    held[h].q = q;
+    return h;
+}
+
+/**
+ * @brief Keeps a matrix until the end of the line
+ *
+ * @param m
+ * @return int its place in the arena
+ */
+int hold_matrix(matrix m) {
+    int h = hold();
+    held[h].m = m;
+    return h;
+}
+
+/**
+ * @brief Returns a quaternion kept with hold_quaternion
+ *
+ * @param h
+ * @return quaternion
+ */
+quaternion held_quaternion(int h) {
+    return held[h].q;
+}
+
+/**
+ * @brief Returns a matrix kept with hold_matrix. It moves if another
+ * transform is held, so it shouldn't be kept past that.
+ *
+ * @param h
+ * @return matrix*
+ */
+matrix* held_matrix(int h) {
+    return &held[h].m;
+}
+
+/**
+ * @brief Returns how many transforms are held, to pass to 
+ * release_transforms
+ *
+ * @return int
+ */
+int transforms_held(void) {
+    return held_count;
+}
+
+/**
+ * @brief Forgets the transforms held since transforms_held returned mark.
+ * Loops call this after each pass, since nothing a pass made is seen by 
+ * the next, so a long loop doesn't fill the arena.
+ *
+ * @param mark
+ */
+void release_transforms(int mark) {
+    held_count = mark;
+}
+
+/**
+ * @brief Forgets every quaternion and matrix. Called once a line is done,
+ * when no value can refer to them any more.
+ *
+ */
+void clear_transforms(void) {
+    held_count = 0;
+    if(held_capacity > TRANSFORM_KEEP) {
+        free(held);
+        held = NULL;
+        held_capacity = 0;
+    }
+}
+
+/**
+ * @brief Returns the named transform called name, or NULL
+ *
+ * @param name
+ * @return named_transform*
+ */
+static named_transform* find_named(char* name) {
+    for(int x = 0; x < named_count; x++) {
+        if(!strcmp(named[x].name, name)) {
+            return &named[x];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Names a held quaternion or matrix, replacing whatever had the
+ * name before
+ *
+ * @param name copied
+ * @param h
+ * @param is_matrix
+ */
+void name_transform(char* name, int h, int is_matrix) {
+    named_transform* t = find_named(name);
+    if(t == NULL) {
+        if(named_count == named_capacity) {
+            named_capacity = named_capacity ? named_capacity * 2 : 8;
+            named = realloc(named, 
+                named_capacity * sizeof(named_transform));
+        }
+        t = &named[named_count++];
+        t->name = malloc(strlen(name) + 1);
+        strcpy(t->name, name);
+    }
+    t->is_matrix = is_matrix;
+    t->t = held[h];
+}
+
+/**
+ * @brief Holds a copy of the transform called name for the rest of the
+ * line
+ *
+ * @param name
+ * @param is_matrix set to whether it is a matrix
+ * @return int its place in the arena, or -1 if nothing has the name
+ */
+int named_transform_held(char* name, int* is_matrix) {
+    named_transform* t = find_named(name);
+    if(t == NULL) {
+        return -1;
+    }
+    *is_matrix = t->is_matrix;
+    int h = hold();
+    held[h] = t->t;
+    return h;
+}
+
+/**
+ * @brief Removes the name of a transform, if something has it
+ *
+ * @param name
+ */
+void unname_transform(char* name) {
+    named_transform* t = find_named(name);
+    if(t != NULL) {
+        free(t->name);
+        *t = named[--named_count];
+    }
+}
+
+/**
+ * @brief Frees every named transform
+ *
+ * @return int number of transforms freed
+ */
+int clear_named_transforms(void) {
+    int freed = named_count;
+    for(int x = 0; x < named_count; x++) {
+        free(named[x].name);
+    }
+    free(named);
+    named = NULL;
+    named_count = 0;
+    named_capacity = 0;
+    return freed;
+}
@@ -0,0 +1,55 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+    #include "vec.h"
+
+    /*
+     * Quaternions and 3x3 and 4x4 affine matrices, and applying them to
+     * one vector or to arrays of them. Values only refer to them by their
+     * place in an arena that is cleared after every line; assigning one to
+     * a name keeps a copy until it is replaced or freed.
+     */
+
+    typedef struct {
+        real w;
+        real i;
+        real j;
+        real k;
+    } quaternion;
+
+    // rows first. The bottom row of a 4x4 is always 0 0 0 1, so only
+    // the rows above it are kept; a 3x3 has no translation column
+    typedef struct {
+        real m[3][4];
+        int size;           // 3 or 4
+    } matrix;
+
+    quaternion quaternion_axis_angle(vector axis, real angle);
+    quaternion quaternion_mul(quaternion a, quaternion b);
+    matrix quaternion_matrix(quaternion q);
+    matrix matrix_rows(vector r0, vector r1, vector r2);
+    matrix matrix_affine(matrix r, vector t);
+    matrix matrix_mul(matrix a, matrix b);
+    vector matrix_apply(const matrix* m, vector v);
+    vector quaternion_rotate(quaternion q, vector v);
+
+    // batch kernels apply the same transform to n vectors in place
+    void matrix_apply_batch(vector_array a, const matrix* m, int n);
+    void quaternion_rotate_batch(vector_array a, quaternion q, int n);
+
+    char* quaternion_to_string(quaternion q);
+    char* matrix_to_string(const matrix* m);
+
+    int hold_quaternion(quaternion q);
+    int hold_matrix(matrix m);
+    quaternion held_quaternion(int h);
+    matrix* held_matrix(int h);
+    int transforms_held(void);
+    void release_transforms(int mark);
+    void clear_transforms(void);
+    void name_transform(char* name, int h, int is_matrix);
+    int named_transform_held(char* name, int* is_matrix);
+    void unname_transform(char* name);
+    int clear_named_transforms(void);
+
+#endif
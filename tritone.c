@@ -10,14 +10,41 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "tritone.h"
 #include "ast.h"
 #include "vec.h"
 #include "vectable.h"
+#include "functable.h"
+#include "wal.h"
+#include "jobs.h"
+#include "prof.h"
+#include "transform.h"
 
 
+#define INPUT_SIZE 4096
+
 static node* root = NULL;
+
+/**
+ * @brief Returns how many more '{' than '}' are in line
+ * 
+ * @param line 
+ * @return int 
+ */
+static int open_brackets(char* line) {
+    int depth = 0;
+    for(char* c = line; *c; c++) {
+        if(*c == '{') {
+            depth++;
+        } else if(*c == '}') {
+            depth--;
+        }
+    }
+    return depth;
+}
+
 /**
  * @brief Runs the tritone application and returns it's output string
  * 
@@ -37,20 +64,56 @@ char* tritone(void) {
         started = 1;
 
     }
-    static char input_buffer[300];
+    static char input_buffer[INPUT_SIZE];
     static char output_buffer[300];
 
+    // background jobs finish between lines, never partway through one
+    poll_jobs();
+    wal_sync();
+
     printf("\033[0;35m");
     printf("tritone");
     printf("\033[0m");
     printf("> ");
 
-    fgets(input_buffer, 300, stdin);
+    PROF_START(start);
+    if(fgets(input_buffer, INPUT_SIZE, stdin) == NULL) {
+        exit(0);
+    }
+
+    // keep reading while a loop body is still open; line breaks 
+    // inside the body separate statements
+    int used = strlen(input_buffer);
+    while(open_brackets(input_buffer) > 0 && used < INPUT_SIZE - 1) {
+        if(input_buffer[used - 1] == '\n') {
+            input_buffer[used - 1] = ';';
+        }
+        printf("   ...> ");
+        if(fgets(input_buffer + used, INPUT_SIZE - used, stdin) == NULL) {
+            break;
+        }
+        used += strlen(input_buffer + used);
+    }
+    PROF_STOP(STAGE_INPUT, start);
+    PROF_LINE();
+    poll_jobs();
+
     root = parse_input(input_buffer);
     // print_ast(root);
-    strncpy(output_buffer, value_to_string(evaluate_ast(root)), 300);
+    PROF_START(evaluating);
+    value result = evaluate_ast(root);
+    PROF_STOP(STAGE_EVALUATE, evaluating);
+    // one write, and maybe one fsync, for everything the line changed
+    wal_sync();
+
+    PROF_START(printing);
+    strncpy(output_buffer, value_to_string(result), 300);
+    PROF_STOP(STAGE_PRINT, printing);
+    // nothing refers to this line's quaternions and matrices any more
+    clear_transforms();
 
     free_ast(root);
+    root = NULL;
     return output_buffer;
 }
 
@@ -60,7 +123,11 @@ char* tritone(void) {
  */
 void tritone_exit(void) {
     free_ast(root);
+    stop_jobs();
+    wal_close();
     free_vectable();
+    clear_functable();
+    clear_named_transforms();
     printf("goodbye!\n");
 }
 
@@ -78,6 +145,34 @@ void print_help() {
            " help: print this message\n"
            " clear: clear the screen\n"
            " free: free all variables\n"
-           " list: list all variables\n"
+           " list: list all variables in order, list sensor_* for a prefix\n"
+           " loops: for i in 1:10 { a = a + i * b; ... }\n"
+           " functions: def proj(a, b) = (a . b) / (b . b) * b\n"
+           " builtins: norm, normalize, angle, lerp, project, min, max,"
+           " abs, sqrt\n"
+           " knn(q, k): the k vectors nearest q, within(q, r): those no"
+           " farther than r\n"
+           " inbox(lo, hi), insphere(c, r): how many vectors are in a box"
+           " or sphere, and their centroid\n"
+           " quat(axis, angle), mat3(r0, r1, r2), mat4(R, t): rotations"
+           " and transforms, rotate(v, q), apply(M, v), or M * v\n"
+           " map: map normalize(_) replaces every vector, _ is each vector,\n"
+           "    map _ * 2 in sensor_* only those starting with sensor_\n"
+           " write \"path\": save every variable as csv, add full for every"
+           " digit and sorted for name order, packed or lossy for a\n"
+           "    compressed binary table that read also takes\n"
+           " read \"path\" bg, write \"path\" bg: load or save in the"
+           " background, jobs: show how far they are\n"
+           " read \"dir/*.csv\": load every file the pattern matches at"
+           " once, unless a file has exactly that name\n"
+           " gen 1000000 seed 7 normal: make random vectors, see the"
+           " README for every option\n"
+           " funcs: list all functions\n"
+           " begin, commit, rollback: stage writes and apply or drop them"
+           " together\n"
+           " set: show or change settings, e.g. set inline off, set fuse"
+           " off, set jit off\n"
+           " compact: rewrite the log (tritone -l path) as a snapshot\n"
+           " stats: show profiling counters (make profile), stats reset\n"
            );
 }
@@ -2,7 +2,8 @@
  * @file vec.c
  * @author Caleb Andreano (andreanoc@msoe.edu)
  * @class CPE2600-121
- * @brief 3-dimensional vector struct and related mathematical operations
+ * @brief 3-dimensional vector struct and related mathematical operations,
+ * with batch versions that work on arrays of vectors
  * 
  * 
  * Course: CPE2600-121
@@ -13,6 +14,8 @@
 #include "vec.h"
 #include <stdio.h>
 #include <float.h>
+#include <tgmath.h>
+#include "simd.h"
 
 /**
  * @brief Adds two vectors together and returns their sum
@@ -50,14 +53,37 @@ vector vec_mul(vector a, vector b) {
     return prod;
 }
 
+/**
+ * @brief Divides two vectors element-wise
+ * 
+ * @param a 
+ * @param b 
+ * @return vector 
+ */
+vector vec_div(vector a, vector b) {
+    vector quot = { a.i / b.i, a.j / b.j, a.k / b.k } ;
+    return quot;
+}
+
+/**
+ * @brief Returns a vector with every component set to s
+ * 
+ * @param s 
+ * @return vector 
+ */
+vector vec_splat(real s) {
+    vector splat = { s, s, s };
+    return splat;
+}
+
 /**
  * @brief Takes the dot product of two vectors
  * 
  * @param a 
  * @param b 
- * @return float 
+ * @return real 
  */
-float vec_dot(vector a, vector b) {
+real vec_dot(vector a, vector b) {
     return (a.i * b.i) + (a.j * b.j) + (a.k * b.k);
 }
 
@@ -69,9 +95,9 @@ float vec_dot(vector a, vector b) {
  * @return vector 
  */
 vector vec_cross(vector a, vector b) {
-    float i = (a.j * b.k)  - (a.k * b.j);
-    float j = -((a.i * b.k)  - (a.k * b.i));
-    float k = (a.i * b.j)  - (a.j * b.i);
+    real i = (a.j * b.k)  - (a.k * b.j);
+    real j = -((a.i * b.k)  - (a.k * b.i));
+    real k = (a.i * b.j)  - (a.j * b.i);
     vector cross = {i, j, k};
     return cross;
 }
@@ -86,4 +112,435 @@ char* vector_to_string(vector v) {
     static char buffer[60];
     snprintf(buffer, 60, "{ i: %.2f, j: %.2f, k: %.2f }", v.i, v.j, v.k);
     return buffer;
-}
\ No newline at end of file
+}
+/**
+ * @brief Returns the length of a vector
+ * 
+ * @param v 
+ * @return real 
+ */
+real vec_norm(vector v) {
+    return sqrt(vec_dot(v, v));
+}
+
+/**
+ * @brief Scales a vector to unit length. The zero vector stays zero.
+ * 
+ * @param v 
+ * @return vector 
+ */
+vector vec_normalize(vector v) {
+    real norm = vec_norm(v);
+    if(norm == 0) {
+        return v;
+    }
+    vector unit = { v.i / norm, v.j / norm, v.k / norm };
+    return unit;
+}
+
+/**
+ * @brief Clamps a cosine into acos's domain. NaN is passed through.
+ * 
+ * @param c 
+ * @return real 
+ */
+static real clamp_cos(real c) {
+    if(c > 1) {
+        return 1;
+    } else if(c < -1) {
+        return -1;
+    }
+    return c;
+}
+
+/**
+ * @brief Returns the angle between two vectors in radians. 
+ * NaN if either is the zero vector.
+ * 
+ * @param a 
+ * @param b 
+ * @return real 
+ */
+real vec_angle(vector a, vector b) {
+    return acos(clamp_cos(vec_dot(a, b) / (vec_norm(a) * vec_norm(b))));
+}
+
+/**
+ * @brief Linearly interpolates from a (t = 0) to b (t = 1)
+ * 
+ * @param a 
+ * @param b 
+ * @param t 
+ * @return vector 
+ */
+vector vec_lerp(vector a, vector b, real t) {
+    vector lerp = { 
+        a.i + (b.i - a.i) * t, 
+        a.j + (b.j - a.j) * t, 
+        a.k + (b.k - a.k) * t 
+    };
+    return lerp;
+}
+
+/**
+ * @brief Projects a onto b
+ * 
+ * @param a 
+ * @param b 
+ * @return vector 
+ */
+vector vec_project(vector a, vector b) {
+    real scale = vec_dot(a, b) / vec_dot(b, b);
+    vector proj = { b.i * scale, b.j * scale, b.k * scale };
+    return proj;
+}
+
+/**
+ * @brief Takes the element-wise minimum of two vectors
+ * 
+ * @param a 
+ * @param b 
+ * @return vector 
+ */
+vector vec_min(vector a, vector b) {
+    vector min = { fmin(a.i, b.i), fmin(a.j, b.j), fmin(a.k, b.k) };
+    return min;
+}
+
+/**
+ * @brief Takes the element-wise maximum of two vectors
+ * 
+ * @param a 
+ * @param b 
+ * @return vector 
+ */
+vector vec_max(vector a, vector b) {
+    vector max = { fmax(a.i, b.i), fmax(a.j, b.j), fmax(a.k, b.k) };
+    return max;
+}
+
+/**
+ * @brief Takes the element-wise absolute value of a vector
+ * 
+ * @param v 
+ * @return vector 
+ */
+vector vec_abs(vector v) {
+    vector abs = { fabs(v.i), fabs(v.j), fabs(v.k) };
+    return abs;
+}
+
+/**
+ * @brief Takes the element-wise square root of a vector
+ * 
+ * @param v 
+ * @return vector 
+ */
+vector vec_sqrt(vector v) {
+    vector root = { sqrt(v.i), sqrt(v.j), sqrt(v.k) };
+    return root;
+}
+
+/**
+ * @brief Returns element x of a vector array
+ * 
+ * @param v 
+ * @param x 
+ * @return vector 
+ */
+static vector array_get(vector_array v, int x) {
+    vector e = { v.i[x], v.j[x], v.k[x] };
+    return e;
+}
+
+/**
+ * @brief Stores e as element x of a vector array
+ * 
+ * @param v 
+ * @param x 
+ * @param e 
+ */
+static void array_set(vector_array v, int x, vector e) {
+    v.i[x] = e.i;
+    v.j[x] = e.j;
+    v.k[x] = e.k;
+}
+
+/*
+ * The batch kernels below run REAL_LANES vectors per iteration with SSE when
+ * it is available, then finish the remaining vectors with the scalar 
+ * version, which gives the same answers for finite input.
+ */
+
+#ifdef SIMD
+/**
+ * @brief Takes the dot products of REAL_LANES pairs of vectors at once
+ */
+static vreal vr_dot(vreal ai, vreal aj, vreal ak, 
+                   vreal bi, vreal bj, vreal bk) {
+    return vr_add(
+        vr_add(vr_mul(ai, bi), vr_mul(aj, bj)), 
+        vr_mul(ak, bk)
+    );
+}
+#endif
+
+/**
+ * @brief Writes the length of each vector to out
+ * 
+ * @param v 
+ * @param out 
+ * @param n 
+ */
+void vec_norm_batch(vector_array v, real* out, int n) {
+    int x = 0;
+#ifdef SIMD
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vreal i = vr_load(v.i + x);
+        vreal j = vr_load(v.j + x);
+        vreal k = vr_load(v.k + x);
+        vr_store(out + x, vr_sqrt(vr_dot(i, j, k, i, j, k)));
+    }
+#endif
+    for(; x < n; x++) {
+        out[x] = vec_norm(array_get(v, x));
+    }
+}
+
+/**
+ * @brief Scales each vector to unit length
+ * 
+ * @param v 
+ * @param n 
+ */
+void vec_normalize_batch(vector_array v, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal zero = vr_zero();
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vreal i = vr_load(v.i + x);
+        vreal j = vr_load(v.j + x);
+        vreal k = vr_load(v.k + x);
+        vreal norm = vr_sqrt(vr_dot(i, j, k, i, j, k));
+        // zero vectors would divide by zero; keep them as they are
+        vreal keep = vr_cmpeq(norm, zero);
+        norm = vr_or(norm, vr_and(keep, vr_set1(1)));
+        vr_store(v.i + x, vr_div(i, norm));
+        vr_store(v.j + x, vr_div(j, norm));
+        vr_store(v.k + x, vr_div(k, norm));
+    }
+#endif
+    for(; x < n; x++) {
+        array_set(v, x, vec_normalize(array_get(v, x)));
+    }
+}
+
+/**
+ * @brief Writes the angle between each vector and b to out
+ * 
+ * @param a 
+ * @param b 
+ * @param out 
+ * @param n 
+ */
+void vec_angle_batch(vector_array a, vector b, real* out, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal bi = vr_set1(b.i);
+    vreal bj = vr_set1(b.j);
+    vreal bk = vr_set1(b.k);
+    vreal bnorm = vr_set1(vec_norm(b));
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vreal i = vr_load(a.i + x);
+        vreal j = vr_load(a.j + x);
+        vreal k = vr_load(a.k + x);
+        vreal norms = vr_mul(vr_sqrt(vr_dot(i, j, k, i, j, k)), bnorm);
+        vr_store(out + x, vr_div(vr_dot(i, j, k, bi, bj, bk), norms));
+    }
+    // there's no vector arccos, so the cosines are finished one at a time
+    for(int c = 0; c < x; c++) {
+        out[c] = acos(clamp_cos(out[c]));
+    }
+#endif
+    for(; x < n; x++) {
+        out[x] = vec_angle(array_get(a, x), b);
+    }
+}
+
+/**
+ * @brief Interpolates each vector towards b by t
+ * 
+ * @param a 
+ * @param b 
+ * @param t 
+ * @param n 
+ */
+void vec_lerp_batch(vector_array a, vector b, real t, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal bi = vr_set1(b.i);
+    vreal bj = vr_set1(b.j);
+    vreal bk = vr_set1(b.k);
+    vreal t4 = vr_set1(t);
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vreal i = vr_load(a.i + x);
+        vreal j = vr_load(a.j + x);
+        vreal k = vr_load(a.k + x);
+        i = vr_add(i, vr_mul(vr_sub(bi, i), t4));
+        j = vr_add(j, vr_mul(vr_sub(bj, j), t4));
+        k = vr_add(k, vr_mul(vr_sub(bk, k), t4));
+        vr_store(a.i + x, i);
+        vr_store(a.j + x, j);
+        vr_store(a.k + x, k);
+    }
+#endif
+    for(; x < n; x++) {
+        array_set(a, x, vec_lerp(array_get(a, x), b, t));
+    }
+}
+
+/**
+ * @brief Projects each vector onto b
+ * 
+ * @param a 
+ * @param b 
+ * @param n 
+ */
+void vec_project_batch(vector_array a, vector b, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal bi = vr_set1(b.i);
+    vreal bj = vr_set1(b.j);
+    vreal bk = vr_set1(b.k);
+    vreal bb = vr_set1(vec_dot(b, b));
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vreal i = vr_load(a.i + x);
+        vreal j = vr_load(a.j + x);
+        vreal k = vr_load(a.k + x);
+        vreal scale = vr_div(vr_dot(i, j, k, bi, bj, bk), bb);
+        vr_store(a.i + x, vr_mul(bi, scale));
+        vr_store(a.j + x, vr_mul(bj, scale));
+        vr_store(a.k + x, vr_mul(bk, scale));
+    }
+#endif
+    for(; x < n; x++) {
+        array_set(a, x, vec_project(array_get(a, x), b));
+    }
+}
+
+/**
+ * @brief Takes the element-wise minimum of each vector and b
+ * 
+ * @param a 
+ * @param b 
+ * @param n 
+ */
+void vec_min_batch(vector_array a, vector b, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal bi = vr_set1(b.i);
+    vreal bj = vr_set1(b.j);
+    vreal bk = vr_set1(b.k);
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vr_store(a.i + x, vr_min(vr_load(a.i + x), bi));
+        vr_store(a.j + x, vr_min(vr_load(a.j + x), bj));
+        vr_store(a.k + x, vr_min(vr_load(a.k + x), bk));
+    }
+#endif
+    for(; x < n; x++) {
+        array_set(a, x, vec_min(array_get(a, x), b));
+    }
+}
+
+/**
+ * @brief Takes the element-wise maximum of each vector and b
+ * 
+ * @param a 
+ * @param b 
+ * @param n 
+ */
+void vec_max_batch(vector_array a, vector b, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal bi = vr_set1(b.i);
+    vreal bj = vr_set1(b.j);
+    vreal bk = vr_set1(b.k);
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vr_store(a.i + x, vr_max(vr_load(a.i + x), bi));
+        vr_store(a.j + x, vr_max(vr_load(a.j + x), bj));
+        vr_store(a.k + x, vr_max(vr_load(a.k + x), bk));
+    }
+#endif
+    for(; x < n; x++) {
+        array_set(a, x, vec_max(array_get(a, x), b));
+    }
+}
+
+/**
+ * @brief Takes the element-wise absolute value of each vector
+ * 
+ * @param v 
+ * @param n 
+ */
+void vec_abs_batch(vector_array v, int n) {
+    int x = 0;
+#ifdef SIMD
+    // clearing the sign bit is the absolute value
+    vreal sign = vr_set1(-0.0);
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vr_store(v.i + x, vr_andnot(sign, vr_load(v.i + x)));
+        vr_store(v.j + x, vr_andnot(sign, vr_load(v.j + x)));
+        vr_store(v.k + x, vr_andnot(sign, vr_load(v.k + x)));
+    }
+#endif
+    for(; x < n; x++) {
+        array_set(v, x, vec_abs(array_get(v, x)));
+    }
+}
+
+/**
+ * @brief Takes the element-wise square root of each vector
+ * 
+ * @param v 
+ * @param n 
+ */
+void vec_sqrt_batch(vector_array v, int n) {
+    int x = 0;
+#ifdef SIMD
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vr_store(v.i + x, vr_sqrt(vr_load(v.i + x)));
+        vr_store(v.j + x, vr_sqrt(vr_load(v.j + x)));
+        vr_store(v.k + x, vr_sqrt(vr_load(v.k + x)));
+    }
+#endif
+    for(; x < n; x++) {
+        array_set(v, x, vec_sqrt(array_get(v, x)));
+    }
+}
+
+/**
+ * @brief Writes the squared distance from each vector to b to out
+ * 
+ * @param a 
+ * @param b 
+ * @param out 
+ * @param n 
+ */
+void vec_dist2_batch(vector_array a, vector b, real* out, int n) {
+    int x = 0;
+#ifdef SIMD
+    vreal bi = vr_set1(b.i);
+    vreal bj = vr_set1(b.j);
+    vreal bk = vr_set1(b.k);
+    for(; x + REAL_LANES <= n; x += REAL_LANES) {
+        vreal i = vr_sub(vr_load(a.i + x), bi);
+        vreal j = vr_sub(vr_load(a.j + x), bj);
+        vreal k = vr_sub(vr_load(a.k + x), bk);
+        vr_store(out + x, vr_dot(i, j, k, i, j, k));
+    }
+#endif
+    for(; x < n; x++) {
+        vector d = vec_sub(array_get(a, x), b);
+        out[x] = vec_dot(d, d);
+    }
+}
@@ -1,22 +1,69 @@
 #ifndef VEC_H
 #define VEC_H 
 
+    // numeric type of every component and scalar, chosen at build time.
+    // build with -DTRITONE_DOUBLE (make double) for double precision
+    #ifdef TRITONE_DOUBLE
+        typedef double real;
+        #define REAL_NAME "double"
+        #define REAL_SCAN "%lf"
+        // enough digits that reading a printed value gives it back exactly
+        #define REAL_FULL "%.17g"
+    #else
+        typedef float real;
+        #define REAL_NAME "float"
+        #define REAL_SCAN "%f"
+        #define REAL_FULL "%.9g"
+    #endif
+
     typedef struct {
-        float i;
-        float j;
-        float k;
+        real i;
+        real j;
+        real k;
     } vector;
 
+    // a batch of vectors stored as separate component arrays, 
+    // so batch kernels can work on several vectors per instruction
+    typedef struct {
+        real* i;
+        real* j;
+        real* k;
+    } vector_array;
+
 
     vector vec_add(vector a, vector b);
     vector vec_sub(vector a, vector b);
     vector vec_mul(vector a, vector b);
-    float vec_dot(vector a, vector b);
+    vector vec_div(vector a, vector b);
+    vector vec_splat(real s);
+    real vec_dot(vector a, vector b);
     vector vec_cross(vector a, vector b);
+    real vec_norm(vector v);
+    vector vec_normalize(vector v);
+    real vec_angle(vector a, vector b);
+    vector vec_lerp(vector a, vector b, real t);
+    vector vec_project(vector a, vector b);
+    vector vec_min(vector a, vector b);
+    vector vec_max(vector a, vector b);
+    vector vec_abs(vector v);
+    vector vec_sqrt(vector v);
+
+    // batch kernels apply to n vectors at once, in place unless they
+    // produce scalars. b and t are the same for every vector
+    void vec_norm_batch(vector_array v, real* out, int n);
+    void vec_normalize_batch(vector_array v, int n);
+    void vec_angle_batch(vector_array a, vector b, real* out, int n);
+    void vec_lerp_batch(vector_array a, vector b, real t, int n);
+    void vec_project_batch(vector_array a, vector b, int n);
+    void vec_min_batch(vector_array a, vector b, int n);
+    void vec_max_batch(vector_array a, vector b, int n);
+    void vec_abs_batch(vector_array v, int n);
+    void vec_sqrt_batch(vector_array v, int n);
+    void vec_dist2_batch(vector_array a, vector b, real* out, int n);
+
     char* vector_to_string(vector v);
-    vector vec_max(void);
     int is_max(vector a);
     int free_vector(char* name);
 
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
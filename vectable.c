@@ -4,37 +4,173 @@
  * @class CPE2600-121
  * @brief Vector Hashtable
  * Supports insertion in O(1) average time and retrieval at O(1) average time.
- * Uses dbj2 hashing for indexing and handles collision using linear probing 
+ * The hash function (djb2, FNV-1a or a wyhash-style multiply mix), the 
+ * probing (linear, quadratic, Robin Hood or swiss) and the load factor 
+ * that triggers doubling can all be changed with set, and tablestats shows
+ * how well the choice suits the stored keys.
+ * 
+ * Swiss probing keeps a control byte per slot holding 7 bits of its hash.
+ * Lookups compare a whole group of 16 control bytes at once with SSE2 and 
+ * only look at keys whose bits match, so a miss usually touches no keys.
+ * 
+ * Capacities are powers of two, so a hash is reduced to a slot with a 
+ * mask. Each entry caches its full hash, which skips most key comparisons
+ * and lets resizing move entries without hashing their keys again.
+ * 
+ * Growing is incremental: the doubled array is allocated and the old one
+ * kept, and every insert and lookup moves the next MIGRATE_STEP old slots
+ * over. Lookups try the new array first, then the old one; an old entry 
+ * is only moved if its key hasn't been inserted again since, so nothing
+ * newer is overwritten. Anything that walks every slot finishes the move 
+ * first.
+ * 
+ * Keys shorter than KEY_INLINE are stored in the entry. Longer ones are 
+ * appended to a string pool owned by the table and the entry keeps their
+ * offset, so inserting, resizing and freeing never allocate per key.
+ * 
+ * Every new key is also added to the ordered index in index.c, which 
+ * list and prefix-scoped maps walk instead of the slots.
+ * 
+ * begin opens a transaction in O(1): later writes go to a small staging 
+ * table of their own, and lookups check it before the table. commit 
+ * copies the staged entries into the table and rollback drops them. The
+ * table itself only changes under the write side of a lock, once 
+ * share_vectable says other threads read it, so threads reading with 
+ * read_vector see every change of a commit or none.
  * 
  * Course: CPE2600-121
  * Assignment: Lab Wk 7
  * @date 2023-10-17
  */
 
+// for pthread_rwlockattr_setkind_np
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "vectable.h"
+#include "index.h"
+#include "space.h"
+#include "wal.h"
+#include "csv.h"
+#include "prof.h"
+#include "pool.h"
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
 
 static vectable* table;
 static int INITIALIZED = 0;
 
+// writes made since begin, or NULL outside a transaction
+static vectable* staged = NULL;
+// set by free inside a transaction: the table's entries are hidden
+static int staged_clear = 0;
+// held for writing by every change to table, and for reading by 
+// read_vector; the main thread is the only writer, so its own reads 
+// don't take it
+static pthread_rwlock_t lock;
+// set by share_vectable; until then no other thread reads the table and 
+// writes skip the lock
+static int shared = 0;
+
 /**
  * @brief implementation of djb2 string hashing
  *        http://www.cse.yorku.ca/~oz/hash.html 
- * @param str 
- * @return long 
+ * @param key 
+ * @return unsigned int 
  */
-int hash(char *key, int capacity) {
+static unsigned int hash_djb2(char *key) {
     unsigned long hash = 5381;
     int c;
 
     while ( (c = *key++) != 0)
         hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
 
-    return hash % capacity;
+    return hash;
+}
+
+/**
+ * @brief 32 bit FNV-1a string hashing
+ *        http://www.isthe.com/chongo/tech/comp/fnv/
+ * @param key 
+ * @return unsigned int 
+ */
+static unsigned int hash_fnv(char* key) {
+    unsigned int hash = 2166136261u;
+    while(*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Multiplies a and b to 128 bits and folds the halves together
+ * 
+ * @param a 
+ * @param b 
+ * @return unsigned long long 
+ */
+static unsigned long long mum(unsigned long long a, unsigned long long b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (unsigned long long)r ^ (unsigned long long)(r >> 64);
+}
+
+/**
+ * @brief String hashing in the style of wyhash: characters are packed 
+ * into 8 byte words and each word is mixed in with one wide multiply, so
+ * short keys cost one or two multiplies instead of one per character
+ * 
+ * @param key 
+ * @return unsigned int 
+ */
+static unsigned int hash_wy(char* key) {
+    unsigned long long seed = 0xa0761d6478bd642full;
+    unsigned long long word = 0;
+    int shift = 0;
+    for(; *key; key++) {
+        word |= (unsigned long long)(unsigned char)*key << shift;
+        shift += 8;
+        if(shift == 64) {
+            seed = mum(seed ^ word, 0xe7037ed1a0b428dbull);
+            word = 0;
+            shift = 0;
+        }
+    }
+    seed = mum(seed ^ word, 0xe7037ed1a0b428dbull);
+    return mum(seed, 0x8ebc6af09c88c6e3ull);
 }
 
+static unsigned int (*const hash_functions[HASH_COUNT])(char*) = {
+    [HASH_DJB2] = hash_djb2,
+    [HASH_FNV] = hash_fnv,
+    [HASH_WY] = hash_wy,
+};
+
+static char* hash_names[HASH_COUNT] = {
+    [HASH_DJB2] = "djb2",
+    [HASH_FNV] = "fnv",
+    [HASH_WY] = "wy",
+};
+
+static char* probe_names[PROBING_COUNT] = {
+    [LINEAR_PROBING] = "linear",
+    [QUADRATIC_PROBING] = "quadratic",
+    [ROBIN_HOOD] = "robin",
+    [SWISS_PROBING] = "swiss",
+};
+
 /**
  * @brief Allocates space for the vectable with an initial capacity
  * 
@@ -43,89 +179,547 @@ int hash(char *key, int capacity) {
 vectable* new_vectable(void) {
     vectable* v = (vectable*)malloc(sizeof(vectable));
     v->entries = (vt_entry*)calloc(INITIAL_CAPACITY, sizeof(vt_entry));
+    v->ctrl = NULL;
+    v->old_entries = NULL;
+    v->old_ctrl = NULL;
+    v->old_capacity = 0;
+    v->migrated = 0;
+    v->pool = NULL;
+    v->pool_size = 0;
+    v->pool_capacity = 0;
     v->size = 0;
     v->capacity = INITIAL_CAPACITY;
+    v->hash = HASH_DJB2;
+    v->probe = LINEAR_PROBING;
+    v->max_load = 0.7f;
+    v->tracked = 0;
     
     return v;
 }
 
+/**
+ * @brief Takes the write side of the lock, if other threads read
+ * 
+ */
+static void write_lock(void) {
+    if(shared) {
+        pthread_rwlock_wrlock(&lock);
+    }
+}
+
+/**
+ * @brief Releases the lock taken by write_lock
+ * 
+ */
+static void write_unlock(void) {
+    if(shared) {
+        pthread_rwlock_unlock(&lock);
+    }
+}
+
+/**
+ * @brief Makes every later change to the table take the lock, so other 
+ * threads can use read_vector. Call it before starting them.
+ * 
+ */
+void share_vectable(void) {
+    shared = 1;
+}
+
 /**
  * @brief Sets the file vectable variable to an empty vectable
  * 
  */
 void vectable_init(void) {
     table = new_vectable();
+    table->tracked = 1;
     INITIALIZED = 1;
+
+    // readers arrive constantly; without this a commit could wait forever
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attributes, 
+        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
 }
 
+// old slots moved to the new array by each insert or lookup while growing
+#define MIGRATE_STEP 8
+
+// bulk inserts hash this many rows ahead and prefetch their home slots
+#define BULK_AHEAD 16
+
+// last name byte of an entry whose key is in the pool. A short key's
+// last byte is always '\0', and an empty slot is all zeros
+#define LONG_KEY 1
+
 /**
- * @brief Frees a list of vt_entry 
+ * @brief Returns true if e holds a key
  * 
- * @param e Pointer to first entry
- * @param capacity How many entries to free
+ * @param e 
  * @return int 
  */
-static int free_entries(vt_entry* e, int capacity) {
-    int freed = 0;
-    for(int i = 0; i < capacity; i++) {
-        if(e[i].key != NULL) {
-            free(e[i].key);
-            freed++;
+static int is_used(vt_entry* e) {
+    return e->name[0] != '\0' || e->name[KEY_INLINE - 1] == LONG_KEY;
+}
+
+/**
+ * @brief Returns the key of a used entry of t
+ * 
+ * @param t 
+ * @param e 
+ * @return char* 
+ */
+static char* entry_key(vectable* t, vt_entry* e) {
+    if(e->name[KEY_INLINE - 1] == LONG_KEY) {
+        return t->pool + e->offset;
+    }
+    return e->name;
+}
+
+/**
+ * @brief Stores key in e, inline if it fits and otherwise in t's pool
+ * 
+ * @param t 
+ * @param e 
+ * @param key 
+ */
+static void store_key(vectable* t, vt_entry* e, char* key) {
+    size_t length = strlen(key);
+    memset(e->name, 0, KEY_INLINE);
+    if(length < KEY_INLINE) {
+        memcpy(e->name, key, length);
+        return;
+    }
+
+    if(t->pool_size + length + 1 > t->pool_capacity) {
+        while(t->pool_size + length + 1 > t->pool_capacity) {
+            t->pool_capacity = t->pool_capacity ? t->pool_capacity * 2 : 4096;
         }
+        t->pool = realloc(t->pool, t->pool_capacity);
     }
-    free(e);
-    return freed;
+    memcpy(t->pool + t->pool_size, key, length + 1);
+    e->offset = t->pool_size;
+    e->name[KEY_INLINE - 1] = LONG_KEY;
+    t->pool_size += length + 1;
+}
+
+/**
+ * @brief Frees t and everything it holds
+ * 
+ * @param t 
+ */
+static void free_table(vectable* t) {
+    free(t->entries);
+    free(t->ctrl);
+    free(t->old_entries);
+    free(t->old_ctrl);
+    free(t->pool);
+    free(t);
 }
 
 /**
- * @brief Frees a vectable, includes its entry
+ * @brief Frees a vectable, includes its entry. An open transaction is 
+ * dropped.
  * 
  * @return int 
  */
 int free_vectable() {
-    int freed = free_entries(table->entries, table->capacity);
-    free(table);
+    int freed = table->size;
+    free_table(table);
+    if(staged != NULL) {
+        free_table(staged);
+        staged = NULL;
+        staged_clear = 0;
+    }
+    index_clear();
+    space_drop();
     return freed;
 }
 
 /**
- * @brief Empties the file vectable
+ * @brief Replaces the table with an empty one with the same settings.
+ * The caller holds the lock.
  * 
- * @return int 
+ * @return int number of entries dropped
  */
-int clear_vectable() {
-    int freed = free_vectable();
+static int reset_table(void) {
+    vt_hash hash = table->hash;
+    vt_probe probe = table->probe;
+    float max_load = table->max_load;
+
+    int freed = table->size;
+    free_table(table);
+    index_clear();
+    space_drop();
     table = new_vectable();
+    table->tracked = 1;
+    table->hash = hash;
+    table->probe = probe;
+    table->max_load = max_load;
+    if(probe == SWISS_PROBING) {
+        // gives the new table its control bytes
+        resize_vectable(INITIAL_CAPACITY);
+    }
     return freed;
 }
 
+/**
+ * @brief Returns how far index is from the slot hash maps to
+ * 
+ * @param t 
+ * @param index 
+ * @param hash 
+ * @return unsigned int 
+ */
+static unsigned int distance(vectable* t, int index, unsigned int hash) {
+    return (index - hash) & (t->capacity - 1);
+}
+
+/**
+ * @brief Returns the slot after index in a probe sequence. step counts 
+ * from 1; quadratic probing moves by 1, 2, 3, ... which visits every slot
+ * of a power of two table.
+ * 
+ * @param t 
+ * @param index 
+ * @param step 
+ * @return int 
+ */
+static int next_slot(vectable* t, int index, int step) {
+    int stride = t->probe == QUADRATIC_PROBING ? step : 1;
+    return (index + stride) & (t->capacity - 1);
+}
+
+/**
+ * @brief Returns a bit mask with bit n set where the nth control byte of
+ * the group at ctrl equals byte
+ * 
+ * @param ctrl 16 byte aligned
+ * @param byte 
+ * @return unsigned int 
+ */
+static unsigned int group_match(unsigned char* ctrl, unsigned char byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((__m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+    unsigned int mask = 0;
+    for(int i = 0; i < GROUP_SIZE; i++) {
+        mask |= (unsigned int)(ctrl[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * @brief Returns the first group a swiss probe for hash looks at. The 
+ * low 7 bits go in the control byte, so groups are picked with the rest.
+ * 
+ * @param t 
+ * @param hash 
+ * @return int 
+ */
+static int home_group(vectable* t, unsigned int hash) {
+    return (hash >> 7) & (t->capacity / GROUP_SIZE - 1);
+}
+
+/**
+ * @brief find_entry for swiss probing. Groups are probed quadratically,
+ * which visits every group of a power of two table.
+ * 
+ * @param t 
+ * @param key 
+ * @param hash 
+ * @param length set to the number of groups visited
+ * @return int 
+ */
+static int find_swiss(vectable* t, char* key, unsigned int hash, int* length) {
+    int group = home_group(t, hash);
+    int groups = t->capacity / GROUP_SIZE;
+    for(int step = 1; ; step++) {
+        unsigned char* ctrl = t->ctrl + group * GROUP_SIZE;
+        unsigned int match = group_match(ctrl, hash & 0x7f);
+        while(match) {
+            int index = group * GROUP_SIZE + __builtin_ctz(match);
+            vt_entry* e = &t->entries[index];
+            if(e->hash == hash && !strcmp(entry_key(t, e), key)) {
+                *length = step;
+                return index;
+            }
+            match &= match - 1;
+        }
+        // keys are never removed, so an empty slot ends every probe
+        if(group_match(ctrl, CTRL_EMPTY)) {
+            *length = step;
+            return -1;
+        }
+        group = (group + step) & (groups - 1);
+    }
+}
+
+/**
+ * @brief place_entry for swiss probing: e goes in the first empty slot of
+ * the first group along its probe sequence that has one
+ * 
+ * @param t 
+ * @param e 
+ * @return int number of groups visited
+ */
+static int place_swiss(vectable* t, vt_entry e) {
+    int group = home_group(t, e.hash);
+    int groups = t->capacity / GROUP_SIZE;
+    for(int step = 1; ; step++) {
+        unsigned int empty = group_match(t->ctrl + group * GROUP_SIZE, 
+                                         CTRL_EMPTY);
+        if(empty) {
+            int index = group * GROUP_SIZE + __builtin_ctz(empty);
+            t->entries[index] = e;
+            t->ctrl[index] = e.hash & 0x7f;
+            return step;
+        }
+        group = (group + step) & (groups - 1);
+    }
+}
+
+/**
+ * @brief Returns the slot holding key, or -1 if it isn't stored
+ * 
+ * @param t 
+ * @param key 
+ * @param hash hash of key
+ * @param length set to the number of slots visited
+ * @return int 
+ */
+static int find_entry(vectable* t, char* key, unsigned int hash, int* length) {
+    if(t->probe == SWISS_PROBING) {
+        return find_swiss(t, key, hash, length);
+    }
+    int index = hash & (t->capacity - 1);
+    int step = 1;
+    while(is_used(&t->entries[index])) {
+        vt_entry* e = &t->entries[index];
+        if(e->hash == hash && !strcmp(entry_key(t, e), key)) {
+            *length = step;
+            return index;
+        }
+
+        // robin hood keeps every probe sequence ordered by distance, so
+        // reaching an entry closer to home than the key would be means 
+        // the key isn't stored
+        if(t->probe == ROBIN_HOOD 
+            && distance(t, index, e->hash) < (unsigned int)(step - 1)) {
+            break;
+        }
+        index = next_slot(t, index, step);
+        step++;
+    }
+    *length = step;
+    return -1;
+}
+
+/**
+ * @brief Stores an entry whose key isn't in t yet. t must have a free slot.
+ * 
+ * @param t 
+ * @param e 
+ * @return int number of slots visited
+ */
+static int place_entry(vectable* t, vt_entry e) {
+    if(t->probe == SWISS_PROBING) {
+        return place_swiss(t, e);
+    }
+    int index = e.hash & (t->capacity - 1);
+    int step = 1;
+    while(is_used(&t->entries[index])) {
+        // robin hood: take the slot from an entry closer to its home and
+        // carry that entry on instead
+        if(t->probe == ROBIN_HOOD && distance(t, index, t->entries[index].hash)
+                                     < distance(t, index, e.hash)) {
+            vt_entry displaced = t->entries[index];
+            t->entries[index] = e;
+            e = displaced;
+        }
+        index = next_slot(t, index, step);
+        step++;
+    }
+    t->entries[index] = e;
+    return step;
+}
+
+/**
+ * @brief Allocates bytes of zeroed memory. Large arrays ask for huge 
+ * pages: growing touches the new slots a few at a time, and a page fault
+ * per 4K would otherwise land on one insert in every few dozen.
+ * 
+ * @param bytes 
+ * @return void* 
+ */
+static void* allocate_zeroed(size_t bytes) {
+    void* p = calloc(bytes, 1);
+#ifdef MADV_HUGEPAGE
+    if(bytes >= 2 * 1024 * 1024) {
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = ((uintptr_t)p + page - 1) & ~(page - 1);
+        uintptr_t end = ((uintptr_t)p + bytes) & ~(page - 1);
+        madvise((void*)start, end - start, MADV_HUGEPAGE);
+    }
+#endif
+    return p;
+}
+
+/**
+ * @brief Gives t an empty array of capacity slots, and control bytes for 
+ * swiss probing. The previous arrays are left to the caller.
+ * 
+ * @param t 
+ * @param capacity 
+ */
+static void allocate_slots(vectable* t, int capacity) {
+    t->entries = (vt_entry*)allocate_zeroed(capacity * sizeof(vt_entry));
+    t->capacity = capacity;
+    t->ctrl = NULL;
+    if(t->probe == SWISS_PROBING) {
+        // aligned so groups can be loaded in one instruction
+        t->ctrl = aligned_alloc(GROUP_SIZE, capacity);
+        memset(t->ctrl, CTRL_EMPTY, capacity);
+    }
+}
+
+/**
+ * @brief Returns a copy of t that looks at the slots being moved out of,
+ * for probing them with the usual functions
+ * 
+ * @param t 
+ * @return vectable 
+ */
+static vectable previous(vectable* t) {
+    vectable old = *t;
+    old.entries = t->old_entries;
+    old.ctrl = t->old_ctrl;
+    old.capacity = t->old_capacity;
+    return old;
+}
+
+/**
+ * @brief Moves up to count of the old slots into the new array, freeing
+ * the old one once it's empty. Keys inserted again since growing began
+ * are already in the new array and keep their newer value.
+ * 
+ * @param t 
+ * @param count 
+ */
+static void migrate(vectable* t, int count) {
+    int end = t->migrated + count;
+    if(end > t->old_capacity) {
+        end = t->old_capacity;
+    }
+    for(int i = t->migrated; i < end; i++) {
+        vt_entry* e = &t->old_entries[i];
+        int length;
+        if(is_used(e) && find_entry(t, entry_key(t, e), e->hash, &length) < 0) {
+            place_entry(t, *e);
+        }
+    }
+    t->migrated = end;
+
+    if(end == t->old_capacity) {
+        free(t->old_entries);
+        free(t->old_ctrl);
+        t->old_entries = NULL;
+        t->old_ctrl = NULL;
+        t->old_capacity = 0;
+        t->migrated = 0;
+    }
+}
+
+/**
+ * @brief Moves every remaining old slot, for code that walks all slots
+ * 
+ * @param t 
+ */
+static void finish_migration(vectable* t) {
+    if(t->old_entries != NULL) {
+        migrate(t, t->old_capacity);
+    }
+}
+
+/**
+ * @brief Finishes moving the table's old slots, under the lock
+ * 
+ */
+static void settle(void) {
+    if(table->old_entries != NULL) {
+        write_lock();
+        finish_migration(table);
+        write_unlock();
+    }
+}
+
+/**
+ * @brief Starts growing t to twice its capacity. The entries are moved 
+ * later by migrate.
+ * 
+ * @param t 
+ */
+static void grow(vectable* t) {
+    PROF_START(start);
+    finish_migration(t);
+    t->old_entries = t->entries;
+    t->old_ctrl = t->ctrl;
+    t->old_capacity = t->capacity;
+    t->migrated = 0;
+    allocate_slots(t, t->capacity * 2);
+    PROF_RESIZE(start);
+}
 
 /**
- * @brief Resizes the vectable to a capacity of new_size
+ * @brief Resizes the vectable to a capacity of new_size, rounded up to a
+ * power of two, all at once. Entries are also re-placed, so this applies
+ * a change of probing. The caller holds the lock.
  * 
  * @param new_size 
  */
 void resize_vectable(int new_size) {
-    vt_entry* new_entries = (vt_entry*)calloc(new_size, sizeof(vt_entry));
-    for(int i = 0; i < table->capacity; i++) {
-        // for each existing entry in the old table
-        if(table->entries[i].key != NULL) {
-            int index = hash(table->entries[i].key, new_size);
-            while(new_entries[index].key != NULL) {
-                index++;
-            }
+    PROF_START(start);
+    finish_migration(table);
+    int capacity = INITIAL_CAPACITY;
+    while(capacity < new_size || capacity <= table->size) {
+        capacity *= 2;
+    }
 
-            new_entries[index].key = malloc(strlen(table->entries[i].key) + 1);
-            strcpy(new_entries[index].key, table->entries[i].key);
-            new_entries[index].value = table->entries[i].value; 
+    vt_entry* old_entries = table->entries;
+    unsigned char* old_ctrl = table->ctrl;
+    int old_capacity = table->capacity;
+    allocate_slots(table, capacity);
+    for(int i = 0; i < old_capacity; i++) {
+        // long keys stay where they are in the pool
+        if(is_used(&old_entries[i])) {
+            place_entry(table, old_entries[i]);
         }
     }
-    free_entries(table->entries, table->capacity);
-    table->capacity = new_size;
-    table->entries = new_entries;
+    free(old_entries);
+    free(old_ctrl);
+    PROF_RESIZE(start);
 }
 
 
+/**
+ * @brief Makes room for count more entries in one resize, if the table
+ * doesn't have it already. The caller holds the lock.
+ * 
+ * @param count 
+ */
+static void reserve(int count) {
+    int needed = (table->size + (long)count) / table->max_load + 1;
+    if(needed > table->capacity) {
+        resize_vectable(needed);
+    }
+}
+
 /***
  * Returns the current load factor of the vectable
 */
@@ -134,45 +728,186 @@ static float load_factor() {
 }
 
 /**
- * @brief Inserts a vector
+ * @brief Inserts or replaces key, whose hash is already known, in t
+ * 
+ * @param t 
+ * @param key 
+ * @param hash hash of key
+ * @param value 
+ * @param length set to the number of slots probed
+ * @return int 1 if key is new to t
+ */
+static int put_hashed(vectable* t, char* key, unsigned int hash, 
+    vector value, int* length) {
+    if(t->old_entries != NULL) {
+        migrate(t, MIGRATE_STEP);
+    }
+
+    int index = find_entry(t, key, hash, length);
+    if(index >= 0) {
+        // the key already exists
+        if(t->tracked) {
+            space_move(key, t->entries[index].value, value);
+        }
+        t->entries[index].value = value;
+        return 0;
+    }
+
+    vt_entry e;
+    int moved = 0;
+    // a key whose old slot hasn't been moved yet moves now, keeping its 
+    // stored name
+    if(t->old_entries != NULL) {
+        vectable old = previous(t);
+        int old_index = find_entry(&old, key, hash, length);
+        if(old_index >= 0) {
+            e = old.entries[old_index];
+            moved = 1;
+        }
+    }
+    if(!moved) {
+        // check for load factor, counting the new entry so a small table 
+        // with a high max load can't fill up completely
+        if(t->size + 1 > t->capacity * t->max_load) {
+            grow(t);
+        }
+        store_key(t, &e, key);
+        e.hash = hash;
+        t->size++;
+    }
+    if(t->tracked && moved) {
+        space_move(key, e.value, value);
+    } else if(t->tracked) {
+        space_insert(key, value);
+    }
+    e.value = value;
+    *length = place_entry(t, e);
+    return !moved;
+}
+
+/**
+ * @brief Inserts or replaces key in t
+ * 
+ * @param t 
+ * @param key 
+ * @param value 
+ * @param length set to the number of slots probed
+ * @return int 1 if key is new to t
+ */
+static int put(vectable* t, char* key, vector value, int* length) {
+    return put_hashed(t, key, hash_functions[t->hash](key), value, length);
+}
+
+/**
+ * @brief Asks for the first slot a probe for hash looks at to be loaded 
+ * into the cache
+ * 
+ * @param t 
+ * @param hash 
+ */
+static void prefetch_slot(vectable* t, unsigned int hash) {
+    if(t->probe == SWISS_PROBING) {
+        int group = home_group(t, hash);
+        __builtin_prefetch(t->ctrl + group * GROUP_SIZE, 1);
+        __builtin_prefetch(&t->entries[group * GROUP_SIZE], 1);
+    } else {
+        __builtin_prefetch(&t->entries[hash & (t->capacity - 1)], 1);
+    }
+}
+
+/**
+ * @brief Stores count rows in t. Each name is hashed BULK_AHEAD rows 
+ * before it is stored and its home slot prefetched, so the cache misses
+ * of a table much bigger than the cache overlap instead of stalling one
+ * row at a time. t should have room for every row already.
+ * 
+ * @param t 
+ * @param names 
+ * @param values 
+ * @param count 
+ * @param indexed set to add new names to the ordered index
+ */
+static void put_rows(vectable* t, char** names, vector* values, int count,
+    int indexed) {
+    unsigned int hashes[BULK_AHEAD];
+    vt_hash h = t->hash;
+    for(int x = 0; x < count && x < BULK_AHEAD; x++) {
+        hashes[x] = hash_functions[h](names[x]);
+        prefetch_slot(t, hashes[x]);
+    }
+    for(int x = 0; x < count; x++) {
+        unsigned int hash = hashes[x % BULK_AHEAD];
+        if(x + BULK_AHEAD < count) {
+            unsigned int ahead = hash_functions[h](names[x + BULK_AHEAD]);
+            hashes[x % BULK_AHEAD] = ahead;
+            prefetch_slot(t, ahead);
+        }
+        int length;
+        if(put_hashed(t, names[x], hash, values[x], &length) && indexed) {
+            index_insert(names[x]);
+        }
+    }
+}
+
+/**
+ * @brief Finds key in t, in the new array and then in the one being moved
+ * out of
+ * 
+ * @param t 
+ * @param key 
+ * @param length set to the number of slots probed
+ * @return vt_entry* the entry, or NULL
+ */
+static vt_entry* lookup(vectable* t, char* key, int* length) {
+    unsigned int hash = hash_functions[t->hash](key);
+    int index = find_entry(t, key, hash, length);
+    if(index >= 0) {
+        return &t->entries[index];
+    }
+    if(t->old_entries != NULL) {
+        vectable old = previous(t);
+        int old_length;
+        index = find_entry(&old, key, hash, &old_length);
+        *length += old_length;
+        if(index >= 0) {
+            return &t->old_entries[index];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Inserts a vector. Inside a transaction it is staged until commit.
  * 
  * @param key Name of variable
  * @param value Vector to store
  */
 void insert_vector(char* key, vector value) {
-    // check for load factor
+    PROF_START(start);
     if(!INITIALIZED) {
         vectable_init();
         INITIALIZED = 1;
     }
-    if(load_factor(table) >= 0.7) {
-        printf("resizing to %d at key %s\n", table->capacity*2, key);
-        resize_vectable(table->capacity*2);
-    }
-
-    // linear probe
-    int index = hash(key, table->capacity);
-    while(table->entries[index].key != NULL) {
 
-        // if the key already exists
-        if(!strcmp(table->entries[index].key, key)) {
-            table->entries[index].value = value;
-            return;
+    int length;
+    if(staged != NULL) {
+        // names the table doesn't have are indexed now, and unindexed 
+        // again by rollback
+        int committed;
+        if(put(staged, key, value, &length) 
+            && lookup(table, key, &committed) == NULL) {
+            index_insert(key);
         }
-
-        // if the probe reaches the end, loop back around
-        if(index == table->capacity - 1) {
-            index = 0;
-        } else {
-            index++;
+    } else {
+        write_lock();
+        if(put(table, key, value, &length)) {
+            index_insert(key);
         }
+        write_unlock();
+        wal_set(key, value);
     }
-
-    table->size++;
-    table->entries[index].key = malloc(strlen(key) + 1);
-    strcpy(table->entries[index].key, key);
-    table->entries[index].value = value;
-    
+    PROF_PROBE(PROBE_INSERT, length);
+    PROF_STOP(STAGE_TABLE, start);
 }
 
 /**
@@ -219,43 +954,512 @@ int is_some(vt_option o) {
  * @return vt_option 
  */
 vt_option get_vector(char* key) {
-    int index = hash(key, table->capacity);
-
-    // probe: existing keys are all in order
-    while(table->entries[index].key != NULL) {
-
-        if(!strcmp(table->entries[index].key, key)) {
-            return some(table->entries[index]);
-        }
-
-        // if we reach the end and haven't found it
-        if(index == table->capacity - 1) {
-            index = 0;
-        } else {
-            index++;
+    PROF_START(start);
+    int length = 0;
+    vt_entry* e = NULL;
+    int hidden = 0;
+    if(staged != NULL) {
+        e = lookup(staged, key, &length);
+        hidden = staged_clear;
+    }
+    if(e == NULL && !hidden) {
+        if(table->old_entries != NULL) {
+            write_lock();
+            migrate(table, MIGRATE_STEP);
+            write_unlock();
         }
+        int table_length;
+        e = lookup(table, key, &table_length);
+        length += table_length;
     }
-    return none();
+    PROF_PROBE(PROBE_GET, length);
+    PROF_STOP(STAGE_TABLE, start);
+    return e != NULL ? some(*e) : none();
 }
 
 /**
- * @brief Lists the variables in the vectable and summarizes its properties
+ * @brief Looks up a committed vector, safely from any thread once 
+ * share_vectable has been called. Staged writes aren't seen, and a commit
+ * is seen all at once.
  * 
+ * @param key 
+ * @return vt_option 
  */
-void print_vectable() {
-    int found = 0;
+vt_option read_vector(char* key) {
+    int length;
+    pthread_rwlock_rdlock(&lock);
+    vt_entry* e = lookup(table, key, &length);
+    vt_option result = e != NULL ? some(*e) : none();
+    pthread_rwlock_unlock(&lock);
+    return result;
+}
+
+/**
+ * @brief Takes the staged names the table doesn't have back out of the 
+ * index
+ * 
+ */
+static void unindex_staged(void) {
+    finish_migration(staged);
+    for(int i = 0; i < staged->capacity; i++) {
+        int length;
+        vt_entry* e = &staged->entries[i];
+        if(is_used(e) && lookup(table, entry_key(staged, e), &length) == NULL) {
+            index_remove(entry_key(staged, e));
+        }
+    }
+}
+
+/**
+ * @brief Opens a transaction. Nothing is copied, so this takes the same 
+ * time however large the table is.
+ * 
+ * @return int 0, or -1 if one is already open
+ */
+int begin_vectable(void) {
+    if(staged != NULL) {
+        return -1;
+    }
+    staged = new_vectable();
+    staged_clear = 0;
+    return 0;
+}
+
+/**
+ * @brief Applies the open transaction to the table, all under one hold of
+ * the lock
+ * 
+ * @return int number of staged writes, or -1 if none is open
+ */
+int commit_vectable(void) {
+    if(staged == NULL) {
+        return -1;
+    }
+    finish_migration(staged);
+    write_lock();
+    wal_begin();
+    if(staged_clear) {
+        reset_table();
+        wal_free();
+    }
+    for(int i = 0; i < staged->capacity; i++) {
+        vt_entry* e = &staged->entries[i];
+        int length;
+        if(!is_used(e)) {
+            continue;
+        }
+        // new names were indexed when staged, unless the index was cleared
+        if(put(table, entry_key(staged, e), e->value, &length) 
+            && staged_clear) {
+            index_insert(entry_key(staged, e));
+        }
+        wal_set(entry_key(staged, e), e->value);
+    }
+    wal_end();
+    write_unlock();
+
+    int count = staged->size;
+    free_table(staged);
+    staged = NULL;
+    staged_clear = 0;
+    return count;
+}
+
+/**
+ * @brief Drops the open transaction
+ * 
+ * @return int number of staged writes dropped, or -1 if none is open
+ */
+int rollback_vectable(void) {
+    if(staged == NULL) {
+        return -1;
+    }
+    unindex_staged();
+    int count = staged->size;
+    free_table(staged);
+    staged = NULL;
+    staged_clear = 0;
+    return count;
+}
+
+/**
+ * @brief Returns true while a transaction is open
+ * 
+ * @return int 
+ */
+int in_transaction(void) {
+    return staged != NULL;
+}
+
+/**
+ * @brief Empties the file vectable, keeping its settings. Inside a 
+ * transaction the table is only hidden until commit.
+ * 
+ * @return int number of vectors freed
+ */
+int clear_vectable() {
+    if(staged != NULL) {
+        int freed = count_vectors();
+        unindex_staged();
+        free_table(staged);
+        staged = new_vectable();
+        staged_clear = 1;
+        return freed;
+    }
+    write_lock();
+    int freed = reset_table();
+    write_unlock();
+    wal_free();
+    return freed;
+}
+
+/**
+ * @brief Switches the hash function by name, rehashing every entry
+ * 
+ * @param name djb2, fnv or wy
+ * @return int 0, or -1 if there's no such hash function
+ */
+int set_vectable_hash(char* name) {
+    for(int h = 0; h < HASH_COUNT; h++) {
+        if(!strcmp(name, hash_names[h])) {
+            write_lock();
+            finish_migration(table);
+            table->hash = h;
+            for(int i = 0; i < table->capacity; i++) {
+                if(is_used(&table->entries[i])) {
+                    table->entries[i].hash = hash_functions[h](
+                        entry_key(table, &table->entries[i]));
+                }
+            }
+            resize_vectable(table->capacity);
+            write_unlock();
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Switches the probing by name, re-placing every entry
+ * 
+ * @param name linear, quadratic, robin or swiss
+ * @return int 0, or -1 if there's no such probing
+ */
+int set_vectable_probe(char* name) {
+    for(int p = 0; p < PROBING_COUNT; p++) {
+        if(!strcmp(name, probe_names[p])) {
+            write_lock();
+            finish_migration(table);
+            table->probe = p;
+            resize_vectable(table->capacity);
+            write_unlock();
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Sets the load factor that triggers doubling, growing the table
+ * right away if it's already past it
+ * 
+ * @param max_load between 0.1 and 0.95
+ * @return int 0, or -1 if max_load is out of range
+ */
+int set_vectable_max_load(float max_load) {
+    if(!(max_load >= 0.1f && max_load <= 0.95f)) {
+        return -1;
+    }
+    write_lock();
+    table->max_load = max_load;
+    int capacity = table->capacity;
+    while(table->size >= capacity * max_load) {
+        capacity *= 2;
+    }
+    if(capacity != table->capacity) {
+        resize_vectable(capacity);
+    }
+    write_unlock();
+    return 0;
+}
+
+/**
+ * @brief Prints the table settings in the same form set takes them
+ * 
+ */
+void print_vectable_settings(void) {
+    printf("hash: %s\n", hash_names[table->hash]);
+    printf("probe: %s\n", probe_names[table->probe]);
+    printf("maxload: %.2f\n", table->max_load);
+}
+
+/**
+ * @brief Returns how many slots a lookup of the entry at index visits,
+ * or for swiss probing how many groups
+ * 
+ * @param index 
+ * @return int 
+ */
+static int probe_length(int index) {
+    if(table->probe == SWISS_PROBING) {
+        int group = home_group(table, table->entries[index].hash);
+        int step = 1;
+        while(group != index / GROUP_SIZE) {
+            group = (group + step) & (table->capacity / GROUP_SIZE - 1);
+            step++;
+        }
+        return step;
+    }
+    int slot = table->entries[index].hash & (table->capacity - 1);
+    int step = 1;
+    while(slot != index) {
+        slot = next_slot(table, slot, step);
+        step++;
+    }
+    return step;
+}
+
+#define HISTOGRAM_BUCKETS 8
+
+/**
+ * @brief Prints the probe length histogram, the longest cluster of 
+ * occupied slots and the memory used by the table
+ * 
+ */
+void print_tablestats(void) {
+    settle();
+    printf("hash %s, %s probing, max load %.2f\n", 
+        hash_names[table->hash], probe_names[table->probe], table->max_load);
+    printf("%d entries in %d slots, load factor %.4f\n", 
+        table->size, table->capacity, load_factor());
+    if(table->size == 0) {
+        return;
+    }
+
+    // bucket b holds lengths 2^(b-1)+1 through 2^b; the last is open ended
+    long histogram[HISTOGRAM_BUCKETS] = { 0 };
+    long total = 0;
+    int longest = 0;
+    int inline_keys = 0;
+    for(int i = 0; i < table->capacity; i++) {
+        if(!is_used(&table->entries[i])) {
+            continue;
+        }
+        int length = probe_length(i);
+        int bucket = 0;
+        while(bucket < HISTOGRAM_BUCKETS - 1 && (1 << bucket) < length) {
+            bucket++;
+        }
+        histogram[bucket]++;
+        total += length;
+        if(length > longest) {
+            longest = length;
+        }
+        if(table->entries[i].name[KEY_INLINE - 1] != LONG_KEY) {
+            inline_keys++;
+        }
+    }
+
+    printf("  %-12s %10s\n", 
+        table->probe == SWISS_PROBING ? "groups" : "probe length", "entries");
+    for(int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        char range[20];
+        if(b < 2) {
+            snprintf(range, 20, "%d", b + 1);
+        } else if(b < HISTOGRAM_BUCKETS - 1) {
+            snprintf(range, 20, "%d-%d", (1 << (b - 1)) + 1, 1 << b);
+        } else {
+            snprintf(range, 20, "%d+", (1 << (b - 1)) + 1);
+        }
+        printf("  %-12s %10ld %6.2f%%\n", 
+            range, histogram[b], 100.0 * histogram[b] / table->size);
+    }
+    printf("average probe length %.3f, longest %d\n", 
+        (double)total / table->size, longest);
+
+    // start after an empty slot so a cluster that wraps is counted whole
+    int empty = 0;
+    while(is_used(&table->entries[empty])) {
+        empty++;
+    }
+    int cluster = 0;
+    int run = 0;
+    for(int n = 1; n <= table->capacity; n++) {
+        if(is_used(&table->entries[(empty + n) & (table->capacity - 1)])) {
+            run++;
+            if(run > cluster) {
+                cluster = run;
+            }
+        } else {
+            run = 0;
+        }
+    }
+    printf("longest cluster: %d slots\n", cluster);
+
+    long slot_bytes = sizeof(vectable) + (long)table->capacity * sizeof(vt_entry);
+    if(table->ctrl != NULL) {
+        slot_bytes += table->capacity;
+    }
+    printf("memory: %ld bytes of slots, %ld of %ld pool bytes used, "
+        "%ld total\n", slot_bytes, table->pool_size, table->pool_capacity, 
+        slot_bytes + table->pool_capacity);
+    printf("%d keys inline, %d in the pool\n", 
+        inline_keys, table->size - inline_keys);
+}
+
+/**
+ * @brief Returns how many vectors are stored
+ * 
+ * @return int 
+ */
+int count_vectors() {
+    if(staged != NULL) {
+        return count_prefix("");
+    }
+    return table->size;
+}
+
+/**
+ * @brief Copies every stored vector into out, which must hold 
+ * count_vectors() vectors. The order is only stable until the next insert.
+ * 
+ * @param out 
+ * @return int number of vectors copied
+ */
+int gather_vectors(vector_array out) {
+    if(staged != NULL) {
+        return gather_prefix("", out);
+    }
+    settle();
+    int x = 0;
+    for(int i = 0; i < table->capacity; i++) {
+        if(is_used(&table->entries[i])) {
+            out.i[x] = table->entries[i].value.i;
+            out.j[x] = table->entries[i].value.j;
+            out.k[x] = table->entries[i].value.k;
+            x++;
+        }
+    }
+    return x;
+}
+
+/**
+ * @brief Writes vectors gathered by gather_vectors back to their entries
+ * 
+ * @param in 
+ */
+void scatter_vectors(vector_array in) {
+    if(staged != NULL) {
+        scatter_prefix("", in);
+        return;
+    }
+    write_lock();
+    finish_migration(table);
+    // every vector changes, so the spatial index is built again when it
+    // is next needed rather than moving each point
+    space_drop();
+    wal_begin();
+    int x = 0;
     for(int i = 0; i < table->capacity; i++) {
-        if(table->entries[i].key != NULL) {
-            printf(
-                "%s: %s\n", 
-                table->entries[i].key, 
-                vector_to_string(table->entries[i].value));
+        if(is_used(&table->entries[i])) {
+            vector v = { in.i[x], in.j[x], in.k[x] };
+            table->entries[i].value = v;
+            wal_set(entry_key(table, &table->entries[i]), v);
+            x++;
+        }
+    }
+    wal_end();
+    write_unlock();
+}
+
+/**
+ * @brief Returns how many stored names start with prefix
+ * 
+ * @param prefix 
+ * @return int 
+ */
+int count_prefix(char* prefix) {
+    index_cursor c = index_seek(prefix);
+    int count = 0;
+    for(char* key = index_next(&c); key != NULL; key = index_next(&c)) {
+        // free inside a transaction hides names the index still has
+        count += !staged_clear || is_some(get_vector(key));
+    }
+    return count;
+}
+
+/**
+ * @brief Copies the vectors whose names start with prefix into out, in 
+ * name order. out must hold count_prefix(prefix) vectors.
+ * 
+ * @param prefix 
+ * @param out 
+ * @return int number of vectors copied
+ */
+int gather_prefix(char* prefix, vector_array out) {
+    index_cursor c = index_seek(prefix);
+    int x = 0;
+    for(char* key = index_next(&c); key != NULL; key = index_next(&c)) {
+        vt_option o = get_vector(key);
+        if(!is_some(o)) {
+            continue;
+        }
+        vector v = o.value.value;
+        out.i[x] = v.i;
+        out.j[x] = v.j;
+        out.k[x] = v.k;
+        x++;
+    }
+    return x;
+}
+
+/**
+ * @brief Writes vectors gathered by gather_prefix back to their names
+ * 
+ * @param prefix 
+ * @param in 
+ */
+void scatter_prefix(char* prefix, vector_array in) {
+    index_cursor c = index_seek(prefix);
+    int x = 0;
+    wal_begin();
+    for(char* key = index_next(&c); key != NULL; key = index_next(&c)) {
+        if(staged_clear && !is_some(get_vector(key))) {
+            continue;
+        }
+        vector v = { in.i[x], in.j[x], in.k[x] };
+        insert_vector(key, v);
+        x++;
+    }
+    wal_end();
+}
+
+/**
+ * @brief Lists the variables whose names start with prefix in name order,
+ * or every variable and a summary of the vectable if prefix is NULL
+ * 
+ * @param prefix 
+ */
+void print_vectable(char* prefix) {
+    index_cursor c = index_seek(prefix != NULL ? prefix : "");
+    int found = 0;
+    for(char* key = index_next(&c); key != NULL; key = index_next(&c)) {
+        vt_option o = get_vector(key);
+        if(is_some(o)) {
+            printf("%s: %s\n", key, vector_to_string(o.value.value));
             found++;
         }
     }
 
-    if(found == 0) {
+    if(found == 0 && prefix != NULL) {
+        printf("No vectors match %s*\n", prefix);
+    } else if(found == 0) {
         printf("No vectors are currently stored\n");
+    } else if(prefix != NULL) {
+        printf("Listed %d of %d stored vectors\n", found, count_vectors());
+    } else if(staged != NULL) {
+        printf("Summary: %d stored vectors, %d uncommitted writes\n", 
+            found, staged->size);
     } else {
         printf(
             "Summary: %d stored vectors at a %0.4f load factor\n", 
@@ -266,98 +1470,596 @@ void print_vectable() {
 }
 
 /**
- * @brief Writes the current vectable as a csv to path
+ * @brief Calls visit with every committed vector, in table order
  * 
- * @param path 
+ * @param visit 
+ * @param arg passed on to visit
  */
-void write_vectable(char* path) {
-    FILE* fp = fopen(path, "w+");
+void for_each_vector(void (*visit)(char* key, vector value, void* arg), 
+    void* arg) {
+    settle();
     for(int i = 0; i < table->capacity; i++) {
-        if(table->entries[i].key != NULL) {
-            vt_entry* e = table->entries;
-            fprintf(
-                fp, 
-                "%s,%.2lf,%.2lf,%.2lf\n",
-                e[i].key,
-                e[i].value.i,
-                e[i].value.j,
-                e[i].value.k
-            );
+        vt_entry* e = &table->entries[i];
+        if(is_used(e)) {
+            visit(entry_key(table, e), e->value, arg);
+        }
+    }
+}
+
+// slots (or names, when sorted) formatted by one thread at a time
+#define EXPORT_CHUNK 32768
+// most threads write_vectable formats with
+#define EXPORT_THREADS 8
+// room a row needs besides its name: three numbers, commas and a newline
+#define EXPORT_ROW 96
+
+// a run of rows for one thread to format
+typedef struct {
+    vectable* table;    // the table or a snapshot of it
+    int from;           // slots from..to, when keys is NULL
+    int to;
+    char** keys;        // otherwise these names, in order
+    int count;
+    int full;
+    char* buffer;       // the formatted rows
+    size_t length;
+    size_t capacity;
+    int rows;
+    int started;        // set while a thread of its own formats it
+} export_chunk;
+
+/**
+ * @brief Writes x the way printf's "%.2f" does, without going through 
+ * printf. Values whose hundredths round too close to a tie to be sure of,
+ * and huge or non-finite ones, are left to snprintf.
+ * 
+ * @param out 
+ * @param x 
+ * @return char* the end of what was written
+ */
+static char* format_fixed(char* out, double x) {
+    double scaled = x * 100;
+    double rounded = nearbyint(scaled);
+    double off = fabs(scaled - rounded);
+    if(!(fabs(scaled) < 1e15) || (off > 0.4999 && off < 0.5001)) {
+        return out + snprintf(out, EXPORT_ROW / 3, "%.2f", x);
+    }
+
+    // "%.2f" keeps the sign of values that round to zero
+    if(signbit(x)) {
+        *out++ = '-';
+        rounded = -rounded;
+    }
+    unsigned long long n = (unsigned long long)rounded;
+    char digits[24];
+    int count = 0;
+    do {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+    } while(n > 0 || count < 3);
+    while(count > 2) {
+        *out++ = digits[--count];
+    }
+    *out++ = '.';
+    *out++ = digits[1];
+    *out++ = digits[0];
+    return out;
+}
+
+/**
+ * @brief Appends one csv row to c's buffer
+ * 
+ * @param c 
+ * @param key 
+ * @param v 
+ */
+static void format_row(export_chunk* c, char* key, vector v) {
+    size_t length = strlen(key);
+    if(c->length + length + EXPORT_ROW > c->capacity) {
+        while(c->length + length + EXPORT_ROW > c->capacity) {
+            c->capacity = c->capacity ? c->capacity * 2 : 1 << 20;
+        }
+        c->buffer = realloc(c->buffer, c->capacity);
+    }
+
+    char* out = c->buffer + c->length;
+    memcpy(out, key, length);
+    out += length;
+    real parts[3] = { v.i, v.j, v.k };
+    for(int x = 0; x < 3; x++) {
+        *out++ = ',';
+        if(c->full) {
+            out += snprintf(out, EXPORT_ROW / 3, REAL_FULL, parts[x]);
+        } else {
+            out = format_fixed(out, parts[x]);
+        }
+    }
+    *out++ = '\n';
+    c->length = out - c->buffer;
+    c->rows++;
+}
+
+/**
+ * @brief Formats the rows of one chunk. Only reads the table, so several
+ * run at once.
+ * 
+ * @param arg the export_chunk
+ * @return void* 
+ */
+static void* format_chunk(void* arg) {
+    export_chunk* c = arg;
+    vectable* t = c->table;
+    c->length = 0;
+    c->rows = 0;
+    if(c->keys != NULL) {
+        for(int x = 0; x < c->count; x++) {
+            int length;
+            vt_entry* e = lookup(t, c->keys[x], &length);
+            if(e != NULL) {
+                format_row(c, c->keys[x], e->value);
+            }
+        }
+    } else {
+        for(int x = c->from; x < c->to; x++) {
+            vt_entry* e = &t->entries[x];
+            if(is_used(e)) {
+                format_row(c, entry_key(t, e), e->value);
+            }
         }
     }
-    fclose(fp);
+    return NULL;
 }
 
 /**
- * @brief Attempts to read a vectable from path
+ * @brief Writes every part to fd, in order, picking up after short writes
+ * 
+ * @param fd 
+ * @param parts 
+ * @param count 
+ * @return int 0, or -1 if a write fails
+ */
+static int write_parts(int fd, struct iovec* parts, int count) {
+    while(count > 0) {
+        ssize_t written = writev(fd, parts, count);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while(count > 0 && (size_t)written >= parts->iov_len) {
+            written -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if(count > 0) {
+            parts->iov_base = (char*)parts->iov_base + written;
+            parts->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Hands the next rows of the table to up to threads chunks: the 
+ * next EXPORT_CHUNK slots each, or the next EXPORT_CHUNK names from the 
+ * index cursor when sorted
+ * 
+ * @param chunks 
+ * @param threads 
+ * @param next first slot not handed out yet
+ * @param cursor index cursor, or NULL for slot order
+ * @return int number of chunks that got rows
+ */
+static int next_chunks(export_chunk* chunks, int threads, int* next, 
+    index_cursor* cursor) {
+    int used = 0;
+    while(used < threads) {
+        export_chunk* c = &chunks[used];
+        if(cursor != NULL) {
+            c->count = 0;
+            char* key;
+            while(c->count < EXPORT_CHUNK 
+                && (key = index_next(cursor)) != NULL) {
+                c->keys[c->count++] = key;
+            }
+            if(c->count == 0) {
+                break;
+            }
+        } else {
+            int capacity = c->table->capacity;
+            if(*next >= capacity) {
+                break;
+            }
+            c->from = *next;
+            c->to = *next + EXPORT_CHUNK < capacity 
+                ? *next + EXPORT_CHUNK : capacity;
+            *next = c->to;
+        }
+        used++;
+    }
+    return used;
+}
+
+/**
+ * @brief Starts formatting count chunks, on threads when there is more 
+ * than one, or on this thread. A chunk whose thread can't be started is
+ * formatted here before going on.
+ * 
+ * @param chunks 
+ * @param threads 
+ * @param count 
+ */
+static void start_chunks(export_chunk* chunks, pthread_t* threads, 
+    int count) {
+    for(int x = 0; x < count; x++) {
+        chunks[x].started = count > 1 
+            && pthread_create(&threads[x], NULL, format_chunk, 
+                &chunks[x]) == 0;
+        if(!chunks[x].started) {
+            format_chunk(&chunks[x]);
+        }
+    }
+}
+
+/**
+ * @brief Writes t as a csv to fd. t is formatted in chunks by several 
+ * threads at once into buffers of their own, while the chunks formatted
+ * before them are written in order with one writev, so the file comes out
+ * the same as one thread would write it.
+ * 
+ * @param t the table or a snapshot
+ * @param fd closed when done
+ * @param flags WRITE_FULL for every digit instead of two decimal places,
+ * WRITE_SORTED for name order through the index
+ * @param progress if not NULL, counts the rows written so far
+ * @return int number of vectors written, or -1 if a write fails
+ */
+static int export_table(vectable* t, int fd, int flags, 
+    atomic_long* progress) {
+    int threads = 1;
+    if(t->capacity > EXPORT_CHUNK) {
+        threads = pool_threads(EXPORT_THREADS);
+    }
+
+    // two sets of chunks: one being formatted while the other is written
+    export_chunk chunks[2][EXPORT_THREADS];
+    pthread_t workers[2][EXPORT_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+    for(int set = 0; set < 2; set++) {
+        for(int x = 0; x < threads; x++) {
+            chunks[set][x].table = t;
+            chunks[set][x].full = (flags & WRITE_FULL) != 0;
+            if(flags & WRITE_SORTED) {
+                chunks[set][x].keys = malloc(EXPORT_CHUNK * sizeof(char*));
+            }
+        }
+    }
+
+    index_cursor cursor;
+    index_cursor* order = NULL;
+    if(flags & WRITE_SORTED) {
+        cursor = index_seek("");
+        order = &cursor;
+    }
+
+    int next = 0;
+    int rows = 0;
+    int failed = 0;
+    int set = 0;
+    int count = next_chunks(chunks[set], threads, &next, order);
+    start_chunks(chunks[set], workers[set], count);
+    while(count > 0) {
+        for(int x = 0; x < count; x++) {
+            if(chunks[set][x].started) {
+                pthread_join(workers[set][x], NULL);
+            }
+        }
+        int following = next_chunks(chunks[!set], threads, &next, order);
+        start_chunks(chunks[!set], workers[!set], following);
+
+        struct iovec parts[EXPORT_THREADS];
+        for(int x = 0; x < count; x++) {
+            parts[x].iov_base = chunks[set][x].buffer;
+            parts[x].iov_len = chunks[set][x].length;
+            rows += chunks[set][x].rows;
+        }
+        if(!failed && write_parts(fd, parts, count) < 0) {
+            failed = 1;
+        }
+        if(progress != NULL) {
+            atomic_store(progress, rows);
+        }
+
+        set = !set;
+        count = following;
+    }
+
+    for(set = 0; set < 2; set++) {
+        for(int x = 0; x < threads; x++) {
+            free(chunks[set][x].buffer);
+            free(chunks[set][x].keys);
+        }
+    }
+    if(close(fd) < 0) {
+        failed = 1;
+    }
+    return failed ? -1 : rows;
+}
+
+/**
+ * @brief Writes the current vectable as a csv to path
  * 
  * @param path 
+ * @param flags WRITE_FULL for every digit instead of two decimal places,
+ * WRITE_SORTED for name order instead of table order
+ * @return int number of vectors written, or -1 if path can't be written
+ */
+int write_vectable(char* path, int flags) {
+    settle();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        return -1;
+    }
+    return export_table(table, fd, flags, NULL);
+}
+
+/**
+ * @brief Returns a copy of the committed vectors for another thread to 
+ * write while this one goes on changing the table. The copy holds only 
+ * the used slots, one after another, and a copy of the string pool, so it
+ * can't be searched, only walked.
+ * 
+ * @return vectable* to write with write_snapshot and free with 
+ * free_snapshot
+ */
+vectable* snapshot_vectable(void) {
+    settle();
+    vectable* s = malloc(sizeof(vectable));
+    *s = *table;
+    s->entries = malloc(((size_t)table->size + 1) * sizeof(vt_entry));
+    s->ctrl = NULL;
+    s->capacity = 0;
+    s->tracked = 0;
+    for(int x = 0; x < table->capacity; x++) {
+        if(is_used(&table->entries[x])) {
+            s->entries[s->capacity++] = table->entries[x];
+        }
+    }
+    s->size = s->capacity;
+    s->pool = malloc(table->pool_size + 1);
+    if(table->pool_size > 0) {
+        memcpy(s->pool, table->pool, table->pool_size);
+    }
+    s->pool_capacity = table->pool_size + 1;
+    return s;
+}
+
+/**
+ * @brief qsort_r comparison of two snapshot entries by name
+ * 
+ * @param a 
+ * @param b 
+ * @param arg the snapshot
  * @return int 
  */
-int read_vectable(char* path) {
-    FILE* fp = fopen(path, "r+");
-    if(!fp) { return -1; }
-
-    char name[40];
-    float i;
-    float j;
-    float k;
-
-    int scan_successes;
-    int line = 1;
-    int read = 0;
-    while((scan_successes = fscanf(
-        fp, 
-        "%[^,],%f,%f,%f\n", 
-        name, &i, &j, &k)
-        ) != EOF) {
-        if(scan_successes != 4) {
-            printf("Error: Bad line at line %d\n, ignoring", line);
-        } else {
-            vector v = {i, j, k};
-            insert_vector(name, v);
-            read++;
+static int compare_entries(const void* a, const void* b, void* arg) {
+    vectable* s = arg;
+    return strcmp(entry_key(s, (vt_entry*)a), entry_key(s, (vt_entry*)b));
+}
+
+/**
+ * @brief Writes a snapshot as a csv to path. Safe to call from any thread.
+ * 
+ * @param s from snapshot_vectable
+ * @param path 
+ * @param flags WRITE_FULL for every digit, WRITE_SORTED to sort the 
+ * snapshot by name first
+ * @param progress if not NULL, counts the rows written so far
+ * @return int number of vectors written, or -1 if path can't be written
+ */
+int write_snapshot(vectable* s, char* path, int flags, atomic_long* progress) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        return -1;
+    }
+    if(flags & WRITE_SORTED) {
+        qsort_r(s->entries, s->capacity, sizeof(vt_entry), compare_entries, s);
+    }
+    return export_table(s, fd, flags & ~WRITE_SORTED, progress);
+}
+
+/**
+ * @brief Frees a snapshot
+ * 
+ * @param s 
+ */
+void free_snapshot(vectable* s) {
+    free(s->entries);
+    free(s->pool);
+    free(s);
+}
+
+/**
+ * @brief Returns an empty table with the settings the table has now, for
+ * another thread to fill with fill_detached while this one goes on. Call
+ * it from the thread that changes the table.
+ * 
+ * @return vectable* 
+ */
+vectable* detached_vectable(void) {
+    vectable* t = new_vectable();
+    t->hash = table->hash;
+    t->probe = table->probe;
+    t->max_load = table->max_load;
+    return t;
+}
+
+/**
+ * @brief Stores count vectors in a detached table, sized for all of them 
+ * first. Touches nothing shared, so any thread can call it.
+ * 
+ * @param t from detached_vectable
+ * @param names 
+ * @param values 
+ * @param count 
+ */
+void fill_detached(vectable* t, char** names, vector* values, int count) {
+    int capacity = t->capacity;
+    while(capacity * t->max_load < t->size + count + 1) {
+        capacity *= 2;
+    }
+    if(capacity != t->capacity || t->probe == SWISS_PROBING) {
+        free(t->entries);
+        free(t->ctrl);
+        allocate_slots(t, capacity);
+    }
+    put_rows(t, names, values, count, 0);
+}
+
+/**
+ * @brief Stores everything in a detached table in the table, all at once 
+ * like insert_vectors, and frees it. If t is the larger of the two and
+ * has the same settings, t becomes the table and the table's vectors are
+ * added to it. Inside a transaction the vectors are staged instead.
+ * 
+ * @param t from detached_vectable
+ * @return int number of vectors stored
+ */
+int publish_detached(vectable* t) {
+    int count = t->size;
+    if(staged != NULL) {
+        for(int x = 0; x < t->capacity; x++) {
+            if(is_used(&t->entries[x])) {
+                insert_vector(entry_key(t, &t->entries[x]), 
+                    t->entries[x].value);
+            }
         }
-        line++;
-    };
-    fclose(fp);
-    return read;
-};
+        free_table(t);
+        return count;
+    }
+
+    write_lock();
+    finish_migration(table);
+    finish_migration(t);
+    // t usually holds far more than the table, so the table's vectors 
+    // move into t instead, where a name t already has keeps t's value
+    vectable* old = NULL;
+    int swap = table->size <= count && t->hash == table->hash 
+        && t->probe == table->probe && t->max_load == table->max_load;
+    if(swap) {
+        old = table;
+        table = t;
+        table->tracked = 1;
+        old->tracked = 0;
+        space_drop();
+    } else {
+        space_bulk(count);
+        reserve(count);
+    }
+    wal_begin();
+    for(int x = 0; x < t->capacity; x++) {
+        vt_entry* e = &t->entries[x];
+        if(!is_used(e)) {
+            continue;
+        }
+        int length;
+        // the index already holds every name the old table had
+        int added = swap ? lookup(old, entry_key(t, e), &length) == NULL
+            : put(table, entry_key(t, e), e->value, &length);
+        if(added) {
+            index_insert(entry_key(t, e));
+        }
+        wal_set(entry_key(t, e), e->value);
+    }
+    wal_end();
+    for(int x = 0; swap && x < old->capacity; x++) {
+        vt_entry* e = &old->entries[x];
+        int length;
+        if(is_used(e) && lookup(table, entry_key(old, e), &length) == NULL) {
+            put(table, entry_key(old, e), e->value, &length);
+        }
+    }
+    write_unlock();
+    free_table(swap ? old : t);
+    return count;
+}
 
 /**
- * @brief Generates a random string of length size
+ * @brief Frees a detached table that won't be published
  * 
- * stolen from 
- * https://codereview.stackexchange.com/questions/29198/random-string-generator-in-c
-*/
-static char *rand_string(char *str, size_t size)
-{
-    const char charset[] = "abcdefghijklmnopqrstuvwxyz"
-                           "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    if (size) {
-        --size;
-        for (size_t n = 0; n < size; n++) {
-            int key = rand() % (int) (sizeof charset - 1);
-            str[n] = charset[key];
+ * @param t 
+ */
+void free_detached(vectable* t) {
+    free_table(t);
+}
+
+/**
+ * @brief Makes room for count more vectors, so inserting them never has
+ * to grow the table
+ * 
+ * @param count 
+ */
+void reserve_vectable(int count) {
+    if(staged != NULL) {
+        return;
+    }
+    write_lock();
+    reserve(count);
+    write_unlock();
+}
+
+/**
+ * @brief Stores count vectors at once: under one hold of the lock, so 
+ * other threads see all of them or none, and as one group in the log. 
+ * Inside a transaction they are staged.
+ * 
+ * @param names 
+ * @param values 
+ * @param count 
+ */
+void insert_vectors(char** names, vector* values, int count) {
+    if(count > 0 && staged != NULL) {
+        for(int x = 0; x < count; x++) {
+            insert_vector(names[x], values[x]);
+        }
+    } else if(count > 0) {
+        write_lock();
+        // a file written in table order lists names in hash order, which
+        // piles them into long clusters while a smaller table fills up, 
+        // so the table is sized for every row first
+        reserve(count);
+        space_bulk(count);
+        put_rows(table, names, values, count, 1);
+        wal_begin();
+        for(int x = 0; x < count; x++) {
+            wal_set(names[x], values[x]);
         }
-        str[size] = '\0';
+        wal_end();
+        write_unlock();
     }
-    return str;
 }
 
 /**
- * @brief Inserts size random vectors into the table
- *  Note: Failure seems to be machine dependent:
- *  - Tested on Native Linux, Ryzen 5900X/32GB: breaks past ~700000 entries
- *  - Tested on WSL Linux, School Laptops: breaks past ~1500 entries
- * @param size 
+ * @brief Attempts to read a vectable from path. The whole file is parsed
+ * before anything is stored, so a bad line leaves the table as it was, 
+ * and the rows are then stored together by insert_vectors.
+ * 
+ * @param path 
+ * @return int number of vectors read, -1 if path can't be opened, or -2
+ * if a line is bad
  */
-void fill_vectable(int size) {
-    for (int i = 0; i < size; i++) {
-        char* str = malloc(sizeof(char) * 13);
-        str = rand_string(str, 12);
-        vector v = { i, i, i };
-        insert_vector(str, v);
-        free(str);
+int read_vectable(char* path) {
+    csv_reader r;
+    int read = csv_read(path, &r);
+    if(read == -2) {
+        printf("Error: Bad line at line %d, nothing was read\n", r.line);
+    } else if(read == 0) {
+        char** names = csv_names(&r);
+        insert_vectors(names, r.values, r.count);
+        free(names);
+        read = r.count;
     }
-}
\ No newline at end of file
+    csv_free(&r);
+    return read;
+}
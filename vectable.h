@@ -1,20 +1,65 @@
 #ifndef VECTABLE_H
 #define VECTABLE_H
 
+    #include <stdatomic.h>
     #include "vec.h"
     #define INITIAL_CAPACITY 16
+    // swiss probing scans slots in aligned groups of this many
+    #define GROUP_SIZE 16
+    #define CTRL_EMPTY 0x80
+
+    // keys shorter than this are stored in the entry itself
+    #define KEY_INLINE 16
 
     typedef struct {
-        char* key;
+        union {
+            char name[KEY_INLINE];  // a short key, padded with '\0'
+            long offset;            // a long key's offset in the pool
+        };
+        unsigned int hash;  // full hash of key
         vector value;
     } vt_entry;
 
+    typedef enum {
+        HASH_DJB2,
+        HASH_FNV,
+        HASH_WY,
+        HASH_COUNT,
+    } vt_hash;
+
+    typedef enum {
+        LINEAR_PROBING,
+        QUADRATIC_PROBING,
+        ROBIN_HOOD,
+        SWISS_PROBING,
+        PROBING_COUNT,
+    } vt_probe;
+
     typedef struct {
         vt_entry* entries;
+        unsigned char* ctrl;    // swiss probing: 7 hash bits per slot
+        vt_entry* old_entries;      // while growing, the previous slots,
+        unsigned char* old_ctrl;    // which are moved over a few at a time
+        int old_capacity;
+        int migrated;               // old slots moved so far
+        char* pool;         // long keys, back to back
+        long pool_size;
+        long pool_capacity;
         int size;           // how many entries
-        int capacity;       // maximum number of entries
+        int capacity;       // maximum number of entries, a power of two
+        vt_hash hash;
+        vt_probe probe;
+        float max_load;     // load factor that triggers doubling
+        int tracked;        // the table itself, whose changes the 
+                            // spatial index follows
     } vectable;
 
+    // options for write_vectable, or'd together
+    typedef enum {
+        WRITE_FULL = 1,     // every digit instead of two decimal places
+        WRITE_SORTED = 2,   // name order instead of table order
+    } vt_write_flags;
+
     typedef enum {
         SOME,
         NONE,
@@ -30,12 +75,40 @@
     int clear_vectable();
     void resize_vectable(int new_size);
     void insert_vector(char* key, vector value);
-    void print_vectable();
-    void fill_vectable();
+    void insert_vectors(char** names, vector* values, int count);
+    void reserve_vectable(int count);
+    void print_vectable(char* prefix);
     int is_some(vt_option o);
     vt_option get_vector(char* key);
-    void write_vectable();
+    vt_option read_vector(char* key);
+    void share_vectable(void);
+    int begin_vectable(void);
+    int commit_vectable(void);
+    int rollback_vectable(void);
+    int in_transaction(void);
+    int write_vectable(char* path, int flags);
+    vectable* snapshot_vectable(void);
+    int write_snapshot(vectable* s, char* path, int flags, 
+        atomic_long* progress);
+    void free_snapshot(vectable* s);
+    vectable* detached_vectable(void);
+    void fill_detached(vectable* t, char** names, vector* values, int count);
+    int publish_detached(vectable* t);
+    void free_detached(vectable* t);
     int read_vectable();
     void vectable_init();
+    int count_vectors();
+    int gather_vectors(vector_array out);
+    void scatter_vectors(vector_array in);
+    int count_prefix(char* prefix);
+    int gather_prefix(char* prefix, vector_array out);
+    void scatter_prefix(char* prefix, vector_array in);
+    int set_vectable_hash(char* name);
+    int set_vectable_probe(char* name);
+    int set_vectable_max_load(float max_load);
+    void print_vectable_settings(void);
+    void print_tablestats(void);
+    void for_each_vector(void (*visit)(char* key, vector value, void* arg), 
+        void* arg);
 
 #endif
\ No newline at end of file
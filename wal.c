@@ -0,0 +1,530 @@
+/**
+ * @file wal.c
+ * @author Caleb Andreano (andreanoc@msoe.edu)
+ * @class CPE2600-121
+ * @brief Write-ahead log for the vector table. Every assignment and free
+ * that reaches the table is appended to the log as a small binary record,
+ * so saving no longer means rewriting the table, and a crash loses at
+ * most the records that weren't fsynced yet.
+ *
+ * A record is a type byte, a 16 bit name length, the name, three doubles
+ * for a set, and a checksum of everything before it, all in the
+ * machine's byte order. Changes that must land together (a commit, a
+ * read, a map) are framed by begin and end records. Replay stops at the
+ * first record that is cut short or fails its checksum, drops an
+ * unfinished frame, and cuts the file back to the last good record.
+ *
+ * Records collect in a buffer that is written at the end of each line, so
+ * one write and at most one fsync cover everything the line changed. Once
+ * the log is several times larger than the table, it is compacted: the
+ * table is written as a fresh log beside it, fsynced and renamed over it.
+ *
+ * Course: CPE2600-121
+ * Assignment: Lab Wk 7
+ * @date 2023-10-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "vectable.h"
+
+#define WAL_SET 1
+#define WAL_FREE 2
+#define WAL_BEGIN 3
+#define WAL_END 4
+
+// bytes buffered before they are written even in the middle of a line
+#define WAL_BUFFER (1 << 20)
+// seconds between fsyncs in batch mode
+#define WAL_SYNC_INTERVAL 0.05
+// the log is compacted once it is this many times its last compacted size
+#define WAL_COMPACT_FACTOR 4
+// and at least this large
+#define WAL_COMPACT_MIN (8 << 20)
+
+static int fd = -1;
+static char* log_path = NULL;
+static char* buffer = NULL;
+static size_t buffered = 0;
+static long log_bytes = 0;
+static long compacted_bytes = 0;
+// set when a record of the compacted log being written can't be written
+static int compact_failed = 0;
+static int depth = 0;
+// the begin record of the open group is only written with its first record
+static int begin_pending = 0;
+static wal_sync_mode sync_mode = WAL_SYNC_BATCH;
+static double last_sync = 0;
+
+static char* sync_names[WAL_SYNC_COUNT] = {
+    [WAL_SYNC_ALWAYS] = "always",
+    [WAL_SYNC_BATCH] = "batch",
+    [WAL_SYNC_OFF] = "off",
+};
+
+/**
+ * @brief Returns a monotonic time in seconds
+ *
+ * @return double
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Returns an FNV-1a style hash of length bytes, taken 8 bytes at a
+ * time, which is plenty to catch a torn or garbled record
+ *
+ * @param bytes
+ * @param length
+ * @return uint32_t
+ */
+static uint32_t checksum(const char* bytes, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(; i < length; i++) {
+        hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ull;
+    }
+    return hash ^ (hash >> 32);
+}
+
+/**
+ * @brief Writes all of length bytes to out
+ *
+ * @param out
+ * @param bytes
+ * @param length
+ * @return int 0, or -1 on error
+ */
+static int write_all(int out, const char* bytes, size_t length) {
+    while(length > 0) {
+        ssize_t written = write(out, bytes, length);
+        if(written < 0) {
+            return -1;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the buffered records to the log
+ *
+ */
+static void flush_buffer(void) {
+    if(buffered > 0 && write_all(fd, buffer, buffered) < 0) {
+        printf("Error: could not write to the log %s\n", log_path);
+    }
+    buffered = 0;
+}
+
+/**
+ * @brief Encodes a record into out, which must hold name plus 32 bytes
+ *
+ * @param out
+ * @param type
+ * @param key name of a set, or NULL
+ * @param value value of a set
+ * @return size_t bytes used
+ */
+static size_t encode(char* out, unsigned char type, char* key, vector value) {
+    size_t length = 0;
+    out[length++] = type;
+    if(type == WAL_SET) {
+        uint16_t name_length = strlen(key);
+        memcpy(out + length, &name_length, sizeof(name_length));
+        length += sizeof(name_length);
+        memcpy(out + length, key, name_length);
+        length += name_length;
+        double components[3] = { value.i, value.j, value.k };
+        memcpy(out + length, components, sizeof(components));
+        length += sizeof(components);
+    }
+    uint32_t sum = checksum(out, length);
+    memcpy(out + length, &sum, sizeof(sum));
+    return length + sizeof(sum);
+}
+
+/**
+ * @brief Appends a record to the buffer
+ *
+ * @param type
+ * @param key
+ * @param value
+ */
+static void append(unsigned char type, char* key, vector value) {
+    if(fd < 0) {
+        return;
+    }
+    if(begin_pending) {
+        begin_pending = 0;
+        append(WAL_BEGIN, NULL, value);
+    }
+    size_t longest = (key != NULL ? strlen(key) : 0) + 32;
+    if(buffered + longest > WAL_BUFFER) {
+        flush_buffer();
+    }
+    size_t used = encode(buffer + buffered, type, key, value);
+    buffered += used;
+    log_bytes += used;
+}
+
+/**
+ * @brief Logs an assignment
+ *
+ * @param key
+ * @param value
+ */
+void wal_set(char* key, vector value) {
+    append(WAL_SET, key, value);
+}
+
+/**
+ * @brief Logs a free of the whole table
+ *
+ */
+void wal_free(void) {
+    vector zero = { 0, 0, 0 };
+    append(WAL_FREE, NULL, zero);
+}
+
+/**
+ * @brief Starts a group of records that replay all together or not at all.
+ * Groups may nest; only the outermost is recorded, and an empty one isn't
+ * recorded at all.
+ *
+ */
+void wal_begin(void) {
+    if(depth++ == 0) {
+        begin_pending = 1;
+    }
+}
+
+/**
+ * @brief Ends a group started by wal_begin
+ *
+ */
+void wal_end(void) {
+    vector zero = { 0, 0, 0 };
+    if(--depth == 0) {
+        if(begin_pending) {
+            begin_pending = 0;
+        } else {
+            append(WAL_END, NULL, zero);
+        }
+    }
+}
+
+/**
+ * @brief Reads the log at path into the table. Records inside a group
+ * are staged in a transaction and only committed by its end record.
+ *
+ * @param path
+ * @param valid set to the length of the records that were good
+ * @return long number of records applied, or -1 if path can't be read
+ */
+static long replay(char* path, long* valid) {
+    *valid = 0;
+    int in = open(path, O_RDONLY);
+    if(in < 0) {
+        return -1;
+    }
+    struct stat st;
+    fstat(in, &st);
+    char* bytes = malloc(st.st_size + 1);
+    long length = 0;
+    while(length < st.st_size) {
+        ssize_t got = read(in, bytes + length, st.st_size - length);
+        if(got <= 0) {
+            break;
+        }
+        length += got;
+    }
+    close(in);
+
+    char name[UINT16_MAX + 1];
+    long applied = 0;
+    long grouped = 0;
+    int open_group = 0;
+    long position = 0;
+    while(position < length) {
+        long start = position;
+        unsigned char type = bytes[position++];
+        vector value = { 0, 0, 0 };
+        if(type == WAL_SET) {
+            uint16_t name_length;
+            if(position + (long)sizeof(name_length) > length) {
+                break;
+            }
+            memcpy(&name_length, bytes + position, sizeof(name_length));
+            position += sizeof(name_length);
+            if(position + name_length + 3 * (long)sizeof(double) > length) {
+                break;
+            }
+            memcpy(name, bytes + position, name_length);
+            name[name_length] = '\0';
+            position += name_length;
+            double components[3];
+            memcpy(components, bytes + position, sizeof(components));
+            position += sizeof(components);
+            value.i = components[0];
+            value.j = components[1];
+            value.k = components[2];
+        } else if(type < WAL_FREE || type > WAL_END) {
+            break;
+        }
+        uint32_t sum;
+        if(position + (long)sizeof(sum) > length) {
+            break;
+        }
+        memcpy(&sum, bytes + position, sizeof(sum));
+        if(sum != checksum(bytes + start, position - start)) {
+            break;
+        }
+        position += sizeof(sum);
+
+        if(type == WAL_SET) {
+            insert_vector(name, value);
+            grouped++;
+        } else if(type == WAL_FREE) {
+            clear_vectable();
+            grouped++;
+        } else if(type == WAL_BEGIN) {
+            begin_vectable();
+            open_group = 1;
+            grouped = 0;
+        } else {
+            commit_vectable();
+            open_group = 0;
+        }
+        if(!open_group) {
+            applied += grouped;
+            grouped = 0;
+            *valid = position;
+        }
+    }
+    if(open_group) {
+        rollback_vectable();
+    }
+    free(bytes);
+    return applied;
+}
+
+/**
+ * @brief Replays the log at path, if there is one, and then logs every
+ * change to the table to it
+ *
+ * @param path
+ * @return int number of records replayed, or -1 if the log can't be
+ * opened
+ */
+int wal_open(char* path) {
+    long valid;
+    long applied = replay(path, &valid);
+    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if(fd < 0) {
+        return -1;
+    }
+    // anything after the last good record is cut off before appending
+    if(ftruncate(fd, valid) < 0 || lseek(fd, valid, SEEK_SET) < 0) {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+    log_path = malloc(strlen(path) + 1);
+    strcpy(log_path, path);
+    buffer = malloc(WAL_BUFFER);
+    buffered = 0;
+    log_bytes = valid;
+    compacted_bytes = valid;
+    last_sync = now();
+    return applied < 0 ? 0 : applied;
+}
+
+/**
+ * @brief Returns true if changes are being logged
+ *
+ * @return int
+ */
+int wal_active(void) {
+    return fd >= 0;
+}
+
+/**
+ * @brief Appends a set record for one vector to a compacted log
+ *
+ * @param key
+ * @param value
+ * @param arg the compacted log's file descriptor
+ */
+static void write_snapshot_record(char* key, vector value, void* arg) {
+    int out = *(int*)arg;
+    size_t longest = strlen(key) + 32;
+    if(buffered + longest > WAL_BUFFER) {
+        if(!compact_failed && write_all(out, buffer, buffered) < 0) {
+            printf("Error: could not write the compacted log\n");
+            compact_failed = 1;
+        }
+        compacted_bytes += buffered;
+        buffered = 0;
+    }
+    buffered += encode(buffer + buffered, WAL_SET, key, value);
+}
+
+/**
+ * @brief fsyncs the directory holding path, so a rename into it lasts
+ *
+ * @param path
+ * @return int 0, or -1 if the directory can't be opened or synced
+ */
+static int sync_directory(char* path) {
+    char* copy = malloc(strlen(path) + 1);
+    if(copy == NULL) {
+        return -1;
+    }
+    strcpy(copy, path);
+    int dir = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if(dir < 0) {
+        return -1;
+    }
+    int failed = fsync(dir) < 0;
+    close(dir);
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Replaces the log with one set record per stored vector. The new
+ * log is written and fsynced beside the old one, renamed over it, and
+ * the directory fsynced, so a crash part way leaves one or the other
+ * whole. Appends then go on through the new log's own descriptor, so
+ * until the rename the old log stays in use.
+ *
+ * @return int 0, or -1 if there's no log, the new one can't be written,
+ * or the rename can't be made to last
+ */
+int wal_compact(void) {
+    if(fd < 0 || depth > 0) {
+        return -1;
+    }
+    flush_buffer();
+
+    char* temporary = malloc(strlen(log_path) + 5);
+    if(temporary == NULL) {
+        return -1;
+    }
+    sprintf(temporary, "%s.new", log_path);
+    int out = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0) {
+        free(temporary);
+        return -1;
+    }
+    compacted_bytes = 0;
+    compact_failed = 0;
+    for_each_vector(write_snapshot_record, &out);
+    int failed = compact_failed || write_all(out, buffer, buffered) < 0;
+    compacted_bytes += buffered;
+    buffered = 0;
+    failed |= fdatasync(out) < 0;
+    if(failed || rename(temporary, log_path) < 0) {
+        close(out);
+        unlink(temporary);
+        free(temporary);
+        // tried again once the log has grown as much again
+        compacted_bytes = log_bytes;
+        return -1;
+    }
+    free(temporary);
+
+    // the old log is gone from the directory, so the new one is used
+    // even if the rename isn't known to have reached the disk
+    close(fd);
+    fd = out;
+    log_bytes = compacted_bytes;
+    last_sync = now();
+    return sync_directory(log_path);
+}
+
+/**
+ * @brief Marks the end of a line: writes the buffered records, fsyncs 
+ * them as the sync mode asks, and compacts the log once it has grown
+ * WAL_COMPACT_FACTOR times past its last compaction
+ *
+ */
+void wal_sync(void) {
+    if(fd < 0 || depth > 0) {
+        return;
+    }
+    flush_buffer();
+    double t = now();
+    if(sync_mode == WAL_SYNC_ALWAYS 
+        || (sync_mode == WAL_SYNC_BATCH && t - last_sync >= WAL_SYNC_INTERVAL)) {
+        fdatasync(fd);
+        last_sync = t;
+    }
+    if(log_bytes >= WAL_COMPACT_MIN 
+        && log_bytes >= WAL_COMPACT_FACTOR * compacted_bytes) {
+        if(wal_compact() < 0) {
+            printf("Error: could not compact the log %s\n", log_path);
+        }
+    }
+}
+
+/**
+ * @brief Writes and fsyncs anything left, then stops logging
+ *
+ */
+void wal_close(void) {
+    if(fd < 0) {
+        return;
+    }
+    flush_buffer();
+    fdatasync(fd);
+    close(fd);
+    fd = -1;
+    free(buffer);
+    free(log_path);
+    buffer = NULL;
+    log_path = NULL;
+}
+
+/**
+ * @brief Sets when the log is fsynced by name
+ *
+ * @param mode always, batch or off
+ * @return int 0, or -1 if there's no such mode
+ */
+int set_wal_sync(char* mode) {
+    for(int m = 0; m < WAL_SYNC_COUNT; m++) {
+        if(!strcmp(mode, sync_names[m])) {
+            sync_mode = m;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Returns the name of the sync mode
+ *
+ * @return char*
+ */
+char* wal_sync_name(void) {
+    return sync_names[sync_mode];
+}
@@ -0,0 +1,31 @@
+#ifndef WAL_H
+#define WAL_H
+
+    #include "vec.h"
+
+    /*
+     * Optional append-only log of changes to the vector table, opened with
+     * tritone -l path. Records are buffered and written at the end of each
+     * line; how often they are also fsynced is set with set sync.
+     */
+
+    typedef enum {
+        WAL_SYNC_ALWAYS,    // fsync at the end of every line
+        WAL_SYNC_BATCH,     // fsync at the end of a line if WAL_SYNC_INTERVAL has passed
+        WAL_SYNC_OFF,       // leave it to the OS
+        WAL_SYNC_COUNT,
+    } wal_sync_mode;
+
+    int wal_open(char* path);
+    void wal_close(void);
+    int wal_active(void);
+    void wal_set(char* key, vector value);
+    void wal_free(void);
+    void wal_begin(void);
+    void wal_end(void);
+    void wal_sync(void);
+    int wal_compact(void);
+    int set_wal_sync(char* mode);
+    char* wal_sync_name(void);
+
+#endif